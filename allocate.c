@@ -17,6 +17,11 @@
 extern uint8_t* checked_malloc(char* file, int line, uint64_t amount);
 extern void checked_free(char* file, int line, void* pointer);
 
+// How many allocations (and bytes) the calling thread has made (see
+// runtime-stats.c).
+extern _Thread_local uint64_t allocate_n_allocations;
+extern _Thread_local uint64_t allocate_n_bytes;
+
 #define malloc_bytes(amount) (checked_malloc(__FILE__, __LINE__, amount))
 #define free_bytes(ptr) (checked_free(__FILE__, __LINE__, ptr))
 
@@ -35,6 +40,9 @@ extern void checked_free(char* file, int line, void* pointer);
 #include "boolean.h"
 #include "fatal-error.h"
 
+_Thread_local uint64_t allocate_n_allocations = 0;
+_Thread_local uint64_t allocate_n_bytes = 0;
+
 boolean_t is_initialized = false;
 boolean_t should_log_value = false;
 
@@ -67,6 +75,8 @@ uint8_t* checked_malloc(char* file, int line, uint64_t amount) {
     fatal_error_impl(file, line, ERROR_MEMORY_ALLOCATION);
   }
   memset(result, 0, amount);
+  allocate_n_allocations++;
+  allocate_n_bytes += amount;
   return result;
 }
 
@@ -0,0 +1,90 @@
+/**
+ * @file aot-runtime.c
+ *
+ * Helpers used by the C code that scheme-to-c (see
+ * scheme-to-c-main.c) generates from scheme source files.
+ */
+
+// ======================================================================
+// This is block is extraced to aot-runtime.h
+// ======================================================================
+
+#ifndef _AOT_RUNTIME_H_
+#define _AOT_RUNTIME_H_
+
+#include "boolean.h"
+#include "call-site.h"
+#include "environment.h"
+#include "list-primitive.h"
+#include "pair.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+extern tagged_reference_t aot_global_ref(environment_t* env, pair_t** cache,
+                                         char* name);
+extern tagged_reference_t aot_call(tagged_reference_t fn, uint64_t n_args,
+                                   tagged_reference_t* args);
+extern void aot_eval_source(environment_t* env, char* source);
+
+/**
+ * Perform an integer arithmetic or comparison operation inline when
+ * both arguments are integers and otherwise call the primitive.
+ */
+static inline tagged_reference_t
+    aot_fixnum_operation(fixnum_operation_t operation, primitive_t primitive,
+                         tagged_reference_t a, tagged_reference_t b) {
+  if (a.tag == TAG_UINT64_T && b.tag == TAG_UINT64_T) {
+    return fixnum_operation_apply(operation, a, b);
+  }
+  tagged_reference_t args[2] = {a, b};
+  return aot_call(tagged_reference(TAG_PRIMITIVE, primitive), 2, args);
+}
+
+#endif /* _AOT_RUNTIME_H_ */
+
+// ======================================================================
+
+#include "aot-runtime.h"
+#include "evaluator.h"
+#include "reader.h"
+#include "runtime-stats.h"
+
+/**
+ * Return the value of the global variable name in env. The binding
+ * is remembered in *cache (since assignments and redefinitions in the
+ * same environment update the binding in place).
+ */
+tagged_reference_t aot_global_ref(environment_t* env, pair_t** cache,
+                                  char* name) {
+  if (*cache == NULL) {
+    *cache = environment_find_binding(env, name);
+    if (*cache == NULL) {
+      fatal_error(ERROR_VARIABLE_NOT_FOUND);
+    }
+  }
+  return (*cache)->tail;
+}
+
+/**
+ * Call a procedure that isn't known at compile time.
+ */
+tagged_reference_t aot_call(tagged_reference_t fn, uint64_t n_args,
+                            tagged_reference_t* args) {
+  if (n_args >= MAX_PRIMITIVE_ARGS) {
+    fatal_error(ERROR_MAX_PRIMITIVE_ARGS);
+  }
+  primitive_arguments_t arguments = {.n_args = n_args};
+  for (uint64_t i = 0; i < n_args; i++) {
+    arguments.args[i] = args[i];
+  }
+  return apply_procedure(fn, arguments);
+}
+
+/**
+ * Evaluate a top-level form that scheme-to-c couldn't compile.
+ */
+void aot_eval_source(environment_t* env, char* source) {
+  read_expression_result_t read_result = read_expression(source, 0);
+  runtime_stats_add(bytes_read, read_result.end);
+  eval(env, read_result.result, false);
+}
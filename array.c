@@ -79,6 +79,6 @@ array_t* array_add(array_t* arr, uint64_t element) {
       array_add(result, array_get(arr, i));
     }
     free_bytes(arr);
-    return result;
+    return array_add(result, element);
   }
 }
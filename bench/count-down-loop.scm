@@ -0,0 +1,3 @@
+(define count-down (lambda (n) (if (= n 0) 0 (count-down (- n 1)))))
+(count-down 300000)
+(do ((i 300000 (- i 1))) ((= i 0) i))
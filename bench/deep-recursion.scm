@@ -0,0 +1,4 @@
+(define count-up (lambda (n) (if (= n 0) 0 (+ 1 (count-up (- n 1))))))
+(count-up 100000)
+(count-up 200000)
+(length (fold-right cons (quote ()) (iota 100000)))
@@ -0,0 +1,4 @@
+(define deriv-each (lambda (f lst) (map (lambda (a) (f a)) lst)))
+(define deriv (lambda (a) (cond ((not (pair? a)) (if (eq? a (quote x)) 1 0)) ((eq? (car a) (quote +)) (cons (quote +) (deriv-each deriv (cdr a)))) ((eq? (car a) (quote -)) (cons (quote -) (deriv-each deriv (cdr a)))) ((eq? (car a) (quote *)) (list (quote *) a (cons (quote +) (deriv-each (lambda (a) (list (quote /) (deriv a) a)) (cdr a))))) ((eq? (car a) (quote /)) (list (quote -) (list (quote /) (deriv (cadr a)) (caddr a)) (list (quote /) (cadr a) (list (quote *) (caddr a) (caddr a) (deriv (caddr a)))))) (else (quote error)))))
+(define run-deriv (lambda (n) (do ((i 0 (+ i 1)) (result #f (deriv (quote (+ (* 3 x x) (* a x x) (* b x) 5))))) ((= i n) result))))
+(length (run-deriv 10000))
@@ -0,0 +1,11 @@
+(define make-generator (lambda (lst) (let ((return #f) (resume #f)) (lambda () (call/cc (lambda (r) (set! return r) (if resume (resume #f) (begin (for-each (lambda (x) (call/cc (lambda (k) (set! resume k) (return x)))) lst) (return (quote done))))))))))
+(define sum-generator (lambda (g) (let loop ((total 0)) (let ((v (g))) (if (eq? v (quote done)) total (loop (+ total v)))))))
+(sum-generator (make-generator (iota 100000)))
+(define deep-generator (lambda (n) (letrec ((return #f) (resume #f) (walk (lambda (i) (if (= i n) 0 (+ (call/cc (lambda (k) (set! resume k) (return i))) (walk (+ i 1))))))) (lambda () (call/cc (lambda (r) (set! return r) (if resume (resume 0) (begin (walk 0) (return (quote done))))))))))
+(sum-generator (deep-generator 50000))
+(define find-first/ec (lambda (p lst) (call/ec (lambda (return) (for-each (lambda (x) (if (p x) (return x) #f)) lst) #f))))
+(define find-first/cc (lambda (p lst) (call/cc (lambda (return) (for-each (lambda (x) (if (p x) (return x) #f)) lst) #f))))
+(define search (lambda (find n lst) (do ((i 0 (+ i 1)) (s 0 (+ s (find (lambda (x) (> x 50)) lst)))) ((= i n) s))))
+(search find-first/ec 10000 (iota 100))
+(search find-first/cc 10000 (iota 100))
+(cek-statistics)
@@ -0,0 +1,12 @@
+(define ping (make-channel))
+(define pong (make-channel))
+(define ponger (spawn (lambda () (let loop ((n 0)) (let ((v (channel-receive ping))) (if (eq? v (quote stop)) n (begin (channel-send pong v) (loop (+ n 1)))))))))
+(define ping-pong (lambda (n) (do ((i 0 (+ i 1)) (s 0 (+ s (begin (channel-send ping i) (channel-receive pong))))) ((= i n) (channel-send ping (quote stop)) s))))
+(ping-pong 100000)
+(join ponger)
+(define results (make-channel 16))
+(define workers (map (lambda (i) (spawn (lambda () (do ((j 0 (+ j 1))) ((= j 10)) (yield)) (channel-send results i)))) (iota 10000)))
+(define collect (lambda (n) (do ((i 0 (+ i 1)) (s 0 (+ s (channel-receive results)))) ((= i n) s))))
+(collect 10000)
+(length (map join workers))
+(cek-statistics)
@@ -0,0 +1,4 @@
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(define n-threads (processor-count))
+(define threads (map (lambda (i) (spawn-interpreter-thread (lambda () (fib 27)))) (iota n-threads)))
+(fold-left + 0 (map join-interpreter-thread threads))
@@ -0,0 +1,4 @@
+(define build (lambda (n) (let loop ((i 0) (result (quote ()))) (if (= i n) result (loop (+ i 1) (cons (list i (quote x) i) result))))))
+(define rebuild (lambda (lst) (reverse (fold-left (lambda (acc x) (cons (car x) acc)) (quote ()) lst))))
+(define run-lists (lambda (n) (do ((i 0 (+ i 1)) (total 0 (+ total (length (append (rebuild (build 1000)) (filter even? (iota 1000))))))) ((= i n) total))))
+(run-lists 100)
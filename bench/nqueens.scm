@@ -0,0 +1,4 @@
+(define ok? (lambda (row dist placed) (or (null? placed) (and (not (= (car placed) (+ row dist))) (not (= (car placed) (- row dist))) (ok? row (+ dist 1) (cdr placed))))))
+(define try-it (lambda (x y z) (if (null? x) (if (null? y) 1 0) (+ (if (ok? (car x) 1 z) (try-it (append (cdr x) y) (quote ()) (cons (car x) z)) 0) (try-it (cdr x) (cons (car x) y) z)))))
+(define queens (lambda (n) (try-it (map (lambda (i) (+ i 1)) (iota n)) (quote ()) (quote ()))))
+(queens 9)
@@ -0,0 +1,4 @@
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(worker-count)
+(parallel-reduce + 0 (parallel-map fib (map (lambda (i) (+ 15 (remainder i 10))) (iota 400))))
+(touch (future (lambda () (fib 25))))
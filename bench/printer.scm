@@ -0,0 +1,11 @@
+(define tree (lambda (depth) (if (= depth 0) (quote leaf) (list depth (tree (- depth 1)) (tree (- depth 1))))))
+(define numbers (iota 50000))
+(define big-tree (tree 15))
+numbers
+big-tree
+numbers
+big-tree
+numbers
+big-tree
+numbers
+big-tree
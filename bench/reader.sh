@@ -0,0 +1,17 @@
+#!/bin/bash
+#
+# Write the input of the reader benchmark to stdout: lines of quoted
+# lists (each shorter than the 1024 bytes the REPL reads at a time)
+# so that reading, rather than evaluating, takes the time.
+
+lines=${1:-5000}
+
+row="(quote ("
+for i in $(seq 1 12); do
+    row="$row (define-$i (lambda (a b c) (if (< a $i) (+ b c) (list a b c))))"
+done
+row="$row))"
+
+for i in $(seq 1 $lines); do
+    echo "$row"
+done
@@ -0,0 +1,12 @@
+(define n 100000)
+(define c (make-shared-channel 1024))
+(define send-each (lambda (i) (if (< i n) (begin (channel-send c i) (send-each (+ i 1))) 0)))
+(define receive-each (lambda (k sum) (if (= k 0) sum (receive-each (- k 1) (+ sum (channel-receive c))))))
+(define receive-batches (lambda (k sum) (if (= k 0) sum (let ((batch (channel-receive-list c 64))) (receive-batches (- k (length batch)) (fold-left + sum batch))))))
+(define items (iota n))
+(define sender (spawn-interpreter-thread (lambda () (send-each 0))))
+(receive-each n 0)
+(join-interpreter-thread sender)
+(define batch-sender (spawn-interpreter-thread (lambda () (channel-send-list c items))))
+(receive-batches n 0)
+(join-interpreter-thread batch-sender)
@@ -0,0 +1,10 @@
+(define words (list "alpha" "beta" "gamma" "delta" "epsilon"))
+(define join (lambda (lst separator) (if (null? lst) "" (fold-left (lambda (acc s) (string-append acc separator s)) (car lst) (cdr lst)))))
+(define sentence (lambda (n) (let loop ((i 0) (acc (quote ()))) (if (= i n) (join acc " ") (loop (+ i 1) (cons (list-ref words (remainder i 5)) acc))))))
+(define run-join (lambda (n) (do ((i 0 (+ i 1)) (total 0 (+ total (string-length (sentence 200))))) ((= i n) total))))
+(run-join 500)
+(define upcase (lambda (s) (list->string (map char-upcase (string->list s)))))
+(define run-upcase (lambda (n) (do ((i 0 (+ i 1)) (total 0 (+ total (string-length (upcase (symbol->string (quote abcdefghijklmnopqrstuvwxyz))))))) ((= i n) total))))
+(run-upcase 20000)
+(define run-grow (lambda (n) (do ((i 0 (+ i 1)) (s "" (if (> (string-length s) 2000) "" (string-append s (string #\a #\λ))))) ((= i n) (string-length s)))))
+(run-grow 20000)
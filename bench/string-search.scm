@@ -0,0 +1,7 @@
+(define double (lambda (s n) (if (= n 0) s (double (string-append s s) (- n 1)))))
+(define text (double "The quick brown fox jumps over the lazy dog. " 14))
+(define copy (substring text 0))
+(do ((i 0 (+ i 1))) ((= i 200) i) (string-contains text "lazy cat"))
+(do ((i 0 (+ i 1))) ((= i 200) i) (string-search-forward "#" text 0))
+(do ((i 0 (+ i 1))) ((= i 200) i) (string-ci=? text copy))
+(do ((i 0 (+ i 1))) ((= i 200) i) (string-prefix? copy text))
@@ -0,0 +1,8 @@
+(define double (lambda (s n) (if (= n 0) s (double (string-append s s) (- n 1)))))
+(define text (double "Λάμβδα λογισμός → lambda calculus. " 14))
+(define n (string-length text))
+(do ((i 0 (+ i 1))) ((= i 100000) i) (string-ref text (- n (+ i 1))))
+(do ((i 0 (+ i 1))) ((= i 20000) i) (substring text (- n (+ i 100)) (- n i)))
+(length (string->list text))
+(string-length (list->string (string->list text)))
+(do ((i 0 (+ i 1))) ((= i 200) i) (string-index text #\x1F600))
@@ -13,6 +13,10 @@ static inline boolean_t untag_boolean(tagged_reference_t reference) {
   return (boolean_t) reference.data;
 }
 
+static inline tagged_reference_t tag_boolean(boolean_t value) {
+  return tagged_reference(TAG_BOOLEAN_T, value ? 1 : 0);
+}
+
 static boolean_t is_false(tagged_reference_t value) {
   return (value.tag == TAG_BOOLEAN_T) && (value.data == 0);
 }
@@ -0,0 +1,115 @@
+/**
+ * @file builtin.c
+ *
+ * The "builtins" are the special forms known to the evaluator and
+ * the primitives every global environment starts out with. They live
+ * in a static perfect hash table (builtin-table.c) which is generated
+ * by symbol-hash (see symbol-hash-main.c) from the catalog in
+ * global-environment.c so looking up a builtin is always a single
+ * table probe (plus one string comparison) and building a global
+ * environment doesn't need to define hundreds of variables.
+ *
+ * The perfect hash uses "hash and displace": the low bits of the
+ * string_hash() of a name select a seed and builtin_slot() mixes the
+ * hash with that seed. The generator picks the seeds so that no two
+ * names end up in the same slot.
+ */
+
+// ======================================================================
+// This is block is extraced to builtin.h
+// ======================================================================
+
+#ifndef _BUILTIN_H_
+#define _BUILTIN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "primitive.h"
+#include "string-util.h"
+
+typedef enum {
+  SPECIAL_FORM_NONE,
+  SPECIAL_FORM_AND,
+  SPECIAL_FORM_BEGIN,
+  SPECIAL_FORM_COND,
+  SPECIAL_FORM_DEFINE,
+  SPECIAL_FORM_DEFINE_SYNTAX,
+  SPECIAL_FORM_DO,
+  SPECIAL_FORM_IF,
+  SPECIAL_FORM_LAMBDA,
+  SPECIAL_FORM_LET,
+  SPECIAL_FORM_LET_STAR,
+  SPECIAL_FORM_LETREC, // also letrec*
+  SPECIAL_FORM_OR,
+  SPECIAL_FORM_QUOTE,
+  SPECIAL_FORM_SET_BANG,
+  SPECIAL_FORM_UNLESS,
+  SPECIAL_FORM_WHEN,
+} special_form_t;
+
+typedef struct {
+  // NULL for an empty slot.
+  char* name;
+  // SPECIAL_FORM_NONE for a primitive.
+  special_form_t special_form;
+  // NULL for a special form.
+  primitive_t primitive;
+} builtin_t;
+
+// These are defined in the generated builtin-table.c
+extern const uint64_t builtin_table_bits;
+extern const uint64_t builtin_n_seeds;
+extern const uint64_t builtin_seeds[];
+extern const builtin_t builtin_table[];
+
+extern const builtin_t* builtin_lookup(const char* name);
+
+/**
+ * Return the slot for a name with the given hash code when the seed
+ * for its hash code is seed (in a table with 2^bits slots).
+ */
+static inline uint64_t builtin_slot(uint64_t hash_code, uint64_t seed,
+                                    uint64_t bits) {
+  return ((hash_code ^ seed) * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - bits);
+}
+
+/**
+ * Return the entry of table (laid out by symbol-hash with the given
+ * seeds) for name or NULL. builtin_lookup() probes the generated table
+ * and symbol-hash checks the tables it makes with this as well.
+ */
+static inline const builtin_t* builtin_probe(const builtin_t* table,
+                                             const uint64_t* seeds,
+                                             uint64_t n_seeds, uint64_t bits,
+                                             const char* name) {
+  uint64_t hash_code = string_hash(name);
+  uint64_t seed = seeds[hash_code & (n_seeds - 1)];
+  const builtin_t* builtin = &table[builtin_slot(hash_code, seed, bits)];
+  if (builtin->name == NULL || !string_equal(builtin->name, name)) {
+    return NULL;
+  }
+  return builtin;
+}
+
+/**
+ * Return the special form named by name or SPECIAL_FORM_NONE.
+ */
+static inline special_form_t special_form_of(const char* name) {
+  const builtin_t* builtin = builtin_lookup(name);
+  return builtin == NULL ? SPECIAL_FORM_NONE : builtin->special_form;
+}
+
+#endif /* _BUILTIN_H_ */
+
+// ======================================================================
+
+#include "builtin.h"
+
+/**
+ * Return the builtin named name or NULL.
+ */
+const builtin_t* builtin_lookup(const char* name) {
+  return builtin_probe(builtin_table, builtin_seeds, builtin_n_seeds,
+                       builtin_table_bits, name);
+}
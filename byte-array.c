@@ -94,7 +94,7 @@ __attribute__((warn_unused_result)) byte_array_t*
     }
     free_bytes(arr);
 
-    return result;
+    return byte_array_append_byte(result, element);
   }
 }
 
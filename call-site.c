@@ -0,0 +1,190 @@
+/**
+ * @file call-site.c
+ *
+ * Call sites let an application (a function call) specialize itself
+ * based on what it has seen ("quickening").
+ *
+ * The first time an application like (+ x 1) is evaluated, the
+ * evaluator replaces its operator expression with a TAG_CALL_SITE_T
+ * node (the original operator expression lives on inside of the
+ * call_site_t) and, based on the operator and arguments of that first
+ * call, picks one of these kinds:
+ *
+ * CALL_SITE_FIXNUM_BINARY - the operator was one of the integer
+ * arithmetic or comparison primitives and there were exactly two
+ * integer arguments. The evaluator performs the operation inline
+ * without creating a primitive_arguments_t or calling the primitive.
+ *
+ * CALL_SITE_CLOSURE - the operator was a closure that accepts exactly
+ * the number of arguments given. The evaluator calls it directly.
+ *
+ * CALL_SITE_GENERIC - anything else.
+ *
+ * The specialized kinds guard their assumptions every time and when a
+ * guard fails the call site is "deoptimized" (permanently) to
+ * CALL_SITE_GENERIC (which is the same code path that was used before
+ * call sites existed).
+ */
+
+// ======================================================================
+// This is block is extraced to call-site.h
+// ======================================================================
+
+#ifndef _CALL_SITE_H_
+#define _CALL_SITE_H_
+
+#include "boolean.h"
+#include "pair.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+typedef enum {
+  CALL_SITE_UNINITIALIZED,
+  CALL_SITE_GENERIC,
+  CALL_SITE_FIXNUM_BINARY,
+  CALL_SITE_CLOSURE,
+} call_site_kind_t;
+
+typedef enum {
+  FIXNUM_OPERATION_NONE,
+  FIXNUM_OPERATION_ADD,
+  FIXNUM_OPERATION_SUB,
+  FIXNUM_OPERATION_MUL,
+  FIXNUM_OPERATION_LESS,
+  FIXNUM_OPERATION_LESS_OR_EQUAL,
+  FIXNUM_OPERATION_EQUAL,
+  FIXNUM_OPERATION_GREATER,
+  FIXNUM_OPERATION_GREATER_OR_EQUAL,
+} fixnum_operation_t;
+
+typedef struct {
+  call_site_kind_t kind;
+  fixnum_operation_t operation;
+  // The only operator seen so far (unless kind is CALL_SITE_GENERIC).
+  tagged_reference_t target;
+  // A single cell (with a NIL tail) holding the original operator
+  // expression so that it can be evaluated with eval_subexpression().
+  pair_t operator;
+} call_site_t;
+
+extern _Thread_local uint64_t call_site_deoptimizations;
+
+extern call_site_t* make_call_site(tagged_reference_t operator_expr);
+extern void call_site_quicken(call_site_t* site, tagged_reference_t fn,
+                              primitive_arguments_t* arguments);
+extern void call_site_deoptimize(call_site_t* site);
+extern fixnum_operation_t fixnum_operation_of(tagged_reference_t fn);
+
+static inline call_site_t* untag_call_site(tagged_reference_t reference) {
+  require_tag(reference, TAG_CALL_SITE_T);
+  return (call_site_t*) reference.data;
+}
+
+/**
+ * Perform operation on two integers (which is only called once the
+ * call site has checked the tags of a and b).
+ */
+static inline tagged_reference_t
+    fixnum_operation_apply(fixnum_operation_t operation, tagged_reference_t a,
+                           tagged_reference_t b) {
+  int64_t x = (int64_t) a.data;
+  int64_t y = (int64_t) b.data;
+  switch (operation) {
+  case FIXNUM_OPERATION_ADD:
+    return tagged_reference(TAG_UINT64_T, a.data + b.data);
+  case FIXNUM_OPERATION_SUB:
+    return tagged_reference(TAG_UINT64_T, a.data - b.data);
+  case FIXNUM_OPERATION_MUL:
+    return tagged_reference(TAG_UINT64_T, a.data * b.data);
+  case FIXNUM_OPERATION_LESS:
+    return tag_boolean(x < y);
+  case FIXNUM_OPERATION_LESS_OR_EQUAL:
+    return tag_boolean(x <= y);
+  case FIXNUM_OPERATION_EQUAL:
+    return tag_boolean(x == y);
+  case FIXNUM_OPERATION_GREATER:
+    return tag_boolean(x > y);
+  case FIXNUM_OPERATION_GREATER_OR_EQUAL:
+    return tag_boolean(x >= y);
+  case FIXNUM_OPERATION_NONE:
+    break;
+  }
+  fatal_error(ERROR_NOT_REACHED);
+}
+
+#endif /* _CALL_SITE_H_ */
+
+// ======================================================================
+
+#include "allocate.h"
+#include "call-site.h"
+#include "closure.h"
+
+_Thread_local uint64_t call_site_deoptimizations = 0;
+
+call_site_t* make_call_site(tagged_reference_t operator_expr) {
+  call_site_t* result = malloc_struct(call_site_t);
+  result->kind = CALL_SITE_UNINITIALIZED;
+  result->operator.head = operator_expr;
+  result->operator.tail = NIL;
+  return result;
+}
+
+/**
+ * Return the operation performed by fn when it is called with two
+ * integers or FIXNUM_OPERATION_NONE.
+ */
+fixnum_operation_t fixnum_operation_of(tagged_reference_t fn) {
+  if (fn.tag != TAG_PRIMITIVE) {
+    return FIXNUM_OPERATION_NONE;
+  }
+  primitive_t primitive = untag_primitive(fn);
+  if (primitive == &primtive_function_plus) {
+    return FIXNUM_OPERATION_ADD;
+  } else if (primitive == &primtive_function_sub) {
+    return FIXNUM_OPERATION_SUB;
+  } else if (primitive == &primtive_function_mul) {
+    return FIXNUM_OPERATION_MUL;
+  } else if (primitive == &primtive_function_less) {
+    return FIXNUM_OPERATION_LESS;
+  } else if (primitive == &primtive_function_less_or_equal) {
+    return FIXNUM_OPERATION_LESS_OR_EQUAL;
+  } else if (primitive == &primtive_function_numerically_equal) {
+    return FIXNUM_OPERATION_EQUAL;
+  } else if (primitive == &primtive_function_greater) {
+    return FIXNUM_OPERATION_GREATER;
+  } else if (primitive == &primtive_function_greater_or_equal) {
+    return FIXNUM_OPERATION_GREATER_OR_EQUAL;
+  }
+  return FIXNUM_OPERATION_NONE;
+}
+
+/**
+ * Pick the kind of an uninitialized call site based on the first call
+ * made from it.
+ */
+void call_site_quicken(call_site_t* site, tagged_reference_t fn,
+                       primitive_arguments_t* arguments) {
+  site->target = fn;
+  site->kind = CALL_SITE_GENERIC;
+
+  fixnum_operation_t operation = fixnum_operation_of(fn);
+  if (operation != FIXNUM_OPERATION_NONE && arguments->n_args == 2
+      && arguments->args[0].tag == TAG_UINT64_T
+      && arguments->args[1].tag == TAG_UINT64_T) {
+    site->kind = CALL_SITE_FIXNUM_BINARY;
+    site->operation = operation;
+  } else if (fn.tag == TAG_CLOSURE_T
+             && untag_closure_t(fn)->n_arg_names == arguments->n_args) {
+    site->kind = CALL_SITE_CLOSURE;
+  }
+}
+
+/**
+ * Fall back to the generic way of evaluating an application.
+ */
+void call_site_deoptimize(call_site_t* site) {
+  site->kind = CALL_SITE_GENERIC;
+  site->target = NIL;
+  call_site_deoptimizations++;
+}
@@ -0,0 +1,1747 @@
+/**
+ * @file cek-evaluator.c
+ *
+ * An evaluator that keeps its continuation on an explicit stack (in
+ * the style of a CEK machine: Control, Environment, Kontinuation)
+ * instead of the C stack. The tree walking evaluator in evaluator.c
+ * recurses on the C stack for every non-tail subexpression so deep
+ * non-tail recursion (like a naive append of a long list) eventually
+ * crashes it. Here the work that remains after a subexpression is
+ * evaluated is pushed as a frame on a heap allocated stack so the
+ * depth of recursion is only limited by memory.
+ *
+ * The stack is a chain of fixed size segments. When the newest
+ * segment is full, a new one is started on top of it (older frames
+ * are never copied or moved). The values collected by a frame (like
+ * the arguments of an application) are stored right after it.
+ *
+ * call/cc captures the continuation by freezing the frames on the
+ * stack in place: each segment has a watermark below which frames are
+ * never changed or overwritten (and a segment holding frozen frames is
+ * never freed). Freezing stops at the first frame that is already
+ * frozen so capturing costs time proportional to the frames pushed
+ * since the last capture. When the machine returns into a frozen
+ * frame, that one frame is copied to the top of the stack first, so
+ * invoking a continuation only has to make its newest frame the top of
+ * the stack. Environments referenced by frozen frames are marked as
+ * captured which is why this evaluator never uses stack environments.
+ *
+ * A continuation is delimited by the C code that started the machine
+ * (cek_eval for a top-level form, or a primitive like hash-table-walk
+ * calling back into scheme with apply_procedure). Invoking one that
+ * belongs to an outer (still running) machine longjmps to it and
+ * invoking one whose machine has finished copies its frames on top of
+ * the current machine's caller instead.
+ *
+ * The machine follows exactly the same protocol as evaluator.c and
+ * shares its helpers: code is rewritten in place the same way (call
+ * sites, inline caches, macro expansion), environments are released
+ * in tail position the same way and a named let whose name is only
+ * called in tail position is a loop. Expressions that don't evaluate
+ * any subexpressions (constants, variables, quote and lambda) are
+ * simply handed to eval().
+ *
+ * This evaluator is used instead of the tree walking evaluator when
+ * the environment variable ARMYKNIFE_EVALUATOR=cek is set. The
+ * cek-statistics primitive describes how much stack has been used.
+ */
+
+// ======================================================================
+// This is block is extraced to cek-evaluator.h
+// ======================================================================
+
+#ifndef _CEK_EVALUATOR_H_
+#define _CEK_EVALUATOR_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "boolean.h"
+#include "environment.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+extern boolean_t cek_is_initialized;
+extern boolean_t cek_is_enabled_value;
+
+extern tagged_reference_t cek_eval(environment_t* env,
+                                   tagged_reference_t expr);
+extern tagged_reference_t cek_apply_procedure(tagged_reference_t fn,
+                                              primitive_arguments_t arguments);
+extern tagged_reference_t
+    primtive_function_cek_statistics(primitive_arguments_t arguments);
+extern boolean_t cek_can_switch(void);
+
+static inline boolean_t cek_is_enabled() {
+  if (cek_is_initialized) {
+    return cek_is_enabled_value;
+  }
+  char* var = getenv("ARMYKNIFE_EVALUATOR");
+  cek_is_initialized = true;
+  if (var != NULL && strcmp(var, "cek") == 0) {
+    cek_is_enabled_value = true;
+  }
+  return cek_is_enabled_value;
+}
+
+#endif /* _CEK_EVALUATOR_H_ */
+
+// ======================================================================
+
+#include <setjmp.h>
+#include <stdint.h>
+
+#include "allocate.h"
+#include "builtin.h"
+#include "call-site.h"
+#include "cek-evaluator.h"
+#include "closure.h"
+#include "continuation.h"
+#include "evaluator.h"
+#include "fatal-error.h"
+#include "green-thread.h"
+#include "interpreter-thread.h"
+#include "jit.h"
+#include "lambda-analysis.h"
+#include "list-primitive.h"
+#include "optional.h"
+#include "pair.h"
+#include "profile.h"
+#include "runtime-stats.h"
+#include "scheme-symbol.h"
+#include "string-util.h"
+#include "syntax-rules.h"
+
+typedef enum {
+  // The body of a lambda, let, begin, etc. (cell is the expression
+  // being evaluated).
+  CEK_FRAME_SEQUENCE,
+  CEK_FRAME_IF,
+  CEK_FRAME_SET,
+  CEK_FRAME_DEFINE,
+  // cell is the operand being evaluated.
+  CEK_FRAME_AND,
+  CEK_FRAME_OR,
+  CEK_FRAME_WHEN,
+  CEK_FRAME_UNLESS,
+  // cell is the clauses starting with the one whose test is being
+  // evaluated.
+  CEK_FRAME_COND,
+  // Evaluating the receiver of (test => receiver). The only value is
+  // the value of the test.
+  CEK_FRAME_COND_RECEIVER,
+  // cell is the next operand and the values are the operator and the
+  // arguments evaluated so far.
+  CEK_FRAME_APPLICATION,
+  // cell is the binding whose initial value is being evaluated.
+  CEK_FRAME_LET,
+  CEK_FRAME_LET_STAR,
+  CEK_FRAME_LETREC,
+  // cell is the next binding and the values are the initial values
+  // evaluated so far.
+  CEK_FRAME_NAMED_LET_INIT,
+  // Evaluating the body of a named let that is a loop.
+  CEK_FRAME_NAMED_LET_LOOP,
+  // The phases of a do loop (cell is the next binding or command).
+  CEK_FRAME_DO_INIT,
+  CEK_FRAME_DO_TEST,
+  CEK_FRAME_DO_COMMAND,
+  CEK_FRAME_DO_STEP,
+  // The extent of a call/ec (the only value is the continuation).
+  CEK_FRAME_ESCAPE,
+  // Calling the thunk of a dynamic-wind (see winder).
+  CEK_FRAME_WIND,
+  // Calling the procedure given to map or for-each. The values are the
+  // procedure and the rest of the lists, and map keeps the results so
+  // far (in reverse) in expr.
+  CEK_FRAME_MAP,
+  CEK_FRAME_FOR_EACH,
+  // The oldest frame of a green thread. The thread is finished when a
+  // value is returned to it.
+  CEK_FRAME_THREAD,
+} cek_frame_kind_t;
+
+/**
+ * The state of a named let loop or do loop which lives as long as the
+ * loop does.
+ */
+typedef struct {
+  named_let_loop_t loop;
+  // A loop that belongs to a frozen frame is never freed (a
+  // continuation may go around it again).
+  boolean_t is_frozen;
+  lambda_analysis_t* analysis;
+  uint64_t n_vars;
+  pair_t* var_bindings[MAX_PRIMITIVE_ARGS];
+} cek_loop_t;
+
+typedef struct cek_frame_S {
+  // The next older frame (which may be in an older segment) or NULL.
+  struct cek_frame_S* previous;
+  struct cek_segment_S* segment;
+  uint64_t depth;
+  cek_frame_kind_t kind;
+  boolean_t in_tail_position;
+  environment_t* env;
+  tagged_reference_t expr;
+  pair_t* cell;
+  // The environment made by a let, named let or do.
+  environment_t* scope;
+  lambda_analysis_t* analysis;
+  cek_loop_t* loop;
+  winder_t* winder;
+  uint64_t n_values;
+  tagged_reference_t values[0];
+} cek_frame_t;
+
+typedef struct cek_segment_S {
+  // The segment that was the newest one when this one was started (or
+  // NULL).
+  struct cek_segment_S* underflow;
+  // Frames below frozen_end belong to captured continuations.
+  uint8_t* frozen_end;
+  // The first free byte and the end of the segment.
+  uint8_t* end;
+  uint8_t* limit;
+  uint64_t size;
+  uint8_t bytes[0];
+} cek_segment_t;
+
+typedef enum {
+  CEK_EVAL,
+  CEK_APPLY,
+  CEK_RETURN,
+} cek_mode_t;
+
+/**
+ * The registers of the machine. What happens next depends on mode.
+ */
+typedef struct {
+  cek_mode_t mode;
+  // CEK_EVAL: evaluate expr in env. When cell isn't NULL, expr is
+  // cell->head.
+  tagged_reference_t expr;
+  pair_t* cell;
+  environment_t* env;
+  boolean_t in_tail_position;
+  // CEK_APPLY: call fn with arguments (from site unless it is NULL).
+  tagged_reference_t fn;
+  primitive_arguments_t arguments;
+  call_site_t* site;
+  // CEK_RETURN: hand value to the newest frame.
+  tagged_reference_t value;
+} cek_registers_t;
+
+/**
+ * Each time C code starts the machine, the frames it pushes go on top
+ * of the frames of any machine that is already running (which is
+ * waiting for the C code to return).
+ */
+typedef struct cek_run_S {
+  struct cek_run_S* outer;
+  uint64_t serial;
+  // The newest frame when this run started. It is finished when that
+  // frame is the newest frame again.
+  cek_frame_t* base;
+  // Where a continuation that belongs to this run is invoked when a
+  // nested run invokes it.
+  jmp_buf target;
+} cek_run_t;
+
+#define CEK_SEGMENT_SIZE (256 * 1024)
+// The stack of a green thread starts with a small segment and each
+// segment added to it is twice as big as the previous one (up to
+// CEK_SEGMENT_SIZE).
+#define CEK_THREAD_SEGMENT_SIZE (4 * 1024)
+
+// Room for the largest possible frame is reserved whenever a frame is
+// pushed so adding a value to the newest frame never has to start a
+// new segment.
+#define CEK_FRAME_RESERVE                                                      \
+  (sizeof(cek_frame_t) + MAX_PRIMITIVE_ARGS * sizeof(tagged_reference_t))
+
+boolean_t cek_is_initialized = false;
+boolean_t cek_is_enabled_value = false;
+
+// The newest segment, the newest frame (NULL when the stack is empty)
+// and the segment used when the stack is empty. These are saved and
+// restored when switching green threads.
+_Thread_local cek_segment_t* cek_stack = NULL;
+_Thread_local cek_frame_t* cek_top = NULL;
+_Thread_local cek_segment_t* cek_bottom_segment = NULL;
+// One empty segment is kept around so that a computation that goes
+// back and forth over a segment boundary doesn't call malloc each
+// time.
+_Thread_local cek_segment_t* cek_spare_segment = NULL;
+
+_Thread_local cek_run_t* cek_current_run = NULL;
+_Thread_local uint64_t cek_n_runs = 0;
+// What is passed to the run that a continuation is invoked in.
+_Thread_local continuation_t* cek_thrown_continuation;
+_Thread_local tagged_reference_t cek_thrown_value;
+
+_Thread_local uint64_t cek_frames_pushed = 0;
+_Thread_local uint64_t cek_max_depth = 0;
+_Thread_local uint64_t cek_segments_allocated = 0;
+_Thread_local uint64_t cek_stack_bytes_in_use = 0;
+_Thread_local uint64_t cek_max_stack_bytes_in_use = 0;
+_Thread_local uint64_t cek_continuations_captured = 0;
+_Thread_local uint64_t cek_frames_copied = 0;
+
+// ======================================================================
+// The stack
+// ======================================================================
+
+static cek_segment_t* cek_make_segment(cek_segment_t* underflow,
+                                       uint64_t size) {
+  cek_segment_t* result = NULL;
+  if (cek_spare_segment != NULL && cek_spare_segment->size == size) {
+    result = cek_spare_segment;
+    cek_spare_segment = NULL;
+  } else {
+    result = (cek_segment_t*) malloc_bytes(sizeof(cek_segment_t) + size);
+    cek_segments_allocated++;
+  }
+  result->underflow = underflow;
+  result->frozen_end = &result->bytes[0];
+  result->end = &result->bytes[0];
+  result->limit = &result->bytes[size];
+  result->size = size;
+  cek_stack_bytes_in_use += size;
+  if (cek_stack_bytes_in_use > cek_max_stack_bytes_in_use) {
+    cek_max_stack_bytes_in_use = cek_stack_bytes_in_use;
+  }
+  return result;
+}
+
+/**
+ * Give back a segment that no longer holds any frames. It becomes the
+ * spare segment so a frame that was just popped can still be read
+ * until the next frame is pushed.
+ */
+static void cek_release_segment(cek_segment_t* segment) {
+  cek_stack_bytes_in_use -= segment->size;
+  if (cek_spare_segment != NULL) {
+    free_bytes(cek_spare_segment);
+  }
+  cek_spare_segment = segment;
+}
+
+static inline uint8_t* cek_frame_end(cek_frame_t* frame) {
+  return (uint8_t*) &frame->values[frame->n_values];
+}
+
+static inline boolean_t cek_is_frozen(cek_frame_t* frame) {
+  return (uint8_t*) frame < frame->segment->frozen_end;
+}
+
+/**
+ * Make frame (NULL for an empty stack) the newest frame. The segments
+ * left behind are released unless they hold frozen frames.
+ */
+static void cek_set_top(cek_frame_t* frame) {
+  cek_segment_t* segment
+      = frame == NULL ? cek_bottom_segment : frame->segment;
+  if (segment != cek_stack) {
+    // A frame is always in the same segment as the frame below it or
+    // in the underflow of that segment, so everything between
+    // cek_stack and segment is garbage. When frame belongs to a
+    // captured continuation, segment may not be below cek_stack at all
+    // but the bottom of the current run always is.
+    cek_frame_t* base = cek_current_run == NULL ? NULL : cek_current_run->base;
+    cek_segment_t* floor = base == NULL ? cek_bottom_segment : base->segment;
+    while (cek_stack != segment && cek_stack != floor) {
+      cek_segment_t* left = cek_stack;
+      cek_stack = left->underflow;
+      if (left->frozen_end == &left->bytes[0]) {
+        cek_release_segment(left);
+      }
+    }
+    cek_stack = segment;
+  }
+  uint8_t* end = frame == NULL ? &segment->bytes[0] : cek_frame_end(frame);
+  segment->end = end < segment->frozen_end ? segment->frozen_end : end;
+  cek_top = frame;
+}
+
+/**
+ * Return where the next frame goes (starting a new segment when there
+ * isn't enough room left in the newest one).
+ */
+static cek_frame_t* cek_allocate_frame(void) {
+  if (cek_stack->end + CEK_FRAME_RESERVE > cek_stack->limit) {
+    uint64_t size = cek_stack->size * 2;
+    cek_stack = cek_make_segment(
+        cek_stack, size < CEK_SEGMENT_SIZE ? size : CEK_SEGMENT_SIZE);
+  }
+  return (cek_frame_t*) cek_stack->end;
+}
+
+static cek_frame_t* cek_push(cek_frame_kind_t kind, environment_t* env,
+                             tagged_reference_t expr,
+                             boolean_t in_tail_position) {
+  cek_frame_t* frame = cek_allocate_frame();
+  frame->previous = cek_top;
+  frame->segment = cek_stack;
+  frame->depth = cek_top == NULL ? 1 : cek_top->depth + 1;
+  frame->kind = kind;
+  frame->in_tail_position = in_tail_position;
+  frame->env = env;
+  frame->expr = expr;
+  frame->cell = NULL;
+  frame->scope = NULL;
+  frame->analysis = NULL;
+  frame->loop = NULL;
+  frame->winder = NULL;
+  frame->n_values = 0;
+  cek_top = frame;
+  cek_stack->end += sizeof(cek_frame_t);
+
+  cek_frames_pushed++;
+  if (frame->depth > cek_max_depth) {
+    cek_max_depth = frame->depth;
+  }
+  return frame;
+}
+
+/**
+ * Remove the newest frame. Its fields can still be read until the
+ * next frame is pushed.
+ */
+static void cek_pop(void) { cek_set_top(cek_top->previous); }
+
+/**
+ * Return the newest frame making sure that it can be changed: a frozen
+ * frame is replaced by a copy of it on top of the stack.
+ */
+static cek_frame_t* cek_thaw(void) {
+  cek_frame_t* frame = cek_top;
+  if (!cek_is_frozen(frame)) {
+    return frame;
+  }
+  uint64_t size = cek_frame_end(frame) - (uint8_t*) frame;
+  cek_frame_t* copy = cek_allocate_frame();
+  memcpy(copy, frame, size);
+  copy->segment = cek_stack;
+  cek_stack->end += size;
+  cek_top = copy;
+  cek_frames_copied++;
+  return copy;
+}
+
+/**
+ * Mark env and the environments it depends on as captured so they
+ * are never released.
+ */
+static void cek_capture_environment(environment_t* env) {
+  while (env != NULL && env != env->toplevel && !env->is_captured) {
+    env->is_captured = true;
+    env = env->parent;
+  }
+}
+
+/**
+ * Freeze the frames of the current run that aren't frozen yet (see
+ * the top of this file).
+ */
+static void cek_freeze(void) {
+  cek_frame_t* base = cek_current_run->base;
+  // The watermark of a segment is only raised once all of its frames
+  // have been visited (the newest one visited is the highest).
+  cek_segment_t* segment = NULL;
+  uint8_t* frozen_end = NULL;
+  for (cek_frame_t* frame = cek_top; frame != base && !cek_is_frozen(frame);
+       frame = frame->previous) {
+    cek_capture_environment(frame->env);
+    cek_capture_environment(frame->scope);
+    if (frame->loop != NULL) {
+      frame->loop->is_frozen = true;
+    }
+    if (frame->segment != segment) {
+      if (segment != NULL) {
+        segment->frozen_end = frozen_end;
+      }
+      segment = frame->segment;
+      frozen_end = cek_frame_end(frame);
+    }
+  }
+  if (segment != NULL) {
+    segment->frozen_end = frozen_end;
+  }
+}
+
+/**
+ * Free the state of a loop that is finished.
+ */
+static void cek_free_loop(cek_loop_t* loop) {
+  if (!loop->is_frozen) {
+    free_bytes(loop);
+  }
+}
+
+/**
+ * Add a value to the newest frame.
+ */
+static void cek_push_value(cek_frame_t* frame, tagged_reference_t value) {
+  if (frame->n_values >= MAX_PRIMITIVE_ARGS) {
+    fatal_error(ERROR_MAX_PRIMITIVE_ARGS);
+  }
+  frame->values[frame->n_values++] = value;
+  cek_stack->end += sizeof(tagged_reference_t);
+}
+
+/**
+ * Copy the values of a frame (skipping the first skip of them) to
+ * arguments.
+ */
+static void cek_get_values(cek_frame_t* frame, uint64_t skip,
+                           primitive_arguments_t* arguments) {
+  memset(arguments, 0, sizeof(primitive_arguments_t));
+  arguments->n_args = frame->n_values - skip;
+  memcpy(&arguments->args[0], &frame->values[skip],
+         arguments->n_args * sizeof(tagged_reference_t));
+}
+
+static inline pair_t* cek_list(tagged_reference_t lst) {
+  return lst.tag == TAG_PAIR_T ? untag_pair(lst) : NULL;
+}
+
+// ======================================================================
+// Transitions
+// ======================================================================
+
+static inline void cek_eval_expr(cek_registers_t* r, environment_t* env,
+                                 tagged_reference_t expr,
+                                 boolean_t in_tail_position) {
+  r->mode = CEK_EVAL;
+  r->expr = expr;
+  r->cell = NULL;
+  r->env = env;
+  r->in_tail_position = in_tail_position;
+}
+
+static inline void cek_eval_cell(cek_registers_t* r, environment_t* env,
+                                 pair_t* cell, boolean_t in_tail_position) {
+  cek_eval_expr(r, env, cell->head, in_tail_position);
+  r->cell = cell;
+}
+
+static inline void cek_return(cek_registers_t* r, tagged_reference_t value) {
+  r->mode = CEK_RETURN;
+  r->value = value;
+}
+
+static inline void cek_apply(cek_registers_t* r, tagged_reference_t fn,
+                             call_site_t* site) {
+  r->mode = CEK_APPLY;
+  r->fn = fn;
+  r->site = site;
+}
+
+/**
+ * Return the special form expr is (or SPECIAL_FORM_NONE for an
+ * application).
+ */
+static inline special_form_t cek_special_form(pair_t* lst) {
+  if (lst->head.tag != TAG_SCHEME_SYMBOL) {
+    return SPECIAL_FORM_NONE;
+  }
+  return special_form_of(untag_reader_symbol(lst->head));
+}
+
+/**
+ * Return true for expressions that eval() evaluates without
+ * evaluating any subexpressions.
+ */
+static inline boolean_t cek_is_leaf(tagged_reference_t expr) {
+  if (expr.tag != TAG_PAIR_T) {
+    return true;
+  }
+  switch (cek_special_form(untag_pair(expr))) {
+  case SPECIAL_FORM_QUOTE:
+  case SPECIAL_FORM_LAMBDA:
+  case SPECIAL_FORM_DEFINE_SYNTAX:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * Evaluate cell->head (not in tail position) right away and return
+ * true when that can be done without pushing a frame. Otherwise the
+ * machine is set up to evaluate it and false is returned.
+ */
+static boolean_t cek_eval_now(cek_registers_t* r, environment_t* env,
+                              pair_t* cell, tagged_reference_t* value) {
+  if (cek_is_leaf(cell->head)) {
+    *value = eval_subexpression(env, cell);
+    return true;
+  }
+  cek_eval_cell(r, env, cell, false);
+  return false;
+}
+
+/**
+ * Evaluate a non-empty list of expressions (the last one in tail
+ * position when in_tail_position is true).
+ */
+static void cek_sequence(cek_registers_t* r, environment_t* env,
+                         tagged_reference_t body,
+                         boolean_t in_tail_position) {
+  pair_t* cell = untag_pair(body);
+  if (cell->tail.tag != TAG_NULL) {
+    cek_frame_t* frame
+        = cek_push(CEK_FRAME_SEQUENCE, env, NIL, in_tail_position);
+    frame->cell = cell;
+    in_tail_position = false;
+  }
+  cek_eval_cell(r, env, cell, in_tail_position);
+}
+
+/**
+ * Evaluate the operand of an and/or in cell. The last one is
+ * evaluated in tail position.
+ */
+static void cek_and_or(cek_registers_t* r, cek_frame_kind_t kind,
+                       environment_t* env, pair_t* cell,
+                       boolean_t in_tail_position) {
+  if (cell->tail.tag != TAG_NULL) {
+    cek_frame_t* frame = cek_push(kind, env, NIL, in_tail_position);
+    frame->cell = cell;
+    in_tail_position = false;
+  }
+  cek_eval_cell(r, env, cell, in_tail_position);
+}
+
+/**
+ * Evaluate the rest of a cond clause whose test evaluated to test.
+ */
+static void cek_cond_body(cek_registers_t* r, environment_t* env,
+                          pair_t* clause, tagged_reference_t test,
+                          boolean_t in_tail_position) {
+  if (clause->tail.tag == TAG_NULL) {
+    release_if_tail_position(env, in_tail_position);
+    cek_return(r, test);
+    return;
+  }
+  pair_t* rest = untag_pair(clause->tail);
+  if (rest->head.tag == TAG_SCHEME_SYMBOL
+      && string_equal(untag_reader_symbol(rest->head), "=>")) {
+    cek_frame_t* frame
+        = cek_push(CEK_FRAME_COND_RECEIVER, env, NIL, in_tail_position);
+    cek_push_value(frame, test);
+    cek_eval_cell(r, env, untag_pair(rest->tail), false);
+    return;
+  }
+  cek_sequence(r, env, clause->tail, in_tail_position);
+}
+
+/**
+ * Evaluate the cond clauses in clauses.
+ */
+static void cek_cond(cek_registers_t* r, environment_t* env,
+                     tagged_reference_t clauses,
+                     boolean_t in_tail_position) {
+  if (clauses.tag != TAG_PAIR_T) {
+    release_if_tail_position(env, in_tail_position);
+    cek_return(r, NIL);
+    return;
+  }
+  pair_t* clause = untag_pair(untag_pair(clauses)->head);
+  if (clause->head.tag == TAG_SCHEME_SYMBOL
+      && string_equal(untag_reader_symbol(clause->head), "else")) {
+    cek_cond_body(r, env, clause, tag_boolean(true), in_tail_position);
+    return;
+  }
+  cek_frame_t* frame = cek_push(CEK_FRAME_COND, env, NIL, in_tail_position);
+  frame->cell = untag_pair(clauses);
+  cek_eval_cell(r, env, clause, false);
+}
+
+/**
+ * Give the variables of a loop new values (with new bindings when a
+ * closure may have captured the old ones).
+ */
+static void cek_update_loop_variables(cek_loop_t* loop, environment_t* scope,
+                                      tagged_reference_t* values) {
+  for (uint64_t i = 0; i < loop->n_vars; i++) {
+    if (loop->analysis->bindings_may_be_captured) {
+      loop->var_bindings[i] = environment_rebind(
+          scope, untag_reader_symbol(loop->var_bindings[i]->head), values[i]);
+    } else {
+      loop->var_bindings[i]->tail = values[i];
+    }
+  }
+}
+
+/**
+ * Start an iteration of the named let loop in frame (the newest
+ * frame).
+ */
+static void cek_named_let_iterate(cek_registers_t* r, cek_frame_t* frame) {
+  cek_loop_t* loop = frame->loop;
+  if (loop->loop.arguments.n_args != loop->n_vars) {
+    fatal_error(ERROR_WRONG_NUMBER_OF_ARGS);
+  }
+  cek_update_loop_variables(loop, frame->scope,
+                            &loop->loop.arguments.args[0]);
+  if (loop->analysis->bindings_may_be_captured) {
+    array_t* defined_names = loop->analysis->defined_names;
+    for (uint64_t i = 0; i < array_length(defined_names); i++) {
+      environment_rebind(frame->scope, (char*) array_get(defined_names, i),
+                         NIL);
+    }
+  }
+  pair_t* rest = untag_pair(untag_pair(frame->expr)->tail);
+  cek_sequence(r, frame->scope, cdr(rest->tail), false);
+}
+
+/**
+ * Evaluate (let name ((var init)...) body...) once the initial values
+ * are known (see eval_named_let).
+ */
+static void cek_named_let(cek_registers_t* r, environment_t* env,
+                          tagged_reference_t expr,
+                          primitive_arguments_t* arguments,
+                          boolean_t in_tail_position) {
+  pair_t* rest = untag_pair(untag_pair(expr)->tail);
+  char* name = untag_reader_symbol(rest->head);
+  tagged_reference_t bindings = car(rest->tail);
+  lambda_analysis_t* analysis = analyze_let(env, expr);
+  uint64_t n_vars = arguments->n_args;
+
+  if (!analysis->is_loop) {
+    closure_t* closure = allocate_closure(n_vars);
+    closure->code = cdr(rest->tail);
+    closure->debug_name = name;
+    closure->analysis = analysis;
+    closure->n_arg_names = n_vars;
+    for (int i = 0; i < n_vars; i++) {
+      closure->arg_names[i]
+          = binding_name(pair_list_get(untag_pair(bindings), i));
+    }
+    close_over_free_variables(closure, env);
+    if (closure->env == env->toplevel) {
+      closure->env = make_frame_environment(env->toplevel);
+    }
+    environment_add_binding(closure->env, name,
+                            tagged_reference(TAG_CLOSURE_T, closure));
+    environment_capture(closure->env);
+    release_if_tail_position(env, in_tail_position);
+    r->arguments = *arguments;
+    cek_apply(r, tagged_reference(TAG_CLOSURE_T, closure), NULL);
+    return;
+  }
+
+  // The loop state is on the heap (instead of the C stack like in
+  // eval_named_let) since it must outlive this transition.
+  cek_loop_t* loop = malloc_struct(cek_loop_t);
+  loop->loop.arguments = *arguments;
+  loop->analysis = analysis;
+  loop->n_vars = n_vars;
+  environment_t* scope = make_scope_environment(env, analysis, false);
+  environment_add_binding(scope, name,
+                          tagged_reference(TAG_NAMED_LET_LOOP_T, &loop->loop));
+  for (uint64_t i = 0; i < n_vars; i++) {
+    loop->var_bindings[i] = environment_add_binding(
+        scope, binding_name(pair_list_get(untag_pair(bindings), i)), NIL);
+  }
+  bind_defined_names(scope, analysis);
+
+  cek_frame_t* frame
+      = cek_push(CEK_FRAME_NAMED_LET_LOOP, env, expr, in_tail_position);
+  frame->scope = scope;
+  frame->loop = loop;
+  cek_named_let_iterate(r, frame);
+}
+
+/**
+ * Evaluate the rest of the operator and arguments of an application
+ * (or the initial values of a named let) in frame (the newest frame).
+ * Once all of them are known, the procedure is applied.
+ */
+static void cek_collect_values(cek_registers_t* r, cek_frame_t* frame) {
+  boolean_t is_application = frame->kind == CEK_FRAME_APPLICATION;
+  while (frame->cell != NULL) {
+    pair_t* cell = frame->cell;
+    if (is_application) {
+      // The operator is in the call site (and has no tail) so the
+      // first argument comes right after it.
+      frame->cell = cek_list(frame->n_values == 0
+                                 ? untag_pair(frame->expr)->tail
+                                 : cell->tail);
+    } else {
+      frame->cell = cek_list(cell->tail);
+      cell = untag_pair(untag_pair(cell->head)->tail);
+    }
+    tagged_reference_t value;
+    if (!cek_eval_now(r, frame->env, cell, &value)) {
+      return;
+    }
+    cek_push_value(frame, value);
+  }
+
+  environment_t* env = frame->env;
+  tagged_reference_t expr = frame->expr;
+  boolean_t in_tail_position = frame->in_tail_position;
+  if (is_application) {
+    cek_get_values(frame, 1, &r->arguments);
+    cek_apply(r, frame->values[0], untag_call_site(untag_pair(expr)->head));
+    cek_pop();
+    release_if_tail_position(env, in_tail_position);
+    return;
+  }
+  primitive_arguments_t arguments;
+  cek_get_values(frame, 0, &arguments);
+  cek_pop();
+  cek_named_let(r, env, expr, &arguments, in_tail_position);
+}
+
+/**
+ * Evaluate an application (see eval_application).
+ */
+static void cek_application(cek_registers_t* r, environment_t* env,
+                            tagged_reference_t expr,
+                            boolean_t in_tail_position) {
+  pair_t* lst = untag_pair(expr);
+  if (lst->head.tag != TAG_CALL_SITE_T) {
+    if (expand_macro_use(env, expr)) {
+      cek_eval_expr(r, env, expr, in_tail_position);
+      return;
+    }
+    call_site_t* site = make_call_site(lst->head);
+    interpreter_code_lock();
+    lst->head = tagged_reference(TAG_CALL_SITE_T, site);
+    interpreter_code_unlock();
+  }
+  cek_frame_t* frame
+      = cek_push(CEK_FRAME_APPLICATION, env, expr, in_tail_position);
+  frame->cell = &untag_call_site(lst->head)->operator;
+  cek_collect_values(r, frame);
+}
+
+/**
+ * Bind the variables of a let, let* or letrec in frame (the newest
+ * frame) one at a time and then evaluate the body.
+ */
+static void cek_let_bindings(cek_registers_t* r, cek_frame_t* frame) {
+  while (frame->cell != NULL) {
+    pair_t* binding = untag_pair(frame->cell->head);
+    environment_t* env
+        = frame->kind == CEK_FRAME_LET ? frame->env : frame->scope;
+    tagged_reference_t value;
+    if (!cek_eval_now(r, env, untag_pair(binding->tail), &value)) {
+      return;
+    }
+    char* name = untag_reader_symbol(binding->head);
+    if (frame->kind == CEK_FRAME_LETREC) {
+      environment_find_local_binding(frame->scope, name)->tail = value;
+    } else {
+      environment_add_binding(frame->scope, name, value);
+    }
+    frame->cell = cek_list(frame->cell->tail);
+  }
+
+  environment_t* scope = frame->scope;
+  if (frame->kind != CEK_FRAME_LETREC) {
+    bind_defined_names(scope, frame->analysis);
+  }
+  tagged_reference_t body = cdr(cdr(frame->expr));
+  cek_pop();
+  cek_sequence(r, scope, body, true);
+}
+
+/**
+ * Evaluate a let, let* or letrec (see eval_let, etc.).
+ */
+static void cek_let(cek_registers_t* r, cek_frame_kind_t kind,
+                    environment_t* env, tagged_reference_t expr,
+                    boolean_t in_tail_position) {
+  pair_t* rest = untag_pair(untag_pair(expr)->tail);
+  if (kind == CEK_FRAME_LET && rest->head.tag == TAG_SCHEME_SYMBOL) {
+    cek_frame_t* frame = cek_push(CEK_FRAME_NAMED_LET_INIT, env, expr,
+                                  in_tail_position);
+    frame->cell = cek_list(car(rest->tail));
+    cek_collect_values(r, frame);
+    return;
+  }
+
+  lambda_analysis_t* analysis = analyze_let(env, expr);
+  environment_t* scope
+      = make_scope_environment(env, analysis, in_tail_position);
+  cek_frame_t* frame = cek_push(kind, env, expr, in_tail_position);
+  frame->scope = scope;
+  frame->analysis = analysis;
+  frame->cell = cek_list(rest->head);
+  if (kind == CEK_FRAME_LETREC) {
+    for (tagged_reference_t bindings = rest->head;
+         bindings.tag == TAG_PAIR_T; bindings = untag_pair(bindings)->tail) {
+      environment_add_binding(scope, binding_name(untag_pair(bindings)->head),
+                              NIL);
+    }
+    bind_defined_names(scope, analysis);
+  }
+  cek_let_bindings(r, frame);
+}
+
+/**
+ * Use the value of the expression the do loop in frame evaluated
+ * last. Return false when the loop is finished.
+ */
+static boolean_t cek_do_receive(cek_registers_t* r, cek_frame_t* frame,
+                                tagged_reference_t value) {
+  pair_t* rest = untag_pair(untag_pair(frame->expr)->tail);
+  cek_loop_t* loop = frame->loop;
+  switch (frame->kind) {
+  case CEK_FRAME_DO_INIT:
+    if (loop->n_vars + 1 >= MAX_PRIMITIVE_ARGS) {
+      fatal_error(ERROR_MAX_PRIMITIVE_ARGS);
+    }
+    loop->var_bindings[loop->n_vars++] = environment_add_binding(
+        frame->scope, untag_reader_symbol(untag_pair(frame->cell->head)->head),
+        value);
+    break;
+
+  case CEK_FRAME_DO_TEST:
+    if (is_false(value)) {
+      frame->kind = CEK_FRAME_DO_COMMAND;
+      frame->cell = cek_list(cdr(rest->tail));
+      return true;
+    }
+    // The loop is finished.
+    pair_t* test_clause = untag_pair(car(rest->tail));
+    environment_t* scope = frame->scope;
+    cek_free_loop(loop);
+    cek_pop();
+    if (test_clause->tail.tag == TAG_NULL) {
+      release_if_tail_position(scope, true);
+      cek_return(r, NIL);
+      return false;
+    }
+    cek_sequence(r, scope, test_clause->tail, true);
+    return false;
+
+  case CEK_FRAME_DO_STEP:
+    cek_push_value(frame, value);
+    break;
+
+  default:
+    break;
+  }
+  frame->cell = cek_list(frame->cell->tail);
+  return true;
+}
+
+/**
+ * Run the do loop in frame (the newest frame) until an expression
+ * that needs the machine has to be evaluated.
+ */
+static void cek_do_next(cek_registers_t* r, cek_frame_t* frame) {
+  pair_t* rest = untag_pair(untag_pair(frame->expr)->tail);
+  while (true) {
+    environment_t* env = frame->scope;
+    pair_t* cell;
+    switch (frame->kind) {
+    case CEK_FRAME_DO_INIT:
+      if (frame->cell == NULL) {
+        frame->kind = CEK_FRAME_DO_TEST;
+        continue;
+      }
+      // The initial values are evaluated in env (frame->scope is only
+      // on top of it on the frame stack).
+      env = frame->env;
+      cell = untag_pair(untag_pair(frame->cell->head)->tail);
+      break;
+
+    case CEK_FRAME_DO_TEST:
+      cell = untag_pair(car(rest->tail));
+      break;
+
+    case CEK_FRAME_DO_COMMAND:
+      if (frame->cell == NULL) {
+        frame->kind = CEK_FRAME_DO_STEP;
+        frame->cell = cek_list(rest->head);
+        continue;
+      }
+      cell = frame->cell;
+      break;
+
+    default:
+      if (frame->cell == NULL) {
+        // All of the steps are evaluated before any variable is
+        // updated.
+        cek_update_loop_variables(frame->loop, frame->scope,
+                                  &frame->values[0]);
+        frame->segment->end = (uint8_t*) &frame->values[0];
+        frame->n_values = 0;
+        frame->kind = CEK_FRAME_DO_TEST;
+        continue;
+      }
+      tagged_reference_t step = cdr(cdr(frame->cell->head));
+      if (step.tag != TAG_PAIR_T) {
+        cek_do_receive(
+            r, frame, frame->loop->var_bindings[frame->n_values]->tail);
+        continue;
+      }
+      cell = untag_pair(step);
+      break;
+    }
+    tagged_reference_t value;
+    if (!cek_eval_now(r, env, cell, &value)
+        || !cek_do_receive(r, frame, value)) {
+      return;
+    }
+  }
+}
+
+/**
+ * Evaluate (do ((var init step)...) (test expr...) command...).
+ */
+static void cek_do(cek_registers_t* r, environment_t* env,
+                   tagged_reference_t expr, boolean_t in_tail_position) {
+  lambda_analysis_t* analysis = analyze_do(env, expr);
+  cek_loop_t* loop = malloc_struct(cek_loop_t);
+  loop->analysis = analysis;
+  loop->n_vars = 0;
+  cek_frame_t* frame
+      = cek_push(CEK_FRAME_DO_INIT, env, expr, in_tail_position);
+  frame->scope = make_scope_environment(env, analysis, in_tail_position);
+  frame->loop = loop;
+  frame->cell = cek_list(car(cdr(expr)));
+  cek_do_next(r, frame);
+}
+
+// ======================================================================
+// Continuations
+// ======================================================================
+
+/**
+ * Call fn with a continuation as its only argument.
+ */
+static void cek_call_with(cek_registers_t* r, tagged_reference_t fn,
+                          continuation_t* continuation) {
+  memset(&r->arguments, 0, sizeof(primitive_arguments_t));
+  r->arguments.n_args = 1;
+  r->arguments.args[0] = tagged_reference(TAG_CONTINUATION_T, continuation);
+  cek_apply(r, fn, NULL);
+}
+
+/**
+ * Return the frame of the call/ec that made continuation when it is
+ * still on the stack of the current run (or else NULL).
+ */
+static cek_frame_t* cek_find_escape_frame(continuation_t* continuation) {
+  for (cek_frame_t* frame = cek_top; frame != cek_current_run->base;
+       frame = frame->previous) {
+    if (frame->kind == CEK_FRAME_ESCAPE
+        && frame->values[0].data == (uint64_t) continuation) {
+      return frame;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Copy the frames of a continuation whose run has finished on top of
+ * the base of the current run (so that once they are done, the value
+ * is returned to the C code that started the current run).
+ */
+static void cek_reinstate_copy(continuation_t* continuation) {
+  cek_frame_t* base = (cek_frame_t*) continuation->base_frame;
+  uint64_t n_frames = 0;
+  for (cek_frame_t* frame = continuation->frame; frame != base;
+       frame = frame->previous) {
+    n_frames++;
+  }
+  cek_frame_t** frames
+      = (cek_frame_t**) malloc_bytes(n_frames * sizeof(cek_frame_t*));
+  uint64_t i = n_frames;
+  for (cek_frame_t* frame = continuation->frame; frame != base;
+       frame = frame->previous) {
+    frames[--i] = frame;
+  }
+  cek_set_top(cek_current_run->base);
+  for (i = 0; i < n_frames; i++) {
+    uint64_t size = cek_frame_end(frames[i]) - (uint8_t*) frames[i];
+    cek_frame_t* copy = cek_allocate_frame();
+    memcpy(copy, frames[i], size);
+    copy->previous = cek_top;
+    copy->segment = cek_stack;
+    copy->depth = cek_top == NULL ? 1 : cek_top->depth + 1;
+    cek_stack->end += size;
+    cek_top = copy;
+  }
+  cek_frames_copied += n_frames;
+  free_bytes(frames);
+}
+
+/**
+ * Pass value to a continuation.
+ */
+static void cek_invoke(cek_registers_t* r, continuation_t* continuation,
+                       tagged_reference_t value) {
+  if (continuation->stack != cek_bottom_segment) {
+    // Continuations can't move computations between green threads.
+    fatal_error(ERROR_CONTINUATION_NOT_ACTIVE);
+  }
+  if (continuation->run != cek_current_run->serial) {
+    for (cek_run_t* run = cek_current_run->outer; run != NULL;
+         run = run->outer) {
+      if (run->serial == continuation->run) {
+        cek_thrown_continuation = continuation;
+        cek_thrown_value = value;
+        longjmp(run->target, 1);
+      }
+    }
+    if (continuation->is_escape) {
+      fatal_error(ERROR_CONTINUATION_NOT_ACTIVE);
+    }
+    continuation_rewind(continuation->winders);
+    cek_reinstate_copy(continuation);
+    cek_return(r, value);
+    return;
+  }
+
+  cek_frame_t* top = continuation->frame;
+  if (continuation->is_escape) {
+    cek_frame_t* frame = cek_find_escape_frame(continuation);
+    if (frame == NULL) {
+      fatal_error(ERROR_CONTINUATION_NOT_ACTIVE);
+    }
+    top = frame->previous;
+  }
+  continuation_rewind(continuation->winders);
+  cek_set_top(top);
+  cek_return(r, value);
+}
+
+/**
+ * Call the procedure of the map or for-each in frame (the newest
+ * frame) with the next elements of the lists, or finish.
+ */
+static void cek_map_next(cek_registers_t* r, cek_frame_t* frame) {
+  primitive_arguments_t lists;
+  cek_get_values(frame, 0, &lists);
+  memset(&r->arguments, 0, sizeof(primitive_arguments_t));
+  if (!next_map_arguments(&lists, &r->arguments)) {
+    tagged_reference_t result = NIL;
+    if (frame->kind == CEK_FRAME_MAP) {
+      for (tagged_reference_t lst = frame->expr; lst.tag == TAG_PAIR_T;
+           lst = untag_pair(lst)->tail) {
+        result = cons(untag_pair(lst)->head, result);
+      }
+    }
+    cek_pop();
+    cek_return(r, result);
+    return;
+  }
+  memcpy(&frame->values[0], &lists.args[0],
+         frame->n_values * sizeof(tagged_reference_t));
+  cek_apply(r, frame->values[0], NULL);
+}
+
+/**
+ * Run the primitives that need the stack of the machine (call/cc,
+ * call/ec and dynamic-wind) and those that call a procedure given to
+ * them (apply, map and for-each) in the machine itself so that the
+ * continuations captured inside of them aren't delimited by a nested
+ * run. Return false for any other primitive.
+ */
+static boolean_t cek_apply_control_primitive(cek_registers_t* r,
+                                             primitive_t primitive) {
+  primitive_arguments_t* arguments = &r->arguments;
+
+  if (primitive == primtive_function_call_with_current_continuation) {
+    require_n_args(*arguments, 1, 1);
+    cek_freeze();
+    continuation_t* continuation = make_continuation(false);
+    continuation->frame = cek_top;
+    continuation->base_frame = cek_current_run->base;
+    continuation->run = cek_current_run->serial;
+    continuation->stack = cek_bottom_segment;
+    cek_continuations_captured++;
+    cek_call_with(r, arguments->args[0], continuation);
+    return true;
+  }
+
+  if (primitive == primtive_function_call_with_escape_continuation) {
+    require_n_args(*arguments, 1, 1);
+    continuation_t* continuation = make_continuation(true);
+    cek_frame_t* frame = cek_push(CEK_FRAME_ESCAPE, NULL, NIL, false);
+    cek_push_value(frame, tagged_reference(TAG_CONTINUATION_T, continuation));
+    continuation->frame = frame;
+    continuation->base_frame = cek_current_run->base;
+    continuation->run = cek_current_run->serial;
+    continuation->stack = cek_bottom_segment;
+    cek_call_with(r, arguments->args[0], continuation);
+    return true;
+  }
+
+  if (primitive == primtive_function_dynamic_wind) {
+    require_n_args(*arguments, 3, 3);
+    tagged_reference_t before = arguments->args[0];
+    tagged_reference_t thunk = arguments->args[1];
+    tagged_reference_t after = arguments->args[2];
+    primitive_arguments_t no_arguments = {.n_args = 0};
+    apply_procedure(before, no_arguments);
+    cek_frame_t* frame = cek_push(CEK_FRAME_WIND, NULL, NIL, false);
+    frame->winder = make_winder(before, after);
+    current_winders = frame->winder;
+    r->arguments = no_arguments;
+    cek_apply(r, thunk, NULL);
+    return true;
+  }
+
+  if (primitive == primtive_function_apply) {
+    primitive_arguments_t proc_arguments;
+    apply_arguments(arguments, &proc_arguments);
+    tagged_reference_t fn = arguments->args[0];
+    r->arguments = proc_arguments;
+    cek_apply(r, fn, NULL);
+    return true;
+  }
+
+  // Even a primitive procedure is called by the machine so that it can
+  // switch green threads (see cek_switch).
+  if ((primitive == primtive_function_map
+       || primitive == primtive_function_for_each)
+      && arguments->n_args >= 2) {
+    cek_frame_t* frame = cek_push(primitive == primtive_function_map
+                                      ? CEK_FRAME_MAP
+                                      : CEK_FRAME_FOR_EACH,
+                                  NULL, NIL, false);
+    for (uint64_t i = 0; i < arguments->n_args; i++) {
+      cek_push_value(frame, arguments->args[i]);
+    }
+    cek_map_next(r, frame);
+    return true;
+  }
+
+  return false;
+}
+
+// ======================================================================
+// Green threads
+// ======================================================================
+
+/**
+ * Green threads can only be switched in the outermost run (a nested
+ * run has C code below it that can't be suspended).
+ */
+boolean_t cek_can_switch(void) {
+  return cek_is_enabled() && cek_current_run != NULL
+         && cek_current_run->outer == NULL;
+}
+
+/**
+ * Continue running thread (starting it when it hasn't started yet).
+ */
+static void cek_resume(cek_registers_t* r, green_thread_t* thread) {
+  green_thread_make_current(thread);
+  if (thread->is_started) {
+    cek_stack = (cek_segment_t*) thread->stack;
+    cek_top = (cek_frame_t*) thread->top;
+    cek_bottom_segment = (cek_segment_t*) thread->bottom;
+    current_winders = thread->winders;
+    cek_return(r, thread->value);
+    return;
+  }
+  thread->is_started = true;
+  cek_stack = cek_make_segment(NULL, CEK_THREAD_SEGMENT_SIZE);
+  cek_bottom_segment = cek_stack;
+  cek_top = NULL;
+  current_winders = NULL;
+  cek_push(CEK_FRAME_THREAD, NULL, NIL, false);
+  memset(&r->arguments, 0, sizeof(primitive_arguments_t));
+  cek_apply(r, thread->thunk, NULL);
+}
+
+/**
+ * Suspend the current thread (a primitive has already put it on the
+ * queue it waits in) and continue with the next one.
+ */
+static void cek_switch(cek_registers_t* r) {
+  green_thread_must_switch = false;
+  green_thread_t* self = current_green_thread();
+  self->stack = cek_stack;
+  self->top = cek_top;
+  self->bottom = cek_bottom_segment;
+  self->winders = current_winders;
+  cek_resume(r, green_thread_next());
+}
+
+/**
+ * Release the stack of the current thread, which has finished with
+ * value, and continue with the next thread.
+ */
+static void cek_finish_thread(cek_registers_t* r, tagged_reference_t value) {
+  cek_segment_t* segment = cek_stack;
+  while (segment != NULL) {
+    cek_segment_t* underflow = segment->underflow;
+    if (segment->frozen_end == &segment->bytes[0]) {
+      cek_release_segment(segment);
+    }
+    segment = underflow;
+  }
+  green_thread_finish(current_green_thread(), value);
+  cek_resume(r, green_thread_next());
+}
+
+// ======================================================================
+// The machine
+// ======================================================================
+
+static void cek_step_eval(cek_registers_t* r) {
+  tagged_reference_t expr = r->expr;
+  environment_t* env = r->env;
+  boolean_t in_tail_position = r->in_tail_position;
+
+  if (expr.tag != TAG_PAIR_T) {
+    if (r->cell != NULL && !in_tail_position) {
+      cek_return(r, eval_subexpression(env, r->cell));
+    } else {
+      cek_return(r, eval(env, expr, in_tail_position));
+    }
+    return;
+  }
+
+  pair_t* lst = untag_pair(expr);
+  special_form_t form = cek_special_form(lst);
+  // Leaves are counted by eval().
+  if (runtime_stats_is_enabled() && !cek_is_leaf(expr)) {
+    runtime_stats.special_forms[form]++;
+  }
+  switch (form) {
+  case SPECIAL_FORM_IF:
+    cek_push(CEK_FRAME_IF, env, expr, in_tail_position);
+    cek_eval_cell(r, env, untag_pair(lst->tail), false);
+    return;
+
+  case SPECIAL_FORM_SET_BANG:
+  case SPECIAL_FORM_DEFINE:
+    cek_push(form == SPECIAL_FORM_DEFINE ? CEK_FRAME_DEFINE : CEK_FRAME_SET,
+             env, expr, in_tail_position);
+    cek_eval_cell(r, env, untag_pair(cdr(lst->tail)), false);
+    return;
+
+  case SPECIAL_FORM_BEGIN:
+    if (lst->tail.tag == TAG_NULL) {
+      release_if_tail_position(env, in_tail_position);
+      cek_return(r, NIL);
+      return;
+    }
+    cek_sequence(r, env, lst->tail, in_tail_position);
+    return;
+
+  case SPECIAL_FORM_AND:
+  case SPECIAL_FORM_OR:
+    if (lst->tail.tag == TAG_NULL) {
+      release_if_tail_position(env, in_tail_position);
+      cek_return(r, tag_boolean(form == SPECIAL_FORM_AND));
+      return;
+    }
+    cek_and_or(r, form == SPECIAL_FORM_AND ? CEK_FRAME_AND : CEK_FRAME_OR,
+               env, untag_pair(lst->tail), in_tail_position);
+    return;
+
+  case SPECIAL_FORM_WHEN:
+  case SPECIAL_FORM_UNLESS:
+    cek_push(form == SPECIAL_FORM_WHEN ? CEK_FRAME_WHEN : CEK_FRAME_UNLESS,
+             env, expr, in_tail_position);
+    cek_eval_cell(r, env, untag_pair(lst->tail), false);
+    return;
+
+  case SPECIAL_FORM_COND:
+    cek_cond(r, env, lst->tail, in_tail_position);
+    return;
+
+  case SPECIAL_FORM_LET:
+    cek_let(r, CEK_FRAME_LET, env, expr, in_tail_position);
+    return;
+
+  case SPECIAL_FORM_LET_STAR:
+    cek_let(r, CEK_FRAME_LET_STAR, env, expr, in_tail_position);
+    return;
+
+  case SPECIAL_FORM_LETREC:
+    cek_let(r, CEK_FRAME_LETREC, env, expr, in_tail_position);
+    return;
+
+  case SPECIAL_FORM_DO:
+    cek_do(r, env, expr, in_tail_position);
+    return;
+
+  case SPECIAL_FORM_NONE:
+    cek_application(r, env, expr, in_tail_position);
+    return;
+
+  default:
+    // quote, lambda and define-syntax
+    if (r->cell != NULL && !in_tail_position) {
+      cek_return(r, eval_subexpression(env, r->cell));
+    } else {
+      cek_return(r, eval(env, expr, in_tail_position));
+    }
+    return;
+  }
+}
+
+/**
+ * Return the shadow stack key (see profile.c) of a closure applied
+ * now. A primitive gets the key just below it so that procedures it
+ * calls back are nested inside it.
+ */
+static inline uintptr_t cek_profile_key(void) {
+  return 2 * ((cek_top == NULL ? 0 : cek_top->depth) + 1);
+}
+
+/**
+ * Call r->fn (see the second half of eval_application).
+ */
+static void cek_step_apply(cek_registers_t* r) {
+  tagged_reference_t fn = r->fn;
+  call_site_t* site = r->site;
+  primitive_arguments_t* arguments = &r->arguments;
+
+  if (site != NULL) {
+    boolean_t is_target
+        = fn.tag == site->target.tag && fn.data == site->target.data;
+    if (site->kind == CALL_SITE_FIXNUM_BINARY) {
+      if (is_target && arguments->args[0].tag == TAG_UINT64_T
+          && arguments->args[1].tag == TAG_UINT64_T) {
+        runtime_stats_count(inline_arithmetic);
+        cek_return(r, fixnum_operation_apply(site->operation,
+                                             arguments->args[0],
+                                             arguments->args[1]));
+        return;
+      }
+      call_site_deoptimize(site);
+    } else if (site->kind == CALL_SITE_CLOSURE && !is_target) {
+      call_site_deoptimize(site);
+    }
+  }
+
+  if (fn.tag == TAG_NAMED_LET_LOOP_T) {
+    // Go around the loop again (see CEK_FRAME_NAMED_LET_LOOP).
+    ((named_let_loop_t*) fn.data)->arguments = *arguments;
+    cek_return(r, fn);
+    return;
+  }
+
+  if (fn.tag == TAG_CONTINUATION_T) {
+    cek_invoke(r, untag_continuation(fn), continuation_argument(arguments));
+    return;
+  }
+
+  if (site != NULL && site->kind == CALL_SITE_UNINITIALIZED) {
+    call_site_quicken(site, fn, arguments);
+  }
+
+  if (fn.tag == TAG_PRIMITIVE) {
+    runtime_stats_count(primitive_applications);
+    primitive_t primitive = untag_primitive(fn);
+    if (!cek_apply_control_primitive(r, primitive)) {
+      tagged_reference_t value
+          = profile_is_running()
+                ? profile_apply_primitive(cek_profile_key() - 1, fn,
+                                          *arguments)
+                : primitive(*arguments);
+      if (green_thread_must_switch) {
+        cek_switch(r);
+      } else {
+        cek_return(r, value);
+      }
+    }
+    return;
+  }
+
+  closure_t* closure = untag_closure_t(fn);
+  runtime_stats_count(closure_applications);
+  if (profile_is_running()) {
+    profile_enter(cek_profile_key(), fn, false);
+  }
+  optional_t compiled_result = jit_try_call(closure, arguments);
+  if (optional_is_present(compiled_result)) {
+    runtime_stats_count(compiled_applications);
+    cek_return(r, optional_value(compiled_result));
+    return;
+  }
+  environment_t* env = bind_closure_arguments(closure, arguments);
+  // The body is always in tail position with respect to the new
+  // environment (which is released once the body has been evaluated).
+  cek_sequence(r, env, closure_code(closure), true);
+}
+
+/**
+ * Hand r->value to the newest frame.
+ */
+static void cek_step_return(cek_registers_t* r, cek_frame_t* frame) {
+  tagged_reference_t value = r->value;
+  environment_t* env = frame->env;
+  boolean_t in_tail_position = frame->in_tail_position;
+
+  switch (frame->kind) {
+  case CEK_FRAME_SEQUENCE:
+    frame->cell = untag_pair(frame->cell->tail);
+    if (frame->cell->tail.tag == TAG_NULL) {
+      cek_pop();
+      cek_eval_cell(r, env, frame->cell, in_tail_position);
+    } else {
+      cek_eval_cell(r, env, frame->cell, false);
+    }
+    return;
+
+  case CEK_FRAME_IF:
+    cek_pop();
+    pair_t* test_cell = untag_pair(untag_pair(frame->expr)->tail);
+    if (!is_false(value)) {
+      cek_eval_cell(r, env, untag_pair(test_cell->tail), in_tail_position);
+      return;
+    }
+    pair_t* alternative = cek_list(untag_pair(test_cell->tail)->tail);
+    if (alternative == NULL) {
+      cek_eval_expr(r, env, NIL, in_tail_position);
+    } else {
+      cek_eval_cell(r, env, alternative, in_tail_position);
+    }
+    return;
+
+  case CEK_FRAME_SET:
+  case CEK_FRAME_DEFINE:
+    cek_pop();
+    tagged_reference_t name = car(untag_pair(frame->expr)->tail);
+    if (frame->kind == CEK_FRAME_SET) {
+      environment_set(env, untag_scheme_symbol(name), value);
+    } else {
+      environment_define(env, untag_reader_symbol(name), value);
+    }
+    release_if_tail_position(env, in_tail_position);
+    cek_return(r, NIL);
+    return;
+
+  case CEK_FRAME_AND:
+  case CEK_FRAME_OR:
+    if (is_false(value) == (frame->kind == CEK_FRAME_AND)) {
+      cek_pop();
+      release_if_tail_position(env, in_tail_position);
+      cek_return(r, value);
+      return;
+    }
+    frame->cell = untag_pair(frame->cell->tail);
+    if (frame->cell->tail.tag == TAG_NULL) {
+      cek_pop();
+      cek_eval_cell(r, env, frame->cell, in_tail_position);
+    } else {
+      cek_eval_cell(r, env, frame->cell, false);
+    }
+    return;
+
+  case CEK_FRAME_WHEN:
+  case CEK_FRAME_UNLESS:
+    cek_pop();
+    tagged_reference_t body = cdr(cdr(frame->expr));
+    if (is_false(value) == (frame->kind == CEK_FRAME_UNLESS)
+        && body.tag != TAG_NULL) {
+      cek_sequence(r, env, body, in_tail_position);
+      return;
+    }
+    release_if_tail_position(env, in_tail_position);
+    cek_return(r, NIL);
+    return;
+
+  case CEK_FRAME_COND:
+    cek_pop();
+    pair_t* clauses = frame->cell;
+    if (is_false(value)) {
+      cek_cond(r, env, clauses->tail, in_tail_position);
+    } else {
+      cek_cond_body(r, env, untag_pair(clauses->head), value,
+                    in_tail_position);
+    }
+    return;
+
+  case CEK_FRAME_COND_RECEIVER:
+    cek_pop();
+    release_if_tail_position(env, in_tail_position);
+    memset(&r->arguments, 0, sizeof(primitive_arguments_t));
+    r->arguments.n_args = 1;
+    r->arguments.args[0] = frame->values[0];
+    cek_apply(r, value, NULL);
+    return;
+
+  case CEK_FRAME_APPLICATION:
+  case CEK_FRAME_NAMED_LET_INIT:
+    cek_push_value(frame, value);
+    cek_collect_values(r, frame);
+    return;
+
+  case CEK_FRAME_LET:
+  case CEK_FRAME_LET_STAR:
+  case CEK_FRAME_LETREC:
+    if (1) {
+      char* name = untag_reader_symbol(untag_pair(frame->cell->head)->head);
+      if (frame->kind == CEK_FRAME_LETREC) {
+        environment_find_local_binding(frame->scope, name)->tail = value;
+      } else {
+        environment_add_binding(frame->scope, name, value);
+      }
+      frame->cell = cek_list(frame->cell->tail);
+      cek_let_bindings(r, frame);
+      return;
+    }
+
+  case CEK_FRAME_NAMED_LET_LOOP:
+    if (value.tag == TAG_NAMED_LET_LOOP_T
+        && value.data == (uint64_t) &frame->loop->loop) {
+      cek_named_let_iterate(r, frame);
+      return;
+    }
+    if (!frame->scope->is_captured) {
+      environment_release(frame->scope);
+    }
+    cek_free_loop(frame->loop);
+    cek_pop();
+    release_if_tail_position(env, in_tail_position);
+    cek_return(r, value);
+    return;
+
+  case CEK_FRAME_DO_INIT:
+  case CEK_FRAME_DO_TEST:
+  case CEK_FRAME_DO_COMMAND:
+  case CEK_FRAME_DO_STEP:
+    if (cek_do_receive(r, frame, value)) {
+      cek_do_next(r, frame);
+    }
+    return;
+
+  case CEK_FRAME_ESCAPE:
+    cek_pop();
+    cek_return(r, value);
+    return;
+
+  case CEK_FRAME_WIND:
+    if (1) {
+      winder_t* winder = frame->winder;
+      cek_pop();
+      current_winders = winder->next;
+      primitive_arguments_t no_arguments = {.n_args = 0};
+      apply_procedure(winder->after, no_arguments);
+      cek_return(r, value);
+      return;
+    }
+
+  case CEK_FRAME_MAP:
+  case CEK_FRAME_FOR_EACH:
+    if (frame->kind == CEK_FRAME_MAP) {
+      frame->expr = cons(value, frame->expr);
+    }
+    cek_map_next(r, frame);
+    return;
+
+  case CEK_FRAME_THREAD:
+    cek_finish_thread(r, value);
+    return;
+  }
+}
+
+/**
+ * Run the machine until all of the frames pushed since it was started
+ * are gone and return the final value.
+ */
+static tagged_reference_t cek_run(cek_registers_t* r) {
+  if (cek_stack == NULL) {
+    cek_stack = cek_make_segment(NULL, CEK_SEGMENT_SIZE);
+    cek_bottom_segment = cek_stack;
+  }
+  cek_run_t run;
+  run.outer = cek_current_run;
+  run.serial = ++cek_n_runs;
+  run.base = cek_top;
+  cek_current_run = &run;
+  if (setjmp(run.target) != 0) {
+    // A nested run invoked a continuation that belongs to this run.
+    cek_current_run = &run;
+    cek_invoke(r, cek_thrown_continuation, cek_thrown_value);
+  }
+  while (true) {
+    switch (r->mode) {
+    case CEK_EVAL:
+      cek_step_eval(r);
+      break;
+
+    case CEK_APPLY:
+      cek_step_apply(r);
+      break;
+
+    case CEK_RETURN:
+      if (cek_top == run.base) {
+        if (profile_is_running()) {
+          profile_leave(cek_profile_key());
+        }
+        cek_current_run = run.outer;
+        return r->value;
+      }
+      cek_frame_t* frame = cek_thaw();
+      if (profile_is_running()) {
+        // Drop the procedures applied above frame.
+        profile_leave(2 * frame->depth + 1);
+      }
+      cek_step_return(r, frame);
+      break;
+    }
+  }
+}
+
+/**
+ * Evaluate a top-level expression.
+ */
+tagged_reference_t cek_eval(environment_t* env, tagged_reference_t expr) {
+  cek_registers_t r;
+  cek_eval_expr(&r, env, expr, true);
+  return cek_run(&r);
+}
+
+/**
+ * Call a primitive or closure with already evaluated arguments (see
+ * apply_procedure).
+ */
+tagged_reference_t cek_apply_procedure(tagged_reference_t fn,
+                                       primitive_arguments_t arguments) {
+  cek_registers_t r;
+  r.arguments = arguments;
+  cek_apply(&r, fn, NULL);
+  return cek_run(&r);
+}
+
+/**
+ * Return an association list describing how much of the explicit
+ * stack has been used so far.
+ */
+tagged_reference_t
+    primtive_function_cek_statistics(primitive_arguments_t arguments) {
+  tagged_reference_t frames
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "frames"),
+             tagged_reference(TAG_UINT64_T, cek_frames_pushed));
+  tagged_reference_t max_depth
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "max-depth"),
+             tagged_reference(TAG_UINT64_T, cek_max_depth));
+  tagged_reference_t segments
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "segments"),
+             tagged_reference(TAG_UINT64_T, cek_segments_allocated));
+  tagged_reference_t max_stack_bytes
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "max-stack-bytes"),
+             tagged_reference(TAG_UINT64_T, cek_max_stack_bytes_in_use));
+  tagged_reference_t continuations
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "continuations"),
+             tagged_reference(TAG_UINT64_T, cek_continuations_captured));
+  tagged_reference_t frames_copied
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "frames-copied"),
+             tagged_reference(TAG_UINT64_T, cek_frames_copied));
+  return cons(
+      frames,
+      cons(max_depth,
+           cons(segments,
+                cons(max_stack_bytes,
+                     cons(continuations, cons(frames_copied, NIL))))));
+}
@@ -0,0 +1,209 @@
+/**
+ * @file char-primitive.c
+ *
+ * Native implementations of the R7RS character procedures. Characters
+ * are immediate values (TAG_UNICODE_CODE_POINT) holding a Unicode code
+ * point.
+ *
+ * Case mapping and classification only know about ASCII (every other
+ * character is its own upper and lower case and isn't alphabetic,
+ * numeric or whitespace).
+ */
+
+// ======================================================================
+// This is block is extraced to char-primitive.h
+// ======================================================================
+
+#ifndef _CHAR_PRIMITIVE_H_
+#define _CHAR_PRIMITIVE_H_
+
+#include "primitive.h"
+#include "tagged-reference.h"
+
+extern tagged_reference_t primtive_function_char_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_to_integer(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_integer_to_char(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_equal_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_less_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_less_or_equal_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_greater_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_greater_or_equal_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_upcase(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_downcase(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_alphabetic_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_numeric_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_whitespace_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_upper_case_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_char_lower_case_p(primitive_arguments_t args);
+
+#endif /* _CHAR_PRIMITIVE_H_ */
+
+// ======================================================================
+
+#include "boolean.h"
+#include "char-primitive.h"
+#include "fatal-error.h"
+#include "string-util.h"
+
+static inline uint32_t untag_char(tagged_reference_t reference) {
+  require_tag(reference, TAG_UNICODE_CODE_POINT);
+  return reference.data;
+}
+
+static inline boolean_t is_upper_case(uint32_t ch) {
+  return ch >= 'A' && ch <= 'Z';
+}
+
+static inline boolean_t is_lower_case(uint32_t ch) {
+  return ch >= 'a' && ch <= 'z';
+}
+
+tagged_reference_t primtive_function_char_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return tag_boolean(arguments.args[0].tag == TAG_UNICODE_CODE_POINT);
+}
+
+/**
+ * Example (char->integer #\λ) => 955
+ */
+tagged_reference_t
+    primtive_function_char_to_integer(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return tagged_reference(TAG_UINT64_T, untag_char(arguments.args[0]));
+}
+
+/**
+ * Example (integer->char 955) => #\λ
+ *
+ * Surrogates and numbers above 0x10ffff aren't characters.
+ */
+tagged_reference_t
+    primtive_function_integer_to_char(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  uint64_t code_point = untag_uint64_t(arguments.args[0]);
+  char encoding[UTF8_MAX_BYTES];
+  if (code_point > 0x10ffff || utf8_encode(code_point, encoding) == 0) {
+    fatal_error(ERROR_INVALID_UTF8);
+  }
+  return tagged_reference(TAG_UNICODE_CODE_POINT, code_point);
+}
+
+/**
+ * Return -1, 0 or 1 when a is less than, equal to or greater than b.
+ */
+static inline int compare_chars(uint32_t a, uint32_t b) {
+  return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+/**
+ * Return true if every pair of adjacent arguments compares as one of
+ * the allowed results (so (char<? a b c) is a < b and b < c).
+ */
+static boolean_t chars_compare(primitive_arguments_t arguments,
+                               int allowed1, int allowed2) {
+  require_n_args(arguments, 1, MAX_PRIMITIVE_ARGS);
+  uint32_t previous = untag_char(arguments.args[0]);
+  boolean_t result = true;
+  for (uint64_t i = 1; i < arguments.n_args; i++) {
+    uint32_t ch = untag_char(arguments.args[i]);
+    int comparison = compare_chars(previous, ch);
+    if (comparison != allowed1 && comparison != allowed2) {
+      result = false;
+    }
+    previous = ch;
+  }
+  return result;
+}
+
+tagged_reference_t
+    primtive_function_char_equal_p(primitive_arguments_t arguments) {
+  return tag_boolean(chars_compare(arguments, 0, 0));
+}
+
+tagged_reference_t
+    primtive_function_char_less_p(primitive_arguments_t arguments) {
+  return tag_boolean(chars_compare(arguments, -1, -1));
+}
+
+tagged_reference_t
+    primtive_function_char_less_or_equal_p(primitive_arguments_t arguments) {
+  return tag_boolean(chars_compare(arguments, -1, 0));
+}
+
+tagged_reference_t
+    primtive_function_char_greater_p(primitive_arguments_t arguments) {
+  return tag_boolean(chars_compare(arguments, 1, 1));
+}
+
+tagged_reference_t primtive_function_char_greater_or_equal_p(
+    primitive_arguments_t arguments) {
+  return tag_boolean(chars_compare(arguments, 1, 0));
+}
+
+tagged_reference_t
+    primtive_function_char_upcase(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  uint32_t ch = untag_char(arguments.args[0]);
+  if (is_lower_case(ch)) {
+    ch -= 'a' - 'A';
+  }
+  return tagged_reference(TAG_UNICODE_CODE_POINT, ch);
+}
+
+tagged_reference_t
+    primtive_function_char_downcase(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  uint32_t ch = untag_char(arguments.args[0]);
+  if (is_upper_case(ch)) {
+    ch += 'a' - 'A';
+  }
+  return tagged_reference(TAG_UNICODE_CODE_POINT, ch);
+}
+
+tagged_reference_t
+    primtive_function_char_alphabetic_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  uint32_t ch = untag_char(arguments.args[0]);
+  return tag_boolean(is_upper_case(ch) || is_lower_case(ch));
+}
+
+tagged_reference_t
+    primtive_function_char_numeric_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  uint32_t ch = untag_char(arguments.args[0]);
+  return tag_boolean(ch >= '0' && ch <= '9');
+}
+
+tagged_reference_t
+    primtive_function_char_whitespace_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  uint32_t ch = untag_char(arguments.args[0]);
+  return tag_boolean(ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r'
+                     || ch == '\f' || ch == '\v');
+}
+
+tagged_reference_t
+    primtive_function_char_upper_case_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return tag_boolean(is_upper_case(untag_char(arguments.args[0])));
+}
+
+tagged_reference_t
+    primtive_function_char_lower_case_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return tag_boolean(is_lower_case(untag_char(arguments.args[0])));
+}
@@ -1,5 +1,16 @@
 /**
  * @file closure.c
+ *
+ * A closure shares the bindings of its free variables with the
+ * environment it was made in (see close_over_free_variables in
+ * evaluator.c). Besides the small environment holding them (used by
+ * lookups by name, set!, etc.), the closure keeps them in a vector
+ * indexed like the free_names of its lambda analysis. The first time
+ * the evaluator resolves a variable reference in the body to one of
+ * them, it replaces the symbol in the code with a TAG_CLOSURE_SLOT_T
+ * node holding the index (much like the global references of
+ * inline-cache.c) so that later evaluations read the binding straight
+ * out of the vector of the closure being called.
  */
 
 // ======================================================================
@@ -9,18 +20,37 @@
 #ifndef _CLOSURE_H_
 #define _CLOSURE_H_
 
+#include "boolean.h"
 #include "environment.h"
+#include "lambda-analysis.h"
 #include "tagged-reference.h"
 
-typedef struct {
+typedef struct closure_S {
   tagged_reference_t code;
   environment_t* env;
   char* debug_name;
+  // See lambda-analysis.c
+  lambda_analysis_t* analysis;
+  // The shared bindings of the free variables indexed like
+  // analysis->free_names (NULL for top-level variables) or NULL when
+  // the closure doesn't have any.
+  pair_t** free_bindings;
+  // The interpreter thread that made the closure (only that thread
+  // runs code directly, see closure_code in interpreter-thread.c).
+  uint64_t owner;
   uint64_t n_arg_names;
   char* arg_names[0];
 } closure_t;
 
+// A reference to a free variable of the closure being called.
+typedef struct {
+  char* name;
+  uint64_t index;
+} closure_slot_t;
+
 extern closure_t* allocate_closure(uint64_t n_arg_names);
+extern closure_slot_t* make_closure_slot(char* name, uint64_t index);
+extern int64_t closure_slot_index(closure_t* closure, pair_t* binding);
 
 // extern char* closure_get_debug_name(closure_t* closure);
 
@@ -29,12 +59,37 @@ static inline closure_t* untag_closure_t(tagged_reference_t closure) {
   return (closure_t*) closure.data;
 }
 
+static inline closure_slot_t* untag_closure_slot(tagged_reference_t reference) {
+  require_tag(reference, TAG_CLOSURE_SLOT_T);
+  return (closure_slot_t*) reference.data;
+}
+
+/**
+ * Return the value of a free variable of the closure env belongs to.
+ *
+ * A slot is only valid in the body of the closure that resolved it so
+ * code reaching it from anywhere else (or a slot for a top-level
+ * variable, which has no shared binding) is a fatal error rather than
+ * a wild read.
+ */
+static inline tagged_reference_t closure_slot_get(environment_t* env,
+                                                  closure_slot_t* slot) {
+  closure_t* closure = env->closure;
+  if (closure == NULL || closure->free_bindings == NULL
+      || slot->index >= array_length(closure->analysis->free_names)
+      || closure->free_bindings[slot->index] == NULL) {
+    fatal_error(ERROR_CLOSURE_SLOT_OUT_OF_SCOPE);
+  }
+  return closure->free_bindings[slot->index]->tail;
+}
+
 #endif /* _CLOSURE_H_ */
 
 // ======================================================================
 
 #include "allocate.h"
 #include "closure.h"
+#include "interpreter-thread.h"
 
 /**
  * Allocate the space for a closure accepting at most "N"
@@ -42,6 +97,32 @@ static inline closure_t* untag_closure_t(tagged_reference_t closure) {
  * closure (see evaluator.c).
  */
 closure_t* allocate_closure(uint64_t n_arg_names) {
-  return (closure_t*) malloc_bytes(sizeof(closure_t)
-                                   + n_arg_names * sizeof(char*));
+  closure_t* result = (closure_t*) malloc_bytes(
+      sizeof(closure_t) + n_arg_names * sizeof(char*));
+  result->owner = interpreter_thread_id;
+  return result;
+}
+
+closure_slot_t* make_closure_slot(char* name, uint64_t index) {
+  closure_slot_t* result = malloc_struct(closure_slot_t);
+  result->name = name;
+  result->index = index;
+  return result;
+}
+
+/**
+ * Return the index of binding in the free variable bindings of
+ * closure or -1 if it isn't one of them.
+ */
+int64_t closure_slot_index(closure_t* closure, pair_t* binding) {
+  if (closure->free_bindings == NULL) {
+    return -1;
+  }
+  uint64_t n_free_names = array_length(closure->analysis->free_names);
+  for (uint64_t i = 0; i < n_free_names; i++) {
+    if (closure->free_bindings[i] == binding) {
+      return i;
+    }
+  }
+  return -1;
 }
@@ -0,0 +1,267 @@
+/**
+ * @file continuation.c
+ *
+ * Continuations (call/cc and call/ec) and dynamic-wind.
+ *
+ * With the explicit stack evaluator (see cek-evaluator.c) call/cc
+ * captures the whole continuation. Capturing just freezes the frames
+ * that are on the segmented stack (a frozen frame is copied when a
+ * computation returns into it, one frame at a time) so the cost of
+ * capturing doesn't depend on the depth of the stack and invoking a
+ * continuation doesn't copy the stack either. call/ec makes a cheaper
+ * one-shot escape continuation which only works until the call to
+ * call/ec returns (so nothing has to be frozen).
+ *
+ * The tree walking evaluator keeps its continuation on the C stack so
+ * both call/cc and call/ec are escape continuations that are
+ * implemented with setjmp() and longjmp().
+ *
+ * dynamic-wind maintains a list of winders (a before and an after
+ * thunk). A continuation remembers the winders at the point it was
+ * captured and invoking it calls the after thunks of the winders being
+ * left (innermost first) and then the before thunks of the winders
+ * being entered again (outermost first).
+ */
+
+// ======================================================================
+// This is block is extraced to continuation.h
+// ======================================================================
+
+#ifndef _CONTINUATION_H_
+#define _CONTINUATION_H_
+
+#include <setjmp.h>
+#include <stdint.h>
+
+#include "boolean.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+typedef struct winder_S {
+  tagged_reference_t before;
+  tagged_reference_t after;
+  struct winder_S* next;
+  // The number of winders in the list starting here.
+  uint64_t depth;
+} winder_t;
+
+typedef struct continuation_S {
+  // An escape continuation only works while the call that made it is
+  // active (every continuation of the tree walking evaluator is an
+  // escape continuation).
+  boolean_t is_escape;
+  boolean_t is_active;
+  winder_t* winders;
+
+  // The tree walking evaluator longjmps to target (and drops the stack
+  // environments allocated after frame_stack_mark). While active it is
+  // on the stack of active escape continuations (see
+  // active_escape_continuations).
+  jmp_buf* target;
+  uint64_t frame_stack_mark;
+  struct continuation_S* next_active;
+
+  // The explicit stack evaluator: the newest frame when captured (see
+  // cek-evaluator.c), the run of the machine it was captured in and
+  // the stack it belongs to (every green thread has its own).
+  void* frame;
+  void* base_frame;
+  uint64_t run;
+  void* stack;
+
+  // The interpreter thread it was captured in (see
+  // interpreter-thread.c).
+  uint64_t interpreter_thread;
+} continuation_t;
+
+extern _Thread_local winder_t* current_winders;
+
+extern continuation_t* make_continuation(boolean_t is_escape);
+extern winder_t* make_winder(tagged_reference_t before,
+                             tagged_reference_t after);
+extern void continuation_rewind(winder_t* winders);
+extern tagged_reference_t
+    continuation_argument(primitive_arguments_t* arguments);
+extern _Noreturn void continuation_throw(continuation_t* continuation,
+                                         primitive_arguments_t* arguments);
+
+extern tagged_reference_t
+    primtive_function_call_with_current_continuation(
+        primitive_arguments_t arguments);
+extern tagged_reference_t
+    primtive_function_call_with_escape_continuation(
+        primitive_arguments_t arguments);
+extern tagged_reference_t
+    primtive_function_dynamic_wind(primitive_arguments_t arguments);
+
+static inline continuation_t*
+    untag_continuation(tagged_reference_t reference) {
+  require_tag(reference, TAG_CONTINUATION_T);
+  return (continuation_t*) reference.data;
+}
+
+#endif /* _CONTINUATION_H_ */
+
+// ======================================================================
+
+#include "allocate.h"
+#include "continuation.h"
+#include "environment.h"
+#include "evaluator.h"
+#include "fatal-error.h"
+#include "interpreter-thread.h"
+
+_Thread_local winder_t* current_winders = NULL;
+
+// The value being passed to a continuation by longjmp().
+_Thread_local tagged_reference_t continuation_thrown_value;
+
+// The escape continuations of the tree walking evaluator whose call
+// hasn't returned yet (newest first). A longjmp to one of them skips
+// the C frames of the newer ones so they have to be deactivated at
+// the same time (their jmp_bufs point into dead stack frames).
+static _Thread_local continuation_t* active_escape_continuations = NULL;
+
+continuation_t* make_continuation(boolean_t is_escape) {
+  continuation_t* result = malloc_struct(continuation_t);
+  result->is_escape = is_escape;
+  result->is_active = true;
+  result->winders = current_winders;
+  result->interpreter_thread = interpreter_thread_id;
+  return result;
+}
+
+winder_t* make_winder(tagged_reference_t before, tagged_reference_t after) {
+  winder_t* result = malloc_struct(winder_t);
+  result->before = before;
+  result->after = after;
+  result->next = current_winders;
+  result->depth = current_winders == NULL ? 1 : current_winders->depth + 1;
+  return result;
+}
+
+static void call_thunk(tagged_reference_t thunk) {
+  primitive_arguments_t arguments = {.n_args = 0};
+  apply_procedure(thunk, arguments);
+}
+
+/**
+ * Enter winders (outermost first) until current_winders is winders.
+ */
+static void continuation_wind(winder_t* winders) {
+  if (winders == current_winders) {
+    return;
+  }
+  continuation_wind(winders->next);
+  call_thunk(winders->before);
+  current_winders = winders;
+}
+
+/**
+ * Leave and enter winders until current_winders is winders.
+ */
+void continuation_rewind(winder_t* winders) {
+  winder_t* common = winders;
+  winder_t* current = current_winders;
+  while (common != current) {
+    uint64_t common_depth = common == NULL ? 0 : common->depth;
+    uint64_t current_depth = current == NULL ? 0 : current->depth;
+    if (common_depth >= current_depth) {
+      common = common->next;
+    }
+    if (current_depth >= common_depth) {
+      current = current->next;
+    }
+  }
+  while (current_winders != common) {
+    winder_t* winder = current_winders;
+    // The after thunk runs outside of its own extent.
+    current_winders = winder->next;
+    call_thunk(winder->after);
+  }
+  continuation_wind(winders);
+}
+
+/**
+ * Return the value passed to a continuation (which receives a single
+ * value, or no value at all).
+ */
+tagged_reference_t continuation_argument(primitive_arguments_t* arguments) {
+  if (arguments->n_args > 1) {
+    fatal_error(ERROR_WRONG_NUMBER_OF_ARGS);
+  }
+  return arguments->n_args == 0 ? NIL : arguments->args[0];
+}
+
+/**
+ * Invoke a continuation of the tree walking evaluator.
+ */
+void continuation_throw(continuation_t* continuation,
+                        primitive_arguments_t* arguments) {
+  if (!continuation->is_active || continuation->target == NULL
+      || continuation->interpreter_thread != interpreter_thread_id) {
+    fatal_error(ERROR_CONTINUATION_NOT_ACTIVE);
+  }
+  continuation_thrown_value = continuation_argument(arguments);
+  while (active_escape_continuations != continuation) {
+    active_escape_continuations->is_active = false;
+    active_escape_continuations = active_escape_continuations->next_active;
+  }
+  continuation_rewind(continuation->winders);
+  environment_frame_stack_reset(continuation->frame_stack_mark);
+  longjmp(*continuation->target, 1);
+}
+
+/**
+ * Call arguments.args[0] with an escape continuation (only used by
+ * the tree walking evaluator, see cek-evaluator.c for the explicit
+ * stack evaluator).
+ */
+static tagged_reference_t call_with_escape(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  jmp_buf target;
+  continuation_t* continuation = make_continuation(true);
+  continuation->target = &target;
+  continuation->frame_stack_mark = environment_frame_stack_mark();
+  continuation->next_active = active_escape_continuations;
+  active_escape_continuations = continuation;
+
+  volatile tagged_reference_t result;
+  if (setjmp(target) == 0) {
+    primitive_arguments_t proc_arguments = {.n_args = 1};
+    proc_arguments.args[0]
+        = tagged_reference(TAG_CONTINUATION_T, continuation);
+    result = apply_procedure(arguments.args[0], proc_arguments);
+  } else {
+    result = continuation_thrown_value;
+  }
+  continuation->is_active = false;
+  active_escape_continuations = continuation->next_active;
+  return result;
+}
+
+tagged_reference_t primtive_function_call_with_current_continuation(
+    primitive_arguments_t arguments) {
+  return call_with_escape(arguments);
+}
+
+tagged_reference_t primtive_function_call_with_escape_continuation(
+    primitive_arguments_t arguments) {
+  return call_with_escape(arguments);
+}
+
+/**
+ * Example (dynamic-wind before thunk after)
+ */
+tagged_reference_t
+    primtive_function_dynamic_wind(primitive_arguments_t arguments) {
+  require_n_args(arguments, 3, 3);
+  call_thunk(arguments.args[0]);
+  current_winders = make_winder(arguments.args[0], arguments.args[2]);
+  primitive_arguments_t thunk_arguments = {.n_args = 0};
+  tagged_reference_t result
+      = apply_procedure(arguments.args[1], thunk_arguments);
+  current_winders = current_winders->next;
+  call_thunk(arguments.args[2]);
+  return result;
+}
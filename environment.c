@@ -13,15 +13,60 @@
 #include "byte-array.h"
 #include "pair.h"
 #include "printer.h"
+#include "runtime-stats.h"
+
+struct closure_S;
 
 typedef struct environment_S {
   // This is a standard way to handle lexically scoped variables.
   struct environment_S* parent;
 
+  // The nearest "top-level" environment (made with make_environment)
+  // in the parent chain. For a top-level environment this is the
+  // environment itself. Call environments and the environments of
+  // closures are never top-level environments.
+  struct environment_S* toplevel;
+
   // This allows environments to be freed "early" during expression
   // evaluation without waiting for the garbage collector.
   boolean_t is_captured;
 
+  // True when this environment lives on the frame stack (see
+  // make_stack_environment) instead of the heap.
+  boolean_t is_stack_allocated;
+
+  // True for a stack environment whose bindings can't be shared with a
+  // closure (see lambda-analysis.c) so they can live on the frame
+  // stack too.
+  boolean_t has_stack_bindings;
+
+  // The bytes a stack environment and the bindings allocated right
+  // after it take up on the frame stack.
+  uint64_t stack_bytes;
+
+  // True for the environment of a let (or similar) evaluated in tail
+  // position. Its parent is released right after it.
+  boolean_t releases_parent;
+
+  // True for a global environment. Any builtin primitive (see
+  // builtin.c) that isn't found in the buckets is added to them the
+  // first time it is looked up.
+  boolean_t has_builtins;
+
+  // True once the environment is shared with interpreter threads (see
+  // interpreter-thread.c). None of its bindings can change after that.
+  boolean_t is_frozen;
+
+  // The top-level environment that the main thread's definitions go to
+  // once this (top-level) environment is frozen.
+  struct environment_S* successor;
+
+  // The closure whose call this environment belongs to (environments
+  // of lets, etc. inherit it from their parent) or NULL outside of any
+  // call. This is how TAG_CLOSURE_SLOT_T references find the bindings
+  // of the closure's free variables (see closure.c).
+  struct closure_S* closure;
+
   // The global environment uses more buckets than a child environment
   int n_buckets;
 
@@ -29,6 +74,20 @@ typedef struct environment_S {
 } environment_t;
 
 extern environment_t* make_environment(environment_t* parent);
+extern environment_t* make_frame_environment(environment_t* parent);
+extern environment_t* make_stack_environment(environment_t* parent);
+extern void environment_release(environment_t* env);
+extern void environment_freeze(environment_t* env);
+extern uint64_t environment_frame_stack_mark(void);
+extern void environment_frame_stack_reset(uint64_t mark);
+extern pair_t* environment_add_binding(environment_t* env, char* var_name,
+                                       tagged_reference_t value);
+extern pair_t* environment_find_local_binding(environment_t* env,
+                                              char* var_name);
+extern pair_t* environment_find_binding(environment_t* env, char* var_name);
+extern pair_t* environment_rebind(environment_t* env, char* var_name,
+                                  tagged_reference_t value);
+extern void environment_share_binding(environment_t* env, pair_t* binding);
 extern optional_t environment_get(environment_t* env, char* var_name);
 extern void environment_set(environment_t* env, char* var_name,
                             tagged_reference_t value);
@@ -37,7 +96,15 @@ extern void environment_define(environment_t* env, char* var_name,
 extern byte_array_t* print_environment(environment_t* env);
 
 static inline void environment_capture(environment_t* env) {
-  env->is_captured = true;
+  if (env->is_stack_allocated) {
+    fatal_error(ERROR_CAPTURED_STACK_ENVIRONMENT);
+  }
+  // A frozen environment (which is always captured) is shared by
+  // several threads so don't write to it.
+  if (!env->is_captured) {
+    env->is_captured = true;
+    runtime_stats_count(captured_environments);
+  }
 }
 
 #endif /* _ENVIRONMENT_H_ */
@@ -46,11 +113,15 @@ static inline void environment_capture(environment_t* env) {
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "allocate.h"
 #include "boolean.h"
+#include "builtin.h"
 #include "closure.h"
 #include "environment.h"
+#include "inline-cache.h"
+#include "interpreter-thread.h"
 #include "optional.h"
 #include "pair.h"
 #include "string-util.h"
@@ -61,9 +132,9 @@ static inline void environment_capture(environment_t* env) {
 #define NESTED_ENVIRONMENT_BUCKETS 1
 
 /**
- * Make an empty environment with the given parent. When parent is
- * NULL, the environment is optimized for lookup performance over
- * space.
+ * Make an empty top-level environment with the given parent. When
+ * parent is NULL, the environment is optimized for lookup performance
+ * over space.
  */
 environment_t* make_environment(environment_t* parent) {
   // The global environment gets more buckets since it will have way
@@ -74,36 +145,222 @@ environment_t* make_environment(environment_t* parent) {
   environment_t* result = (environment_t*) malloc_bytes(
       sizeof(environment_t) + n_buckets * sizeof(tagged_reference_t));
   result->parent = parent;
+  result->toplevel = result;
   result->n_buckets = n_buckets;
+  runtime_stats_count(heap_environments);
 
   return result;
 }
 
-pair_t* environment_find_binding(environment_t* env, char* var_name) {
-  if (env == NULL) {
-    return NULL;
+/**
+ * Make an empty (heap allocated) environment for a call or a closure.
+ */
+environment_t* make_frame_environment(environment_t* parent) {
+  environment_t* result = (environment_t*) malloc_bytes(
+      sizeof(environment_t)
+      + NESTED_ENVIRONMENT_BUCKETS * sizeof(tagged_reference_t));
+  result->parent = parent;
+  result->toplevel = parent->toplevel;
+  result->closure = parent->closure;
+  result->n_buckets = NESTED_ENVIRONMENT_BUCKETS;
+  runtime_stats_count(heap_environments);
+  return result;
+}
+
+// Environments for calls that can't be captured by a closure (see
+// lambda-analysis.c) are allocated from this stack instead of the
+// heap. Since a call's environment is always released before the
+// environment of its caller, a simple bump pointer is all we need.
+// The bindings of the topmost environment (its parameters and the
+// cells of its bucket) are allocated right after it, so a call whose
+// environment lives here doesn't allocate anything on the heap. If
+// the stack overflows, we just go back to allocating on the heap.
+
+#define FRAME_STACK_SIZE 65536
+#define FRAME_SIZE                                                             \
+  (sizeof(environment_t)                                                       \
+   + NESTED_ENVIRONMENT_BUCKETS * sizeof(tagged_reference_t))
+#define FRAME_STACK_BYTES (FRAME_STACK_SIZE * FRAME_SIZE)
+
+// Every interpreter thread has its own frame stack. frame_stack_top
+// is the number of bytes in use.
+_Thread_local uint8_t* frame_stack = NULL;
+_Thread_local uint64_t frame_stack_top = 0;
+
+/**
+ * Make an empty environment with the given (non NULL) parent that
+ * must be released with environment_release() before its parent
+ * environment is released.
+ */
+environment_t* make_stack_environment(environment_t* parent) {
+  if (frame_stack == NULL) {
+    frame_stack = malloc_bytes(FRAME_STACK_BYTES);
+  }
+  if (frame_stack_top + FRAME_SIZE > FRAME_STACK_BYTES) {
+    return make_frame_environment(parent);
   }
+  environment_t* result = (environment_t*) &frame_stack[frame_stack_top];
+  frame_stack_top += FRAME_SIZE;
+  memset(result, 0, FRAME_SIZE);
+  result->parent = parent;
+  result->toplevel = parent->toplevel;
+  result->closure = parent->closure;
+  result->is_stack_allocated = true;
+  result->stack_bytes = FRAME_SIZE;
+  result->n_buckets = NESTED_ENVIRONMENT_BUCKETS;
+  runtime_stats_count(stack_environments);
+  return result;
+}
+
+/**
+ * Return the current height of the frame stack (in bytes).
+ */
+uint64_t environment_frame_stack_mark(void) { return frame_stack_top; }
+
+/**
+ * Drop every stack environment allocated after mark was taken (used
+ * when a continuation escapes past the calls that allocated them).
+ */
+void environment_frame_stack_reset(uint64_t mark) { frame_stack_top = mark; }
 
-  tagged_reference_t lst = NIL;
-  if (env->n_buckets > 1) {
-    uint64_t hash_code = string_hash(var_name);
-    uint64_t bucket_number = hash_code % env->n_buckets;
-    lst = env->buckets[bucket_number];
+/**
+ * Release an environment that is no longer needed (and hasn't been
+ * captured).
+ */
+void environment_release(environment_t* env) {
+  environment_t* parent = env->releases_parent ? env->parent : NULL;
+  if (!env->is_stack_allocated) {
+    runtime_stats_count(freed_environments);
+    free_bytes(env);
   } else {
-    lst = env->buckets[0];
+    runtime_stats_count(popped_environments);
+    if ((uint8_t*) env + env->stack_bytes != &frame_stack[frame_stack_top]) {
+      fatal_error(ERROR_FRAME_STACK_CORRUPTED);
+    }
+    frame_stack_top -= env->stack_bytes;
+  }
+  if (parent != NULL && !parent->is_captured) {
+    environment_release(parent);
+  }
+}
+
+/**
+ * Freeze the top-level environment env and every environment above it
+ * so that interpreter threads can share them (see
+ * interpreter-thread.c). Any builtin that hasn't been looked up yet is
+ * added first since nothing can be added later.
+ */
+void environment_freeze(environment_t* env) {
+  for (environment_t* e = env; e != NULL && !e->is_frozen; e = e->parent) {
+    if (e->has_builtins) {
+      for (uint64_t i = 0; i < (UINT64_C(1) << builtin_table_bits); i++) {
+        if (builtin_table[i].primitive != NULL) {
+          environment_find_local_binding(e, builtin_table[i].name);
+        }
+      }
+    }
+    e->is_captured = true;
+    e->is_frozen = true;
+  }
+  if (env->successor == NULL) {
+    env->successor = make_environment(env);
+    environment_capture(env->successor);
   }
+}
 
-  if (lst.tag == TAG_NULL) {
-    return environment_find_binding(env->parent, var_name);
+/**
+ * Return the bucket of env that var_name belongs in (we avoid hashing
+ * when there is only one bucket).
+ */
+static inline uint64_t environment_bucket_number(environment_t* env,
+                                                 char* var_name) {
+  if (env->n_buckets == 1) {
+    return 0;
   }
+  return string_hash(var_name) % env->n_buckets;
+}
 
-  pair_t* binding = pair_assoc_list_find_binding(untag_pair(lst), var_name);
+/**
+ * Allocate the binding pair and bucket cell of a new binding of the
+ * topmost stack environment env on the frame stack (see
+ * make_stack_environment) or return NULL if env's bindings must be on
+ * the heap, env isn't the topmost environment or there is no room.
+ */
+static pair_t* environment_stack_allocate_binding(environment_t* env) {
+  uint64_t n_bytes = 2 * sizeof(pair_t);
+  if (!env->has_stack_bindings
+      || (uint8_t*) env + env->stack_bytes != &frame_stack[frame_stack_top]
+      || frame_stack_top + n_bytes > FRAME_STACK_BYTES) {
+    return NULL;
+  }
+  pair_t* result = (pair_t*) &frame_stack[frame_stack_top];
+  frame_stack_top += n_bytes;
+  env->stack_bytes += n_bytes;
+  return result;
+}
 
-  if (binding != NULL) {
+/**
+ * Add a new binding to env (without checking for an existing one).
+ */
+pair_t* environment_add_binding(environment_t* env, char* var_name,
+                                tagged_reference_t value) {
+  uint64_t bucket_number = environment_bucket_number(env, var_name);
+  pair_t* pairs = environment_stack_allocate_binding(env);
+  if (pairs != NULL) {
+    pair_t* binding = &pairs[0];
+    pair_t* cell = &pairs[1];
+    binding->head = tagged_reference(TAG_SCHEME_SYMBOL, var_name);
+    binding->tail = value;
+    cell->head = tagged_reference(TAG_PAIR_T, binding);
+    cell->tail = env->buckets[bucket_number];
+    env->buckets[bucket_number] = tagged_reference(TAG_PAIR_T, cell);
     return binding;
   }
+  tagged_reference_t new_binding
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, var_name), value);
+  env->buckets[bucket_number]
+      = cons(new_binding, env->buckets[bucket_number]);
+  return untag_pair(new_binding);
+}
+
+/**
+ * Find the binding for var_name in env itself (ignoring any parent
+ * environments) or return NULL.
+ */
+pair_t* environment_find_local_binding(environment_t* env, char* var_name) {
+  tagged_reference_t lst
+      = env->buckets[environment_bucket_number(env, var_name)];
 
-  return environment_find_binding(env->parent, var_name);
+  pair_t* binding = NULL;
+  if (lst.tag != TAG_NULL) {
+    binding = pair_assoc_list_find_binding(untag_pair(lst), var_name);
+  }
+  if (binding == NULL && env->has_builtins && !env->is_frozen) {
+    const builtin_t* builtin = builtin_lookup(var_name);
+    if (builtin != NULL && builtin->primitive != NULL) {
+      binding = environment_add_binding(
+          env, builtin->name,
+          tagged_reference(TAG_PRIMITIVE, builtin->primitive));
+    }
+  }
+  return binding;
+}
+
+/**
+ * Find the binding for var_name in env or the closest of its parents
+ * that has one (or return NULL).
+ */
+pair_t* environment_find_binding(environment_t* env, char* var_name) {
+  for (uint64_t depth = 0; env != NULL; depth++) {
+    pair_t* binding = environment_find_local_binding(env, var_name);
+    if (binding != NULL) {
+      runtime_stats_count_lookup(depth);
+      return binding;
+    }
+    env = env->parent;
+  }
+  runtime_stats_count(failed_lookups);
+  return NULL;
 }
 
 /**
@@ -131,11 +388,17 @@ void environment_set(environment_t* env, char* var_name,
     fatal_error(ERROR_NULL_ENVIRONMENT);
   }
 
-  pair_t* binding = environment_find_binding(env, var_name);
-  if (binding == NULL) {
-    fatal_error(ERROR_VARIABLE_NOT_FOUND);
+  for (; env != NULL; env = env->parent) {
+    pair_t* binding = environment_find_local_binding(env, var_name);
+    if (binding != NULL) {
+      if (env->is_frozen) {
+        fatal_error(ERROR_ENVIRONMENT_FROZEN);
+      }
+      binding->tail = value;
+      return;
+    }
   }
-  binding->tail = value;
+  fatal_error(ERROR_VARIABLE_NOT_FOUND);
 }
 
 /**
@@ -148,41 +411,70 @@ void environment_define(environment_t* env, char* var_name,
     fatal_error(ERROR_NULL_ENVIRONMENT);
   }
 
-  /*
-  // Total hack to put a debug name on closures defined at the
-  // top-level. This is completely optional behavior as the debug name
-  // is not directly accessible.
-  if (env->parent == NULL) {
-    if (value.tag == TAG_CLOSURE_T) {
-      closure_t* closure = untag_closure_t(value);
-      if (closure->debug_name == NULL) {
-        closure->debug_name = var_name;
-      }
+  // Once a top-level environment is frozen, the main thread goes on
+  // defining things in its successor (an interpreter thread never
+  // defines top-level variables).
+  while (env->is_frozen) {
+    if (env->successor == NULL || interpreter_thread_id != 0) {
+      fatal_error(ERROR_ENVIRONMENT_FROZEN);
     }
+    env = env->successor;
   }
-  */
 
-  pair_t* binding = environment_find_binding(env, var_name);
+  // Put a debug name on closures defined at the top-level (this is
+  // how the profiler names them, see profile.c).
+  if (env->toplevel == env && value.tag == TAG_CLOSURE_T) {
+    closure_t* closure = untag_closure_t(value);
+    if (closure->debug_name == NULL) {
+      closure->debug_name = var_name;
+    }
+  }
+
+  // Only a binding in env itself is replaced, a binding in a parent
+  // environment is shadowed instead.
+  pair_t* binding = environment_find_local_binding(env, var_name);
   if (binding != NULL) {
     binding->tail = value;
-    byte_array_t* env_as_string = print_environment(env);
   } else {
-    uint64_t hash_code = string_hash(var_name);
-    uint64_t bucket_number = hash_code % env->n_buckets;
-    tagged_reference_t new_binding
-        = cons(tagged_reference(TAG_SCHEME_SYMBOL, var_name), value);
-    tagged_reference_t new_binding_list
-        = cons(new_binding, env->buckets[bucket_number]);
-    env->buckets[bucket_number] = new_binding_list;
-
-    // We should immediately find what we just defined...
-    pair_t* b = environment_find_binding(env, var_name);
-    if (b == NULL) {
-      fatal_error(ERROR_UKNOWN);
+    environment_add_binding(env, var_name, value);
+    if (env->toplevel == env) {
+      // A new top-level binding may shadow a cached one.
+      __atomic_add_fetch(&global_binding_epoch, 1, __ATOMIC_RELAXED);
     }
   }
 }
 
+/**
+ * Replace the binding of var_name in env itself with a new binding
+ * holding value. Closures sharing the old binding (see
+ * environment_share_binding) keep seeing its old value.
+ */
+pair_t* environment_rebind(environment_t* env, char* var_name,
+                           tagged_reference_t value) {
+  tagged_reference_t lst
+      = env->buckets[environment_bucket_number(env, var_name)];
+  for (; lst.tag == TAG_PAIR_T; lst = untag_pair(lst)->tail) {
+    pair_t* cell = untag_pair(lst);
+    if (string_equal(untag_reader_symbol(untag_pair(cell->head)->head),
+                     var_name)) {
+      cell->head = cons(tagged_reference(TAG_SCHEME_SYMBOL, var_name), value);
+      return untag_pair(cell->head);
+    }
+  }
+  fatal_error(ERROR_VARIABLE_NOT_FOUND);
+}
+
+/**
+ * Add an existing binding (from some other environment) to env so
+ * that both environments see any changes to its value.
+ */
+void environment_share_binding(environment_t* env, pair_t* binding) {
+  uint64_t bucket_number
+      = environment_bucket_number(env, untag_reader_symbol(binding->head));
+  env->buckets[bucket_number] = cons(tagged_reference(TAG_PAIR_T, binding),
+                                     env->buckets[bucket_number]);
+}
+
 byte_array_t* print_environment(environment_t* env) {
   byte_array_t* output = make_byte_array(1024);
 
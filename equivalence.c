@@ -0,0 +1,114 @@
+/**
+ * @file equivalence.c
+ *
+ * The three standard scheme equivalence predicates (eq?, eqv? and
+ * equal?) plus matching hash functions so that hash tables can be
+ * keyed by any of them.
+ */
+
+// ======================================================================
+// This is block is extraced to equivalence.h
+// ======================================================================
+
+#ifndef _EQUIVALENCE_H_
+#define _EQUIVALENCE_H_
+
+#include "boolean.h"
+#include "tagged-reference.h"
+
+extern boolean_t is_eq(tagged_reference_t a, tagged_reference_t b);
+extern boolean_t is_eqv(tagged_reference_t a, tagged_reference_t b);
+extern boolean_t is_equal(tagged_reference_t a, tagged_reference_t b);
+
+extern uint64_t hash_eq(tagged_reference_t reference);
+extern uint64_t hash_equal(tagged_reference_t reference);
+
+#endif /* _EQUIVALENCE_H_ */
+
+// ======================================================================
+
+#include "equivalence.h"
+#include "pair.h"
+#include "string-util.h"
+
+// When hashing lists for equal?, we only look at this many elements
+// so that very long (or circular) lists don't make hashing expensive.
+#define HASH_EQUAL_MAX_ELEMENTS 16
+
+/**
+ * Return true if a and b are the same object.
+ *
+ * The reader interns symbols (so the same name is usually the same
+ * pointer) but symbols made from C strings aren't, so two symbols with
+ * the same name are still considered eq? by comparing their names.
+ */
+boolean_t is_eq(tagged_reference_t a, tagged_reference_t b) {
+  if (a.tag != b.tag) {
+    return false;
+  }
+  if (a.data == b.data) {
+    return true;
+  }
+  if (a.tag == TAG_SCHEME_SYMBOL) {
+    return string_equal((char*) a.data, (char*) b.data);
+  }
+  return false;
+}
+
+/**
+ * Return true if a and b are eqv?. Since all of our numbers and
+ * characters are immediate values, this is currently the same as eq?.
+ */
+boolean_t is_eqv(tagged_reference_t a, tagged_reference_t b) {
+  return is_eq(a, b);
+}
+
+/**
+ * Return true if a and b are structurally equal, i.e., pairs with
+ * equal? heads and tails or strings with the same contents.
+ */
+boolean_t is_equal(tagged_reference_t a, tagged_reference_t b) {
+  while (a.tag == TAG_PAIR_T && b.tag == TAG_PAIR_T) {
+    if (a.data == b.data) {
+      return true;
+    }
+    if (!is_equal(untag_pair(a)->head, untag_pair(b)->head)) {
+      return false;
+    }
+    a = untag_pair(a)->tail;
+    b = untag_pair(b)->tail;
+  }
+  if (a.tag == TAG_STRING && b.tag == TAG_STRING) {
+    return immutable_string_equal((char*) a.data, (char*) b.data);
+  }
+  return is_eqv(a, b);
+}
+
+/**
+ * Return a hash code consistent with is_eq() (and is_eqv()).
+ */
+uint64_t hash_eq(tagged_reference_t reference) {
+  if (reference.tag == TAG_SCHEME_SYMBOL) {
+    return string_hash((char*) reference.data);
+  }
+  return fasthash64(&reference, sizeof(reference), 0);
+}
+
+/**
+ * Return a hash code consistent with is_equal().
+ */
+uint64_t hash_equal(tagged_reference_t reference) {
+  uint64_t result = 0;
+  for (int i = 0; reference.tag == TAG_PAIR_T && i < HASH_EQUAL_MAX_ELEMENTS;
+       i++) {
+    result = (result * 31) + hash_equal(untag_pair(reference)->head);
+    reference = untag_pair(reference)->tail;
+  }
+  if (reference.tag == TAG_STRING) {
+    return result ^ immutable_string_hash((char*) reference.data);
+  }
+  if (reference.tag == TAG_PAIR_T) {
+    return result;
+  }
+  return result ^ hash_eq(reference);
+}
@@ -16,11 +16,53 @@
 #define _EVALUATOR_T_H_
 
 #include "boolean.h"
+#include "closure.h"
 #include "environment.h"
+#include "lambda-analysis.h"
+#include "pair.h"
+#include "primitive.h"
 #include "tagged-reference.h"
 
+/**
+ * The state of a named let that is evaluated as a loop. The name of
+ * the loop is bound to a TAG_NAMED_LET_LOOP_T reference to this
+ * struct. Calling it (which only happens in tail position) just
+ * remembers the arguments and returns the loop itself so that
+ * eval_named_let knows to go around again.
+ */
+typedef struct {
+  primitive_arguments_t arguments;
+} named_let_loop_t;
+
 extern tagged_reference_t eval(environment_t* env, tagged_reference_t expr,
                                boolean_t in_tail_position);
+extern tagged_reference_t apply_procedure(tagged_reference_t fn,
+                                          primitive_arguments_t arguments);
+
+// These are shared with the explicit stack evaluator (cek-evaluator.c).
+extern tagged_reference_t eval_subexpression(environment_t* env,
+                                             pair_t* cell);
+extern environment_t* make_scope_environment(environment_t* env,
+                                             lambda_analysis_t* analysis,
+                                             boolean_t in_tail_position);
+extern void bind_defined_names(environment_t* env,
+                               lambda_analysis_t* analysis);
+extern environment_t* bind_closure_arguments(closure_t* closure,
+                                             primitive_arguments_t* arguments);
+extern void close_over_free_variables(closure_t* closure,
+                                      environment_t* env);
+
+/**
+ * When an expression is evaluated in tail position, the environment
+ * it is evaluated in is no longer needed afterwards (unless a closure
+ * has captured it).
+ */
+static inline void release_if_tail_position(environment_t* env,
+                                            boolean_t in_tail_position) {
+  if (in_tail_position && !env->is_captured) {
+    environment_release(env);
+  }
+}
 
 #endif /* _EVALUATOR_T_H_ */
 
@@ -32,27 +74,28 @@ extern tagged_reference_t eval(environment_t* env, tagged_reference_t expr,
 #include <string.h>
 
 #include "allocate.h"
+#include "builtin.h"
+#include "call-site.h"
+#include "cek-evaluator.h"
 #include "closure.h"
+#include "continuation.h"
 #include "evaluator.h"
 #include "fatal-error.h"
+#include "inline-cache.h"
+#include "interpreter-thread.h"
+#include "jit.h"
+#include "lambda-analysis.h"
 #include "optional.h"
 #include "pair.h"
 #include "primitive.h"
+#include "profile.h"
+#include "runtime-stats.h"
 #include "scheme-symbol.h"
 #include "string-util.h"
+#include "syntax-rules.h"
 
 #define TAIL_CALL return
 
-// See the symbol-hash command line tool in this directory if you need
-// to generate more. Example make symbol-hash && ./symbol-hash 'if'
-// 'set!' 'quote' 'lambda'.
-
-#define HASHCODE_DEFINE UINT64_C(1242841461589453162)
-#define HASHCODE_IF UINT64_C(12687957717205024595)
-#define HASHCODE_LAMBDA UINT64_C(11364329973434366565)
-#define HASHCODE_QUOTE UINT64_C(10597478766694597373)
-#define HASHCODE_SET_BANG UINT64_C(8292903574644452355)
-
 // These must have the same signature as eval() to have a chance of
 // doing tail recursion.
 
@@ -65,6 +108,26 @@ tagged_reference_t eval_application(environment_t* env, tagged_reference_t expr,
                                     boolean_t in_tail_position);
 tagged_reference_t eval_lambda(environment_t* env, tagged_reference_t expr,
                                boolean_t in_tail_position);
+tagged_reference_t eval_sequence(environment_t* env, tagged_reference_t body,
+                                 boolean_t in_tail_position);
+tagged_reference_t eval_and(environment_t* env, tagged_reference_t expr,
+                            boolean_t in_tail_position);
+tagged_reference_t eval_or(environment_t* env, tagged_reference_t expr,
+                           boolean_t in_tail_position);
+tagged_reference_t eval_when(environment_t* env, tagged_reference_t expr,
+                             boolean_t is_unless, boolean_t in_tail_position);
+tagged_reference_t eval_cond(environment_t* env, tagged_reference_t expr,
+                             boolean_t in_tail_position);
+tagged_reference_t eval_let(environment_t* env, tagged_reference_t expr,
+                            boolean_t in_tail_position);
+tagged_reference_t eval_let_star(environment_t* env, tagged_reference_t expr,
+                                 boolean_t in_tail_position);
+tagged_reference_t eval_letrec(environment_t* env, tagged_reference_t expr,
+                               boolean_t in_tail_position);
+tagged_reference_t eval_named_let(environment_t* env, tagged_reference_t expr,
+                                  boolean_t in_tail_position);
+tagged_reference_t eval_do(environment_t* env, tagged_reference_t expr,
+                           boolean_t in_tail_position);
 
 /**
  * This is the entry point to the evaluator. Dvaluate the given
@@ -79,12 +142,12 @@ tagged_reference_t eval(environment_t* env, tagged_reference_t expr,
   // Handle self-evaluating values and variable lookups
   switch (expr.tag) {
   case TAG_NULL:
+  case TAG_BOOLEAN_T:
   case TAG_STRING:
   case TAG_UINT64_T:
+  case TAG_UNICODE_CODE_POINT:
   case TAG_ERROR_T:
-    if (in_tail_position && !env->is_captured) {
-      free_bytes(env);
-    }
+    release_if_tail_position(env, in_tail_position);
     return expr;
 
   case TAG_SCHEME_SYMBOL:
@@ -93,61 +156,110 @@ tagged_reference_t eval(environment_t* env, tagged_reference_t expr,
       if (!optional_is_present(result)) {
         fatal_error(ERROR_VARIABLE_NOT_FOUND);
       }
-      if (in_tail_position && !env->is_captured) {
-        free_bytes(env);
+      release_if_tail_position(env, in_tail_position);
+      return optional_value(result);
+    }
+
+  case TAG_GLOBAL_REFERENCE_T:
+    if (1) {
+      optional_t result
+          = global_reference_get(env, untag_global_reference(expr));
+      if (!optional_is_present(result)) {
+        fatal_error(ERROR_VARIABLE_NOT_FOUND);
       }
+      release_if_tail_position(env, in_tail_position);
       return optional_value(result);
     }
+
+  case TAG_CLOSURE_SLOT_T:
+    if (1) {
+      tagged_reference_t value
+          = closure_slot_get(env, untag_closure_slot(expr));
+      release_if_tail_position(env, in_tail_position);
+      return value;
+    }
   }
 
   pair_t* lst = untag_pair(expr);
 
   if (pair_list_length(lst) == 0) {
-    if (in_tail_position && !env->is_captured) {
-      free_bytes(env);
-    }
+    release_if_tail_position(env, in_tail_position);
     return (tagged_reference_t){ERROR_CANT_EVAL_EMPTY_EXPRESSION, TAG_ERROR_T};
   }
 
   tagged_reference_t first = pair_list_get(lst, 0);
   if (first.tag == TAG_SCHEME_SYMBOL) {
-    char* symbol_name = untag_reader_symbol(first);
-    // We probably don't need all 64 bits and with so few special
-    // forms, just doing a chain of sring_equal() calls may be faster
-    // or nearly as fast though there is probably a break even point
-    // where this is much faster...
-    uint64_t hashcode = string_hash(symbol_name);
-    switch (hashcode) {
-    case HASHCODE_IF:
-      if (!string_equal(symbol_name, "if")) {
-        break;
-      }
-      TAIL_CALL eval_if_expression(env, expr, in_tail_position);
+    // Special forms are found in the same perfect hash table as the
+    // builtin primitives (see builtin.c) with a single probe.
+    special_form_t form = special_form_of(untag_reader_symbol(first));
+    runtime_stats_count(special_forms[form]);
+    switch (form) {
+    case SPECIAL_FORM_NONE:
       break;
 
-    case HASHCODE_SET_BANG:
-      if (!string_equal(symbol_name, "set!")) {
-        break;
-      }
+    case SPECIAL_FORM_IF:
+      TAIL_CALL eval_if_expression(env, expr, in_tail_position);
+
+    case SPECIAL_FORM_SET_BANG:
       TAIL_CALL eval_assignment(env, expr, in_tail_position);
 
-    case HASHCODE_QUOTE:
-      if (in_tail_position && !env->is_captured) {
-        free_bytes(env);
-      }
+    case SPECIAL_FORM_QUOTE:
+      release_if_tail_position(env, in_tail_position);
       return pair_list_get(lst, 1);
 
-    case HASHCODE_LAMBDA:
+    case SPECIAL_FORM_LAMBDA:
       TAIL_CALL eval_lambda(env, expr, in_tail_position);
 
-    case HASHCODE_DEFINE:
+    case SPECIAL_FORM_BEGIN:
+      if (lst->tail.tag == TAG_NULL) {
+        release_if_tail_position(env, in_tail_position);
+        return NIL;
+      }
+      TAIL_CALL eval_sequence(env, lst->tail, in_tail_position);
+
+    case SPECIAL_FORM_AND:
+      TAIL_CALL eval_and(env, expr, in_tail_position);
+
+    case SPECIAL_FORM_OR:
+      TAIL_CALL eval_or(env, expr, in_tail_position);
+
+    case SPECIAL_FORM_WHEN:
+      TAIL_CALL eval_when(env, expr, false, in_tail_position);
+
+    case SPECIAL_FORM_UNLESS:
+      TAIL_CALL eval_when(env, expr, true, in_tail_position);
+
+    case SPECIAL_FORM_COND:
+      TAIL_CALL eval_cond(env, expr, in_tail_position);
+
+    case SPECIAL_FORM_LET:
+      TAIL_CALL eval_let(env, expr, in_tail_position);
+
+    case SPECIAL_FORM_LET_STAR:
+      TAIL_CALL eval_let_star(env, expr, in_tail_position);
+
+    case SPECIAL_FORM_LETREC:
+      TAIL_CALL eval_letrec(env, expr, in_tail_position);
+
+    case SPECIAL_FORM_DO:
+      TAIL_CALL eval_do(env, expr, in_tail_position);
+
+    case SPECIAL_FORM_DEFINE:
       if (1) {
         tagged_reference_t name = pair_list_get(lst, 1);
         tagged_reference_t value = eval(env, pair_list_get(lst, 2), false);
         environment_define(env, untag_reader_symbol(name), value);
-        if (in_tail_position && !env->is_captured) {
-          free_bytes(env);
-        }
+        release_if_tail_position(env, in_tail_position);
+        return NIL;
+      }
+
+    case SPECIAL_FORM_DEFINE_SYNTAX:
+      if (1) {
+        tagged_reference_t name = pair_list_get(lst, 1);
+        syntax_rules_t* macro = make_syntax_rules(pair_list_get(lst, 2));
+        environment_define(env, untag_reader_symbol(name),
+                           tagged_reference(TAG_SYNTAX_RULES_T, macro));
+        release_if_tail_position(env, in_tail_position);
         return NIL;
       }
     }
@@ -160,13 +272,13 @@ tagged_reference_t eval_if_expression(environment_t* env,
                                       tagged_reference_t expr,
                                       boolean_t in_tail_position) {
   pair_t* lst = untag_pair(expr);
-  tagged_reference_t test_expr = pair_list_get(lst, 1);
   tagged_reference_t consequent_expr = pair_list_get(lst, 2);
   tagged_reference_t alternative_expr = NIL;
   if (pair_list_length(lst) >= 3) {
     alternative_expr = pair_list_get(lst, 3);
   }
-  tagged_reference_t evaluated_expr = eval(env, test_expr, false);
+  tagged_reference_t evaluated_expr
+      = eval_subexpression(env, untag_pair(lst->tail));
   if (is_false(evaluated_expr)) {
     TAIL_CALL eval(env, alternative_expr, in_tail_position);
   } else {
@@ -179,61 +291,557 @@ tagged_reference_t eval_assignment(environment_t* env, tagged_reference_t expr,
                                    boolean_t in_tail_position) {
   pair_t* lst = untag_pair(expr);
 
-  // TODO(jawilson): do the assignment!
-  if (in_tail_position && !env->is_captured) {
-    free_bytes(env);
-  }
   tagged_reference_t var_symbol = pair_list_get(lst, 1);
   tagged_reference_t expr_value = pair_list_get(lst, 2);
   tagged_reference_t value = eval(env, expr_value, false);
   environment_set(env, untag_scheme_symbol(var_symbol), value);
+  release_if_tail_position(env, in_tail_position);
+  return NIL;
+}
+
+tagged_reference_t eval_and(environment_t* env, tagged_reference_t expr,
+                            boolean_t in_tail_position) {
+  tagged_reference_t cell = untag_pair(expr)->tail;
+  if (cell.tag == TAG_NULL) {
+    release_if_tail_position(env, in_tail_position);
+    return tag_boolean(true);
+  }
+  while (untag_pair(cell)->tail.tag != TAG_NULL) {
+    tagged_reference_t value = eval_subexpression(env, untag_pair(cell));
+    if (is_false(value)) {
+      release_if_tail_position(env, in_tail_position);
+      return value;
+    }
+    cell = untag_pair(cell)->tail;
+  }
+  TAIL_CALL eval(env, untag_pair(cell)->head, in_tail_position);
+}
+
+tagged_reference_t eval_or(environment_t* env, tagged_reference_t expr,
+                           boolean_t in_tail_position) {
+  tagged_reference_t cell = untag_pair(expr)->tail;
+  if (cell.tag == TAG_NULL) {
+    release_if_tail_position(env, in_tail_position);
+    return tag_boolean(false);
+  }
+  while (untag_pair(cell)->tail.tag != TAG_NULL) {
+    tagged_reference_t value = eval_subexpression(env, untag_pair(cell));
+    if (!is_false(value)) {
+      release_if_tail_position(env, in_tail_position);
+      return value;
+    }
+    cell = untag_pair(cell)->tail;
+  }
+  TAIL_CALL eval(env, untag_pair(cell)->head, in_tail_position);
+}
+
+/**
+ * Evaluate (when test body...) or (unless test body...).
+ */
+tagged_reference_t eval_when(environment_t* env, tagged_reference_t expr,
+                             boolean_t is_unless, boolean_t in_tail_position) {
+  pair_t* test_cell = untag_pair(untag_pair(expr)->tail);
+  tagged_reference_t test = eval_subexpression(env, test_cell);
+  if (is_false(test) == is_unless && test_cell->tail.tag != TAG_NULL) {
+    TAIL_CALL eval_sequence(env, test_cell->tail, in_tail_position);
+  }
+  release_if_tail_position(env, in_tail_position);
   return NIL;
 }
 
+/**
+ * Evaluate (cond clause...) where each clause is (test expr...),
+ * (test => receiver) or (else expr...).
+ */
+tagged_reference_t eval_cond(environment_t* env, tagged_reference_t expr,
+                             boolean_t in_tail_position) {
+  for (tagged_reference_t clauses = untag_pair(expr)->tail;
+       clauses.tag == TAG_PAIR_T; clauses = untag_pair(clauses)->tail) {
+    pair_t* clause = untag_pair(untag_pair(clauses)->head);
+    tagged_reference_t test;
+    if (clause->head.tag == TAG_SCHEME_SYMBOL
+        && string_equal(untag_reader_symbol(clause->head), "else")) {
+      test = tag_boolean(true);
+    } else {
+      test = eval_subexpression(env, clause);
+      if (is_false(test)) {
+        continue;
+      }
+    }
+    if (clause->tail.tag == TAG_NULL) {
+      release_if_tail_position(env, in_tail_position);
+      return test;
+    }
+    tagged_reference_t second = car(clause->tail);
+    if (second.tag == TAG_SCHEME_SYMBOL
+        && string_equal(untag_reader_symbol(second), "=>")) {
+      tagged_reference_t receiver = eval(env, car(cdr(clause->tail)), false);
+      release_if_tail_position(env, in_tail_position);
+      primitive_arguments_t arguments = {.n_args = 1};
+      arguments.args[0] = test;
+      TAIL_CALL apply_procedure(receiver, arguments);
+    }
+    TAIL_CALL eval_sequence(env, clause->tail, in_tail_position);
+  }
+  release_if_tail_position(env, in_tail_position);
+  return NIL;
+}
+
+/**
+ * Make the environment for a let (or similar) evaluated in env. When
+ * the let is in tail position, env is released along with it.
+ */
+environment_t* make_scope_environment(environment_t* env,
+                                      lambda_analysis_t* analysis,
+                                      boolean_t in_tail_position) {
+  // The explicit stack evaluator never uses stack environments since
+  // call/cc can make any environment outlive its call (see
+  // cek_freeze).
+  environment_t* result = analysis->frame_may_escape || cek_is_enabled()
+                              ? make_frame_environment(env)
+                              : make_stack_environment(env);
+  result->has_stack_bindings
+      = result->is_stack_allocated && !analysis->bindings_may_be_captured;
+  result->releases_parent = in_tail_position && !env->is_captured;
+  return result;
+}
+
+/**
+ * Evaluate the body of a let (or similar) evaluated in env whose
+ * environment is frame. The body is always in tail position with
+ * respect to frame (which is released along with it). While
+ * profiling, a body that isn't really in tail position (a let in the
+ * middle of a procedure, or any top-level form) is marked on the
+ * shadow stack so the procedures it calls in tail position don't
+ * replace the procedure around it (see profile_enter).
+ */
+static tagged_reference_t eval_scope_body(environment_t* env,
+                                          environment_t* frame,
+                                          tagged_reference_t body,
+                                          boolean_t in_tail_position) {
+  if (profile_is_running() && (!in_tail_position || env == env->toplevel)) {
+    uintptr_t profile_key = PROFILE_C_FRAME_KEY();
+    profile_enter(profile_key, NIL, false);
+    tagged_reference_t result = eval_sequence(frame, body, true);
+    profile_leave(profile_key);
+    return result;
+  }
+  TAIL_CALL eval_sequence(frame, body, true);
+}
+
+/**
+ * Bind the names defined in the body of a lambda (or let, etc.) up
+ * front so that closures created in the body can share their bindings
+ * before they are defined.
+ */
+void bind_defined_names(environment_t* env, lambda_analysis_t* analysis) {
+  array_t* defined_names = analysis->defined_names;
+  for (uint64_t i = 0; i < array_length(defined_names); i++) {
+    char* name = (char*) array_get(defined_names, i);
+    if (environment_find_local_binding(env, name) == NULL) {
+      environment_add_binding(env, name, NIL);
+    }
+  }
+}
+
+/**
+ * Evaluate (let ((name init)...) body...) or a named let.
+ */
+tagged_reference_t eval_let(environment_t* env, tagged_reference_t expr,
+                            boolean_t in_tail_position) {
+  pair_t* rest = untag_pair(untag_pair(expr)->tail);
+  if (rest->head.tag == TAG_SCHEME_SYMBOL) {
+    TAIL_CALL eval_named_let(env, expr, in_tail_position);
+  }
+  lambda_analysis_t* analysis = analyze_let(env, expr);
+  environment_t* frame
+      = make_scope_environment(env, analysis, in_tail_position);
+  // The initial values are evaluated in env (frame is only on top of
+  // it on the frame stack).
+  for (tagged_reference_t bindings = rest->head; bindings.tag == TAG_PAIR_T;
+       bindings = untag_pair(bindings)->tail) {
+    pair_t* binding = untag_pair(untag_pair(bindings)->head);
+    environment_add_binding(frame, untag_reader_symbol(binding->head),
+                            eval_subexpression(env, untag_pair(binding->tail)));
+  }
+  bind_defined_names(frame, analysis);
+  TAIL_CALL eval_scope_body(env, frame, rest->tail, in_tail_position);
+}
+
+/**
+ * Evaluate (let* ((name init)...) body...). All of the names are
+ * bound in a single environment. A name that is bound twice gets a
+ * new binding that shadows the old one (which may have been captured
+ * by a closure in a later initial value).
+ */
+tagged_reference_t eval_let_star(environment_t* env, tagged_reference_t expr,
+                                 boolean_t in_tail_position) {
+  pair_t* rest = untag_pair(untag_pair(expr)->tail);
+  lambda_analysis_t* analysis = analyze_let(env, expr);
+  environment_t* frame
+      = make_scope_environment(env, analysis, in_tail_position);
+  for (tagged_reference_t bindings = rest->head; bindings.tag == TAG_PAIR_T;
+       bindings = untag_pair(bindings)->tail) {
+    pair_t* binding = untag_pair(untag_pair(bindings)->head);
+    environment_add_binding(
+        frame, untag_reader_symbol(binding->head),
+        eval_subexpression(frame, untag_pair(binding->tail)));
+  }
+  bind_defined_names(frame, analysis);
+  TAIL_CALL eval_scope_body(env, frame, rest->tail, in_tail_position);
+}
+
+/**
+ * Evaluate (letrec ((name init)...) body...) (and letrec* which is
+ * the same thing since the initial values are evaluated in order).
+ */
+tagged_reference_t eval_letrec(environment_t* env, tagged_reference_t expr,
+                               boolean_t in_tail_position) {
+  pair_t* rest = untag_pair(untag_pair(expr)->tail);
+  lambda_analysis_t* analysis = analyze_let(env, expr);
+  environment_t* frame
+      = make_scope_environment(env, analysis, in_tail_position);
+  for (tagged_reference_t bindings = rest->head; bindings.tag == TAG_PAIR_T;
+       bindings = untag_pair(bindings)->tail) {
+    environment_add_binding(frame, binding_name(untag_pair(bindings)->head),
+                            NIL);
+  }
+  bind_defined_names(frame, analysis);
+  for (tagged_reference_t bindings = rest->head; bindings.tag == TAG_PAIR_T;
+       bindings = untag_pair(bindings)->tail) {
+    pair_t* binding = untag_pair(untag_pair(bindings)->head);
+    tagged_reference_t value
+        = eval_subexpression(frame, untag_pair(binding->tail));
+    environment_find_local_binding(frame, untag_reader_symbol(binding->head))
+        ->tail
+        = value;
+  }
+  TAIL_CALL eval_scope_body(env, frame, rest->tail, in_tail_position);
+}
+
+/**
+ * Evaluate (let name ((var init)...) body...).
+ *
+ * When name is only called in tail position from the body (see
+ * lambda-analysis.c), this is just a loop: the body is evaluated over
+ * and over in a single environment whose bindings are updated in
+ * place (unless a closure in the body may have captured them) so no
+ * allocation is done per iteration.
+ *
+ * Otherwise name is bound to a real closure (like the equivalent
+ * letrec) which is called with the initial values.
+ */
+tagged_reference_t eval_named_let(environment_t* env, tagged_reference_t expr,
+                                  boolean_t in_tail_position) {
+  pair_t* rest = untag_pair(untag_pair(expr)->tail);
+  char* name = untag_reader_symbol(rest->head);
+  tagged_reference_t bindings = car(rest->tail);
+  tagged_reference_t body = cdr(rest->tail);
+  lambda_analysis_t* analysis = analyze_let(env, expr);
+
+  primitive_arguments_t arguments = {.n_args = 0};
+  for (tagged_reference_t lst = bindings; lst.tag == TAG_PAIR_T;
+       lst = untag_pair(lst)->tail) {
+    if (arguments.n_args + 1 >= MAX_PRIMITIVE_ARGS) {
+      fatal_error(ERROR_MAX_PRIMITIVE_ARGS);
+    }
+    pair_t* binding = untag_pair(untag_pair(lst)->head);
+    arguments.args[arguments.n_args++]
+        = eval_subexpression(env, untag_pair(binding->tail));
+  }
+  uint64_t n_vars = arguments.n_args;
+
+  if (!analysis->is_loop) {
+    closure_t* closure = allocate_closure(n_vars);
+    closure->code = body;
+    closure->debug_name = name;
+    closure->analysis = analysis;
+    closure->n_arg_names = n_vars;
+    for (int i = 0; i < n_vars; i++) {
+      closure->arg_names[i]
+          = binding_name(pair_list_get(untag_pair(bindings), i));
+    }
+    close_over_free_variables(closure, env);
+    if (closure->env == env->toplevel) {
+      closure->env = make_frame_environment(env->toplevel);
+    }
+    environment_add_binding(closure->env, name,
+                            tagged_reference(TAG_CLOSURE_T, closure));
+    environment_capture(closure->env);
+    release_if_tail_position(env, in_tail_position);
+    TAIL_CALL apply_procedure(tagged_reference(TAG_CLOSURE_T, closure),
+                              arguments);
+  }
+
+  named_let_loop_t loop = {.arguments = arguments};
+  environment_t* frame = make_scope_environment(env, analysis, false);
+  environment_add_binding(frame, name,
+                          tagged_reference(TAG_NAMED_LET_LOOP_T, &loop));
+  pair_t* var_bindings[MAX_PRIMITIVE_ARGS];
+  for (uint64_t i = 0; i < n_vars; i++) {
+    var_bindings[i] = environment_add_binding(
+        frame, binding_name(pair_list_get(untag_pair(bindings), i)), NIL);
+  }
+  bind_defined_names(frame, analysis);
+
+  while (true) {
+    if (loop.arguments.n_args != n_vars) {
+      fatal_error(ERROR_WRONG_NUMBER_OF_ARGS);
+    }
+    for (uint64_t i = 0; i < n_vars; i++) {
+      if (analysis->bindings_may_be_captured) {
+        var_bindings[i] = environment_rebind(
+            frame, untag_reader_symbol(var_bindings[i]->head),
+            loop.arguments.args[i]);
+      } else {
+        var_bindings[i]->tail = loop.arguments.args[i];
+      }
+    }
+    if (analysis->bindings_may_be_captured) {
+      array_t* defined_names = analysis->defined_names;
+      for (uint64_t i = 0; i < array_length(defined_names); i++) {
+        environment_rebind(frame, (char*) array_get(defined_names, i), NIL);
+      }
+    }
+    tagged_reference_t result = eval_sequence(frame, body, false);
+    if (result.tag != TAG_NAMED_LET_LOOP_T
+        || result.data != (uint64_t) &loop) {
+      environment_release(frame);
+      release_if_tail_position(env, in_tail_position);
+      return result;
+    }
+  }
+}
+
+/**
+ * Evaluate (do ((var init step)...) (test expr...) command...). Like
+ * a named let loop, a single environment is used for all iterations.
+ */
+tagged_reference_t eval_do(environment_t* env, tagged_reference_t expr,
+                           boolean_t in_tail_position) {
+  pair_t* rest = untag_pair(untag_pair(expr)->tail);
+  lambda_analysis_t* analysis = analyze_do(env, expr);
+  pair_t* test_clause = untag_pair(car(rest->tail));
+  tagged_reference_t commands = cdr(rest->tail);
+
+  environment_t* frame
+      = make_scope_environment(env, analysis, in_tail_position);
+  uint64_t n_vars = 0;
+  pair_t* var_bindings[MAX_PRIMITIVE_ARGS];
+  for (tagged_reference_t lst = rest->head; lst.tag == TAG_PAIR_T;
+       lst = untag_pair(lst)->tail) {
+    if (n_vars + 1 >= MAX_PRIMITIVE_ARGS) {
+      fatal_error(ERROR_MAX_PRIMITIVE_ARGS);
+    }
+    pair_t* binding = untag_pair(untag_pair(lst)->head);
+    var_bindings[n_vars++] = environment_add_binding(
+        frame, untag_reader_symbol(binding->head),
+        eval_subexpression(env, untag_pair(binding->tail)));
+  }
+
+  while (is_false(eval_subexpression(frame, test_clause))) {
+    for (tagged_reference_t lst = commands; lst.tag == TAG_PAIR_T;
+         lst = untag_pair(lst)->tail) {
+      eval(frame, untag_pair(lst)->head, false);
+    }
+    // All of the steps are evaluated before any variable is updated.
+    tagged_reference_t values[MAX_PRIMITIVE_ARGS];
+    uint64_t i = 0;
+    for (tagged_reference_t lst = rest->head; lst.tag == TAG_PAIR_T;
+         lst = untag_pair(lst)->tail, i++) {
+      tagged_reference_t step = cdr(cdr(untag_pair(lst)->head));
+      values[i] = step.tag == TAG_PAIR_T
+                      ? eval_subexpression(frame, untag_pair(step))
+                      : var_bindings[i]->tail;
+    }
+    for (i = 0; i < n_vars; i++) {
+      if (analysis->bindings_may_be_captured) {
+        var_bindings[i] = environment_rebind(
+            frame, untag_reader_symbol(var_bindings[i]->head), values[i]);
+      } else {
+        var_bindings[i]->tail = values[i];
+      }
+    }
+  }
+
+  if (test_clause->tail.tag == TAG_NULL) {
+    release_if_tail_position(frame, true);
+    return NIL;
+  }
+  TAIL_CALL eval_scope_body(env, frame, test_clause->tail,
+                            in_tail_position);
+}
+
 /**
  * Evaluate and application, i.e., a function call.
+ *
+ * The operator of every application is replaced by a call site (see
+ * call-site.c) the first time it is evaluated so that common cases,
+ * like integer arithmetic or always calling the same closure, can
+ * skip some of the generic work. Before that, an application that
+ * turns out to be a macro use is replaced by its expansion.
  */
 tagged_reference_t eval_application(environment_t* env, tagged_reference_t expr,
                                     boolean_t in_tail_position) {
   primitive_arguments_t arguments = {.n_args = 0};
 
-  // The above should be sufficient but just clear the entire
-  // structure while we are still in early development.
-  memset(&arguments, 0, sizeof(arguments));
-
   // perform an "application" (aka, function call to a primitive or
   // closure).
 
   pair_t* lst = untag_pair(expr);
+  if (lst->head.tag != TAG_CALL_SITE_T) {
+    if (expand_macro_use(env, expr)) {
+      TAIL_CALL eval(env, expr, in_tail_position);
+    }
+    call_site_t* site = make_call_site(lst->head);
+    interpreter_code_lock();
+    lst->head = tagged_reference(TAG_CALL_SITE_T, site);
+    interpreter_code_unlock();
+  }
+  call_site_t* site = untag_call_site(lst->head);
+
+  tagged_reference_t fn = eval_subexpression(env, &site->operator);
+  boolean_t is_target
+      = fn.tag == site->target.tag && fn.data == site->target.data;
+
+  if (site->kind == CALL_SITE_FIXNUM_BINARY) {
+    if (is_target) {
+      pair_t* first_cell = untag_pair(lst->tail);
+      tagged_reference_t a = eval_subexpression(env, first_cell);
+      tagged_reference_t b
+          = eval_subexpression(env, untag_pair(first_cell->tail));
+      release_if_tail_position(env, in_tail_position);
+      if (a.tag == TAG_UINT64_T && b.tag == TAG_UINT64_T) {
+        runtime_stats_count(inline_arithmetic);
+        return fixnum_operation_apply(site->operation, a, b);
+      }
+      // The arguments have already been evaluated so this call is
+      // finished the generic way.
+      call_site_deoptimize(site);
+      memset(&arguments, 0, sizeof(arguments));
+      arguments.n_args = 2;
+      arguments.args[0] = a;
+      arguments.args[1] = b;
+      runtime_stats_count(primitive_applications);
+      return untag_primitive(fn)(arguments);
+    }
+    call_site_deoptimize(site);
+  } else if (site->kind == CALL_SITE_CLOSURE && !is_target) {
+    call_site_deoptimize(site);
+  }
 
-  tagged_reference_t fn = eval(env, pair_list_get(lst, 0), false);
+  // A closure call site always has the right number of arguments for
+  // its closure so nothing needs to be cleared.
+  if (site->kind != CALL_SITE_CLOSURE) {
+    // The above should be sufficient but just clear the entire
+    // structure while we are still in early development.
+    memset(&arguments, 0, sizeof(arguments));
+  }
 
-  for (int i = 1; (i < pair_list_length(lst)); i++) {
-    if (i >= MAX_PRIMITIVE_ARGS) {
+  for (tagged_reference_t cell = lst->tail; cell.tag == TAG_PAIR_T;
+       cell = untag_pair(cell)->tail) {
+    if (arguments.n_args + 1 >= MAX_PRIMITIVE_ARGS) {
       fatal_error(ERROR_MAX_PRIMITIVE_ARGS);
     }
-    tagged_reference_t arg_expr = pair_list_get(lst, i);
-    arguments.args[arguments.n_args++] = eval(env, arg_expr, false);
+    arguments.args[arguments.n_args++]
+        = eval_subexpression(env, untag_pair(cell));
   }
 
-  if (in_tail_position && !env->is_captured) {
-    free_bytes(env);
-    env = 0;
+  // While profiling, the shadow stack entry of a closure that isn't
+  // really called in tail position (a top-level form is evaluated
+  // "in tail position") is dropped when its body returns.
+  boolean_t is_profiled = profile_is_running();
+  boolean_t leaves_profile
+      = is_profiled && (!in_tail_position || env == env->toplevel);
+
+  release_if_tail_position(env, in_tail_position);
+  env = NULL;
+
+  if (fn.tag == TAG_NAMED_LET_LOOP_T) {
+    // Go around the loop again (see eval_named_let).
+    ((named_let_loop_t*) fn.data)->arguments = arguments;
+    return fn;
   }
 
-  if (fn.tag == TAG_PRIMITIVE) {
+  if (fn.tag == TAG_CONTINUATION_T) {
+    continuation_throw(untag_continuation(fn), &arguments);
+  }
+
+  if (site->kind == CALL_SITE_UNINITIALIZED) {
+    call_site_quicken(site, fn, &arguments);
+  }
+
+  closure_t* closure = NULL;
+  if (site->kind == CALL_SITE_CLOSURE) {
+    // fn was checked against site->target above.
+    closure = (closure_t*) fn.data;
+  } else if (fn.tag == TAG_PRIMITIVE) {
+    runtime_stats_count(primitive_applications);
+    if (is_profiled) {
+      return profile_apply_primitive(PROFILE_C_FRAME_KEY(), fn, arguments);
+    }
     primitive_t primitive = untag_primitive(fn);
     return primitive(arguments);
+  } else {
+    closure = untag_closure_t(fn);
   }
+  runtime_stats_count(closure_applications);
 
-  closure_t* closure = untag_closure_t(fn);
-  env = make_environment(closure->env);
+  uintptr_t profile_key = 0;
+  if (is_profiled) {
+    profile_key = PROFILE_C_FRAME_KEY();
+    profile_enter(profile_key, fn, !leaves_profile);
+  }
+
+  optional_t compiled_result = jit_try_call(closure, &arguments);
+  if (optional_is_present(compiled_result)) {
+    runtime_stats_count(compiled_applications);
+    if (is_profiled) {
+      profile_leave(profile_key);
+    }
+    return optional_value(compiled_result);
+  }
+
+  env = bind_closure_arguments(closure, &arguments);
+  if (leaves_profile) {
+    tagged_reference_t result
+        = eval_sequence(env, closure_code(closure), true);
+    profile_leave(profile_key);
+    return result;
+  }
+  // The body is always in tail position with respect to the new
+  // environment (which is released once the body has been evaluated).
+  TAIL_CALL eval_sequence(env, closure_code(closure), true);
+}
+
+/**
+ * Make a new environment for a call to closure with the arguments
+ * bound to the closure's parameter names.
+ */
+environment_t* bind_closure_arguments(closure_t* closure,
+                                      primitive_arguments_t* arguments) {
+  environment_t* env = closure->analysis->frame_may_escape
+                               || cek_is_enabled()
+                           ? make_frame_environment(closure->env)
+                           : make_stack_environment(closure->env);
+  env->closure = closure;
+  env->has_stack_bindings = env->is_stack_allocated
+                            && !closure->analysis->bindings_may_be_captured;
   // make sure number of args are compatible.
   for (int i = 0; (i < closure->n_arg_names); i++) {
-    environment_define(env, closure->arg_names[i], arguments.args[i]);
+    environment_define(env, closure->arg_names[i], arguments->args[i]);
   }
+  bind_defined_names(env, closure->analysis);
+  return env;
+}
 
-  pair_t* sequence = untag_pair(closure->code);
+/**
+ * Evaluate a non-empty list of expressions returning the value of the
+ * last one (which is evaluated in tail position).
+ */
+tagged_reference_t eval_sequence(environment_t* env, tagged_reference_t body,
+                                 boolean_t in_tail_position) {
+  pair_t* sequence = untag_pair(body);
   while (sequence->tail.tag != TAG_NULL) {
     eval(env, sequence->head, false);
     sequence = untag_pair(sequence->tail);
@@ -242,27 +850,155 @@ tagged_reference_t eval_application(environment_t* env, tagged_reference_t expr,
   TAIL_CALL eval(env, sequence->head, in_tail_position);
 }
 
+/**
+ * Evaluate cell->head (not in tail position). When cell->head is a
+ * reference to a global variable, it is replaced with an inline cache
+ * (see inline-cache.c) and when it is a reference to a free variable
+ * of the closure being called, it is replaced with the index of the
+ * variable's binding in the closure (see closure.c) so that the next
+ * evaluation doesn't need to search for the variable.
+ */
+tagged_reference_t eval_subexpression(environment_t* env, pair_t* cell) {
+  tagged_reference_t expr = cell->head;
+  if (expr.tag == TAG_CLOSURE_SLOT_T) {
+    return closure_slot_get(env, untag_closure_slot(expr));
+  }
+  if (expr.tag != TAG_SCHEME_SYMBOL) {
+    return eval(env, expr, false);
+  }
+
+  char* name = untag_reader_symbol(expr);
+  uint64_t depth = 0;
+  for (environment_t* e = env; e != env->toplevel; e = e->parent, depth++) {
+    pair_t* binding = environment_find_local_binding(e, name);
+    if (binding != NULL) {
+      // Counted here since environment_find_binding isn't used.
+      runtime_stats_count_lookup(depth);
+      if (env->closure != NULL && e == env->closure->env) {
+        int64_t index = closure_slot_index(env->closure, binding);
+        if (index >= 0) {
+          interpreter_code_lock();
+          cell->head = tagged_reference(TAG_CLOSURE_SLOT_T,
+                                        make_closure_slot(name, index));
+          interpreter_code_unlock();
+        }
+      }
+      return binding->tail;
+    }
+  }
+
+  global_reference_t* reference = make_global_reference(name);
+  optional_t result = global_reference_get(env, reference);
+  if (!optional_is_present(result)) {
+    fatal_error(ERROR_VARIABLE_NOT_FOUND);
+  }
+  interpreter_code_lock();
+  cell->head = tagged_reference(TAG_GLOBAL_REFERENCE_T, reference);
+  interpreter_code_unlock();
+  return optional_value(result);
+}
+
+/**
+ * Call a primitive or closure with already evaluated arguments. This
+ * is how primitives (like hash-table-walk) call back into scheme.
+ */
+tagged_reference_t apply_procedure(tagged_reference_t fn,
+                                   primitive_arguments_t arguments) {
+  if (cek_is_enabled()) {
+    return cek_apply_procedure(fn, arguments);
+  }
+  if (fn.tag == TAG_CONTINUATION_T) {
+    continuation_throw(untag_continuation(fn), &arguments);
+  }
+  boolean_t is_profiled = profile_is_running();
+  if (fn.tag == TAG_PRIMITIVE) {
+    runtime_stats_count(primitive_applications);
+    if (is_profiled) {
+      return profile_apply_primitive(PROFILE_C_FRAME_KEY(), fn, arguments);
+    }
+    primitive_t primitive = untag_primitive(fn);
+    return primitive(arguments);
+  }
+  closure_t* closure = untag_closure_t(fn);
+  runtime_stats_count(closure_applications);
+  uintptr_t profile_key = 0;
+  if (is_profiled) {
+    profile_key = PROFILE_C_FRAME_KEY();
+    profile_enter(profile_key, fn, false);
+  }
+  optional_t compiled_result = jit_try_call(closure, &arguments);
+  if (optional_is_present(compiled_result)) {
+    runtime_stats_count(compiled_applications);
+    if (is_profiled) {
+      profile_leave(profile_key);
+    }
+    return optional_value(compiled_result);
+  }
+  environment_t* env = bind_closure_arguments(closure, &arguments);
+  if (is_profiled) {
+    tagged_reference_t result
+        = eval_sequence(env, closure_code(closure), true);
+    profile_leave(profile_key);
+    return result;
+  }
+  return eval_sequence(env, closure_code(closure), true);
+}
+
+/**
+ * Instead of closing over env (and therefore every environment up to
+ * the top-level), a closure gets a small environment of its own that
+ * shares just the bindings of its free variables that aren't
+ * top-level variables (which are also kept in closure->free_bindings,
+ * see closure.c). Most closures don't need one at all (and just use
+ * the top-level environment).
+ */
+void close_over_free_variables(closure_t* closure, environment_t* env) {
+  environment_t* toplevel = env->toplevel;
+  closure->env = toplevel;
+  array_t* free_names = closure->analysis->free_names;
+  for (uint64_t i = 0; i < array_length(free_names); i++) {
+    char* name = (char*) array_get(free_names, i);
+    for (environment_t* e = env; e != toplevel; e = e->parent) {
+      pair_t* binding = environment_find_local_binding(e, name);
+      if (binding != NULL) {
+        if (closure->env == toplevel) {
+          closure->env = make_frame_environment(toplevel);
+          closure->free_bindings = (pair_t**) malloc_bytes(
+              array_length(free_names) * sizeof(pair_t*));
+        }
+        environment_share_binding(closure->env, binding);
+        closure->free_bindings[i] = binding;
+        break;
+      }
+    }
+  }
+}
+
 /**
  * Make a closure
  */
 tagged_reference_t eval_lambda(environment_t* env, tagged_reference_t expr,
                                boolean_t in_tail_position) {
-  pair_t* argument_list = untag_pair(pair_list_get(untag_pair(expr), 1));
+  tagged_reference_t arguments = pair_list_get(untag_pair(expr), 1);
+  pair_t* argument_list = is_nil(arguments) ? NULL : untag_pair(arguments);
   uint64_t n_args = pair_list_length(argument_list);
   closure_t* closure = allocate_closure(n_args);
   closure->code = cdr(cdr(expr));
-  closure->env = env;
   closure->debug_name = NULL;
+  closure->analysis = analyze_lambda(env, expr);
   closure->n_arg_names = n_args;
   for (int i = 0; i < n_args; i++) {
     closure->arg_names[i]
         = untag_scheme_symbol(pair_list_get(argument_list, i));
   }
 
+  close_over_free_variables(closure, env);
+
   // Once we close over an environment we need a garbage collector to
   // reclaim it (and don't need to free it here even if we are
   // in_tail_position).
-  environment_capture(env);
+  environment_capture(closure->env);
 
+  release_if_tail_position(env, in_tail_position);
   return tagged_reference(TAG_CLOSURE_T, closure);
 }
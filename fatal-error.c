@@ -32,6 +32,19 @@ typedef enum {
   ERROR_WRONG_NUMBER_OF_ARGS,
   ERROR_CLOSURE_HAS_NO_BODY,
   ERROR_NULL_ENVIRONMENT,
+  ERROR_KEY_NOT_FOUND,
+  ERROR_CAPTURED_STACK_ENVIRONMENT,
+  ERROR_FRAME_STACK_CORRUPTED,
+  ERROR_BAD_SYNTAX,
+  ERROR_NO_MATCHING_SYNTAX_RULE,
+  ERROR_CONTINUATION_NOT_ACTIVE,
+  ERROR_DEADLOCK,
+  ERROR_GREEN_THREAD_CANT_WAIT,
+  ERROR_ENVIRONMENT_FROZEN,
+  ERROR_INTERPRETER_THREAD_NOT_STARTED,
+  ERROR_FILE_NOT_OPENED,
+  ERROR_INVALID_UTF8,
+  ERROR_CLOSURE_SLOT_OUT_OF_SCOPE,
 } error_code_t;
 
 extern _Noreturn void fatal_error_impl(char* file, int line, int error_code);
@@ -105,6 +118,38 @@ const char* fatal_error_code_to_string(int error_code) {
     return "ERROR_NOT_REACHED";
   case ERROR_MAX_PRIMITIVE_ARGS:
     return "ERROR_MAX_PRIMITIVE_ARGS";
+  case ERROR_WRONG_NUMBER_OF_ARGS:
+    return "ERROR_WRONG_NUMBER_OF_ARGS";
+  case ERROR_CLOSURE_HAS_NO_BODY:
+    return "ERROR_CLOSURE_HAS_NO_BODY";
+  case ERROR_NULL_ENVIRONMENT:
+    return "ERROR_NULL_ENVIRONMENT";
+  case ERROR_KEY_NOT_FOUND:
+    return "ERROR_KEY_NOT_FOUND";
+  case ERROR_CAPTURED_STACK_ENVIRONMENT:
+    return "ERROR_CAPTURED_STACK_ENVIRONMENT";
+  case ERROR_FRAME_STACK_CORRUPTED:
+    return "ERROR_FRAME_STACK_CORRUPTED";
+  case ERROR_BAD_SYNTAX:
+    return "ERROR_BAD_SYNTAX";
+  case ERROR_NO_MATCHING_SYNTAX_RULE:
+    return "ERROR_NO_MATCHING_SYNTAX_RULE";
+  case ERROR_CONTINUATION_NOT_ACTIVE:
+    return "ERROR_CONTINUATION_NOT_ACTIVE";
+  case ERROR_DEADLOCK:
+    return "ERROR_DEADLOCK";
+  case ERROR_GREEN_THREAD_CANT_WAIT:
+    return "ERROR_GREEN_THREAD_CANT_WAIT";
+  case ERROR_ENVIRONMENT_FROZEN:
+    return "ERROR_ENVIRONMENT_FROZEN";
+  case ERROR_INTERPRETER_THREAD_NOT_STARTED:
+    return "ERROR_INTERPRETER_THREAD_NOT_STARTED";
+  case ERROR_FILE_NOT_OPENED:
+    return "ERROR_FILE_NOT_OPENED";
+  case ERROR_INVALID_UTF8:
+    return "ERROR_INVALID_UTF8";
+  case ERROR_CLOSURE_SLOT_OUT_OF_SCOPE:
+    return "ERROR_CLOSURE_SLOT_OUT_OF_SCOPE";
   default:
     return "error";
   }
@@ -0,0 +1,616 @@
+/**
+ * @file future.c
+ *
+ * Futures (future and touch) and parallel-map, parallel-for-each and
+ * parallel-reduce, all run by a pool of worker threads that balance
+ * the load by stealing tasks from each other.
+ *
+ * Every worker, and every other thread that makes tasks, owns a
+ * Chase-Lev deque of tasks. The owner pushes and pops tasks at the
+ * bottom of its deque without locks (only taking the very last task
+ * races with thieves, which is settled by a compare and swap) while
+ * idle threads steal the oldest tasks from the top of other deques.
+ * So a thread mostly runs the tasks it just made itself, whose data is
+ * still in its cache, and the older tasks are the ones that move.
+ *
+ * A future is run by whichever thread claims it first by changing its
+ * state from pending to running, so touching a future that nobody has
+ * started yet just runs it right there, and a future that has already
+ * been claimed is skipped when it is taken off a deque. The chunks of
+ * parallel-map, etc. are only run by the thread that takes them off a
+ * deque so that they can be freed as soon as they are all done. A
+ * thread that waits for a task running elsewhere runs other tasks in
+ * the meantime.
+ *
+ * The workers are interpreter threads (see interpreter-thread.c) and
+ * the procedures given to them are shared the same way: their
+ * top-level environment is frozen. They should be pure procedures
+ * since the order in which the tasks run is unpredictable.
+ *
+ * The number of workers is given by the environment variable
+ * ARMYKNIFE_WORKERS and is otherwise one less than the number of
+ * processors (since the thread that makes the tasks helps running
+ * them). With no workers everything runs sequentially in the calling
+ * thread (and a future runs when it is first touched).
+ */
+
+// ======================================================================
+// This is block is extraced to future.h
+// ======================================================================
+
+#ifndef _FUTURE_H_
+#define _FUTURE_H_
+
+#include <stdint.h>
+
+#include "boolean.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+typedef enum {
+  FUTURE_TASK_PENDING,
+  FUTURE_TASK_RUNNING,
+  FUTURE_TASK_DONE,
+} future_task_state_t;
+
+// What a task of parallel-map, etc. does with its chunk of the list.
+typedef enum {
+  FUTURE_CHUNK_MAP,
+  FUTURE_CHUNK_FOR_EACH,
+  FUTURE_CHUNK_REDUCE,
+} future_chunk_operation_t;
+
+typedef struct {
+  // A future_task_state_t (only accessed atomically).
+  uint64_t state;
+  // The thunk of a future or the procedure applied to each element of
+  // a chunk.
+  tagged_reference_t procedure;
+  boolean_t is_chunk;
+  future_chunk_operation_t operation;
+  // The first pair of a chunk and its number of elements.
+  tagged_reference_t items;
+  uint64_t n_items;
+  // Where FUTURE_CHUNK_MAP puts the value for each element.
+  tagged_reference_t* results;
+  tagged_reference_t value;
+} future_task_t;
+
+typedef struct {
+  // Always a power of two.
+  int64_t size;
+  future_task_t* tasks[0];
+} future_deque_array_t;
+
+typedef struct {
+  // Thieves take tasks at the top and the owner at the bottom (which
+  // are kept on different cache lines).
+  int64_t top;
+  uint8_t padding[56];
+  int64_t bottom;
+  future_deque_array_t* array;
+} future_deque_t;
+
+extern uint64_t future_worker_count(void);
+extern tagged_reference_t future_wait(future_task_t* task);
+
+extern tagged_reference_t primtive_function_future(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_touch(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_parallel_map(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_parallel_for_each(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_parallel_reduce(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_worker_count(primitive_arguments_t args);
+
+static inline future_task_t* untag_future(tagged_reference_t reference) {
+  require_tag(reference, TAG_FUTURE_T);
+  return (future_task_t*) reference.data;
+}
+
+#endif /* _FUTURE_H_ */
+
+// ======================================================================
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "allocate.h"
+#include "evaluator.h"
+#include "fatal-error.h"
+#include "future.h"
+#include "interpreter-thread.h"
+#include "pair.h"
+#include "string-util.h"
+
+#define FUTURE_MAX_DEQUES 256
+#define FUTURE_DEQUE_INITIAL_SIZE 64
+// parallel-map, etc. split a list into this many chunks per thread so
+// that a thread that finishes early can steal some more work.
+#define FUTURE_CHUNKS_PER_THREAD 4
+// How often an idle worker looks for a task before going to sleep.
+#define FUTURE_IDLE_SPINS 64
+
+// The deques of every thread that has made tasks. A slot is NULL until
+// the thread that reserved it has made its deque.
+future_deque_t* future_deques[FUTURE_MAX_DEQUES];
+uint64_t future_n_deques = 0;
+_Thread_local future_deque_t* future_own_deque = NULL;
+// Used to pick the first deque to steal from.
+_Thread_local uint64_t future_random_state = 0;
+
+pthread_once_t future_pool_once = PTHREAD_ONCE_INIT;
+uint64_t future_n_workers = 0;
+
+// Idle workers sleep on this condition variable.
+pthread_mutex_t future_sleep_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t future_wakeup = PTHREAD_COND_INITIALIZER;
+uint64_t future_n_sleeping = 0;
+
+// ======================================================================
+// Chase-Lev deques
+// ======================================================================
+
+static future_deque_array_t* future_make_deque_array(int64_t size) {
+  future_deque_array_t* result = (future_deque_array_t*) malloc_bytes(
+      sizeof(future_deque_array_t) + size * sizeof(future_task_t*));
+  result->size = size;
+  return result;
+}
+
+static inline future_task_t** future_deque_slot(future_deque_array_t* array,
+                                                int64_t index) {
+  return &array->tasks[index & (array->size - 1)];
+}
+
+/**
+ * Replace the array of a full deque with one twice as big. The old
+ * array is never freed since a thief may still be reading it.
+ */
+static future_deque_array_t* future_deque_grow(future_deque_t* deque,
+                                               future_deque_array_t* array,
+                                               int64_t top, int64_t bottom) {
+  future_deque_array_t* result = future_make_deque_array(array->size * 2);
+  for (int64_t i = top; i < bottom; i++) {
+    *future_deque_slot(result, i) = __atomic_load_n(
+        future_deque_slot(array, i), __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&deque->array, result, __ATOMIC_RELEASE);
+  return result;
+}
+
+/**
+ * Add a task at the bottom (only called by the owner).
+ */
+static void future_deque_push(future_deque_t* deque, future_task_t* task) {
+  int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  future_deque_array_t* array
+      = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+  if (bottom - top > array->size - 1) {
+    array = future_deque_grow(deque, array, top, bottom);
+  }
+  __atomic_store_n(future_deque_slot(array, bottom), task, __ATOMIC_RELAXED);
+  __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Take the newest task from the bottom or return NULL (only called by
+ * the owner).
+ */
+static future_task_t* future_deque_pop(future_deque_t* deque) {
+  int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+  future_deque_array_t* array
+      = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+  __atomic_store_n(&deque->bottom, bottom, __ATOMIC_SEQ_CST);
+  int64_t top = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+  if (top > bottom) {
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  future_task_t* task
+      = __atomic_load_n(future_deque_slot(array, bottom), __ATOMIC_RELAXED);
+  if (top == bottom) {
+    // This is the last task so a thief may be taking it too.
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      task = NULL;
+    }
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+  }
+  return task;
+}
+
+/**
+ * Take the oldest task from the top or return NULL (which can also
+ * mean another thread got it first).
+ */
+static future_task_t* future_deque_steal(future_deque_t* deque) {
+  int64_t top = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+  int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST);
+  if (top >= bottom) {
+    return NULL;
+  }
+  future_deque_array_t* array
+      = __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+  future_task_t* task
+      = __atomic_load_n(future_deque_slot(array, top), __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+  return task;
+}
+
+/**
+ * Return the deque of the current thread, making it the first time
+ * (NULL when there is no room for another deque).
+ */
+static future_deque_t* future_get_own_deque(void) {
+  if (future_own_deque != NULL) {
+    return future_own_deque;
+  }
+  uint64_t index
+      = __atomic_fetch_add(&future_n_deques, 1, __ATOMIC_RELAXED);
+  if (index >= FUTURE_MAX_DEQUES) {
+    return NULL;
+  }
+  future_deque_t* deque = malloc_struct(future_deque_t);
+  deque->array = future_make_deque_array(FUTURE_DEQUE_INITIAL_SIZE);
+  __atomic_store_n(&future_deques[index], deque, __ATOMIC_RELEASE);
+  future_own_deque = deque;
+  future_random_state = index + 1;
+  return deque;
+}
+
+// ======================================================================
+// Running tasks
+// ======================================================================
+
+static void future_run_chunk(future_task_t* task) {
+  primitive_arguments_t arguments = {.n_args = 1};
+  tagged_reference_t items = task->items;
+  for (uint64_t i = 0; i < task->n_items; i++) {
+    tagged_reference_t item = untag_pair(items)->head;
+    items = untag_pair(items)->tail;
+    switch (task->operation) {
+    case FUTURE_CHUNK_MAP:
+      arguments.args[0] = item;
+      task->results[i] = apply_procedure(task->procedure, arguments);
+      break;
+    case FUTURE_CHUNK_FOR_EACH:
+      arguments.args[0] = item;
+      apply_procedure(task->procedure, arguments);
+      break;
+    case FUTURE_CHUNK_REDUCE:
+      if (i == 0) {
+        task->value = item;
+      } else {
+        primitive_arguments_t pair_arguments = {.n_args = 2};
+        pair_arguments.args[0] = task->value;
+        pair_arguments.args[1] = item;
+        task->value = apply_procedure(task->procedure, pair_arguments);
+      }
+      break;
+    }
+  }
+}
+
+/**
+ * Run task unless some thread has already claimed it.
+ */
+static void future_try_run(future_task_t* task) {
+  uint64_t expected = FUTURE_TASK_PENDING;
+  if (!__atomic_compare_exchange_n(&task->state, &expected,
+                                   FUTURE_TASK_RUNNING, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    return;
+  }
+  if (task->is_chunk) {
+    future_run_chunk(task);
+  } else {
+    primitive_arguments_t no_arguments = {.n_args = 0};
+    task->value = apply_procedure(task->procedure, no_arguments);
+  }
+  __atomic_store_n(&task->state, FUTURE_TASK_DONE, __ATOMIC_RELEASE);
+}
+
+/**
+ * Run one task from the current thread's deque or else one stolen
+ * from another deque. Return false if no task was found.
+ */
+static boolean_t future_help(void) {
+  future_task_t* task = NULL;
+  if (future_own_deque != NULL) {
+    task = future_deque_pop(future_own_deque);
+  }
+  if (task == NULL) {
+    uint64_t n_deques = __atomic_load_n(&future_n_deques, __ATOMIC_RELAXED);
+    if (n_deques > FUTURE_MAX_DEQUES) {
+      n_deques = FUTURE_MAX_DEQUES;
+    }
+    // xorshift
+    future_random_state ^= future_random_state << 13;
+    future_random_state ^= future_random_state >> 7;
+    future_random_state ^= future_random_state << 17;
+    for (uint64_t i = 0; i < n_deques && task == NULL; i++) {
+      future_deque_t* victim = __atomic_load_n(
+          &future_deques[(future_random_state + i) % n_deques],
+          __ATOMIC_ACQUIRE);
+      if (victim != NULL && victim != future_own_deque) {
+        task = future_deque_steal(victim);
+      }
+    }
+  }
+  if (task == NULL) {
+    return false;
+  }
+  future_try_run(task);
+  return true;
+}
+
+/**
+ * Wait until task is done, running it (or other tasks) meanwhile.
+ */
+tagged_reference_t future_wait(future_task_t* task) {
+  if (!task->is_chunk) {
+    future_try_run(task);
+  }
+  while (__atomic_load_n(&task->state, __ATOMIC_ACQUIRE)
+         != FUTURE_TASK_DONE) {
+    if (!future_help()) {
+      sched_yield();
+    }
+  }
+  return task->value;
+}
+
+static void* future_worker_main(void* argument) {
+  interpreter_thread_id = (uint64_t) argument;
+  future_get_own_deque();
+  if (future_random_state == 0) {
+    future_random_state = interpreter_thread_id;
+  }
+  uint64_t n_idle = 0;
+  while (true) {
+    if (future_help()) {
+      n_idle = 0;
+    } else if (++n_idle < FUTURE_IDLE_SPINS) {
+      sched_yield();
+    } else {
+      // A wakeup can be missed (a task may be pushed right before we
+      // start waiting) so never sleep for long.
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += 1000000;
+      if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+      pthread_mutex_lock(&future_sleep_mutex);
+      __atomic_add_fetch(&future_n_sleeping, 1, __ATOMIC_RELAXED);
+      pthread_cond_timedwait(&future_wakeup, &future_sleep_mutex, &deadline);
+      __atomic_sub_fetch(&future_n_sleeping, 1, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&future_sleep_mutex);
+    }
+  }
+  return NULL;
+}
+
+static void future_start_pool(void) {
+  char* var = getenv("ARMYKNIFE_WORKERS");
+  if (var != NULL) {
+    future_n_workers = string_parse_uint64(var);
+  } else {
+    long n_processors = sysconf(_SC_NPROCESSORS_ONLN);
+    future_n_workers = n_processors > 1 ? n_processors - 1 : 0;
+  }
+  if (future_n_workers > FUTURE_MAX_DEQUES / 2) {
+    future_n_workers = FUTURE_MAX_DEQUES / 2;
+  }
+  if (future_n_workers == 0) {
+    return;
+  }
+  interpreter_thread_share(NIL);
+  for (uint64_t i = 0; i < future_n_workers; i++) {
+    pthread_t handle;
+    uint64_t id = interpreter_thread_allocate_id();
+    interpreter_thread_create(&handle, future_worker_main, (void*) id);
+    pthread_detach(handle);
+  }
+}
+
+/**
+ * Return the number of worker threads (starting them the first time).
+ */
+uint64_t future_worker_count(void) {
+  pthread_once(&future_pool_once, future_start_pool);
+  return future_n_workers;
+}
+
+/**
+ * Make task available to the workers. Return false if this thread
+ * can't have a deque (then the task must be run some other way).
+ */
+static boolean_t future_submit(future_task_t* task) {
+  future_deque_t* deque = future_get_own_deque();
+  if (deque == NULL) {
+    return false;
+  }
+  future_deque_push(deque, task);
+  if (__atomic_load_n(&future_n_sleeping, __ATOMIC_RELAXED) > 0) {
+    pthread_mutex_lock(&future_sleep_mutex);
+    pthread_cond_signal(&future_wakeup);
+    pthread_mutex_unlock(&future_sleep_mutex);
+  }
+  return true;
+}
+
+// ======================================================================
+// Primitives
+// ======================================================================
+
+/**
+ * Example (future (lambda () (fib 30)))
+ */
+tagged_reference_t primtive_function_future(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  future_task_t* task = malloc_struct(future_task_t);
+  task->procedure = arguments.args[0];
+  task->value = NIL;
+  if (future_worker_count() > 0) {
+    interpreter_thread_share(task->procedure);
+    future_submit(task);
+  }
+  return tagged_reference(TAG_FUTURE_T, task);
+}
+
+/**
+ * Return the value of a future (waiting for it if necessary). Anything
+ * that isn't a future is simply returned.
+ */
+tagged_reference_t primtive_function_touch(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  if (arguments.args[0].tag != TAG_FUTURE_T) {
+    return arguments.args[0];
+  }
+  return future_wait(untag_future(arguments.args[0]));
+}
+
+/**
+ * Split lst into chunks, apply fn to each element (see
+ * future_run_chunk) and wait until all of the chunks are done. The
+ * chunks are returned (in order) and must be freed by the caller.
+ */
+static future_task_t* future_run_chunks(future_chunk_operation_t operation,
+                                        tagged_reference_t fn,
+                                        tagged_reference_t lst,
+                                        tagged_reference_t* results,
+                                        uint64_t n_items,
+                                        uint64_t* n_chunks) {
+  uint64_t n_workers = future_worker_count();
+  *n_chunks = (n_workers + 1) * FUTURE_CHUNKS_PER_THREAD;
+  if (n_workers == 0 || *n_chunks > n_items) {
+    *n_chunks = n_workers == 0 || n_items == 0 ? 1 : n_items;
+  }
+  if (n_workers > 0) {
+    interpreter_thread_share(fn);
+  }
+
+  future_task_t* chunks = (future_task_t*) malloc_bytes(
+      *n_chunks * sizeof(future_task_t));
+  uint64_t start = 0;
+  for (uint64_t i = 0; i < *n_chunks; i++) {
+    future_task_t* chunk = &chunks[i];
+    chunk->is_chunk = true;
+    chunk->operation = operation;
+    chunk->procedure = fn;
+    chunk->items = lst;
+    chunk->n_items
+        = n_items / *n_chunks + (i < n_items % *n_chunks ? 1 : 0);
+    chunk->results = results == NULL ? NULL : &results[start];
+    chunk->value = NIL;
+    for (uint64_t j = 0; j < chunk->n_items; j++) {
+      lst = untag_pair(lst)->tail;
+    }
+    start += chunk->n_items;
+  }
+  // The chunks are pushed in reverse order so that this thread starts
+  // with the first chunk while the workers steal from the end.
+  for (uint64_t i = *n_chunks; i > 0; i--) {
+    if (n_workers == 0 || !future_submit(&chunks[i - 1])) {
+      future_try_run(&chunks[i - 1]);
+    }
+  }
+  for (uint64_t i = 0; i < *n_chunks; i++) {
+    future_wait(&chunks[i]);
+  }
+  return chunks;
+}
+
+/**
+ * Return the length of lst (which must be a proper list).
+ */
+static uint64_t future_list_length(tagged_reference_t lst) {
+  uint64_t result = 0;
+  for (; lst.tag == TAG_PAIR_T; lst = untag_pair(lst)->tail) {
+    result++;
+  }
+  if (lst.tag != TAG_NULL) {
+    fatal_error(ERROR_REFERENCE_NOT_EXPECTED_TYPE);
+  }
+  return result;
+}
+
+/**
+ * Example (parallel-map square (iota 1000))
+ */
+tagged_reference_t
+    primtive_function_parallel_map(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  uint64_t n_items = future_list_length(arguments.args[1]);
+  tagged_reference_t* results = (tagged_reference_t*) malloc_bytes(
+      (n_items + 1) * sizeof(tagged_reference_t));
+  uint64_t n_chunks;
+  future_task_t* chunks
+      = future_run_chunks(FUTURE_CHUNK_MAP, arguments.args[0],
+                          arguments.args[1], results, n_items, &n_chunks);
+  tagged_reference_t result = NIL;
+  for (uint64_t i = n_items; i > 0; i--) {
+    result = cons(results[i - 1], result);
+  }
+  free_bytes(chunks);
+  free_bytes(results);
+  return result;
+}
+
+tagged_reference_t
+    primtive_function_parallel_for_each(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  uint64_t n_items = future_list_length(arguments.args[1]);
+  uint64_t n_chunks;
+  future_task_t* chunks
+      = future_run_chunks(FUTURE_CHUNK_FOR_EACH, arguments.args[0],
+                          arguments.args[1], NULL, n_items, &n_chunks);
+  free_bytes(chunks);
+  return NIL;
+}
+
+/**
+ * Example (parallel-reduce + 0 (iota 1000))
+ *
+ * Combine the elements of a list with an associative procedure. Each
+ * chunk of the list is combined in parallel and then the results of
+ * the chunks are combined (from left to right) starting with init.
+ */
+tagged_reference_t
+    primtive_function_parallel_reduce(primitive_arguments_t arguments) {
+  require_n_args(arguments, 3, 3);
+  uint64_t n_items = future_list_length(arguments.args[2]);
+  uint64_t n_chunks;
+  future_task_t* chunks
+      = future_run_chunks(FUTURE_CHUNK_REDUCE, arguments.args[0],
+                          arguments.args[2], NULL, n_items, &n_chunks);
+  tagged_reference_t result = arguments.args[1];
+  primitive_arguments_t pair_arguments = {.n_args = 2};
+  for (uint64_t i = 0; i < n_chunks; i++) {
+    if (chunks[i].n_items > 0) {
+      pair_arguments.args[0] = result;
+      pair_arguments.args[1] = chunks[i].value;
+      result = apply_procedure(arguments.args[0], pair_arguments);
+    }
+  }
+  free_bytes(chunks);
+  return result;
+}
+
+tagged_reference_t
+    primtive_function_worker_count(primitive_arguments_t arguments) {
+  require_n_args(arguments, 0, 0);
+  return tagged_reference(TAG_UINT64_T, future_worker_count());
+}
@@ -27,9 +27,25 @@ extern environment_t* make_global_environment();
 
 #include <stdlib.h>
 
+#include "builtin.h"
+#include "cek-evaluator.h"
+#include "char-primitive.h"
+#include "continuation.h"
 #include "environment.h"
+#include "future.h"
 #include "global-environment.h"
+#include "green-thread.h"
+#include "hash-table.h"
+#include "heap-census.h"
+#include "inline-cache.h"
+#include "interpreter-thread.h"
+#include "list-primitive.h"
+#include "mark.h"
 #include "primitive.h"
+#include "profile.h"
+#include "runtime-stats.h"
+#include "shared-channel.h"
+#include "string-primitive.h"
 
 #define unimplemented(name)                                                    \
   do {                                                                         \
@@ -47,12 +63,37 @@ extern environment_t* make_global_environment();
   do {                                                                         \
   } while (0)
 
+// The global environment isn't populated by calling these. Instead
+// symbol-hash reads every define_primitive() and special_form() in
+// this file to generate the static table in builtin-table.c (see
+// builtin.c). Expanding them here still makes the compiler check that
+// the functions and special forms exist.
+#define define_primitive(env, name, function) ((void) &function)
+#define special_form(name, form) ((void) form)
+
 void add_basic_primtives(environment_t* env);
+void add_hash_table_primitives(environment_t* env);
+void add_green_thread_primitives(environment_t* env);
+void add_interpreter_thread_primitives(environment_t* env);
+void add_future_primitives(environment_t* env);
+void add_shared_channel_primitives(environment_t* env);
+void add_mark_primitives(environment_t* env);
+void add_heap_census_primitives(environment_t* env);
+void add_profile_primitives(environment_t* env);
+void add_runtime_stats_primitives(environment_t* env);
+void add_string_search_primitives(environment_t* env);
+
+// See scheme/prelude.scm (and the prelude.c generated from it).
+void load_prelude(environment_t* env);
 
 environment_t* make_global_environment() {
   environment_t* result = make_environment(NULL);
   environment_capture(result);
-  add_basic_primtives(result);
+  result->has_builtins = true;
+  load_prelude(result);
+  mark_add_root_environment(result);
+  // Only what comes after the prelude is counted.
+  runtime_stats_initialize();
   return result;
 }
 
@@ -65,34 +106,30 @@ environment_t* make_global_environment() {
 
 void add_basic_primtives(environment_t* env) {
   /* clang-format off */
-  environment_define(env, "-",
-                     tagged_reference(TAG_PRIMITIVE, &primtive_function_sub));
-  environment_define(env, "*",
-                     tagged_reference(TAG_PRIMITIVE, &primtive_function_sub));
+  define_primitive(env, "-", primtive_function_sub);
+  define_primitive(env, "*", primtive_function_mul);
   not_a_primitive("...");
-  environment_define(env, "/",
-                     tagged_reference(TAG_PRIMITIVE, &primtive_function_div));
+  define_primitive(env, "/", primtive_function_div);
   not_a_primitive("_");
-  environment_define(env, "+",
-                     tagged_reference(TAG_PRIMITIVE, &primtive_function_plus));
-  unimplemented("<");
-  unimplemented("<=");
-  unimplemented("=");
+  define_primitive(env, "+", primtive_function_plus);
+  define_primitive(env, "<", primtive_function_less);
+  define_primitive(env, "<=", primtive_function_less_or_equal);
+  define_primitive(env, "=", primtive_function_numerically_equal);
   unimplemented("=>");
-  unimplemented(">");
-  unimplemented(">=");
-  unimplemented("abs");
+  define_primitive(env, ">", primtive_function_greater);
+  define_primitive(env, ">=", primtive_function_greater_or_equal);
+  written_in_scheme("abs");
   math_function("acos");
-  not_a_primitive("and");
+  special_form("and", SPECIAL_FORM_AND);
   math_function("angle");
-  written_in_scheme("append");
-  written_in_scheme("apply");
+  define_primitive(env, "append", primtive_function_append);
+  define_primitive(env, "apply", primtive_function_apply);
   math_function("asin");
-  written_in_scheme("assoc");
-  written_in_scheme("assq");
-  written_in_scheme("assv");
+  define_primitive(env, "assoc", primtive_function_assoc);
+  define_primitive(env, "assq", primtive_function_assq);
+  define_primitive(env, "assv", primtive_function_assv);
   math_function("atan");
-  not_a_primitive("begin");
+  special_form("begin", SPECIAL_FORM_BEGIN);
   io_function("binary-port?");
   unimplemented("/ boolean?");
   unimplemented("boolean=?");
@@ -104,85 +141,94 @@ void add_basic_primtives(environment_t* env) {
   unimplemented("bytevector-length");
   unimplemented("bytevector-u8-ref");
   unimplemented("bytevector-u8-set!");
-  written_in_scheme("caaaar");
-  written_in_scheme("caaadr");
-  written_in_scheme("caaar");
-  written_in_scheme("caadar");
-  written_in_scheme("caaddr");
-  written_in_scheme("caadr");
-  written_in_scheme("caar");
-  written_in_scheme("cadaar");
-  written_in_scheme("cadadr");
-  written_in_scheme("cadar");
-  written_in_scheme("caddar");
-  written_in_scheme("cadddr");
-  written_in_scheme("caddr");
-  written_in_scheme("cadr");
-  unimplemented("call/cc");
-  unimplemented("call-with-current-continuation");
+  define_primitive(env, "caaaar", primtive_function_caaaar);
+  define_primitive(env, "caaadr", primtive_function_caaadr);
+  define_primitive(env, "caaar", primtive_function_caaar);
+  define_primitive(env, "caadar", primtive_function_caadar);
+  define_primitive(env, "caaddr", primtive_function_caaddr);
+  define_primitive(env, "caadr", primtive_function_caadr);
+  define_primitive(env, "caar", primtive_function_caar);
+  define_primitive(env, "cadaar", primtive_function_cadaar);
+  define_primitive(env, "cadadr", primtive_function_cadadr);
+  define_primitive(env, "cadar", primtive_function_cadar);
+  define_primitive(env, "caddar", primtive_function_caddar);
+  define_primitive(env, "cadddr", primtive_function_cadddr);
+  define_primitive(env, "caddr", primtive_function_caddr);
+  define_primitive(env, "cadr", primtive_function_cadr);
+  define_primitive(env, "call/cc",
+                   primtive_function_call_with_current_continuation);
+  define_primitive(env, "call/ec",
+                   primtive_function_call_with_escape_continuation);
+  define_primitive(env, "call-with-current-continuation",
+                   primtive_function_call_with_current_continuation);
+  define_primitive(env, "call-with-escape-continuation",
+                   primtive_function_call_with_escape_continuation);
   io_function("call-with-input-file");
   io_function("call-with-output-file");
   io_function("call-with-port");
   // call-with-values
   io_function("call-with-input-file");
-  unimplemented("/ car");
+  define_primitive(env, "car", primtive_function_car);
   not_a_primitive("case");
   not_a_primitive("case-lambda");
-  written_in_scheme("cdaaar");
-  written_in_scheme("cdaadr");
-  written_in_scheme("cdaar");
-  written_in_scheme("cdadar");
-  written_in_scheme("cdaddr");
-  written_in_scheme("cdadr");
-  written_in_scheme("cdar");
-  written_in_scheme("cddaar");
-  written_in_scheme("cddadr");
-  written_in_scheme("cddar");
-  written_in_scheme("cdddar");
-  written_in_scheme("cddddr");
-  written_in_scheme("cdddr");
-  written_in_scheme("cddr");
-  unimplemented("cdr");
+  define_primitive(env, "cdaaar", primtive_function_cdaaar);
+  define_primitive(env, "cdaadr", primtive_function_cdaadr);
+  define_primitive(env, "cdaar", primtive_function_cdaar);
+  define_primitive(env, "cdadar", primtive_function_cdadar);
+  define_primitive(env, "cdaddr", primtive_function_cdaddr);
+  define_primitive(env, "cdadr", primtive_function_cdadr);
+  define_primitive(env, "cdar", primtive_function_cdar);
+  define_primitive(env, "cddaar", primtive_function_cddaar);
+  define_primitive(env, "cddadr", primtive_function_cddadr);
+  define_primitive(env, "cddar", primtive_function_cddar);
+  define_primitive(env, "cdddar", primtive_function_cdddar);
+  define_primitive(env, "cddddr", primtive_function_cddddr);
+  define_primitive(env, "cdddr", primtive_function_cdddr);
+  define_primitive(env, "cddr", primtive_function_cddr);
+  define_primitive(env, "cdr", primtive_function_cdr);
   unimplemented("ceiling");
-  unimplemented("char?");
-  written_in_scheme("char<?");
-  written_in_scheme("char<=?");
-  written_in_scheme("char=?");
-  written_in_scheme("char>?");
-  written_in_scheme("char>=?");
-  unimplemented("char->integer");
-  written_in_scheme("char-alphabetic?");
+  define_primitive(env, "char?", primtive_function_char_p);
+  define_primitive(env, "char<?", primtive_function_char_less_p);
+  define_primitive(env, "char<=?", primtive_function_char_less_or_equal_p);
+  define_primitive(env, "char=?", primtive_function_char_equal_p);
+  define_primitive(env, "char>?", primtive_function_char_greater_p);
+  define_primitive(env, "char>=?", primtive_function_char_greater_or_equal_p);
+  define_primitive(env, "char->integer", primtive_function_char_to_integer);
+  define_primitive(env, "char-alphabetic?",
+                   primtive_function_char_alphabetic_p);
   written_in_scheme("char-ci<?");
   written_in_scheme("char-ci<=?");
   written_in_scheme("char-ci=?");
   written_in_scheme("char-ci>?");
   written_in_scheme("char-ci>=?");
-  written_in_scheme("char-downcase");
+  define_primitive(env, "char-downcase", primtive_function_char_downcase);
   written_in_scheme("char-foldcase");
-  written_in_scheme("char-lower-case?");
-  written_in_scheme("char-numeric?");
+  define_primitive(env, "char-lower-case?",
+                   primtive_function_char_lower_case_p);
+  define_primitive(env, "char-numeric?", primtive_function_char_numeric_p);
   io_function("char-ready?");
-  written_in_scheme("char-upcase");
-  written_in_scheme("char-upper-case?");
-  written_in_scheme("char-whitespace?");
+  define_primitive(env, "char-upcase", primtive_function_char_upcase);
+  define_primitive(env, "char-upper-case?",
+                   primtive_function_char_upper_case_p);
+  define_primitive(env, "char-whitespace?",
+                   primtive_function_char_whitespace_p);
   io_function("close-input-port");
   io_function("close-output-port");
   io_function("close-port");
   math_function("command-line");
   math_function("complex?");
-  not_a_primitive("cond");
+  special_form("cond", SPECIAL_FORM_COND);
   not_a_primitive("cond-expand");
-  unimplemented("cons");
+  define_primitive(env, "cons", primtive_function_cons);
   math_function("cos");
   io_function("/ current-error-port");
   io_function("/ current-input-port");
   // current-jiffy
   io_function("current-output-port");
   // current-second
-  not_a_primitive("define");
+  special_form("define", SPECIAL_FORM_DEFINE);
   // define-record-type
-  not_a_primitive("define");
-  not_a_primitive("define-syntax");
+  special_form("define-syntax", SPECIAL_FORM_DEFINE_SYNTAX);
   not_a_primitive("define-values");
   // delay
   // delay-force
@@ -190,16 +236,16 @@ void add_basic_primtives(environment_t* env) {
   math_function("denominator");
   math_function("digit-value");
   io_function("display");
-  not_a_primitive("do");
-  not_a_primitive("dynamic-wind");
+  special_form("do", SPECIAL_FORM_DO);
+  define_primitive(env, "dynamic-wind", primtive_function_dynamic_wind);
   not_a_primitive("else");
   unimplemented("emergency-exit");
   unimplemented("environment");
   io_function("eof-object");
   io_function("eof-object?");
-  // eq?
-  // equal?
-  // eqv?
+  define_primitive(env, "eq?", primtive_function_eq_p);
+  define_primitive(env, "equal?", primtive_function_equal_p);
+  define_primitive(env, "eqv?", primtive_function_eqv_p);
   // error
   // error-object?
   // error-object-irritants
@@ -222,14 +268,14 @@ void add_basic_primtives(environment_t* env) {
   // floor-remainder
   io_function("flush-output-port");
   written_in_scheme("force");
-  written_in_scheme("for-each");
+  define_primitive(env, "for-each", primtive_function_for_each);
   written_in_scheme("gcd");
   // get-environment-variable
   // get-environment-variables
   // get-output-bytevector
   // get-output-string
   // guard
-  not_a_primitive("if");
+  special_form("if", SPECIAL_FORM_IF);
   math_function("imag-part");
   // import
   // include
@@ -241,29 +287,31 @@ void add_basic_primtives(environment_t* env) {
   io_function("input-port?");
   io_function("input-port-open?");
   unimplemented("integer?");
-  unimplemented("integer->char");
+  define_primitive(env, "integer->char", primtive_function_integer_to_char);
   // interaction-environment
   // interaction-environment
   // jiffies-per-second
-  not_a_primitive("lambda");
+  special_form("lambda", SPECIAL_FORM_LAMBDA);
   written_in_scheme("lcm");
-  written_in_scheme("length");
-  not_a_primitive("let");
-  not_a_primitive("let*");
+  define_primitive(env, "length", primtive_function_length);
+  special_form("let", SPECIAL_FORM_LET);
+  special_form("let*", SPECIAL_FORM_LET_STAR);
+  special_form("letrec", SPECIAL_FORM_LETREC);
+  special_form("letrec*", SPECIAL_FORM_LETREC);
   not_a_primitive("let*-values");
   not_a_primitive("let*-values");
   not_a_primitive("let*-values");
   not_a_primitive("let*-values");
   not_a_primitive("let*-values");
   not_a_primitive("let*-values");
-  // list
-  // list?
-  written_in_scheme("list->string");
+  define_primitive(env, "list", primtive_function_list);
+  define_primitive(env, "list?", primtive_function_list_p);
+  define_primitive(env, "list->string", primtive_function_list_to_string);
   written_in_scheme("list->vector");
-  written_in_scheme("list-copy");
-  written_in_scheme("list-ref");
+  define_primitive(env, "list-copy", primtive_function_list_copy);
+  define_primitive(env, "list-ref", primtive_function_list_ref);
   written_in_scheme("list-set!");
-  written_in_scheme("list-tail");
+  define_primitive(env, "list-tail", primtive_function_list_tail);
   io_function("load");
   // log
   // magnitude
@@ -275,18 +323,18 @@ void add_basic_primtives(environment_t* env) {
   // make-rectangular
   unimplemented("make-string");
   unimplemented("/ make-vector");
-  written_in_scheme("map");
+  define_primitive(env, "map", primtive_function_map);
   written_in_scheme("max");
-  written_in_scheme("member");
-  written_in_scheme("memq");
-  written_in_scheme("memv");
+  define_primitive(env, "member", primtive_function_member);
+  define_primitive(env, "memq", primtive_function_memq);
+  define_primitive(env, "memv", primtive_function_memv);
   written_in_scheme("min");
   // modulo
   math_function("nan?");
   written_in_scheme("negative?");
   io_function("newline");
-  unimplemented("not");
-  unimplemented("null?");
+  written_in_scheme("not");
+  define_primitive(env, "null?", primtive_function_null_p);
   written_in_scheme("number?");
   unimplemented("number->string");
   // numerator
@@ -299,10 +347,10 @@ void add_basic_primtives(environment_t* env) {
   io_function("open-output-bytevector");
   io_function("open-output-file");
   io_function("open-output-string");
-  not_a_primitive("or");
+  special_form("or", SPECIAL_FORM_OR);
   io_function("output-port?");
   io_function("output-port-open?");
-  // pair?
+  define_primitive(env, "pair?", primtive_function_pair_p);
   // parameterize
   io_function("peek-char");
   io_function("peek-u8");
@@ -310,7 +358,7 @@ void add_basic_primtives(environment_t* env) {
   // positive?
   // procedure?
   not_a_primitive("quasiquote");
-  not_a_primitive("quote");
+  special_form("quote", SPECIAL_FORM_QUOTE);
   math_function("quotient");
   // raise
   // raise-continuable
@@ -326,48 +374,50 @@ void add_basic_primtives(environment_t* env) {
   math_function("real?");
   math_function("real-part");
   // remainder
-  written_in_scheme("reverse");
+  define_primitive(env, "reverse", primtive_function_reverse);
   // round
   // scheme-report-environment
-  // set!
-  // set-car!
-  // set-cdr!
+  special_form("set!", SPECIAL_FORM_SET_BANG);
+  define_primitive(env, "set-car!", primtive_function_set_car);
+  define_primitive(env, "set-cdr!", primtive_function_set_cdr);
   math_function("sin");
   math_function("sqrt");
   written_in_scheme("square");
-  // string
-  // string?
+  define_primitive(env, "string", primtive_function_string);
+  define_primitive(env, "string?", primtive_function_string_p);
   written_in_scheme("string<?");
   written_in_scheme("string<=?");
-  // string=?
+  define_primitive(env, "string=?", primtive_function_string_equal_p);
   written_in_scheme("string>?");
   written_in_scheme("string>=?");
-  written_in_scheme("string->list");
+  define_primitive(env, "string->list", primtive_function_string_to_list);
   // string->number
-  // string->symbol
+  define_primitive(env, "string->symbol", primtive_function_string_to_symbol);
   // string->utf8
   written_in_scheme("string->vector");
-  // string-append
-  written_in_scheme("string-ci<?");
-  written_in_scheme("string-ci<=?");
-  written_in_scheme("string-ci=?");
-  written_in_scheme("string-ci>?");
-  written_in_scheme("string-ci>=?");
+  define_primitive(env, "string-append", primtive_function_string_append);
+  define_primitive(env, "string-ci<?", primtive_function_string_ci_less_p);
+  define_primitive(env, "string-ci<=?",
+                   primtive_function_string_ci_less_or_equal_p);
+  define_primitive(env, "string-ci=?", primtive_function_string_ci_equal_p);
+  define_primitive(env, "string-ci>?", primtive_function_string_ci_greater_p);
+  define_primitive(env, "string-ci>=?",
+                   primtive_function_string_ci_greater_or_equal_p);
   written_in_scheme("string-copy");
   written_in_scheme("string-copy!");
   written_in_scheme("string-downcase");
   written_in_scheme("string-fill!");
   written_in_scheme("string-foldcase");
   written_in_scheme("string-for-each");
-  // string-length
+  define_primitive(env, "string-length", primtive_function_string_length);
   written_in_scheme("string-map");
-  // string-ref
+  define_primitive(env, "string-ref", primtive_function_string_ref);
   // string-set!
   written_in_scheme("string-upcase");
-  written_in_scheme("substring");
-  // symbol?
+  define_primitive(env, "substring", primtive_function_substring);
+  define_primitive(env, "symbol?", primtive_function_symbol_p);
   // symbol=?
-  // symbol->string
+  define_primitive(env, "symbol->string", primtive_function_symbol_to_string);
   not_a_primitive("syntax-error");
   not_a_primitive("syntax-rules");
   math_function("tan");
@@ -377,7 +427,7 @@ void add_basic_primtives(environment_t* env) {
   math_function("truncate-quotient");
   math_function("truncate-remainder");
   io_function("u8-ready?");
-  not_a_primitive("unless");
+  special_form("unless", SPECIAL_FORM_UNLESS);
   not_a_primitive("unquote");
   not_a_primitive("unquote-splicing");
   // utf8->string
@@ -395,7 +445,7 @@ void add_basic_primtives(environment_t* env) {
   written_in_scheme("vector-map");
   // vector-ref
   // vector-set!
-  not_a_primitive("when");
+  special_form("when", SPECIAL_FORM_WHEN);
   // with-exception-handler
   io_function("with-input-from-file");
   io_function("with-output-to-file");
@@ -418,4 +468,128 @@ void add_basic_primtives(environment_t* env) {
                      tagged_reference(TAG_PRIMITIVE,
   &primtive_function_get_tag));
   */
+
+  // ==========================================================================
+  // Statistics about the implementation itself
+  // ==========================================================================
+  define_primitive(env, "inline-cache-statistics",
+                   primtive_function_inline_cache_statistics);
+  define_primitive(env, "cek-statistics", primtive_function_cek_statistics);
+}
+
+// See https://srfi.schemers.org/srfi-69/srfi-69.html
+
+void add_hash_table_primitives(environment_t* env) {
+  define_primitive(env, "make-hash-table", primtive_function_make_hash_table);
+  define_primitive(env, "hash-table?", primtive_function_hash_table_p);
+  define_primitive(env, "hash-table-ref", primtive_function_hash_table_ref);
+  define_primitive(env, "hash-table-ref/default",
+                   primtive_function_hash_table_ref_default);
+  define_primitive(env, "hash-table-set!", primtive_function_hash_table_set);
+  define_primitive(env, "hash-table-delete!",
+                   primtive_function_hash_table_delete);
+  define_primitive(env, "hash-table-exists?",
+                   primtive_function_hash_table_exists);
+  define_primitive(env, "hash-table-contains?",
+                   primtive_function_hash_table_exists);
+  define_primitive(env, "hash-table-update!",
+                   primtive_function_hash_table_update);
+  define_primitive(env, "hash-table-update!/default",
+                   primtive_function_hash_table_update_default);
+  define_primitive(env, "hash-table-size", primtive_function_hash_table_size);
+  define_primitive(env, "hash-table-count", primtive_function_hash_table_size);
+  define_primitive(env, "hash-table-walk", primtive_function_hash_table_walk);
+  define_primitive(env, "hash-table-fold", primtive_function_hash_table_fold);
+  define_primitive(env, "hash-table-keys", primtive_function_hash_table_keys);
+  define_primitive(env, "hash-table-values",
+                   primtive_function_hash_table_values);
+  define_primitive(env, "hash-table->alist",
+                   primtive_function_hash_table_to_alist);
+  define_primitive(env, "hash-table-clear!",
+                   primtive_function_hash_table_clear);
+  define_primitive(env, "hash-table-copy", primtive_function_hash_table_copy);
+  define_primitive(env, "hash", primtive_function_hash);
+  define_primitive(env, "string-hash", primtive_function_string_hash);
+  define_primitive(env, "hash-by-identity", primtive_function_hash_by_identity);
+}
+
+// See green-thread.c
+
+void add_green_thread_primitives(environment_t* env) {
+  define_primitive(env, "spawn", primtive_function_spawn);
+  define_primitive(env, "yield", primtive_function_yield);
+  define_primitive(env, "sleep", primtive_function_sleep);
+  define_primitive(env, "join", primtive_function_join);
+  define_primitive(env, "make-channel", primtive_function_make_channel);
+  define_primitive(env, "channel-send", primtive_function_channel_send);
+  define_primitive(env, "channel-receive", primtive_function_channel_receive);
+}
+
+// See interpreter-thread.c
+
+void add_interpreter_thread_primitives(environment_t* env) {
+  define_primitive(env, "spawn-interpreter-thread",
+                   primtive_function_spawn_interpreter_thread);
+  define_primitive(env, "join-interpreter-thread",
+                   primtive_function_join_interpreter_thread);
+  define_primitive(env, "processor-count", primtive_function_processor_count);
+}
+
+// See future.c
+
+void add_future_primitives(environment_t* env) {
+  define_primitive(env, "future", primtive_function_future);
+  define_primitive(env, "touch", primtive_function_touch);
+  define_primitive(env, "parallel-map", primtive_function_parallel_map);
+  define_primitive(env, "parallel-for-each",
+                   primtive_function_parallel_for_each);
+  define_primitive(env, "parallel-reduce", primtive_function_parallel_reduce);
+  define_primitive(env, "worker-count", primtive_function_worker_count);
+}
+
+// See shared-channel.c
+
+void add_shared_channel_primitives(environment_t* env) {
+  define_primitive(env, "make-shared-channel",
+                   primtive_function_make_shared_channel);
+  define_primitive(env, "channel-send-list",
+                   primtive_function_channel_send_list);
+  define_primitive(env, "channel-receive-list",
+                   primtive_function_channel_receive_list);
+}
+
+// See mark.c
+
+void add_mark_primitives(environment_t* env) {
+  define_primitive(env, "heap-mark", primtive_function_heap_mark);
+}
+
+// See profile.c
+
+void add_profile_primitives(environment_t* env) {
+  define_primitive(env, "profile-start", primtive_function_profile_start);
+  define_primitive(env, "profile-stop", primtive_function_profile_stop);
+}
+
+// See runtime-stats.c
+
+void add_runtime_stats_primitives(environment_t* env) {
+  define_primitive(env, "runtime-stats", primtive_function_runtime_stats);
+}
+
+// See heap-census.c
+
+void add_heap_census_primitives(environment_t* env) {
+  define_primitive(env, "heap-census", primtive_function_heap_census);
+}
+
+// See string-primitive.c (and SRFI-13)
+
+void add_string_search_primitives(environment_t* env) {
+  define_primitive(env, "string-search-forward",
+                   primtive_function_string_search_forward);
+  define_primitive(env, "string-contains", primtive_function_string_contains);
+  define_primitive(env, "string-prefix?", primtive_function_string_prefix_p);
+  define_primitive(env, "string-suffix?", primtive_function_string_suffix_p);
+  define_primitive(env, "string-index", primtive_function_string_index);
 }
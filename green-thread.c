@@ -0,0 +1,442 @@
+/**
+ * @file green-thread.c
+ *
+ * Green threads (spawn, yield, sleep and join) and channels so that
+ * many scheme computations can run concurrently in one OS thread.
+ *
+ * With the explicit stack evaluator (see cek-evaluator.c) every green
+ * thread has a stack of its own: a chain of segments that starts out
+ * small and grows on demand, so a thread that is waiting costs a few
+ * kilobytes. Switching threads saves the handful of registers that
+ * describe the stack of the running thread and restores those of the
+ * next one (no frames are copied). Threads are never preempted: a
+ * thread runs until it yields, sleeps, waits (for a channel or in
+ * join) or finishes.
+ *
+ * The scheduler is a FIFO run queue plus a list of sleeping threads
+ * ordered by the time they wake up. When no thread is runnable but
+ * some thread is sleeping, the process sleeps until it wakes up. When
+ * no thread is runnable or sleeping, they are deadlocked (which is a
+ * fatal error).
+ *
+ * The main thread (the one evaluating top-level forms) only lets the
+ * other threads run when it yields, sleeps or waits itself. Threads
+ * can't switch inside a procedure called from C (like the procedure
+ * given to hash-table-walk): yield does nothing there and waiting is
+ * an error.
+ *
+ * The tree walking evaluator can't suspend a computation so there
+ * spawn simply runs the new thread to completion right away.
+ */
+
+// ======================================================================
+// This is block is extraced to green-thread.h
+// ======================================================================
+
+#ifndef _GREEN_THREAD_H_
+#define _GREEN_THREAD_H_
+
+#include <stdint.h>
+
+#include "boolean.h"
+#include "continuation.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+typedef enum {
+  GREEN_THREAD_RUNNABLE,
+  GREEN_THREAD_RUNNING,
+  GREEN_THREAD_SLEEPING,
+  GREEN_THREAD_WAITING,
+  GREEN_THREAD_FINISHED,
+} green_thread_state_t;
+
+typedef struct green_thread_S {
+  uint64_t id;
+  green_thread_state_t state;
+  boolean_t is_started;
+  // Called with no arguments when the thread starts.
+  tagged_reference_t thunk;
+  // The value the thread is resumed with (like the value received
+  // from a channel, or the value a waiting sender wants to send) and
+  // finally the value of thunk.
+  tagged_reference_t value;
+  // The stack of a suspended thread (see cek-evaluator.c).
+  void* stack;
+  void* top;
+  void* bottom;
+  winder_t* winders;
+  // When a sleeping thread wakes up (see green_thread_now).
+  uint64_t wake_time;
+  // The next thread in the run queue or in a list of waiting threads.
+  struct green_thread_S* next;
+  // The threads waiting in join for this thread to finish.
+  struct green_thread_S* joiners;
+} green_thread_t;
+
+typedef struct {
+  green_thread_t* head;
+  green_thread_t* tail;
+} green_thread_queue_t;
+
+typedef struct {
+  // The most values the channel holds before a sender has to wait (0
+  // means there is no limit).
+  uint64_t capacity;
+  // A ring buffer whose size is a power of two.
+  tagged_reference_t* buffer;
+  uint64_t size;
+  uint64_t start;
+  uint64_t count;
+  green_thread_queue_t receivers;
+  green_thread_queue_t senders;
+} channel_t;
+
+// Set by a primitive that suspended the current thread. The
+// evaluator then switches to the thread green_thread_next() returns.
+extern _Thread_local boolean_t green_thread_must_switch;
+
+extern green_thread_t* current_green_thread(void);
+extern void green_thread_make_current(green_thread_t* thread);
+extern green_thread_t* green_thread_next(void);
+extern void green_thread_finish(green_thread_t* thread,
+                                tagged_reference_t value);
+extern uint64_t green_thread_now(void);
+
+extern tagged_reference_t primtive_function_spawn(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_yield(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_sleep(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_join(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_make_channel(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_channel_send(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_channel_receive(primitive_arguments_t args);
+
+static inline green_thread_t*
+    untag_green_thread(tagged_reference_t reference) {
+  require_tag(reference, TAG_GREEN_THREAD_T);
+  return (green_thread_t*) reference.data;
+}
+
+static inline channel_t* untag_channel(tagged_reference_t reference) {
+  require_tag(reference, TAG_CHANNEL_T);
+  return (channel_t*) reference.data;
+}
+
+#endif /* _GREEN_THREAD_H_ */
+
+// ======================================================================
+
+#include <string.h>
+#include <time.h>
+
+#include "allocate.h"
+#include "cek-evaluator.h"
+#include "evaluator.h"
+#include "fatal-error.h"
+#include "green-thread.h"
+#include "shared-channel.h"
+
+_Thread_local boolean_t green_thread_must_switch = false;
+
+_Thread_local green_thread_t* green_thread_current = NULL;
+_Thread_local green_thread_queue_t green_thread_run_queue = {NULL, NULL};
+// Ordered by wake_time.
+_Thread_local green_thread_t* green_thread_sleepers = NULL;
+_Thread_local uint64_t green_thread_next_id = 0;
+
+static void queue_add(green_thread_queue_t* queue, green_thread_t* thread) {
+  thread->next = NULL;
+  if (queue->tail == NULL) {
+    queue->head = thread;
+  } else {
+    queue->tail->next = thread;
+  }
+  queue->tail = thread;
+}
+
+static green_thread_t* queue_remove(green_thread_queue_t* queue) {
+  green_thread_t* result = queue->head;
+  if (result != NULL) {
+    queue->head = result->next;
+    if (queue->head == NULL) {
+      queue->tail = NULL;
+    }
+    result->next = NULL;
+  }
+  return result;
+}
+
+static green_thread_t* make_green_thread(tagged_reference_t thunk) {
+  green_thread_t* result = malloc_struct(green_thread_t);
+  result->id = green_thread_next_id++;
+  result->thunk = thunk;
+  return result;
+}
+
+/**
+ * Return the running thread (the main thread is made the first time
+ * this is called).
+ */
+green_thread_t* current_green_thread(void) {
+  if (green_thread_current == NULL) {
+    green_thread_current = make_green_thread(NIL);
+    green_thread_current->state = GREEN_THREAD_RUNNING;
+    green_thread_current->is_started = true;
+  }
+  return green_thread_current;
+}
+
+void green_thread_make_current(green_thread_t* thread) {
+  thread->state = GREEN_THREAD_RUNNING;
+  green_thread_current = thread;
+}
+
+/**
+ * Return the current time in nanoseconds (only differences between
+ * two times mean anything).
+ */
+uint64_t green_thread_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Make a thread runnable. It is resumed with value.
+ */
+static void green_thread_wake(green_thread_t* thread,
+                              tagged_reference_t value) {
+  thread->state = GREEN_THREAD_RUNNABLE;
+  thread->value = value;
+  queue_add(&green_thread_run_queue, thread);
+}
+
+/**
+ * Return the next thread to run (sleeping until one wakes up when
+ * necessary).
+ */
+green_thread_t* green_thread_next(void) {
+  while (true) {
+    if (green_thread_sleepers != NULL) {
+      uint64_t now = green_thread_now();
+      while (green_thread_sleepers != NULL
+             && green_thread_sleepers->wake_time <= now) {
+        green_thread_t* sleeper = green_thread_sleepers;
+        green_thread_sleepers = sleeper->next;
+        green_thread_wake(sleeper, NIL);
+      }
+    }
+    green_thread_t* result = queue_remove(&green_thread_run_queue);
+    if (result != NULL) {
+      return result;
+    }
+    if (green_thread_sleepers == NULL) {
+      fatal_error(ERROR_DEADLOCK);
+    }
+    uint64_t delay = green_thread_sleepers->wake_time - green_thread_now();
+    if ((int64_t) delay > 0) {
+      struct timespec duration = {.tv_sec = delay / 1000000000ULL,
+                                  .tv_nsec = delay % 1000000000ULL};
+      nanosleep(&duration, NULL);
+    }
+  }
+}
+
+/**
+ * Record the value of a thread that has finished and wake up the
+ * threads waiting for it.
+ */
+void green_thread_finish(green_thread_t* thread, tagged_reference_t value) {
+  thread->state = GREEN_THREAD_FINISHED;
+  thread->value = value;
+  thread->thunk = NIL;
+  while (thread->joiners != NULL) {
+    green_thread_t* joiner = thread->joiners;
+    thread->joiners = joiner->next;
+    green_thread_wake(joiner, value);
+  }
+}
+
+/**
+ * Suspend the current thread (which must be woken up later by
+ * someone else). Fatal when the evaluator can't switch threads right
+ * now.
+ */
+static void green_thread_suspend(green_thread_state_t state) {
+  if (!cek_can_switch()) {
+    fatal_error(cek_is_enabled() ? ERROR_GREEN_THREAD_CANT_WAIT
+                                 : ERROR_DEADLOCK);
+  }
+  current_green_thread()->state = state;
+  green_thread_must_switch = true;
+}
+
+/**
+ * Example (spawn (lambda () (channel-send c 1)))
+ */
+tagged_reference_t primtive_function_spawn(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  green_thread_t* thread = make_green_thread(arguments.args[0]);
+  if (!cek_is_enabled()) {
+    primitive_arguments_t no_arguments = {.n_args = 0};
+    green_thread_t* spawner = current_green_thread();
+    green_thread_make_current(thread);
+    thread->is_started = true;
+    tagged_reference_t value = apply_procedure(thread->thunk, no_arguments);
+    green_thread_make_current(spawner);
+    green_thread_finish(thread, value);
+  } else {
+    green_thread_wake(thread, NIL);
+  }
+  return tagged_reference(TAG_GREEN_THREAD_T, thread);
+}
+
+tagged_reference_t primtive_function_yield(primitive_arguments_t arguments) {
+  require_n_args(arguments, 0, 0);
+  if (cek_can_switch()) {
+    green_thread_wake(current_green_thread(), NIL);
+    green_thread_must_switch = true;
+  }
+  return NIL;
+}
+
+/**
+ * Example (sleep 10) ;; milliseconds
+ */
+tagged_reference_t primtive_function_sleep(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  uint64_t milliseconds = untag_uint64_t(arguments.args[0]);
+  if (!cek_can_switch()) {
+    struct timespec duration = {.tv_sec = milliseconds / 1000,
+                                .tv_nsec = (milliseconds % 1000) * 1000000};
+    nanosleep(&duration, NULL);
+    return NIL;
+  }
+  green_thread_t* self = current_green_thread();
+  self->wake_time = green_thread_now() + milliseconds * 1000000;
+  green_thread_t** link = &green_thread_sleepers;
+  while (*link != NULL && (*link)->wake_time <= self->wake_time) {
+    link = &(*link)->next;
+  }
+  self->next = *link;
+  *link = self;
+  green_thread_suspend(GREEN_THREAD_SLEEPING);
+  return NIL;
+}
+
+/**
+ * Wait for a thread to finish and return the value of its thunk.
+ */
+tagged_reference_t primtive_function_join(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  green_thread_t* thread = untag_green_thread(arguments.args[0]);
+  if (thread->state == GREEN_THREAD_FINISHED) {
+    return thread->value;
+  }
+  green_thread_t* self = current_green_thread();
+  self->next = thread->joiners;
+  thread->joiners = self;
+  green_thread_suspend(GREEN_THREAD_WAITING);
+  return NIL;
+}
+
+/**
+ * Example (make-channel) or (make-channel capacity)
+ */
+tagged_reference_t
+    primtive_function_make_channel(primitive_arguments_t arguments) {
+  require_n_args(arguments, 0, 1);
+  channel_t* channel = malloc_struct(channel_t);
+  if (arguments.n_args == 1) {
+    channel->capacity = untag_uint64_t(arguments.args[0]);
+  }
+  channel->size = 8;
+  channel->buffer = (tagged_reference_t*) malloc_bytes(
+      channel->size * sizeof(tagged_reference_t));
+  return tagged_reference(TAG_CHANNEL_T, channel);
+}
+
+static void channel_add(channel_t* channel, tagged_reference_t value) {
+  if (channel->count == channel->size) {
+    tagged_reference_t* buffer = (tagged_reference_t*) malloc_bytes(
+        2 * channel->size * sizeof(tagged_reference_t));
+    for (uint64_t i = 0; i < channel->count; i++) {
+      buffer[i] = channel->buffer[(channel->start + i) & (channel->size - 1)];
+    }
+    free_bytes(channel->buffer);
+    channel->buffer = buffer;
+    channel->size *= 2;
+    channel->start = 0;
+  }
+  channel->buffer[(channel->start + channel->count) & (channel->size - 1)]
+      = value;
+  channel->count++;
+}
+
+static tagged_reference_t channel_remove(channel_t* channel) {
+  tagged_reference_t result = channel->buffer[channel->start];
+  channel->start = (channel->start + 1) & (channel->size - 1);
+  channel->count--;
+  return result;
+}
+
+/**
+ * Example (channel-send channel value)
+ *
+ * A waiting receiver gets the value right away. Otherwise the value is
+ * buffered unless the channel is full, in which case the sender waits
+ * for a receiver to make room.
+ *
+ * This also sends to a shared channel (see shared-channel.c).
+ */
+tagged_reference_t
+    primtive_function_channel_send(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  if (arguments.args[0].tag == TAG_SHARED_CHANNEL_T) {
+    shared_channel_send(untag_shared_channel(arguments.args[0]),
+                        arguments.args[1]);
+    return NIL;
+  }
+  channel_t* channel = untag_channel(arguments.args[0]);
+  green_thread_t* receiver = queue_remove(&channel->receivers);
+  if (receiver != NULL) {
+    green_thread_wake(receiver, arguments.args[1]);
+  } else if (channel->capacity == 0 || channel->count < channel->capacity) {
+    channel_add(channel, arguments.args[1]);
+  } else {
+    green_thread_t* self = current_green_thread();
+    green_thread_suspend(GREEN_THREAD_WAITING);
+    self->value = arguments.args[1];
+    queue_add(&channel->senders, self);
+  }
+  return NIL;
+}
+
+/**
+ * Example (channel-receive channel)
+ *
+ * This also receives from a shared channel (see shared-channel.c).
+ */
+tagged_reference_t
+    primtive_function_channel_receive(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  if (arguments.args[0].tag == TAG_SHARED_CHANNEL_T) {
+    return shared_channel_receive(untag_shared_channel(arguments.args[0]));
+  }
+  channel_t* channel = untag_channel(arguments.args[0]);
+  if (channel->count > 0) {
+    tagged_reference_t result = channel_remove(channel);
+    green_thread_t* sender = queue_remove(&channel->senders);
+    if (sender != NULL) {
+      channel_add(channel, sender->value);
+      green_thread_wake(sender, NIL);
+    }
+    return result;
+  }
+  green_thread_suspend(GREEN_THREAD_WAITING);
+  queue_add(&channel->receivers, current_green_thread());
+  return NIL;
+}
@@ -0,0 +1,728 @@
+/**
+ * @file hash-table.c
+ *
+ * This file contains an open addressing hash table keyed by
+ * tagged_reference_t (plus the SRFI-69 style primitives that expose
+ * it to scheme).
+ *
+ * The layout follows the "Swiss table" design: besides the array of
+ * entries there is an array of one byte "control" values, one per
+ * slot, which either mark the slot as empty/deleted or hold 7 bits
+ * of the hash code of the key in that slot. A lookup loads a group
+ * of 16 control bytes at once and compares them all against the
+ * wanted 7 bits (with SSE2 when available) so that only slots that
+ * are very likely to hold the key ever have their key compared.
+ */
+
+// ======================================================================
+// This is block is extraced to hash-table.h
+// ======================================================================
+
+#ifndef _HASH_TABLE_H_
+#define _HASH_TABLE_H_
+
+#include <stdint.h>
+
+#include "boolean.h"
+#include "optional.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+typedef enum {
+  HASH_TABLE_EQ,
+  HASH_TABLE_EQV,
+  HASH_TABLE_EQUAL,
+  HASH_TABLE_STRING,
+} hash_table_equivalence_t;
+
+typedef struct {
+  tagged_reference_t key;
+  tagged_reference_t value;
+} hash_table_entry_t;
+
+typedef struct {
+  hash_table_equivalence_t equivalence;
+  uint64_t n_entries;
+  uint64_t n_deleted;
+  // Always a power of two and never smaller than a group.
+  uint64_t capacity;
+  // capacity + HASH_TABLE_GROUP_WIDTH bytes. The extra bytes mirror
+  // the first group so a group can be loaded from any slot.
+  uint8_t* control;
+  hash_table_entry_t* entries;
+} hash_table_t;
+
+extern hash_table_t* make_hash_table(hash_table_equivalence_t equivalence,
+                                     uint64_t initial_capacity);
+extern optional_t hash_table_get(hash_table_t* table, tagged_reference_t key);
+extern hash_table_entry_t* hash_table_find_entry(hash_table_t* table,
+                                                 tagged_reference_t key);
+extern hash_table_entry_t* hash_table_insert_entry(hash_table_t* table,
+                                                   tagged_reference_t key);
+extern void hash_table_set(hash_table_t* table, tagged_reference_t key,
+                           tagged_reference_t value);
+extern boolean_t hash_table_delete(hash_table_t* table,
+                                   tagged_reference_t key);
+extern void hash_table_clear(hash_table_t* table);
+extern hash_table_t* hash_table_copy(hash_table_t* table);
+
+/**
+ * Iterate over all of the entries in a hash table without allocating
+ * anything. Use like this:
+ *
+ * for (uint64_t i = 0; i < table->capacity; i++) {
+ *   if (hash_table_slot_is_full(table, i)) { ... table->entries[i] ... }
+ * }
+ */
+static inline boolean_t hash_table_slot_is_full(hash_table_t* table,
+                                                uint64_t slot) {
+  return (table->control[slot] & 0x80) == 0;
+}
+
+static inline hash_table_t* untag_hash_table(tagged_reference_t reference) {
+  require_tag(reference, TAG_HASH_TABLE_T);
+  return (hash_table_t*) reference.data;
+}
+
+extern tagged_reference_t
+    primtive_function_make_hash_table(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_ref(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_ref_default(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_set(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_delete(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_exists(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_update(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_update_default(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_size(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_walk(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_fold(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_keys(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_values(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_to_alist(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_clear(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_table_copy(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_hash(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_hash(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_hash_by_identity(primitive_arguments_t args);
+
+#endif /* _HASH_TABLE_H_ */
+
+// ======================================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "allocate.h"
+#include "equivalence.h"
+#include "evaluator.h"
+#include "fatal-error.h"
+#include "hash-table.h"
+#include "pair.h"
+#include "string-util.h"
+
+#define HASH_TABLE_GROUP_WIDTH 16
+
+#define CONTROL_EMPTY ((uint8_t) 0x80)
+#define CONTROL_DELETED ((uint8_t) 0xfe)
+
+// The low 7 bits of the hash are stored in the control byte (h2) and
+// the remaining bits pick the first group to probe (h1).
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t) ((hash) & 0x7f))
+
+/**
+ * Return a bit mask with bit i set when control byte i of the group
+ * starting at control equals byte.
+ */
+static inline uint32_t group_match(const uint8_t* control, uint8_t byte) {
+#if defined(__SSE2__)
+  __m128i group = _mm_loadu_si128((const __m128i*) control);
+  return (uint32_t) _mm_movemask_epi8(
+      _mm_cmpeq_epi8(group, _mm_set1_epi8((char) byte)));
+#else
+  uint32_t result = 0;
+  for (int i = 0; i < HASH_TABLE_GROUP_WIDTH; i++) {
+    if (control[i] == byte) {
+      result |= (1 << i);
+    }
+  }
+  return result;
+#endif
+}
+
+/**
+ * Return a bit mask with bit i set when slot i of the group is empty
+ * or deleted (these are the only control bytes with the high bit
+ * set).
+ */
+static inline uint32_t group_match_empty_or_deleted(const uint8_t* control) {
+#if defined(__SSE2__)
+  __m128i group = _mm_loadu_si128((const __m128i*) control);
+  return (uint32_t) _mm_movemask_epi8(group);
+#else
+  uint32_t result = 0;
+  for (int i = 0; i < HASH_TABLE_GROUP_WIDTH; i++) {
+    if (control[i] & 0x80) {
+      result |= (1 << i);
+    }
+  }
+  return result;
+#endif
+}
+
+static uint64_t hash_table_hash(hash_table_t* table, tagged_reference_t key) {
+  switch (table->equivalence) {
+  case HASH_TABLE_EQ:
+  case HASH_TABLE_EQV:
+    return hash_eq(key);
+  case HASH_TABLE_EQUAL:
+    return hash_equal(key);
+  case HASH_TABLE_STRING:
+    return string_or_reader_symbol_hash(key);
+  }
+  fatal_error(ERROR_NOT_REACHED);
+}
+
+static boolean_t hash_table_key_equal(hash_table_t* table,
+                                      tagged_reference_t a,
+                                      tagged_reference_t b) {
+  switch (table->equivalence) {
+  case HASH_TABLE_EQ:
+    return is_eq(a, b);
+  case HASH_TABLE_EQV:
+    return is_eqv(a, b);
+  case HASH_TABLE_EQUAL:
+    return is_equal(a, b);
+  case HASH_TABLE_STRING:
+    if (a.tag == TAG_STRING && b.tag == TAG_STRING) {
+      return immutable_string_equal((char*) a.data, (char*) b.data);
+    }
+    return string_equal(untag_string_or_reader_symbol(a),
+                        untag_string_or_reader_symbol(b));
+  }
+  fatal_error(ERROR_NOT_REACHED);
+}
+
+static inline void set_control(hash_table_t* table, uint64_t slot,
+                               uint8_t byte) {
+  table->control[slot] = byte;
+  if (slot < HASH_TABLE_GROUP_WIDTH) {
+    table->control[table->capacity + slot] = byte;
+  }
+}
+
+static void allocate_slots(hash_table_t* table, uint64_t capacity) {
+  table->capacity = capacity;
+  table->control = malloc_bytes(capacity + HASH_TABLE_GROUP_WIDTH);
+  memset(table->control, CONTROL_EMPTY, capacity + HASH_TABLE_GROUP_WIDTH);
+  table->entries = (hash_table_entry_t*) malloc_bytes(
+      capacity * sizeof(hash_table_entry_t));
+  table->n_entries = 0;
+  table->n_deleted = 0;
+}
+
+/**
+ * Make an empty hash table. The initial_capacity is a hint.
+ */
+hash_table_t* make_hash_table(hash_table_equivalence_t equivalence,
+                              uint64_t initial_capacity) {
+  uint64_t capacity = HASH_TABLE_GROUP_WIDTH;
+  while (capacity < initial_capacity) {
+    capacity *= 2;
+  }
+  hash_table_t* result = malloc_struct(hash_table_t);
+  result->equivalence = equivalence;
+  allocate_slots(result, capacity);
+  return result;
+}
+
+/**
+ * Find the slot holding key or return -1.
+ */
+static int64_t hash_table_find_slot(hash_table_t* table,
+                                    tagged_reference_t key, uint64_t hash) {
+  uint64_t mask = table->capacity - 1;
+  uint64_t position = H1(hash) & mask;
+  uint8_t h2 = H2(hash);
+  for (uint64_t stride = 0; stride <= table->capacity;
+       stride += HASH_TABLE_GROUP_WIDTH) {
+    const uint8_t* group = &table->control[position];
+    uint32_t matches = group_match(group, h2);
+    while (matches) {
+      uint64_t slot = (position + __builtin_ctz(matches)) & mask;
+      if (hash_table_key_equal(table, table->entries[slot].key, key)) {
+        return slot;
+      }
+      matches &= matches - 1;
+    }
+    // An empty slot in this group means the probe sequence used by
+    // any insert of key would have stopped here.
+    if (group_match(group, CONTROL_EMPTY)) {
+      return -1;
+    }
+    position = (position + stride + HASH_TABLE_GROUP_WIDTH) & mask;
+  }
+  return -1;
+}
+
+/**
+ * Find the first empty or deleted slot on the probe sequence for
+ * hash. There always is one because the table is never full.
+ */
+static uint64_t hash_table_find_free_slot(hash_table_t* table, uint64_t hash) {
+  uint64_t mask = table->capacity - 1;
+  uint64_t position = H1(hash) & mask;
+  for (uint64_t stride = 0;; stride += HASH_TABLE_GROUP_WIDTH) {
+    uint32_t free_slots
+        = group_match_empty_or_deleted(&table->control[position]);
+    if (free_slots) {
+      return (position + __builtin_ctz(free_slots)) & mask;
+    }
+    position = (position + stride + HASH_TABLE_GROUP_WIDTH) & mask;
+  }
+}
+
+static void hash_table_rehash(hash_table_t* table, uint64_t new_capacity) {
+  uint64_t old_capacity = table->capacity;
+  uint8_t* old_control = table->control;
+  hash_table_entry_t* old_entries = table->entries;
+
+  allocate_slots(table, new_capacity);
+  for (uint64_t i = 0; i < old_capacity; i++) {
+    if ((old_control[i] & 0x80) == 0) {
+      uint64_t hash = hash_table_hash(table, old_entries[i].key);
+      uint64_t slot = hash_table_find_free_slot(table, hash);
+      set_control(table, slot, H2(hash));
+      table->entries[slot] = old_entries[i];
+      table->n_entries++;
+    }
+  }
+
+  free_bytes(old_control);
+  free_bytes(old_entries);
+}
+
+/**
+ * Return a pointer to the entry for key or NULL. The pointer is only
+ * valid until the next insertion into the table.
+ */
+hash_table_entry_t* hash_table_find_entry(hash_table_t* table,
+                                          tagged_reference_t key) {
+  int64_t slot = hash_table_find_slot(table, key, hash_table_hash(table, key));
+  if (slot < 0) {
+    return NULL;
+  }
+  return &table->entries[slot];
+}
+
+/**
+ * Return a pointer to the entry for key, creating one (with a NIL
+ * value) when necessary. This allows updates to be done in place
+ * with a single probe.
+ */
+hash_table_entry_t* hash_table_insert_entry(hash_table_t* table,
+                                            tagged_reference_t key) {
+  uint64_t hash = hash_table_hash(table, key);
+  int64_t slot = hash_table_find_slot(table, key, hash);
+  if (slot >= 0) {
+    return &table->entries[slot];
+  }
+
+  // Keep the load factor (including deleted slots) at or below 7/8.
+  if ((table->n_entries + table->n_deleted + 1) * 8 > table->capacity * 7) {
+    uint64_t new_capacity = table->capacity;
+    if ((table->n_entries + 1) * 2 > table->capacity) {
+      new_capacity *= 2;
+    }
+    hash_table_rehash(table, new_capacity);
+  }
+
+  uint64_t free_slot = hash_table_find_free_slot(table, hash);
+  if (table->control[free_slot] == CONTROL_DELETED) {
+    table->n_deleted--;
+  }
+  set_control(table, free_slot, H2(hash));
+  table->entries[free_slot].key = key;
+  table->entries[free_slot].value = NIL;
+  table->n_entries++;
+  return &table->entries[free_slot];
+}
+
+optional_t hash_table_get(hash_table_t* table, tagged_reference_t key) {
+  hash_table_entry_t* entry = hash_table_find_entry(table, key);
+  if (entry == NULL) {
+    return optional_empty();
+  }
+  return optional_of(entry->value);
+}
+
+void hash_table_set(hash_table_t* table, tagged_reference_t key,
+                    tagged_reference_t value) {
+  hash_table_insert_entry(table, key)->value = value;
+}
+
+/**
+ * Remove key from the table returning true if it was present.
+ */
+boolean_t hash_table_delete(hash_table_t* table, tagged_reference_t key) {
+  int64_t slot = hash_table_find_slot(table, key, hash_table_hash(table, key));
+  if (slot < 0) {
+    return false;
+  }
+  set_control(table, slot, CONTROL_DELETED);
+  table->entries[slot].key = NIL;
+  table->entries[slot].value = NIL;
+  table->n_entries--;
+  table->n_deleted++;
+  return true;
+}
+
+void hash_table_clear(hash_table_t* table) {
+  memset(table->control, CONTROL_EMPTY,
+         table->capacity + HASH_TABLE_GROUP_WIDTH);
+  memset(table->entries, 0, table->capacity * sizeof(hash_table_entry_t));
+  table->n_entries = 0;
+  table->n_deleted = 0;
+}
+
+hash_table_t* hash_table_copy(hash_table_t* table) {
+  hash_table_t* result = malloc_struct(hash_table_t);
+  *result = *table;
+  result->control = malloc_bytes(table->capacity + HASH_TABLE_GROUP_WIDTH);
+  memcpy(result->control, table->control,
+         table->capacity + HASH_TABLE_GROUP_WIDTH);
+  result->entries = (hash_table_entry_t*) malloc_bytes(
+      table->capacity * sizeof(hash_table_entry_t));
+  memcpy(result->entries, table->entries,
+         table->capacity * sizeof(hash_table_entry_t));
+  return result;
+}
+
+/**
+ * Free a table nothing else refers to (like a copy only used while
+ * iterating).
+ */
+static void hash_table_free(hash_table_t* table) {
+  free_bytes(table->control);
+  free_bytes(table->entries);
+  free_bytes(table);
+}
+
+// ======================================================================
+// Scheme primitives (see SRFI-69)
+// ======================================================================
+
+static inline tagged_reference_t call_0(tagged_reference_t fn) {
+  primitive_arguments_t arguments = {.n_args = 0};
+  return apply_procedure(fn, arguments);
+}
+
+static inline tagged_reference_t call_1(tagged_reference_t fn,
+                                        tagged_reference_t arg) {
+  primitive_arguments_t arguments = {.n_args = 1};
+  arguments.args[0] = arg;
+  return apply_procedure(fn, arguments);
+}
+
+/**
+ * Example (make-hash-table) or (make-hash-table string=?)
+ *
+ * The optional equivalence procedure must be one of the eq?, eqv?,
+ * equal? or string=? primitives. An optional hash function is
+ * accepted but ignored since we always use the hash function that
+ * matches the equivalence procedure.
+ */
+tagged_reference_t
+    primtive_function_make_hash_table(primitive_arguments_t arguments) {
+  require_n_args(arguments, 0, 2);
+  hash_table_equivalence_t equivalence = HASH_TABLE_EQUAL;
+  if (arguments.n_args >= 1) {
+    primitive_t predicate = untag_primitive(arguments.args[0]);
+    if (predicate == &primtive_function_eq_p) {
+      equivalence = HASH_TABLE_EQ;
+    } else if (predicate == &primtive_function_eqv_p) {
+      equivalence = HASH_TABLE_EQV;
+    } else if (predicate == &primtive_function_equal_p) {
+      equivalence = HASH_TABLE_EQUAL;
+    } else if (predicate == &primtive_function_string_equal_p) {
+      equivalence = HASH_TABLE_STRING;
+    } else {
+      fatal_error(ERROR_REFERENCE_NOT_EXPECTED_TYPE);
+    }
+  }
+  return tagged_reference(TAG_HASH_TABLE_T, make_hash_table(equivalence, 0));
+}
+
+tagged_reference_t
+    primtive_function_hash_table_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return tag_boolean(arguments.args[0].tag == TAG_HASH_TABLE_T);
+}
+
+/**
+ * Example (hash-table-ref table key) or (hash-table-ref table key
+ * thunk) where thunk is called when key is not present.
+ */
+tagged_reference_t
+    primtive_function_hash_table_ref(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 3);
+  hash_table_t* table = untag_hash_table(arguments.args[0]);
+  hash_table_entry_t* entry = hash_table_find_entry(table, arguments.args[1]);
+  if (entry != NULL) {
+    return entry->value;
+  }
+  if (arguments.n_args == 3) {
+    return call_0(arguments.args[2]);
+  }
+  fatal_error(ERROR_KEY_NOT_FOUND);
+}
+
+tagged_reference_t
+    primtive_function_hash_table_ref_default(primitive_arguments_t arguments) {
+  require_n_args(arguments, 3, 3);
+  hash_table_t* table = untag_hash_table(arguments.args[0]);
+  hash_table_entry_t* entry = hash_table_find_entry(table, arguments.args[1]);
+  if (entry != NULL) {
+    return entry->value;
+  }
+  return arguments.args[2];
+}
+
+tagged_reference_t
+    primtive_function_hash_table_set(primitive_arguments_t arguments) {
+  require_n_args(arguments, 3, 3);
+  hash_table_set(untag_hash_table(arguments.args[0]), arguments.args[1],
+                 arguments.args[2]);
+  return NIL;
+}
+
+tagged_reference_t
+    primtive_function_hash_table_delete(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  hash_table_delete(untag_hash_table(arguments.args[0]), arguments.args[1]);
+  return NIL;
+}
+
+tagged_reference_t
+    primtive_function_hash_table_exists(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  hash_table_t* table = untag_hash_table(arguments.args[0]);
+  return tag_boolean(hash_table_find_entry(table, arguments.args[1]) != NULL);
+}
+
+/**
+ * Store value in entry, what hash_table_find_entry returned for key
+ * (when entries were the table's entries and entry held entry_key)
+ * before calling out to scheme. The entry is written directly unless
+ * the call moved or removed it (a rehash allocates new entries, a
+ * delete or clear empties the slot) in which case key is looked up
+ * again.
+ */
+static void hash_table_update_entry(hash_table_t* table,
+                                    tagged_reference_t key,
+                                    hash_table_entry_t* entries,
+                                    hash_table_entry_t* entry,
+                                    tagged_reference_t entry_key,
+                                    tagged_reference_t value) {
+  if (entry != NULL && table->entries == entries
+      && hash_table_slot_is_full(table, entry - entries)
+      && entry->key.tag == entry_key.tag
+      && entry->key.data == entry_key.data) {
+    entry->value = value;
+  } else {
+    hash_table_set(table, key, value);
+  }
+}
+
+/**
+ * Example (hash-table-update! table key proc) or (hash-table-update!
+ * table key proc thunk).
+ *
+ * proc may itself modify the table, see hash_table_update_entry.
+ */
+tagged_reference_t
+    primtive_function_hash_table_update(primitive_arguments_t arguments) {
+  require_n_args(arguments, 3, 4);
+  hash_table_t* table = untag_hash_table(arguments.args[0]);
+  tagged_reference_t key = arguments.args[1];
+  hash_table_entry_t* entries = table->entries;
+  hash_table_entry_t* entry = hash_table_find_entry(table, key);
+  tagged_reference_t entry_key = entry != NULL ? entry->key : NIL;
+  tagged_reference_t old_value;
+  if (entry != NULL) {
+    old_value = entry->value;
+  } else if (arguments.n_args == 4) {
+    old_value = call_0(arguments.args[3]);
+  } else {
+    fatal_error(ERROR_KEY_NOT_FOUND);
+  }
+  tagged_reference_t new_value = call_1(arguments.args[2], old_value);
+  hash_table_update_entry(table, key, entries, entry, entry_key, new_value);
+  return NIL;
+}
+
+tagged_reference_t primtive_function_hash_table_update_default(
+    primitive_arguments_t arguments) {
+  require_n_args(arguments, 4, 4);
+  hash_table_t* table = untag_hash_table(arguments.args[0]);
+  tagged_reference_t key = arguments.args[1];
+  hash_table_entry_t* entries = table->entries;
+  hash_table_entry_t* entry = hash_table_find_entry(table, key);
+  tagged_reference_t entry_key = entry != NULL ? entry->key : NIL;
+  tagged_reference_t old_value
+      = (entry != NULL) ? entry->value : arguments.args[3];
+  tagged_reference_t new_value = call_1(arguments.args[2], old_value);
+  hash_table_update_entry(table, key, entries, entry, entry_key, new_value);
+  return NIL;
+}
+
+tagged_reference_t
+    primtive_function_hash_table_size(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return tagged_reference(TAG_UINT64_T,
+                          untag_hash_table(arguments.args[0])->n_entries);
+}
+
+/**
+ * Example (hash-table-walk table (lambda (key value) ...))
+ *
+ * proc may modify the table (and move its entries) so the entries as
+ * they were when the walk started are visited.
+ */
+tagged_reference_t
+    primtive_function_hash_table_walk(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  hash_table_t* table = hash_table_copy(untag_hash_table(arguments.args[0]));
+  primitive_arguments_t proc_arguments = {.n_args = 2};
+  for (uint64_t i = 0; i < table->capacity; i++) {
+    if (hash_table_slot_is_full(table, i)) {
+      proc_arguments.args[0] = table->entries[i].key;
+      proc_arguments.args[1] = table->entries[i].value;
+      apply_procedure(arguments.args[1], proc_arguments);
+    }
+  }
+  hash_table_free(table);
+  return NIL;
+}
+
+/**
+ * Example (hash-table-fold table (lambda (key value acc) ...) initial)
+ *
+ * Like hash-table-walk, proc sees the entries as they were when the
+ * fold started.
+ */
+tagged_reference_t
+    primtive_function_hash_table_fold(primitive_arguments_t arguments) {
+  require_n_args(arguments, 3, 3);
+  hash_table_t* table = hash_table_copy(untag_hash_table(arguments.args[0]));
+  tagged_reference_t result = arguments.args[2];
+  primitive_arguments_t proc_arguments = {.n_args = 3};
+  for (uint64_t i = 0; i < table->capacity; i++) {
+    if (hash_table_slot_is_full(table, i)) {
+      proc_arguments.args[0] = table->entries[i].key;
+      proc_arguments.args[1] = table->entries[i].value;
+      proc_arguments.args[2] = result;
+      result = apply_procedure(arguments.args[1], proc_arguments);
+    }
+  }
+  hash_table_free(table);
+  return result;
+}
+
+tagged_reference_t
+    primtive_function_hash_table_keys(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  hash_table_t* table = untag_hash_table(arguments.args[0]);
+  tagged_reference_t result = NIL;
+  for (uint64_t i = 0; i < table->capacity; i++) {
+    if (hash_table_slot_is_full(table, i)) {
+      result = cons(table->entries[i].key, result);
+    }
+  }
+  return result;
+}
+
+tagged_reference_t
+    primtive_function_hash_table_values(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  hash_table_t* table = untag_hash_table(arguments.args[0]);
+  tagged_reference_t result = NIL;
+  for (uint64_t i = 0; i < table->capacity; i++) {
+    if (hash_table_slot_is_full(table, i)) {
+      result = cons(table->entries[i].value, result);
+    }
+  }
+  return result;
+}
+
+tagged_reference_t
+    primtive_function_hash_table_to_alist(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  hash_table_t* table = untag_hash_table(arguments.args[0]);
+  tagged_reference_t result = NIL;
+  for (uint64_t i = 0; i < table->capacity; i++) {
+    if (hash_table_slot_is_full(table, i)) {
+      result = cons(cons(table->entries[i].key, table->entries[i].value),
+                    result);
+    }
+  }
+  return result;
+}
+
+tagged_reference_t
+    primtive_function_hash_table_clear(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  hash_table_clear(untag_hash_table(arguments.args[0]));
+  return NIL;
+}
+
+tagged_reference_t
+    primtive_function_hash_table_copy(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 2);
+  return tagged_reference(TAG_HASH_TABLE_T,
+                          hash_table_copy(untag_hash_table(arguments.args[0])));
+}
+
+/**
+ * Example (hash obj) returns a hash code consistent with equal?.
+ */
+tagged_reference_t primtive_function_hash(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 2);
+  return tagged_reference(TAG_UINT64_T, hash_equal(arguments.args[0]));
+}
+
+tagged_reference_t
+    primtive_function_string_hash(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 2);
+  return tagged_reference(TAG_UINT64_T,
+                          string_or_reader_symbol_hash(arguments.args[0]));
+}
+
+tagged_reference_t
+    primtive_function_hash_by_identity(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 2);
+  return tagged_reference(TAG_UINT64_T, hash_eq(arguments.args[0]));
+}
@@ -0,0 +1,473 @@
+/**
+ * @file heap-census.c
+ *
+ * A census of everything reachable from the global environments: how
+ * many objects (and bytes) there are of each type and how much of
+ * the heap each top-level binding keeps alive on its own.
+ *
+ * Objects are malloced without a header (and there is no list of
+ * them), so "the heap" here is what the heap marker would find (see
+ * mark.c). The walk is done by a single thread using the marker's
+ * knowledge of what every object refers to.
+ *
+ * The retained size of a binding is the size of the objects that are
+ * only reachable through its value. Each binding's value is walked in
+ * turn and every object remembers the first binding that reached it.
+ * When another binding reaches it too, it (and everything it refers
+ * to) is marked as shared instead, so no object is walked more than
+ * a few times. The global environments themselves and their bindings
+ * are shared from the start.
+ *
+ * (heap-census "file") also writes every object to a file in a
+ * simple binary format (all numbers are 64 bit and in the byte order
+ * of the machine):
+ *
+ *   "AKHEAP" 0 1, number of objects, number of roots
+ *   for every object: address, tag, size, number of children and the
+ *     address of every child that is a heap object
+ *   for every root (top-level binding): address (or immediate data)
+ *     of the value, its tag, the length of its name and the name
+ *     itself (not padded)
+ */
+
+// ======================================================================
+// This is block is extraced to heap-census.h
+// ======================================================================
+
+#ifndef _HEAP_CENSUS_H_
+#define _HEAP_CENSUS_H_
+
+#include "primitive.h"
+#include "tagged-reference.h"
+
+extern tagged_reference_t
+    primtive_function_heap_census(primitive_arguments_t args);
+
+#endif /* _HEAP_CENSUS_H_ */
+
+// ======================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocate.h"
+#include "array.h"
+#include "environment.h"
+#include "fatal-error.h"
+#include "heap-census.h"
+#include "mark.h"
+#include "pair.h"
+#include "string-util.h"
+
+#define HEAP_CENSUS_INITIAL_CAPACITY 1024
+// The owner of an object reachable from more than one binding.
+#define HEAP_CENSUS_SHARED UINT64_MAX
+
+typedef struct {
+  // 0 is an empty slot.
+  uint64_t address;
+  uint64_t tag;
+  // The index of the binding that reached it or HEAP_CENSUS_SHARED.
+  uint64_t owner;
+} heap_census_object_t;
+
+typedef struct {
+  char* name;
+  tagged_reference_t value;
+  uint64_t retained_bytes;
+} heap_census_root_t;
+
+typedef struct {
+  tagged_reference_t* entries;
+  uint64_t n_entries;
+  uint64_t capacity;
+} heap_census_stack_t;
+
+typedef struct {
+  // Always a power of two.
+  uint64_t capacity;
+  uint64_t n_objects;
+  heap_census_object_t* objects;
+  heap_census_root_t* roots;
+  uint64_t n_roots;
+  uint64_t roots_capacity;
+  // The binding being walked.
+  uint64_t owner;
+  heap_census_stack_t owned;
+  heap_census_stack_t shared;
+} heap_census_t;
+
+static const char* heap_census_tag_names[MARK_MAX_TAGS] = {
+    [TAG_STRING] = "string",
+    [TAG_SCHEME_SYMBOL] = "symbol",
+    [TAG_PAIR_T] = "pair",
+    [TAG_VECTOR_T] = "vector",
+    [TAG_RECORD_T] = "record",
+    [TAG_BYTE_VECTOR_T] = "bytevector",
+    [TAG_CLOSURE_T] = "closure",
+    [TAG_CPU_THREAD_STATE_T] = "cpu-thread-state",
+    [TAG_HASH_TABLE_T] = "hash-table",
+    [TAG_LAMBDA_ANALYSIS_T] = "lambda-analysis",
+    [TAG_GLOBAL_REFERENCE_T] = "global-reference",
+    [TAG_CALL_SITE_T] = "call-site",
+    [TAG_NAMED_LET_LOOP_T] = "named-let-loop",
+    [TAG_SYNTAX_RULES_T] = "syntax-rules",
+    [TAG_CONTINUATION_T] = "continuation",
+    [TAG_GREEN_THREAD_T] = "green-thread",
+    [TAG_CHANNEL_T] = "channel",
+    [TAG_INTERPRETER_THREAD_T] = "interpreter-thread",
+    [TAG_FUTURE_T] = "future",
+    [TAG_SHARED_CHANNEL_T] = "shared-channel",
+    [TAG_ENVIRONMENT_T] = "environment",
+    [TAG_CLOSURE_SLOT_T] = "closure-slot",
+};
+
+static inline uint64_t heap_census_address_hash(uint64_t address) {
+  // Objects are at least 8 byte aligned.
+  return (address >> 3) * 0x9e3779b97f4a7c15ULL;
+}
+
+static void heap_census_grow(heap_census_t* census) {
+  uint64_t old_capacity = census->capacity;
+  heap_census_object_t* old_objects = census->objects;
+  census->capacity = old_capacity * 2;
+  census->objects = (heap_census_object_t*) malloc_bytes(
+      census->capacity * sizeof(heap_census_object_t));
+  for (uint64_t i = 0; i < old_capacity; i++) {
+    if (old_objects[i].address != 0) {
+      uint64_t mask = census->capacity - 1;
+      uint64_t j = heap_census_address_hash(old_objects[i].address) & mask;
+      while (census->objects[j].address != 0) {
+        j = (j + 1) & mask;
+      }
+      census->objects[j] = old_objects[i];
+    }
+  }
+  free_bytes(old_objects);
+}
+
+/**
+ * Return the entry for object, adding one (with owner set to owner)
+ * when there isn't one yet. *is_new tells which happened.
+ */
+static heap_census_object_t* heap_census_find(heap_census_t* census,
+                                              tagged_reference_t object,
+                                              uint64_t owner,
+                                              boolean_t* is_new) {
+  // Keep the table at most half full.
+  if (2 * (census->n_objects + 1) > census->capacity) {
+    heap_census_grow(census);
+  }
+  uint64_t mask = census->capacity - 1;
+  uint64_t i = heap_census_address_hash(object.data) & mask;
+  while (census->objects[i].address != 0) {
+    if (census->objects[i].address == object.data) {
+      *is_new = false;
+      return &census->objects[i];
+    }
+    i = (i + 1) & mask;
+  }
+  census->objects[i].address = object.data;
+  census->objects[i].tag = object.tag;
+  census->objects[i].owner = owner;
+  census->n_objects++;
+  *is_new = true;
+  return &census->objects[i];
+}
+
+static void heap_census_push(heap_census_stack_t* stack,
+                             tagged_reference_t object) {
+  if (stack->n_entries == stack->capacity) {
+    uint64_t capacity = stack->capacity == 0 ? 256 : stack->capacity * 2;
+    tagged_reference_t* entries = (tagged_reference_t*) malloc_bytes(
+        capacity * sizeof(tagged_reference_t));
+    if (stack->entries != NULL) {
+      memcpy(entries, stack->entries,
+             stack->n_entries * sizeof(tagged_reference_t));
+      free_bytes(stack->entries);
+    }
+    stack->entries = entries;
+    stack->capacity = capacity;
+  }
+  stack->entries[stack->n_entries++] = object;
+}
+
+/**
+ * Mark object (and later everything it refers to) as shared.
+ */
+static void heap_census_visit_shared(void* context, tagged_reference_t object) {
+  heap_census_t* census = (heap_census_t*) context;
+  if (!mark_is_heap_object(object)) {
+    return;
+  }
+  boolean_t is_new;
+  heap_census_object_t* entry
+      = heap_census_find(census, object, HEAP_CENSUS_SHARED, &is_new);
+  if (!is_new && entry->owner == HEAP_CENSUS_SHARED) {
+    return;
+  }
+  entry->owner = HEAP_CENSUS_SHARED;
+  heap_census_push(&census->shared, object);
+}
+
+/**
+ * Give object to the binding being walked unless another binding got
+ * there first, in which case it becomes shared.
+ */
+static void heap_census_visit_owned(void* context, tagged_reference_t object) {
+  heap_census_t* census = (heap_census_t*) context;
+  if (!mark_is_heap_object(object)) {
+    return;
+  }
+  boolean_t is_new;
+  heap_census_object_t* entry
+      = heap_census_find(census, object, census->owner, &is_new);
+  if (is_new) {
+    heap_census_push(&census->owned, object);
+    return;
+  }
+  if (entry->owner == census->owner || entry->owner == HEAP_CENSUS_SHARED) {
+    return;
+  }
+  entry->owner = HEAP_CENSUS_SHARED;
+  heap_census_push(&census->shared, object);
+  while (census->shared.n_entries > 0) {
+    mark_each_child(census->shared.entries[--census->shared.n_entries],
+                    heap_census_visit_shared, census);
+  }
+}
+
+static void heap_census_add_root(heap_census_t* census, char* name,
+                                 tagged_reference_t value) {
+  if (census->n_roots == census->roots_capacity) {
+    uint64_t capacity
+        = census->roots_capacity == 0 ? 256 : census->roots_capacity * 2;
+    heap_census_root_t* roots = (heap_census_root_t*) malloc_bytes(
+        capacity * sizeof(heap_census_root_t));
+    if (census->roots != NULL) {
+      memcpy(roots, census->roots,
+             census->n_roots * sizeof(heap_census_root_t));
+      free_bytes(census->roots);
+    }
+    census->roots = roots;
+    census->roots_capacity = capacity;
+  }
+  census->roots[census->n_roots++]
+      = (heap_census_root_t){.name = name, .value = value};
+}
+
+/**
+ * Share a global environment (and the ones before and after it) and
+ * the lists holding its bindings and remember every binding as a
+ * root.
+ */
+static void heap_census_add_environment(heap_census_t* census,
+                                        environment_t* env) {
+  while (env != NULL) {
+    boolean_t is_new;
+    heap_census_find(census, tagged_reference(TAG_ENVIRONMENT_T, env),
+                     HEAP_CENSUS_SHARED, &is_new);
+    if (!is_new) {
+      return;
+    }
+    for (int i = 0; i < env->n_buckets; i++) {
+      for (tagged_reference_t cell = env->buckets[i]; cell.tag == TAG_PAIR_T;
+           cell = untag_pair(cell)->tail) {
+        heap_census_find(census, cell, HEAP_CENSUS_SHARED, &is_new);
+        tagged_reference_t binding = untag_pair(cell)->head;
+        heap_census_find(census, binding, HEAP_CENSUS_SHARED, &is_new);
+        tagged_reference_t name = untag_pair(binding)->head;
+        heap_census_find(census, name, HEAP_CENSUS_SHARED, &is_new);
+        heap_census_add_root(census, untag_reader_symbol(name),
+                             untag_pair(binding)->tail);
+      }
+    }
+    heap_census_add_environment(census, env->parent);
+    env = env->successor;
+  }
+}
+
+/**
+ * Walk everything reachable from the global environments.
+ */
+static void heap_census_take(heap_census_t* census) {
+  census->capacity = HEAP_CENSUS_INITIAL_CAPACITY;
+  census->objects = (heap_census_object_t*) malloc_bytes(
+      census->capacity * sizeof(heap_census_object_t));
+  uint64_t n_environments = mark_root_environments == NULL
+                                ? 0
+                                : array_length(mark_root_environments);
+  for (uint64_t i = 0; i < n_environments; i++) {
+    heap_census_add_environment(
+        census, (environment_t*) array_get(mark_root_environments, i));
+  }
+  for (uint64_t i = 0; i < census->n_roots; i++) {
+    census->owner = i;
+    heap_census_visit_owned(census, census->roots[i].value);
+    while (census->owned.n_entries > 0) {
+      mark_each_child(census->owned.entries[--census->owned.n_entries],
+                      heap_census_visit_owned, census);
+    }
+  }
+  for (uint64_t i = 0; i < census->capacity; i++) {
+    heap_census_object_t* entry = &census->objects[i];
+    if (entry->address != 0 && entry->owner != HEAP_CENSUS_SHARED) {
+      census->roots[entry->owner].retained_bytes += mark_object_size(
+          tagged_reference(entry->tag, entry->address));
+    }
+  }
+}
+
+static void heap_census_free(heap_census_t* census) {
+  free_bytes(census->objects);
+  if (census->roots != NULL) {
+    free_bytes(census->roots);
+  }
+  if (census->owned.entries != NULL) {
+    free_bytes(census->owned.entries);
+  }
+  if (census->shared.entries != NULL) {
+    free_bytes(census->shared.entries);
+  }
+}
+
+static inline void heap_census_write_word(FILE* file, uint64_t word) {
+  fwrite(&word, sizeof(word), 1, file);
+}
+
+static void heap_census_collect_child(void* context,
+                                      tagged_reference_t child) {
+  if (mark_is_heap_object(child)) {
+    heap_census_push((heap_census_stack_t*) context, child);
+  }
+}
+
+/**
+ * Write every object and root to file (see the top of this file).
+ */
+static void heap_census_dump(heap_census_t* census, FILE* file) {
+  fwrite("AKHEAP\0\1", 8, 1, file);
+  heap_census_write_word(file, census->n_objects);
+  heap_census_write_word(file, census->n_roots);
+  heap_census_stack_t children = {0};
+  for (uint64_t i = 0; i < census->capacity; i++) {
+    heap_census_object_t* entry = &census->objects[i];
+    if (entry->address == 0) {
+      continue;
+    }
+    tagged_reference_t object = tagged_reference(entry->tag, entry->address);
+    children.n_entries = 0;
+    mark_each_child(object, heap_census_collect_child, &children);
+    heap_census_write_word(file, entry->address);
+    heap_census_write_word(file, entry->tag);
+    heap_census_write_word(file, mark_object_size(object));
+    heap_census_write_word(file, children.n_entries);
+    for (uint64_t j = 0; j < children.n_entries; j++) {
+      heap_census_write_word(file, children.entries[j].data);
+    }
+  }
+  for (uint64_t i = 0; i < census->n_roots; i++) {
+    heap_census_root_t* root = &census->roots[i];
+    uint64_t length = strlen(root->name);
+    heap_census_write_word(file, root->value.data);
+    heap_census_write_word(file, root->value.tag);
+    heap_census_write_word(file, length);
+    fwrite(root->name, 1, length, file);
+  }
+  if (children.entries != NULL) {
+    free_bytes(children.entries);
+  }
+}
+
+static int heap_census_compare_roots(const void* a, const void* b) {
+  uint64_t a_bytes = ((heap_census_root_t*) a)->retained_bytes;
+  uint64_t b_bytes = ((heap_census_root_t*) b)->retained_bytes;
+  return a_bytes < b_bytes ? 1 : (a_bytes > b_bytes ? -1 : 0);
+}
+
+/**
+ * Example (heap-census) or (heap-census "heap.dump")
+ *
+ * Walk everything reachable from the global environments and return
+ * an association list with the number of objects and bytes found, the
+ * number of objects and bytes of each type (as (type objects .
+ * bytes)) and the bytes retained by each top-level binding (largest
+ * first, leaving out the ones that retain nothing). Given a file name
+ * (a string or symbol), the objects are also written to that file.
+ */
+tagged_reference_t
+    primtive_function_heap_census(primitive_arguments_t arguments) {
+  require_n_args(arguments, 0, 1);
+  FILE* file = NULL;
+  if (arguments.n_args == 1) {
+    file = fopen(untag_string_or_reader_symbol(arguments.args[0]), "wb");
+    if (file == NULL) {
+      fatal_error(ERROR_FILE_NOT_OPENED);
+    }
+  }
+
+  heap_census_t census = {0};
+  heap_census_take(&census);
+  if (file != NULL) {
+    heap_census_dump(&census, file);
+    fclose(file);
+  }
+
+  uint64_t n_objects[MARK_MAX_TAGS] = {0};
+  uint64_t n_bytes[MARK_MAX_TAGS] = {0};
+  uint64_t total_bytes = 0;
+  for (uint64_t i = 0; i < census.capacity; i++) {
+    heap_census_object_t* entry = &census.objects[i];
+    if (entry->address != 0) {
+      uint64_t size
+          = mark_object_size(tagged_reference(entry->tag, entry->address));
+      n_objects[entry->tag]++;
+      n_bytes[entry->tag] += size;
+      total_bytes += size;
+    }
+  }
+
+  tagged_reference_t tags = NIL;
+  for (uint64_t tag = MARK_MAX_TAGS; tag > 0; tag--) {
+    if (n_objects[tag - 1] > 0) {
+      const char* name = heap_census_tag_names[tag - 1];
+      if (name == NULL) {
+        name = "unknown";
+      }
+      tags = cons(
+          cons(tagged_reference(TAG_SCHEME_SYMBOL, name),
+               cons(tagged_reference(TAG_UINT64_T, n_objects[tag - 1]),
+                    tagged_reference(TAG_UINT64_T, n_bytes[tag - 1]))),
+          tags);
+    }
+  }
+
+  qsort(census.roots, census.n_roots, sizeof(heap_census_root_t),
+        heap_census_compare_roots);
+  tagged_reference_t retained = NIL;
+  for (uint64_t i = census.n_roots; i > 0; i--) {
+    heap_census_root_t* root = &census.roots[i - 1];
+    if (root->retained_bytes > 0) {
+      retained
+          = cons(cons(tagged_reference(TAG_SCHEME_SYMBOL, root->name),
+                      tagged_reference(TAG_UINT64_T, root->retained_bytes)),
+                 retained);
+    }
+  }
+  uint64_t total_objects = census.n_objects;
+  heap_census_free(&census);
+
+  tagged_reference_t objects
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "objects"),
+             tagged_reference(TAG_UINT64_T, total_objects));
+  tagged_reference_t bytes = cons(tagged_reference(TAG_SCHEME_SYMBOL, "bytes"),
+                                  tagged_reference(TAG_UINT64_T, total_bytes));
+  return cons(
+      objects,
+      cons(bytes,
+           cons(cons(tagged_reference(TAG_SCHEME_SYMBOL, "types"), tags),
+                cons(cons(tagged_reference(TAG_SCHEME_SYMBOL, "retained"),
+                          retained),
+                     NIL))));
+}
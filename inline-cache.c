@@ -0,0 +1,154 @@
+/**
+ * @file inline-cache.c
+ *
+ * Inline caches for references to global (top-level) variables.
+ *
+ * The first time the evaluator resolves a variable reference to a
+ * top-level binding, it replaces the symbol in the expression itself
+ * with a TAG_GLOBAL_REFERENCE_T node pointing at a global_reference_t
+ * that remembers the binding (see eval_variable_reference() in
+ * evaluator.c). Later evaluations of the same expression read the
+ * value straight out of the cached binding.
+ *
+ * Since internal defines are bound when a call environment is made
+ * (see lambda-analysis.c), a reference that isn't bound in any
+ * environment below the top-level environment can never become bound
+ * there later so only changes to top-level environments can make a
+ * cache stale. Defining a new top-level variable (which can shadow a
+ * binding in a parent top-level environment) increments
+ * global_binding_epoch which invalidates every cache. Assigning to a
+ * top-level variable changes the value in the binding itself and
+ * doesn't affect the caches. A cache for a frozen top-level
+ * environment (see interpreter-thread.c) is never stale since nothing
+ * can be defined there (or in any of its parents) anymore.
+ *
+ * Interpreter threads (and futures) share code, so one thread may
+ * refill a cache while others read it. The cached fields are guarded
+ * by a sequence lock: a refill makes the sequence number odd, writes
+ * the fields and makes it even again, and a reader only uses the
+ * fields when the sequence number was the same even number before
+ * and after reading them. A thread that can't take the lock (because
+ * another thread is refilling the cache) just doesn't refill it.
+ */
+
+// ======================================================================
+// This is block is extraced to inline-cache.h
+// ======================================================================
+
+#ifndef _INLINE_CACHE_H_
+#define _INLINE_CACHE_H_
+
+#include "environment.h"
+#include "optional.h"
+#include "pair.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+typedef struct {
+  char* name;
+  // Odd while a thread is refilling the fields below.
+  uint64_t sequence;
+  pair_t* binding;
+  // The cache is only valid for this top-level environment and epoch.
+  environment_t* toplevel;
+  uint64_t epoch;
+} global_reference_t;
+
+extern uint64_t global_binding_epoch;
+extern _Thread_local uint64_t inline_cache_hits;
+extern _Thread_local uint64_t inline_cache_misses;
+
+extern global_reference_t* make_global_reference(char* name);
+extern optional_t global_reference_get(environment_t* env,
+                                       global_reference_t* reference);
+
+extern tagged_reference_t
+    primtive_function_inline_cache_statistics(primitive_arguments_t arguments);
+
+static inline global_reference_t*
+    untag_global_reference(tagged_reference_t reference) {
+  require_tag(reference, TAG_GLOBAL_REFERENCE_T);
+  return (global_reference_t*) reference.data;
+}
+
+#endif /* _INLINE_CACHE_H_ */
+
+// ======================================================================
+
+#include "allocate.h"
+#include "inline-cache.h"
+
+uint64_t global_binding_epoch = 0;
+_Thread_local uint64_t inline_cache_hits = 0;
+_Thread_local uint64_t inline_cache_misses = 0;
+
+global_reference_t* make_global_reference(char* name) {
+  global_reference_t* result = malloc_struct(global_reference_t);
+  result->name = name;
+  return result;
+}
+
+/**
+ * Return the value of the global variable named by reference in the
+ * top-level environment of env, refilling the cache if it is stale.
+ */
+optional_t global_reference_get(environment_t* env,
+                                global_reference_t* reference) {
+  environment_t* toplevel = env->toplevel;
+  // The main thread may define something while interpreter threads
+  // (see interpreter-thread.c) read the epoch.
+  uint64_t epoch = __atomic_load_n(&global_binding_epoch, __ATOMIC_RELAXED);
+
+  uint64_t sequence
+      = __atomic_load_n(&reference->sequence, __ATOMIC_ACQUIRE);
+  pair_t* cached_binding
+      = __atomic_load_n(&reference->binding, __ATOMIC_RELAXED);
+  environment_t* cached_toplevel
+      = __atomic_load_n(&reference->toplevel, __ATOMIC_RELAXED);
+  uint64_t cached_epoch = __atomic_load_n(&reference->epoch, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  boolean_t is_consistent
+      = (sequence & 1) == 0
+        && __atomic_load_n(&reference->sequence, __ATOMIC_RELAXED) == sequence;
+
+  if (is_consistent && cached_binding != NULL && cached_toplevel == toplevel
+      && (toplevel->is_frozen || cached_epoch == epoch)) {
+    inline_cache_hits++;
+    return optional_of(cached_binding->tail);
+  }
+
+  inline_cache_misses++;
+  pair_t* binding = environment_find_binding(toplevel, reference->name);
+  if (binding == NULL) {
+    return optional_empty();
+  }
+  if ((sequence & 1) == 0
+      && __atomic_compare_exchange_n(&reference->sequence, &sequence,
+                                     sequence + 1, false, __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED)) {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&reference->binding, binding, __ATOMIC_RELAXED);
+    __atomic_store_n(&reference->toplevel, toplevel, __ATOMIC_RELAXED);
+    __atomic_store_n(&reference->epoch, epoch, __ATOMIC_RELAXED);
+    __atomic_store_n(&reference->sequence, sequence + 2, __ATOMIC_RELEASE);
+  }
+  return optional_of(binding->tail);
+}
+
+/**
+ * Example (inline-cache-statistics) => ((hits . 10) . ((misses . 2) . ()))
+ *
+ * Return an association list with the number of inline cache hits
+ * and misses so far.
+ */
+tagged_reference_t
+    primtive_function_inline_cache_statistics(primitive_arguments_t arguments) {
+  require_n_args(arguments, 0, 0);
+  tagged_reference_t hits
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "hits"),
+             tagged_reference(TAG_UINT64_T, inline_cache_hits));
+  tagged_reference_t misses
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "misses"),
+             tagged_reference(TAG_UINT64_T, inline_cache_misses));
+  return cons(hits, cons(misses, NIL));
+}
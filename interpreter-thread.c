@@ -0,0 +1,281 @@
+/**
+ * @file interpreter-thread.c
+ *
+ * Interpreter threads: OS threads that evaluate scheme code in
+ * parallel (unlike green threads, see green-thread.c, which all share
+ * one OS thread).
+ *
+ * Everything an evaluation changes as it goes, the frame stack of the
+ * tree walking evaluator, the explicit stack, dynamic-wind winders,
+ * green threads and the various statistics, is thread local so every
+ * interpreter thread has its own. Objects are allocated with malloc
+ * which already gives each thread an arena of its own (so threads
+ * rarely contend for the allocator).
+ *
+ * The global environment is shared. Spawning a thread freezes the
+ * top-level environment of its thunk (and every environment above
+ * it): the builtins are all added to it and after that none of its
+ * bindings can change. Since nothing is ever written to a frozen
+ * environment, threads read it without any locks and an inline cache
+ * for a frozen environment never goes stale. The main thread keeps
+ * going in a fresh top-level environment whose parent is the frozen
+ * one (see environment_freeze), so later top-level definitions only
+ * shadow the frozen bindings. Defining or assigning a frozen binding
+ * is a fatal error.
+ *
+ * The evaluator rewrites code as it runs it (call sites, inline
+ * caches and macro expansion) so two threads can't run the same code.
+ * Instead, the first time a thread calls a closure made by another
+ * thread it makes a private copy of the closure's code (see
+ * closure_code) which it then rewrites and optimizes as it likes. The
+ * copy is made from the original expressions (see
+ * original_expression) while holding interpreter_code_mutex which
+ * every thread also holds while it rewrites code.
+ */
+
+// ======================================================================
+// This is block is extraced to interpreter-thread.h
+// ======================================================================
+
+#ifndef _INTERPRETER_THREAD_H_
+#define _INTERPRETER_THREAD_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "boolean.h"
+#include "closure.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+typedef struct {
+  uint64_t id;
+  pthread_t handle;
+  // Called with no arguments by the new thread.
+  tagged_reference_t thunk;
+  // The value of thunk once the thread has been joined.
+  tagged_reference_t value;
+  boolean_t is_joined;
+  pthread_mutex_t join_mutex;
+} interpreter_thread_t;
+
+// 0 for the main thread.
+extern _Thread_local uint64_t interpreter_thread_id;
+extern boolean_t interpreter_threads_started;
+extern pthread_mutex_t interpreter_code_mutex;
+
+extern tagged_reference_t interpreter_thread_copy_code(tagged_reference_t code);
+extern void interpreter_thread_share(tagged_reference_t procedure);
+extern uint64_t interpreter_thread_allocate_id(void);
+extern void interpreter_thread_create(pthread_t* handle, void* (*start)(void*),
+                                      void* argument);
+
+extern tagged_reference_t
+    primtive_function_spawn_interpreter_thread(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_join_interpreter_thread(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_processor_count(primitive_arguments_t args);
+
+/**
+ * Take the lock that must be held while rewriting code (this does
+ * nothing until the first interpreter thread is started).
+ */
+static inline void interpreter_code_lock(void) {
+  if (interpreter_threads_started) {
+    pthread_mutex_lock(&interpreter_code_mutex);
+  }
+}
+
+static inline void interpreter_code_unlock(void) {
+  if (interpreter_threads_started) {
+    pthread_mutex_unlock(&interpreter_code_mutex);
+  }
+}
+
+/**
+ * Return the code the current thread should run for closure (its own
+ * copy when another thread made closure).
+ */
+static inline tagged_reference_t closure_code(closure_t* closure) {
+  if (closure->owner == interpreter_thread_id) {
+    return closure->code;
+  }
+  return interpreter_thread_copy_code(closure->code);
+}
+
+static inline interpreter_thread_t*
+    untag_interpreter_thread(tagged_reference_t reference) {
+  require_tag(reference, TAG_INTERPRETER_THREAD_T);
+  return (interpreter_thread_t*) reference.data;
+}
+
+#endif /* _INTERPRETER_THREAD_H_ */
+
+// ======================================================================
+
+#include <unistd.h>
+
+#include "allocate.h"
+#include "cek-evaluator.h"
+#include "environment.h"
+#include "evaluator.h"
+#include "fatal-error.h"
+#include "hash-table.h"
+#include "interpreter-thread.h"
+#include "lambda-analysis.h"
+#include "pair.h"
+
+// The C stack of an interpreter thread. The tree walking evaluator
+// recurses on the C stack so this is generous (the memory is only
+// committed as the stack grows).
+#define INTERPRETER_THREAD_STACK_SIZE (256 * 1024 * 1024)
+
+_Thread_local uint64_t interpreter_thread_id = 0;
+uint64_t interpreter_thread_next_id = 1;
+boolean_t interpreter_threads_started = false;
+pthread_mutex_t interpreter_code_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Maps the code of closures made by other threads to this thread's
+// copy of it.
+_Thread_local hash_table_t* interpreter_thread_code_copies = NULL;
+
+/**
+ * Copy the pairs of expr undoing any rewriting done by the evaluator.
+ */
+static tagged_reference_t copy_expression(tagged_reference_t expr) {
+  expr = original_expression(expr);
+  if (expr.tag != TAG_PAIR_T) {
+    return expr;
+  }
+  tagged_reference_t result = NIL;
+  pair_t* last = NULL;
+  for (; expr.tag == TAG_PAIR_T; expr = untag_pair(expr)->tail) {
+    tagged_reference_t cell
+        = cons(copy_expression(untag_pair(expr)->head), NIL);
+    if (last == NULL) {
+      result = cell;
+    } else {
+      last->tail = cell;
+    }
+    last = untag_pair(cell);
+  }
+  last->tail = expr;
+  return result;
+}
+
+/**
+ * Return this thread's copy of code (the body of a closure made by
+ * another thread), making it the first time.
+ */
+tagged_reference_t interpreter_thread_copy_code(tagged_reference_t code) {
+  if (interpreter_thread_code_copies == NULL) {
+    interpreter_thread_code_copies = make_hash_table(HASH_TABLE_EQ, 64);
+  }
+  optional_t copy = hash_table_get(interpreter_thread_code_copies, code);
+  if (optional_is_present(copy)) {
+    return optional_value(copy);
+  }
+  interpreter_code_lock();
+  tagged_reference_t result = copy_expression(code);
+  interpreter_code_unlock();
+  hash_table_set(interpreter_thread_code_copies, code, result);
+  return result;
+}
+
+/**
+ * Get ready to call procedure from other interpreter threads by
+ * freezing its top-level environment.
+ */
+void interpreter_thread_share(tagged_reference_t procedure) {
+  if (procedure.tag == TAG_CLOSURE_T) {
+    environment_freeze(untag_closure_t(procedure)->env->toplevel);
+  }
+  // Make sure the evaluator is chosen before any thread asks.
+  cek_is_enabled();
+  if (!interpreter_threads_started) {
+    interpreter_threads_started = true;
+  }
+}
+
+/**
+ * Return the id of a new interpreter thread (which must store it in
+ * interpreter_thread_id before it runs any scheme code).
+ */
+uint64_t interpreter_thread_allocate_id(void) {
+  return __atomic_fetch_add(&interpreter_thread_next_id, 1,
+                            __ATOMIC_RELAXED);
+}
+
+/**
+ * Start an OS thread with a stack big enough to run the evaluator.
+ */
+void interpreter_thread_create(pthread_t* handle, void* (*start)(void*),
+                               void* argument) {
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setstacksize(&attributes, INTERPRETER_THREAD_STACK_SIZE);
+  int error = pthread_create(handle, &attributes, start, argument);
+  pthread_attr_destroy(&attributes);
+  if (error != 0) {
+    fatal_error(ERROR_INTERPRETER_THREAD_NOT_STARTED);
+  }
+}
+
+static void* interpreter_thread_main(void* argument) {
+  interpreter_thread_t* thread = (interpreter_thread_t*) argument;
+  interpreter_thread_id = thread->id;
+  primitive_arguments_t no_arguments = {.n_args = 0};
+  thread->value = apply_procedure(thread->thunk, no_arguments);
+  return NULL;
+}
+
+/**
+ * Example (spawn-interpreter-thread (lambda () (fib 30)))
+ *
+ * Start an OS thread that calls a thunk. The top-level environment
+ * of the thunk is frozen first.
+ */
+tagged_reference_t primtive_function_spawn_interpreter_thread(
+    primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  tagged_reference_t thunk = arguments.args[0];
+  interpreter_thread_share(thunk);
+
+  interpreter_thread_t* thread = malloc_struct(interpreter_thread_t);
+  thread->id = interpreter_thread_allocate_id();
+  thread->thunk = thunk;
+  thread->value = NIL;
+  pthread_mutex_init(&thread->join_mutex, NULL);
+  interpreter_thread_create(&thread->handle, interpreter_thread_main, thread);
+  return tagged_reference(TAG_INTERPRETER_THREAD_T, thread);
+}
+
+/**
+ * Wait for an interpreter thread to finish and return the value of
+ * its thunk. This blocks the whole OS thread (including any other
+ * green threads running on it).
+ */
+tagged_reference_t
+    primtive_function_join_interpreter_thread(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  interpreter_thread_t* thread = untag_interpreter_thread(arguments.args[0]);
+  pthread_mutex_lock(&thread->join_mutex);
+  if (!thread->is_joined) {
+    pthread_join(thread->handle, NULL);
+    thread->is_joined = true;
+  }
+  pthread_mutex_unlock(&thread->join_mutex);
+  return thread->value;
+}
+
+/**
+ * Return the number of processors that are online (a good number of
+ * interpreter threads to use for a parallel job).
+ */
+tagged_reference_t
+    primtive_function_processor_count(primitive_arguments_t arguments) {
+  require_n_args(arguments, 0, 0);
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return tagged_reference(TAG_UINT64_T, count < 1 ? 1 : count);
+}
@@ -0,0 +1,762 @@
+/**
+ * @file jit.c
+ *
+ * An optional (and very small) template JIT that translates the body
+ * of a closure into x86-64 machine code.
+ *
+ * Only "pure integer" lambdas are compiled, i.e., lambdas with a
+ * single expression body built out of integer constants, parameter
+ * references, references to global variables, if, calls to the
+ * integer arithmetic and comparison primitives (+, -, *, /, <, <=, =,
+ * >, >=, eq?, eqv? and equal?) and calls back to the lambda itself
+ * through a global variable. This covers things like conditional
+ * breakpoint predicates and fib. Each expression is given a type
+ * (integer or boolean) while it is compiled so the generated code
+ * works on untagged 64bit values. Anything else (strings, pairs,
+ * closures that capture variables, calls of other closures, etc.)
+ * falls back to the interpreter (at the granularity of a whole
+ * lambda).
+ *
+ * The generated code is a simple stack machine: every expression
+ * leaves its value in rax and binary operations save their first
+ * operand on the machine stack. A compiled lambda is called with a
+ * pointer to its (untagged) arguments in rdi and keeps that pointer
+ * in rbx.
+ *
+ * Binary arithmetic and comparisons are done inline. Everything else
+ * calls back into the runtime: global variables are read through an
+ * inline cache (see inline-cache.c) and the other primitive calls
+ * (like (/ n 2) or (+ a b c)) call the primitive itself. When a
+ * global variable isn't bound to an integer or a primitive returns
+ * something of the wrong type, the helper "bails out" with a longjmp
+ * back to jit_try_call() which interprets the whole call instead.
+ * This is only possible because compiled code has no side effects,
+ * so nothing has happened that running the call again could repeat.
+ *
+ * Since compiled code uses the values of some global variables (the
+ * primitives and the lambda itself) at the time it was compiled,
+ * every call checks that those variables are still bound to the same
+ * values and that all of the arguments are integers. If not, the
+ * call is simply interpreted. A top-level define can also shadow one
+ * of the bindings that were found (for example, a define in the
+ * successor of a frozen environment, see interpreter-thread.c), so
+ * like an inline cache, compiled code remembers the
+ * global_binding_epoch it was checked in and looks its bindings up
+ * again after the epoch changes, compiling the lambda again when they
+ * are different.
+ *
+ * The JIT is only used when the environment variable
+ * ARMYKNIFE_JIT=true is set and is never used when not running on
+ * x86-64.
+ */
+
+// ======================================================================
+// This is block is extraced to jit.h
+// ======================================================================
+
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include "array.h"
+#include "boolean.h"
+#include "closure.h"
+#include "environment.h"
+#include "optional.h"
+#include "primitive.h"
+
+typedef enum {
+  JIT_TYPE_INVALID,
+  JIT_TYPE_INTEGER,
+  JIT_TYPE_BOOLEAN,
+} jit_type_t;
+
+typedef int64_t (*jit_entry_t)(int64_t* arguments);
+
+typedef struct jit_function_S {
+  jit_entry_t entry;
+  uint64_t n_args;
+  jit_type_t return_type;
+  // True when the generated code calls back into the runtime (and may
+  // bail out).
+  boolean_t calls_runtime;
+  // The generated code is only valid for closures in this
+  // environment (which means they haven't captured any variables).
+  environment_t* toplevel;
+  // The global bindings (jit_dependency_t*) the generated code
+  // depends on and the global_binding_epoch they were last found in.
+  array_t* dependencies;
+  uint64_t epoch;
+} jit_function_t;
+
+typedef struct {
+  char* name;
+  pair_t* binding;
+  // The primitive that must still be bound or NIL for a reference to
+  // the compiled lambda itself.
+  tagged_reference_t value;
+} jit_dependency_t;
+
+extern _Thread_local uint64_t jit_compiled_functions;
+extern _Thread_local uint64_t jit_calls;
+extern _Thread_local uint64_t jit_bailouts;
+
+extern jit_function_t* jit_compile(closure_t* closure);
+extern optional_t jit_try_call(closure_t* closure,
+                               primitive_arguments_t* arguments);
+
+#endif /* _JIT_H_ */
+
+// ======================================================================
+
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "allocate.h"
+#include "byte-array.h"
+#include "call-site.h"
+#include "inline-cache.h"
+#include "interpreter-thread.h"
+#include "jit.h"
+#include "lambda-analysis.h"
+#include "string-util.h"
+
+// A lambda is compiled once it has been called this many times.
+#define JIT_THRESHOLD 2
+
+_Thread_local uint64_t jit_compiled_functions = 0;
+_Thread_local uint64_t jit_calls = 0;
+_Thread_local uint64_t jit_bailouts = 0;
+
+// Where a runtime helper called by compiled code jumps to when it
+// can't return a value of the type the code expects.
+static _Thread_local jmp_buf* jit_bailout_target = NULL;
+
+boolean_t jit_is_initialized = false;
+boolean_t jit_is_enabled_value = false;
+
+static inline boolean_t jit_is_enabled() {
+  if (jit_is_initialized) {
+    return jit_is_enabled_value;
+  }
+  char* var = getenv("ARMYKNIFE_JIT");
+  jit_is_initialized = true;
+  if (var != NULL && strcmp(var, "true") == 0) {
+    jit_is_enabled_value = true;
+  }
+  return jit_is_enabled_value;
+}
+
+#if defined(__x86_64__)
+
+typedef struct {
+  byte_array_t* code;
+  closure_t* closure;
+  array_t* dependencies;
+  // The type a recursive call is assumed to return.
+  jit_type_t return_type;
+  boolean_t calls_runtime;
+} jit_compiler_t;
+
+// The primitives (other than the binary operations done inline) that
+// compiled code may call with integer arguments and the type of what
+// they return. They must not have any side effects (see the comment
+// at the top of this file).
+typedef struct {
+  primitive_t primitive;
+  jit_type_t type;
+} jit_helper_primitive_t;
+
+static const jit_helper_primitive_t jit_helper_primitives[] = {
+    {&primtive_function_plus, JIT_TYPE_INTEGER},
+    {&primtive_function_sub, JIT_TYPE_INTEGER},
+    {&primtive_function_mul, JIT_TYPE_INTEGER},
+    {&primtive_function_div, JIT_TYPE_INTEGER},
+    {&primtive_function_less, JIT_TYPE_BOOLEAN},
+    {&primtive_function_less_or_equal, JIT_TYPE_BOOLEAN},
+    {&primtive_function_numerically_equal, JIT_TYPE_BOOLEAN},
+    {&primtive_function_greater, JIT_TYPE_BOOLEAN},
+    {&primtive_function_greater_or_equal, JIT_TYPE_BOOLEAN},
+    {&primtive_function_eq_p, JIT_TYPE_BOOLEAN},
+    {&primtive_function_eqv_p, JIT_TYPE_BOOLEAN},
+    {&primtive_function_equal_p, JIT_TYPE_BOOLEAN},
+};
+
+__attribute__((noreturn)) static void jit_bail_out(void) {
+  longjmp(*jit_bailout_target, 1);
+}
+
+/**
+ * Called by compiled code to read the global variable named by
+ * reference.
+ */
+static int64_t jit_global_integer(global_reference_t* reference,
+                                  environment_t* toplevel) {
+  optional_t value = global_reference_get(toplevel, reference);
+  if (!optional_is_present(value)
+      || optional_value(value).tag != TAG_UINT64_T) {
+    jit_bail_out();
+  }
+  return (int64_t) optional_value(value).data;
+}
+
+/**
+ * Called by compiled code to call one of the jit_helper_primitives
+ * with n_args integers.
+ */
+static int64_t jit_call_primitive(primitive_t primitive, int64_t* args,
+                                  uint64_t n_args, jit_type_t type) {
+  primitive_arguments_t arguments;
+  arguments.n_args = n_args;
+  for (uint64_t i = 0; i < n_args; i++) {
+    arguments.args[i] = tagged_reference(TAG_UINT64_T, args[i]);
+  }
+  tagged_reference_t result = primitive(arguments);
+  if (type == JIT_TYPE_BOOLEAN && result.tag == TAG_BOOLEAN_T) {
+    return result.data != 0;
+  }
+  if (type == JIT_TYPE_INTEGER && result.tag == TAG_UINT64_T) {
+    return (int64_t) result.data;
+  }
+  jit_bail_out();
+}
+
+static void emit_bytes(jit_compiler_t* compiler, uint8_t* bytes,
+                       uint64_t n_bytes) {
+  compiler->code = byte_array_append_bytes(compiler->code, bytes, n_bytes);
+}
+
+static void emit_uint32(jit_compiler_t* compiler, uint32_t value) {
+  emit_bytes(compiler, (uint8_t*) &value, sizeof(value));
+}
+
+static void emit_uint64(jit_compiler_t* compiler, uint64_t value) {
+  emit_bytes(compiler, (uint8_t*) &value, sizeof(value));
+}
+
+static uint64_t code_position(jit_compiler_t* compiler) {
+  return byte_array_length(compiler->code);
+}
+
+/**
+ * Fill in the rel32 operand of a jump which ends at patch_position +
+ * 4 so that it jumps to the current position.
+ */
+static void patch_rel32(jit_compiler_t* compiler, uint64_t patch_position) {
+  uint32_t offset = code_position(compiler) - (patch_position + 4);
+  memcpy(&compiler->code->elements[patch_position], &offset, sizeof(offset));
+}
+
+#define EMIT(compiler, ...)                                                    \
+  do {                                                                         \
+    uint8_t bytes[] = {__VA_ARGS__};                                           \
+    emit_bytes(compiler, bytes, sizeof(bytes));                                \
+  } while (0)
+
+/**
+ * Call a C function (with its arguments already in rdi, rsi, etc.)
+ * from anywhere in the generated code. The stack is aligned to 16
+ * bytes for the call as the ABI requires.
+ */
+static void emit_helper_call(jit_compiler_t* compiler, void* helper) {
+  // mov rax, rsp; and rsp, -16; push rax; sub rsp, 8
+  EMIT(compiler, 0x48, 0x89, 0xE0, 0x48, 0x83, 0xE4, 0xF0, 0x50, 0x48, 0x83,
+       0xEC, 0x08);
+  // mov rax, helper; call rax
+  EMIT(compiler, 0x48, 0xB8);
+  emit_uint64(compiler, (uint64_t) helper);
+  EMIT(compiler, 0xFF, 0xD0);
+  // add rsp, 8; pop rsp
+  EMIT(compiler, 0x48, 0x83, 0xC4, 0x08, 0x5C);
+  compiler->calls_runtime = true;
+}
+
+static int64_t parameter_index(closure_t* closure, char* name) {
+  for (int i = 0; i < closure->n_arg_names; i++) {
+    if (string_equal(closure->arg_names[i], name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static uint64_t list_length(tagged_reference_t lst) {
+  uint64_t result = 0;
+  while (lst.tag == TAG_PAIR_T) {
+    result++;
+    lst = untag_pair(lst)->tail;
+  }
+  return result;
+}
+
+static void add_dependency(jit_compiler_t* compiler, char* name,
+                           pair_t* binding, tagged_reference_t value) {
+  for (uint64_t i = 0; i < array_length(compiler->dependencies); i++) {
+    if (((jit_dependency_t*) array_get(compiler->dependencies, i))->binding
+        == binding) {
+      return;
+    }
+  }
+  jit_dependency_t* dependency = malloc_struct(jit_dependency_t);
+  dependency->name = name;
+  dependency->binding = binding;
+  dependency->value = value;
+  compiler->dependencies
+      = array_add(compiler->dependencies, (uint64_t) dependency);
+}
+
+static jit_type_t compile_expression(jit_compiler_t* compiler,
+                                     tagged_reference_t expr);
+
+/**
+ * (if test consequent alternative)
+ */
+static jit_type_t compile_if(jit_compiler_t* compiler,
+                             tagged_reference_t expr) {
+  if (list_length(expr) != 4) {
+    return JIT_TYPE_INVALID;
+  }
+  if (compile_expression(compiler, car(cdr(expr))) != JIT_TYPE_BOOLEAN) {
+    return JIT_TYPE_INVALID;
+  }
+  // test rax, rax; jz alternative
+  EMIT(compiler, 0x48, 0x85, 0xC0, 0x0F, 0x84);
+  uint64_t jump_to_alternative = code_position(compiler);
+  emit_uint32(compiler, 0);
+
+  jit_type_t consequent_type
+      = compile_expression(compiler, car(cdr(cdr(expr))));
+  // jmp end
+  EMIT(compiler, 0xE9);
+  uint64_t jump_to_end = code_position(compiler);
+  emit_uint32(compiler, 0);
+
+  patch_rel32(compiler, jump_to_alternative);
+  jit_type_t alternative_type
+      = compile_expression(compiler, car(cdr(cdr(cdr(expr)))));
+  patch_rel32(compiler, jump_to_end);
+
+  if (consequent_type != alternative_type) {
+    return JIT_TYPE_INVALID;
+  }
+  return consequent_type;
+}
+
+/**
+ * Call an arithmetic or comparison primitive with two integers.
+ */
+static jit_type_t compile_fixnum_operation(jit_compiler_t* compiler,
+                                           fixnum_operation_t operation,
+                                           tagged_reference_t operands) {
+  if (list_length(operands) != 2) {
+    return JIT_TYPE_INVALID;
+  }
+  if (compile_expression(compiler, car(operands)) != JIT_TYPE_INTEGER) {
+    return JIT_TYPE_INVALID;
+  }
+  // push rax
+  EMIT(compiler, 0x50);
+  if (compile_expression(compiler, car(cdr(operands))) != JIT_TYPE_INTEGER) {
+    return JIT_TYPE_INVALID;
+  }
+  // mov rcx, rax; pop rax
+  EMIT(compiler, 0x48, 0x89, 0xC1, 0x58);
+
+  uint8_t setcc = 0;
+  switch (operation) {
+  case FIXNUM_OPERATION_ADD:
+    // add rax, rcx
+    EMIT(compiler, 0x48, 0x01, 0xC8);
+    return JIT_TYPE_INTEGER;
+  case FIXNUM_OPERATION_SUB:
+    // sub rax, rcx
+    EMIT(compiler, 0x48, 0x29, 0xC8);
+    return JIT_TYPE_INTEGER;
+  case FIXNUM_OPERATION_MUL:
+    // imul rax, rcx
+    EMIT(compiler, 0x48, 0x0F, 0xAF, 0xC1);
+    return JIT_TYPE_INTEGER;
+  case FIXNUM_OPERATION_LESS:
+    setcc = 0x9C;
+    break;
+  case FIXNUM_OPERATION_LESS_OR_EQUAL:
+    setcc = 0x9E;
+    break;
+  case FIXNUM_OPERATION_EQUAL:
+    setcc = 0x94;
+    break;
+  case FIXNUM_OPERATION_GREATER:
+    setcc = 0x9F;
+    break;
+  case FIXNUM_OPERATION_GREATER_OR_EQUAL:
+    setcc = 0x9D;
+    break;
+  case FIXNUM_OPERATION_NONE:
+    return JIT_TYPE_INVALID;
+  }
+  // cmp rax, rcx; setcc al; movzx eax, al
+  EMIT(compiler, 0x48, 0x39, 0xC8, 0x0F, setcc, 0xC0, 0x0F, 0xB6, 0xC0);
+  return JIT_TYPE_BOOLEAN;
+}
+
+/**
+ * Push the (integer) values of operands last to first so that they
+ * end up in order in memory starting at rsp.
+ */
+static boolean_t compile_arguments(jit_compiler_t* compiler,
+                                   tagged_reference_t operands) {
+  for (int64_t i = list_length(operands) - 1; i >= 0; i--) {
+    tagged_reference_t operand = operands;
+    for (int64_t j = 0; j < i; j++) {
+      operand = cdr(operand);
+    }
+    if (compile_expression(compiler, car(operand)) != JIT_TYPE_INTEGER) {
+      return false;
+    }
+    // push rax
+    EMIT(compiler, 0x50);
+  }
+  return true;
+}
+
+/**
+ * Call one of the jit_helper_primitives through jit_call_primitive().
+ */
+static jit_type_t compile_primitive_call(jit_compiler_t* compiler,
+                                         primitive_t primitive,
+                                         jit_type_t type,
+                                         tagged_reference_t operands) {
+  uint64_t n_operands = list_length(operands);
+  if (n_operands > MAX_PRIMITIVE_ARGS
+      || !compile_arguments(compiler, operands)) {
+    return JIT_TYPE_INVALID;
+  }
+  // mov rsi, rsp; mov rdi, primitive; mov rdx, n_operands; mov rcx, type
+  EMIT(compiler, 0x48, 0x89, 0xE6, 0x48, 0xBF);
+  emit_uint64(compiler, (uint64_t) primitive);
+  EMIT(compiler, 0x48, 0xBA);
+  emit_uint64(compiler, n_operands);
+  EMIT(compiler, 0x48, 0xB9);
+  emit_uint64(compiler, type);
+  emit_helper_call(compiler, &jit_call_primitive);
+  // add rsp, 8 * n_operands
+  EMIT(compiler, 0x48, 0x81, 0xC4);
+  emit_uint32(compiler, 8 * n_operands);
+  return type;
+}
+
+/**
+ * Read a global variable (which must hold an integer) through
+ * jit_global_integer().
+ */
+static jit_type_t compile_global_reference(jit_compiler_t* compiler,
+                                           char* name) {
+  // mov rdi, reference; mov rsi, toplevel
+  EMIT(compiler, 0x48, 0xBF);
+  emit_uint64(compiler, (uint64_t) make_global_reference(name));
+  EMIT(compiler, 0x48, 0xBE);
+  emit_uint64(compiler, (uint64_t) compiler->closure->env);
+  emit_helper_call(compiler, &jit_global_integer);
+  return JIT_TYPE_INTEGER;
+}
+
+/**
+ * Call the lambda being compiled.
+ */
+static jit_type_t compile_recursive_call(jit_compiler_t* compiler,
+                                         tagged_reference_t operands) {
+  uint64_t n_operands = list_length(operands);
+  if (n_operands != compiler->closure->n_arg_names
+      || !compile_arguments(compiler, operands)) {
+    return JIT_TYPE_INVALID;
+  }
+  // mov rdi, rsp; call entry
+  EMIT(compiler, 0x48, 0x89, 0xE7, 0xE8);
+  emit_uint32(compiler, -(code_position(compiler) + 4));
+  // add rsp, 8 * n_operands
+  EMIT(compiler, 0x48, 0x81, 0xC4);
+  emit_uint32(compiler, 8 * n_operands);
+  return compiler->return_type;
+}
+
+static jit_type_t compile_expression(jit_compiler_t* compiler,
+                                     tagged_reference_t expr) {
+  expr = original_expression(expr);
+
+  if (expr.tag == TAG_UINT64_T) {
+    // mov rax, imm64
+    EMIT(compiler, 0x48, 0xB8);
+    emit_uint64(compiler, expr.data);
+    return JIT_TYPE_INTEGER;
+  }
+
+  if (expr.tag == TAG_SCHEME_SYMBOL) {
+    int64_t index
+        = parameter_index(compiler->closure, untag_reader_symbol(expr));
+    if (index < 0) {
+      return compile_global_reference(compiler, untag_reader_symbol(expr));
+    }
+    // mov rax, [rbx + 8 * index]
+    EMIT(compiler, 0x48, 0x8B, 0x83);
+    emit_uint32(compiler, 8 * index);
+    return JIT_TYPE_INTEGER;
+  }
+
+  if (expr.tag != TAG_PAIR_T) {
+    return JIT_TYPE_INVALID;
+  }
+
+  tagged_reference_t operator = original_expression(car(expr));
+  if (operator.tag != TAG_SCHEME_SYMBOL) {
+    return JIT_TYPE_INVALID;
+  }
+  char* name = untag_reader_symbol(operator);
+  if (string_equal(name, "if")) {
+    return compile_if(compiler, expr);
+  }
+  if (parameter_index(compiler->closure, name) >= 0) {
+    return JIT_TYPE_INVALID;
+  }
+
+  pair_t* binding
+      = environment_find_binding(compiler->closure->env->toplevel, name);
+  if (binding == NULL) {
+    return JIT_TYPE_INVALID;
+  }
+  tagged_reference_t fn = binding->tail;
+
+  if (fn.tag == TAG_CLOSURE_T
+      && untag_closure_t(fn)->analysis == compiler->closure->analysis) {
+    add_dependency(compiler, name, binding, NIL);
+    return compile_recursive_call(compiler, cdr(expr));
+  }
+  if (fn.tag != TAG_PRIMITIVE) {
+    return JIT_TYPE_INVALID;
+  }
+
+  fixnum_operation_t operation = fixnum_operation_of(fn);
+  if (untag_primitive(fn) == &primtive_function_eq_p
+      || untag_primitive(fn) == &primtive_function_eqv_p) {
+    // Same as = for two integers.
+    operation = FIXNUM_OPERATION_EQUAL;
+  }
+  if (operation != FIXNUM_OPERATION_NONE && list_length(cdr(expr)) == 2) {
+    add_dependency(compiler, name, binding, fn);
+    return compile_fixnum_operation(compiler, operation, cdr(expr));
+  }
+  for (uint64_t i = 0; i < sizeof(jit_helper_primitives)
+                               / sizeof(jit_helper_primitives[0]);
+       i++) {
+    if (untag_primitive(fn) == jit_helper_primitives[i].primitive) {
+      add_dependency(compiler, name, binding, fn);
+      return compile_primitive_call(compiler, untag_primitive(fn),
+                                    jit_helper_primitives[i].type,
+                                    cdr(expr));
+    }
+  }
+  return JIT_TYPE_INVALID;
+}
+
+/**
+ * Copy the generated code into executable memory or return NULL.
+ */
+static jit_entry_t install_code(byte_array_t* code) {
+  uint64_t size = byte_array_length(code);
+  void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return NULL;
+  }
+  memcpy(memory, &code->elements[0], size);
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, size);
+    return NULL;
+  }
+  return (jit_entry_t) memory;
+}
+
+static jit_function_t* compile_with_return_type(closure_t* closure,
+                                                jit_type_t return_type) {
+  uint64_t epoch = __atomic_load_n(&global_binding_epoch, __ATOMIC_RELAXED);
+  jit_compiler_t compiler = {
+      .code = make_byte_array(256),
+      .closure = closure,
+      .dependencies = make_array(4),
+      .return_type = return_type,
+  };
+
+  // push rbp; mov rbp, rsp; push rbx; mov rbx, rdi
+  EMIT(&compiler, 0x55, 0x48, 0x89, 0xE5, 0x53, 0x48, 0x89, 0xFB);
+  jit_type_t type = compile_expression(&compiler, car(closure->code));
+  // pop rbx; pop rbp; ret
+  EMIT(&compiler, 0x5B, 0x5D, 0xC3);
+
+  jit_entry_t entry = NULL;
+  if (type == return_type) {
+    entry = install_code(compiler.code);
+  }
+  free_bytes(compiler.code);
+  if (entry == NULL) {
+    free_bytes(compiler.dependencies);
+    return NULL;
+  }
+
+  jit_function_t* result = malloc_struct(jit_function_t);
+  result->entry = entry;
+  result->n_args = closure->n_arg_names;
+  result->return_type = return_type;
+  result->calls_runtime = compiler.calls_runtime;
+  result->toplevel = closure->env;
+  result->dependencies = compiler.dependencies;
+  result->epoch = epoch;
+  return result;
+}
+
+#endif /* defined(__x86_64__) */
+
+/**
+ * Compile the lambda closure was made from or return NULL if it isn't
+ * in the subset we can compile.
+ */
+jit_function_t* jit_compile(closure_t* closure) {
+#if defined(__x86_64__)
+  if (closure->env != closure->env->toplevel
+      || list_length(closure->code) != 1) {
+    return NULL;
+  }
+  // The return type is only needed up front for recursive calls so
+  // just try both.
+  jit_function_t* result
+      = compile_with_return_type(closure, JIT_TYPE_INTEGER);
+  if (result == NULL) {
+    result = compile_with_return_type(closure, JIT_TYPE_BOOLEAN);
+  }
+  if (result != NULL) {
+    jit_compiled_functions++;
+  }
+  return result;
+#else
+  return NULL;
+#endif /* defined(__x86_64__) */
+}
+
+/**
+ * Return true if the global variables the compiled code of function
+ * depends on are still bound the way they were when it was compiled.
+ */
+static boolean_t jit_dependencies_are_current(jit_function_t* function,
+                                              lambda_analysis_t* analysis) {
+  // The main thread may define something while interpreter threads
+  // (see interpreter-thread.c) read the epoch.
+  uint64_t epoch = __atomic_load_n(&global_binding_epoch, __ATOMIC_RELAXED);
+  if (!function->toplevel->is_frozen
+      && __atomic_load_n(&function->epoch, __ATOMIC_RELAXED) != epoch) {
+    for (uint64_t i = 0; i < array_length(function->dependencies); i++) {
+      jit_dependency_t* dependency
+          = (jit_dependency_t*) array_get(function->dependencies, i);
+      if (environment_find_binding(function->toplevel, dependency->name)
+          != dependency->binding) {
+        return false;
+      }
+    }
+    __atomic_store_n(&function->epoch, epoch, __ATOMIC_RELAXED);
+  }
+
+  // Assignments change the values of the bindings themselves.
+  for (uint64_t i = 0; i < array_length(function->dependencies); i++) {
+    jit_dependency_t* dependency
+        = (jit_dependency_t*) array_get(function->dependencies, i);
+    tagged_reference_t value = dependency->binding->tail;
+    if (is_nil(dependency->value)) {
+      if (value.tag != TAG_CLOSURE_T
+          || untag_closure_t(value)->analysis != analysis) {
+        return false;
+      }
+    } else if (value.tag != dependency->value.tag
+               || value.data != dependency->value.data) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Call closure with arguments using compiled code when possible
+ * (compiling it when it becomes hot). Returns optional_empty() when
+ * the call must be interpreted instead.
+ */
+optional_t jit_try_call(closure_t* closure, primitive_arguments_t* arguments) {
+  if (!jit_is_enabled()) {
+    return optional_empty();
+  }
+
+  // Only the thread that made a closure compiles it (see
+  // interpreter-thread.c), other threads just use the compiled code
+  // once it has been published.
+  lambda_analysis_t* analysis = closure->analysis;
+  boolean_t is_owner = closure->owner == interpreter_thread_id;
+  jit_function_t* function
+      = __atomic_load_n(&analysis->jit, __ATOMIC_ACQUIRE);
+  if (function == NULL) {
+    if (!is_owner || analysis->jit_failed
+        || ++analysis->n_calls < JIT_THRESHOLD) {
+      return optional_empty();
+    }
+    function = jit_compile(closure);
+    if (function == NULL) {
+      analysis->jit_failed = true;
+      return optional_empty();
+    }
+    __atomic_store_n(&analysis->jit, function, __ATOMIC_RELEASE);
+  }
+
+  if (closure->env != function->toplevel
+      || arguments->n_args != function->n_args) {
+    return optional_empty();
+  }
+  if (!jit_dependencies_are_current(function, analysis)) {
+    // A binding was shadowed or assigned. The code is never freed
+    // since another thread may still be running it.
+    if (!is_owner) {
+      return optional_empty();
+    }
+    function = jit_compile(closure);
+    if (function == NULL) {
+      analysis->jit_failed = true;
+    }
+    __atomic_store_n(&analysis->jit, function, __ATOMIC_RELEASE);
+    if (function == NULL) {
+      return optional_empty();
+    }
+  }
+
+  int64_t untagged_arguments[MAX_PRIMITIVE_ARGS];
+  for (uint64_t i = 0; i < arguments->n_args; i++) {
+    if (arguments->args[i].tag != TAG_UINT64_T) {
+      return optional_empty();
+    }
+    untagged_arguments[i] = (int64_t) arguments->args[i].data;
+  }
+
+  jit_calls++;
+  int64_t result;
+  if (function->calls_runtime) {
+    jmp_buf target;
+    jmp_buf* previous_target = jit_bailout_target;
+    jit_bailout_target = &target;
+    if (setjmp(target) != 0) {
+      jit_bailout_target = previous_target;
+      jit_bailouts++;
+      return optional_empty();
+    }
+    result = function->entry(untagged_arguments);
+    jit_bailout_target = previous_target;
+  } else {
+    result = function->entry(untagged_arguments);
+  }
+  if (function->return_type == JIT_TYPE_BOOLEAN) {
+    return optional_of(tag_boolean(result));
+  }
+  return optional_of(tagged_reference(TAG_UINT64_T, result));
+}
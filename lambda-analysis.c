@@ -0,0 +1,625 @@
+/**
+ * @file lambda-analysis.c
+ *
+ * A tiny static analysis of lambda expressions. The evaluator works
+ * directly on s-expressions so instead of a separate compilation
+ * pass, the analysis is done the first time a lambda expression is
+ * evaluated and the result is remembered (keyed by the identity of
+ * the lambda expression) so that creating more closures from the
+ * same lambda expression is cheap.
+ *
+ * We compute:
+ *
+ * 1. the names defined (with define) inside of the body. These are
+ * bound in the environment of a call before the body is evaluated
+ * (which is what R7RS requires anyways) so the set of names in a call
+ * environment never changes after it is created.
+ *
+ * 2. the free variables of the lambda, i.e., the variables referenced
+ * in the body (including inside of nested lambdas) that are not
+ * parameters or defined in the body. A closure only captures the
+ * bindings of these variables (see eval_lambda) instead of the entire
+ * environment it was created in.
+ *
+ * 3. whether an environment created to call a closure made from the
+ * lambda can escape (only call/cc can do this since closures no
+ * longer capture environments). Environments that can't escape are
+ * allocated on the frame stack (see environment.c) instead of on the
+ * heap.
+ *
+ * The binding forms that the evaluator implements natively (let,
+ * let*, letrec, letrec*, named let and do) also create an environment
+ * and are analyzed the same way (see analyze_let and analyze_do) with
+ * the names they bind playing the role of the parameters.
+ *
+ * Any macro uses in an expression are expanded (see syntax-rules.c)
+ * right before it is analyzed so the analysis only sees the expanded
+ * code.
+ */
+
+// ======================================================================
+// This is block is extraced to lambda-analysis.h
+// ======================================================================
+
+#ifndef _LAMBDA_ANALYSIS_H_
+#define _LAMBDA_ANALYSIS_H_
+
+#include "array.h"
+#include "boolean.h"
+#include "environment.h"
+#include "tagged-reference.h"
+
+typedef struct {
+  // True if the body contains anything that could capture the
+  // environment a call is evaluated in.
+  boolean_t frame_may_escape;
+  // The names (char*) defined inside of the body.
+  array_t* defined_names;
+  // The free variables (char*) of the lambda.
+  array_t* free_names;
+  // True if a lambda in the body refers to one of the parameters or
+  // defined names. Loops must then make fresh bindings for every
+  // iteration instead of updating the old ones.
+  boolean_t bindings_may_be_captured;
+  // For a named let, true when the name is only ever called in tail
+  // position from the body so that it can be evaluated as a loop.
+  boolean_t is_loop;
+  // See jit.c
+  uint64_t n_calls;
+  boolean_t jit_failed;
+  struct jit_function_S* jit;
+} lambda_analysis_t;
+
+extern lambda_analysis_t* analyze_lambda(environment_t* env,
+                                         tagged_reference_t lambda_expr);
+extern lambda_analysis_t* analyze_let(environment_t* env,
+                                      tagged_reference_t let_expr);
+extern lambda_analysis_t* analyze_do(environment_t* env,
+                                     tagged_reference_t do_expr);
+extern char* binding_name(tagged_reference_t binding);
+extern boolean_t name_array_contains(array_t* names, char* name);
+extern tagged_reference_t original_expression(tagged_reference_t reference);
+
+#endif /* _LAMBDA_ANALYSIS_H_ */
+
+// ======================================================================
+
+#include "allocate.h"
+#include "call-site.h"
+#include "closure.h"
+#include "hash-table.h"
+#include "inline-cache.h"
+#include "lambda-analysis.h"
+#include "pair.h"
+#include "string-util.h"
+#include "syntax-rules.h"
+
+_Thread_local hash_table_t* lambda_analysis_cache = NULL;
+
+boolean_t name_array_contains(array_t* names, char* name) {
+  for (uint64_t i = 0; i < array_length(names); i++) {
+    if (string_equal((char*) array_get(names, i), name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static array_t* name_array_add(array_t* names, char* name) {
+  if (name_array_contains(names, name)) {
+    return names;
+  }
+  return array_add(names, (uint64_t) name);
+}
+
+/**
+ * The evaluator rewrites parts of the code it evaluates (see
+ * inline-cache.c and call-site.c). Return what was originally read
+ * in place of reference.
+ */
+tagged_reference_t original_expression(tagged_reference_t reference) {
+  if (reference.tag == TAG_CALL_SITE_T) {
+    return original_expression(untag_call_site(reference)->operator.head);
+  }
+  if (reference.tag == TAG_GLOBAL_REFERENCE_T) {
+    return tagged_reference(TAG_SCHEME_SYMBOL,
+                            untag_global_reference(reference)->name);
+  }
+  if (reference.tag == TAG_CLOSURE_SLOT_T) {
+    return tagged_reference(TAG_SCHEME_SYMBOL,
+                            untag_closure_slot(reference)->name);
+  }
+  return reference;
+}
+
+static boolean_t is_symbol_named(tagged_reference_t reference, char* name) {
+  reference = original_expression(reference);
+  return reference.tag == TAG_SCHEME_SYMBOL
+         && string_equal(untag_reader_symbol(reference), name);
+}
+
+/**
+ * Return true if expr is a form that creates a new scope for the
+ * names defined inside of it.
+ */
+static boolean_t is_scope_form(tagged_reference_t expr) {
+  if (expr.tag != TAG_PAIR_T) {
+    return false;
+  }
+  tagged_reference_t first = car(expr);
+  return is_symbol_named(first, "lambda") || is_symbol_named(first, "let")
+         || is_symbol_named(first, "let*") || is_symbol_named(first, "letrec")
+         || is_symbol_named(first, "letrec*") || is_symbol_named(first, "do");
+}
+
+/**
+ * Return the name bound by an element of the bindings of a let or do
+ * (which looks like (name init ...)) or by a lambda parameter.
+ */
+char* binding_name(tagged_reference_t binding) {
+  if (binding.tag == TAG_PAIR_T) {
+    binding = car(binding);
+  }
+  return untag_reader_symbol(binding);
+}
+
+/**
+ * Return true if expr (which is not quoted) contains anything that
+ * can capture the current environment. This is conservative: any
+ * mention of call/cc, even as a variable name, counts.
+ */
+boolean_t may_capture_environment(tagged_reference_t expr) {
+  if (expr.tag == TAG_PAIR_T && is_symbol_named(car(expr), "quote")) {
+    return false;
+  }
+  while (expr.tag == TAG_PAIR_T) {
+    if (may_capture_environment(untag_pair(expr)->head)) {
+      return true;
+    }
+    expr = untag_pair(expr)->tail;
+  }
+  return is_symbol_named(expr, "call/cc")
+         || is_symbol_named(expr, "call-with-current-continuation");
+}
+
+/**
+ * Add the names defined anywhere in expr (except inside of nested
+ * lambdas or quoted data) to names.
+ */
+static array_t* collect_defined_names(array_t* names,
+                                      tagged_reference_t expr) {
+  if (expr.tag != TAG_PAIR_T) {
+    return names;
+  }
+  tagged_reference_t first = car(expr);
+  if (is_symbol_named(first, "quote") || is_scope_form(expr)) {
+    return names;
+  }
+  if (is_symbol_named(first, "define")
+      || is_symbol_named(first, "define-syntax")) {
+    names = name_array_add(names, untag_reader_symbol(car(cdr(expr))));
+  }
+  while (expr.tag == TAG_PAIR_T) {
+    names = collect_defined_names(names, car(expr));
+    expr = cdr(expr);
+  }
+  return names;
+}
+
+static array_t* collect_referenced_names(array_t* names,
+                                         tagged_reference_t expr);
+
+static array_t* add_names(array_t* names, array_t* more_names) {
+  for (uint64_t i = 0; i < array_length(more_names); i++) {
+    names = name_array_add(names, (char*) array_get(more_names, i));
+  }
+  return names;
+}
+
+/**
+ * Add the names referenced by the initial values of bindings (a list
+ * of (name init ...)) to names.
+ */
+static array_t* collect_init_names(array_t* names,
+                                   tagged_reference_t bindings) {
+  for (; bindings.tag == TAG_PAIR_T; bindings = cdr(bindings)) {
+    names = collect_referenced_names(names, car(cdr(car(bindings))));
+  }
+  return names;
+}
+
+/**
+ * Add the names of all variables referenced in expr to names. The
+ * variables referenced by a nested lambda (or let, etc.) are its free
+ * variables.
+ */
+static array_t* collect_referenced_names(array_t* names,
+                                         tagged_reference_t expr) {
+  expr = original_expression(expr);
+  if (expr.tag == TAG_SCHEME_SYMBOL) {
+    return name_array_add(names, untag_reader_symbol(expr));
+  }
+  if (expr.tag != TAG_PAIR_T) {
+    return names;
+  }
+  tagged_reference_t first = car(expr);
+  if (is_symbol_named(first, "quote")
+      || is_symbol_named(first, "define-syntax")) {
+    return names;
+  }
+  if (is_symbol_named(first, "lambda")) {
+    return add_names(names, analyze_lambda(NULL, expr)->free_names);
+  }
+  if (is_symbol_named(first, "let")) {
+    tagged_reference_t bindings = car(cdr(expr));
+    if (bindings.tag == TAG_SCHEME_SYMBOL) {
+      bindings = car(cdr(cdr(expr)));
+    }
+    names = collect_init_names(names, bindings);
+    return add_names(names, analyze_let(NULL, expr)->free_names);
+  }
+  if (is_symbol_named(first, "let*")) {
+    // Each initial value can see the names bound before it.
+    array_t* bound_names = make_array(4);
+    for (tagged_reference_t bindings = car(cdr(expr));
+         bindings.tag == TAG_PAIR_T; bindings = cdr(bindings)) {
+      array_t* init_names
+          = collect_referenced_names(make_array(4), car(cdr(car(bindings))));
+      for (uint64_t i = 0; i < array_length(init_names); i++) {
+        char* name = (char*) array_get(init_names, i);
+        if (!name_array_contains(bound_names, name)) {
+          names = name_array_add(names, name);
+        }
+      }
+      free_bytes(init_names);
+      bound_names = name_array_add(bound_names, binding_name(car(bindings)));
+    }
+    free_bytes(bound_names);
+    return add_names(names, analyze_let(NULL, expr)->free_names);
+  }
+  if (is_symbol_named(first, "letrec") || is_symbol_named(first, "letrec*")) {
+    return add_names(names, analyze_let(NULL, expr)->free_names);
+  }
+  if (is_symbol_named(first, "do")) {
+    names = collect_init_names(names, car(cdr(expr)));
+    return add_names(names, analyze_do(NULL, expr)->free_names);
+  }
+  if (is_symbol_named(first, "cond")) {
+    for (tagged_reference_t clauses = cdr(expr); clauses.tag == TAG_PAIR_T;
+         clauses = cdr(clauses)) {
+      for (tagged_reference_t lst = car(clauses); lst.tag == TAG_PAIR_T;
+           lst = cdr(lst)) {
+        if (!is_symbol_named(car(lst), "else")
+            && !is_symbol_named(car(lst), "=>")) {
+          names = collect_referenced_names(names, car(lst));
+        }
+      }
+    }
+    return names;
+  }
+  if (is_symbol_named(first, "if") || is_symbol_named(first, "define")
+      || is_symbol_named(first, "set!") || is_symbol_named(first, "begin")
+      || is_symbol_named(first, "and") || is_symbol_named(first, "or")
+      || is_symbol_named(first, "when") || is_symbol_named(first, "unless")) {
+    // The keyword itself is not a variable reference.
+    expr = cdr(expr);
+  }
+  while (expr.tag == TAG_PAIR_T) {
+    names = collect_referenced_names(names, car(expr));
+    expr = cdr(expr);
+  }
+  return names;
+}
+
+/**
+ * Add the free variables of every lambda nested in expr to names
+ * (and of every named let that isn't a loop, since the procedure it
+ * makes shares their bindings too).
+ */
+static array_t* collect_captured_names(array_t* names,
+                                       tagged_reference_t expr) {
+  if (expr.tag != TAG_PAIR_T || is_symbol_named(car(expr), "quote")) {
+    return names;
+  }
+  if (is_symbol_named(car(expr), "lambda")) {
+    return add_names(names, analyze_lambda(NULL, expr)->free_names);
+  }
+  if (is_symbol_named(car(expr), "let")
+      && cdr(expr).tag == TAG_PAIR_T
+      && car(cdr(expr)).tag == TAG_SCHEME_SYMBOL) {
+    lambda_analysis_t* analysis = analyze_let(NULL, expr);
+    if (!analysis->is_loop) {
+      names = add_names(names, analysis->free_names);
+    }
+  }
+  while (expr.tag == TAG_PAIR_T) {
+    names = collect_captured_names(names, car(expr));
+    expr = cdr(expr);
+  }
+  return names;
+}
+
+/**
+ * Return true if name is only used in expr as the operator of calls
+ * in tail position (when in_tail_position is true). This is
+ * conservative and doesn't bother with shadowing (so any use inside
+ * of a lambda, define, set! or do counts as not in tail position).
+ */
+static boolean_t is_only_tail_called(tagged_reference_t expr, char* name,
+                                     boolean_t in_tail_position);
+
+/**
+ * Return true if name appears anywhere in expr (outside of quoted
+ * data).
+ */
+static boolean_t is_mentioned(tagged_reference_t expr, char* name) {
+  expr = original_expression(expr);
+  if (expr.tag == TAG_SCHEME_SYMBOL) {
+    return string_equal(untag_reader_symbol(expr), name);
+  }
+  if (expr.tag != TAG_PAIR_T || is_symbol_named(car(expr), "quote")) {
+    return false;
+  }
+  for (; expr.tag == TAG_PAIR_T; expr = cdr(expr)) {
+    if (is_mentioned(car(expr), name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Same as is_only_tail_called for a sequence where only the last
+ * expression is in tail position.
+ */
+static boolean_t is_only_tail_called_in_sequence(tagged_reference_t exprs,
+                                                 char* name,
+                                                 boolean_t in_tail_position) {
+  for (; exprs.tag == TAG_PAIR_T; exprs = cdr(exprs)) {
+    boolean_t is_last = cdr(exprs).tag != TAG_PAIR_T;
+    if (!is_only_tail_called(car(exprs), name,
+                             in_tail_position && is_last)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static boolean_t is_only_tail_called(tagged_reference_t expr, char* name,
+                                     boolean_t in_tail_position) {
+  expr = original_expression(expr);
+  if (expr.tag == TAG_SCHEME_SYMBOL) {
+    return !string_equal(untag_reader_symbol(expr), name);
+  }
+  if (expr.tag != TAG_PAIR_T) {
+    return true;
+  }
+  tagged_reference_t first = car(expr);
+  if (is_symbol_named(first, "quote")) {
+    return true;
+  }
+  if (is_symbol_named(first, "if")) {
+    // Both the consequent and the alternative are in tail position.
+    for (tagged_reference_t branches = cdr(cdr(expr));
+         branches.tag == TAG_PAIR_T; branches = cdr(branches)) {
+      if (!is_only_tail_called(car(branches), name, in_tail_position)) {
+        return false;
+      }
+    }
+    return !is_mentioned(car(cdr(expr)), name);
+  }
+  if (is_symbol_named(first, "begin") || is_symbol_named(first, "and")
+      || is_symbol_named(first, "or")) {
+    return is_only_tail_called_in_sequence(cdr(expr), name,
+                                           in_tail_position);
+  }
+  if (is_symbol_named(first, "when") || is_symbol_named(first, "unless")) {
+    return !is_mentioned(car(cdr(expr)), name)
+           && is_only_tail_called_in_sequence(cdr(cdr(expr)), name,
+                                              in_tail_position);
+  }
+  if (is_symbol_named(first, "cond")) {
+    for (tagged_reference_t clauses = cdr(expr); clauses.tag == TAG_PAIR_T;
+         clauses = cdr(clauses)) {
+      tagged_reference_t clause = car(clauses);
+      if (cdr(clause).tag == TAG_PAIR_T
+          && is_symbol_named(car(cdr(clause)), "=>")) {
+        if (is_mentioned(clause, name)) {
+          return false;
+        }
+      } else if (!is_only_tail_called(car(clause), name, false)
+                 || !is_only_tail_called_in_sequence(cdr(clause), name,
+                                                     in_tail_position)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (is_symbol_named(first, "let") || is_symbol_named(first, "let*")
+      || is_symbol_named(first, "letrec")
+      || is_symbol_named(first, "letrec*")) {
+    tagged_reference_t rest = cdr(expr);
+    if (car(rest).tag == TAG_SCHEME_SYMBOL) {
+      // The body of a nested named let is only in tail position when
+      // it is evaluated as a loop (and not called recursively).
+      in_tail_position
+          = in_tail_position && analyze_let(NULL, expr)->is_loop;
+      rest = cdr(rest);
+    }
+    return !is_mentioned(car(rest), name)
+           && is_only_tail_called_in_sequence(cdr(rest), name,
+                                              in_tail_position);
+  }
+  // An application.
+  if (is_symbol_named(first, name)) {
+    return in_tail_position && !is_mentioned(cdr(expr), name);
+  }
+  return !is_mentioned(expr, name);
+}
+
+/**
+ * Return a list of the expressions in lst followed by those in exprs
+ * (without modifying either list).
+ */
+static tagged_reference_t prepend_expressions(tagged_reference_t lst,
+                                              tagged_reference_t exprs) {
+  if (lst.tag != TAG_PAIR_T) {
+    return exprs;
+  }
+  return cons(car(lst), prepend_expressions(cdr(lst), exprs));
+}
+
+/**
+ * Return a list of the initial values (or steps when is_step is true)
+ * of bindings.
+ */
+static tagged_reference_t binding_expressions(tagged_reference_t bindings,
+                                              boolean_t is_step) {
+  if (bindings.tag != TAG_PAIR_T) {
+    return NIL;
+  }
+  tagged_reference_t rest = binding_expressions(cdr(bindings), is_step);
+  tagged_reference_t expr = cdr(car(bindings));
+  if (is_step) {
+    expr = cdr(expr);
+    if (expr.tag != TAG_PAIR_T) {
+      return rest;
+    }
+  }
+  return cons(car(expr), rest);
+}
+
+static lambda_analysis_t* get_cached_analysis(tagged_reference_t expr) {
+  if (lambda_analysis_cache == NULL) {
+    lambda_analysis_cache = make_hash_table(HASH_TABLE_EQ, 64);
+  }
+  optional_t cached = hash_table_get(lambda_analysis_cache, expr);
+  if (optional_is_present(cached)) {
+    return (lambda_analysis_t*) optional_value(cached).data;
+  }
+  return NULL;
+}
+
+/**
+ * Analyze a form (expr) that evaluates body (a list of expressions)
+ * in a new environment where names (a list of names or bindings) are
+ * bound.
+ */
+static lambda_analysis_t* analyze_scope(tagged_reference_t expr,
+                                        tagged_reference_t names,
+                                        tagged_reference_t body) {
+  lambda_analysis_t* result = malloc_struct(lambda_analysis_t);
+  result->frame_may_escape = may_capture_environment(expr);
+
+  result->defined_names = make_array(4);
+  for (tagged_reference_t lst = body; lst.tag == TAG_PAIR_T; lst = cdr(lst)) {
+    result->defined_names
+        = collect_defined_names(result->defined_names, car(lst));
+  }
+
+  array_t* referenced_names = make_array(8);
+  array_t* captured_names = make_array(8);
+  for (tagged_reference_t lst = body; lst.tag == TAG_PAIR_T; lst = cdr(lst)) {
+    referenced_names = collect_referenced_names(referenced_names, car(lst));
+    captured_names = collect_captured_names(captured_names, car(lst));
+  }
+
+  result->free_names = make_array(8);
+  for (uint64_t i = 0; i < array_length(referenced_names); i++) {
+    char* name = (char*) array_get(referenced_names, i);
+    if (name_array_contains(result->defined_names, name)) {
+      continue;
+    }
+    boolean_t is_parameter = false;
+    for (tagged_reference_t lst = names; lst.tag == TAG_PAIR_T;
+         lst = cdr(lst)) {
+      if (string_equal(binding_name(car(lst)), name)) {
+        is_parameter = true;
+      }
+    }
+    if (!is_parameter) {
+      result->free_names = array_add(result->free_names, (uint64_t) name);
+    }
+  }
+  free_bytes(referenced_names);
+
+  result->bindings_may_be_captured = false;
+  for (uint64_t i = 0; i < array_length(captured_names); i++) {
+    char* name = (char*) array_get(captured_names, i);
+    if (!name_array_contains(result->free_names, name)) {
+      result->bindings_may_be_captured = true;
+    }
+  }
+  free_bytes(captured_names);
+
+  hash_table_set(lambda_analysis_cache, expr,
+                 tagged_reference(TAG_LAMBDA_ANALYSIS_T, result));
+  return result;
+}
+
+/**
+ * Return the (possibly cached) analysis of lambda_expr which must
+ * look like (lambda (args...) body...). The first time, any macro
+ * uses in lambda_expr are expanded using the macros visible in env
+ * (which is NULL for a lambda nested in an already expanded
+ * expression).
+ */
+lambda_analysis_t* analyze_lambda(environment_t* env,
+                                  tagged_reference_t lambda_expr) {
+  lambda_analysis_t* result = get_cached_analysis(lambda_expr);
+  if (result == NULL) {
+    expand_macros(env, lambda_expr);
+    result = analyze_scope(lambda_expr, car(cdr(lambda_expr)),
+                           cdr(cdr(lambda_expr)));
+  }
+  return result;
+}
+
+/**
+ * Return the (possibly cached) analysis of the scope created by a
+ * let, let*, letrec, letrec* or named let expression. The initial
+ * values are part of the scope except for let and named let. For a
+ * named let, the name is bound in the scope too. Macros are expanded
+ * like for analyze_lambda.
+ */
+lambda_analysis_t* analyze_let(environment_t* env,
+                               tagged_reference_t let_expr) {
+  lambda_analysis_t* result = get_cached_analysis(let_expr);
+  if (result != NULL) {
+    return result;
+  }
+  expand_macros(env, let_expr);
+  tagged_reference_t rest = cdr(let_expr);
+  if (car(rest).tag == TAG_SCHEME_SYMBOL) {
+    char* name = untag_reader_symbol(car(rest));
+    tagged_reference_t body = cdr(cdr(rest));
+    result
+        = analyze_scope(let_expr, cons(car(rest), car(cdr(rest))), body);
+    result->is_loop = is_only_tail_called_in_sequence(body, name, true);
+    return result;
+  }
+  tagged_reference_t body = cdr(rest);
+  if (is_symbol_named(car(let_expr), "letrec")
+      || is_symbol_named(car(let_expr), "letrec*")) {
+    body = prepend_expressions(binding_expressions(car(rest), false), body);
+  }
+  return analyze_scope(let_expr, car(rest), body);
+}
+
+/**
+ * Return the (possibly cached) analysis of the scope created by a do
+ * loop, (do ((var init step)...) (test expr...) command...). The
+ * initial values are not part of the scope. Macros are expanded like
+ * for analyze_lambda.
+ */
+lambda_analysis_t* analyze_do(environment_t* env, tagged_reference_t do_expr) {
+  lambda_analysis_t* result = get_cached_analysis(do_expr);
+  if (result != NULL) {
+    return result;
+  }
+  expand_macros(env, do_expr);
+  tagged_reference_t bindings = car(cdr(do_expr));
+  tagged_reference_t body = prepend_expressions(
+      cdr(cdr(do_expr)), binding_expressions(bindings, true));
+  return analyze_scope(do_expr, bindings, body);
+}
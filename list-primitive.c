@@ -0,0 +1,484 @@
+/**
+ * @file list-primitive.c
+ *
+ * Native implementations of the R7RS list library. These could be
+ * written in scheme but since every scheme program leans on them so
+ * heavily, they are written in C as simple loops (no recursion on the
+ * C stack) that allocate only the pairs they return.
+ */
+
+// ======================================================================
+// This is block is extraced to list-primitive.h
+// ======================================================================
+
+#ifndef _LIST_PRIMITIVE_H_
+#define _LIST_PRIMITIVE_H_
+
+#include "boolean.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+extern tagged_reference_t primtive_function_cons(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_car(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_cdr(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_set_car(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_set_cdr(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_null_p(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_pair_p(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_list_p(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_list(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_length(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_append(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_reverse(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_list_tail(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_list_ref(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_list_copy(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_memq(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_memv(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_member(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_assq(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_assv(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_assoc(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_map(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_for_each(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_apply(primitive_arguments_t args);
+extern void apply_arguments(primitive_arguments_t* arguments,
+                            primitive_arguments_t* proc_arguments);
+extern boolean_t next_map_arguments(primitive_arguments_t* arguments,
+                                    primitive_arguments_t* proc_arguments);
+
+// caar, cadr, ..., cddddr
+#define DECLARE_CXR_PRIMITIVE(name)                                            \
+  extern tagged_reference_t primtive_function_##name(                          \
+      primitive_arguments_t args)
+
+DECLARE_CXR_PRIMITIVE(caar);
+DECLARE_CXR_PRIMITIVE(cadr);
+DECLARE_CXR_PRIMITIVE(cdar);
+DECLARE_CXR_PRIMITIVE(cddr);
+DECLARE_CXR_PRIMITIVE(caaar);
+DECLARE_CXR_PRIMITIVE(caadr);
+DECLARE_CXR_PRIMITIVE(cadar);
+DECLARE_CXR_PRIMITIVE(caddr);
+DECLARE_CXR_PRIMITIVE(cdaar);
+DECLARE_CXR_PRIMITIVE(cdadr);
+DECLARE_CXR_PRIMITIVE(cddar);
+DECLARE_CXR_PRIMITIVE(cdddr);
+DECLARE_CXR_PRIMITIVE(caaaar);
+DECLARE_CXR_PRIMITIVE(caaadr);
+DECLARE_CXR_PRIMITIVE(caadar);
+DECLARE_CXR_PRIMITIVE(caaddr);
+DECLARE_CXR_PRIMITIVE(cadaar);
+DECLARE_CXR_PRIMITIVE(cadadr);
+DECLARE_CXR_PRIMITIVE(caddar);
+DECLARE_CXR_PRIMITIVE(cadddr);
+DECLARE_CXR_PRIMITIVE(cdaaar);
+DECLARE_CXR_PRIMITIVE(cdaadr);
+DECLARE_CXR_PRIMITIVE(cdadar);
+DECLARE_CXR_PRIMITIVE(cdaddr);
+DECLARE_CXR_PRIMITIVE(cddaar);
+DECLARE_CXR_PRIMITIVE(cddadr);
+DECLARE_CXR_PRIMITIVE(cdddar);
+DECLARE_CXR_PRIMITIVE(cddddr);
+
+#endif /* _LIST_PRIMITIVE_H_ */
+
+// ======================================================================
+
+#include <string.h>
+
+#include "boolean.h"
+#include "equivalence.h"
+#include "evaluator.h"
+#include "fatal-error.h"
+#include "list-primitive.h"
+#include "pair.h"
+
+/**
+ * A list_builder_t makes it easy to build a list from front to back
+ * (without having to reverse the result at the end).
+ */
+typedef struct {
+  tagged_reference_t head;
+  pair_t* last;
+} list_builder_t;
+
+static inline void list_builder_add(list_builder_t* builder,
+                                    tagged_reference_t element) {
+  pair_t* pair = make_pair(element, NIL);
+  if (builder->last == NULL) {
+    builder->head = tagged_reference(TAG_PAIR_T, pair);
+  } else {
+    builder->last->tail = tagged_reference(TAG_PAIR_T, pair);
+  }
+  builder->last = pair;
+}
+
+tagged_reference_t primtive_function_cons(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  return cons(arguments.args[0], arguments.args[1]);
+}
+
+tagged_reference_t primtive_function_car(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return car(arguments.args[0]);
+}
+
+tagged_reference_t primtive_function_cdr(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return cdr(arguments.args[0]);
+}
+
+tagged_reference_t primtive_function_set_car(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  untag_pair(arguments.args[0])->head = arguments.args[1];
+  return NIL;
+}
+
+tagged_reference_t primtive_function_set_cdr(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  untag_pair(arguments.args[0])->tail = arguments.args[1];
+  return NIL;
+}
+
+tagged_reference_t primtive_function_null_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return tag_boolean(is_nil(arguments.args[0]));
+}
+
+tagged_reference_t primtive_function_pair_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return tag_boolean(arguments.args[0].tag == TAG_PAIR_T);
+}
+
+/**
+ * Example (list? '(1 2)) => #t
+ *
+ * This uses the "tortoise and hare" algorithm so that circular lists
+ * are not considered lists (and don't loop forever).
+ */
+tagged_reference_t primtive_function_list_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  tagged_reference_t slow = arguments.args[0];
+  tagged_reference_t fast = arguments.args[0];
+  while (1) {
+    for (int i = 0; i < 2; i++) {
+      if (is_nil(fast)) {
+        return tag_boolean(true);
+      }
+      if (fast.tag != TAG_PAIR_T) {
+        return tag_boolean(false);
+      }
+      fast = untag_pair(fast)->tail;
+    }
+    slow = untag_pair(slow)->tail;
+    if (fast.data == slow.data) {
+      return tag_boolean(false);
+    }
+  }
+}
+
+tagged_reference_t primtive_function_list(primitive_arguments_t arguments) {
+  tagged_reference_t result = NIL;
+  for (int i = arguments.n_args - 1; i >= 0; i--) {
+    result = cons(arguments.args[i], result);
+  }
+  return result;
+}
+
+tagged_reference_t primtive_function_length(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  uint64_t length = 0;
+  for (tagged_reference_t lst = arguments.args[0]; !is_nil(lst);
+       lst = untag_pair(lst)->tail) {
+    length++;
+  }
+  return tagged_reference(TAG_UINT64_T, length);
+}
+
+/**
+ * Example (append '(1 2) '(3) '(4 5)) => (1 2 3 4 5)
+ *
+ * All but the last list are copied and the last list is shared with
+ * the result.
+ */
+tagged_reference_t primtive_function_append(primitive_arguments_t arguments) {
+  if (arguments.n_args == 0) {
+    return NIL;
+  }
+  list_builder_t builder = {NIL, NULL};
+  for (int i = 0; i < arguments.n_args - 1; i++) {
+    for (tagged_reference_t lst = arguments.args[i]; !is_nil(lst);
+         lst = untag_pair(lst)->tail) {
+      list_builder_add(&builder, untag_pair(lst)->head);
+    }
+  }
+  tagged_reference_t last = arguments.args[arguments.n_args - 1];
+  if (builder.last == NULL) {
+    return last;
+  }
+  builder.last->tail = last;
+  return builder.head;
+}
+
+tagged_reference_t primtive_function_reverse(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  tagged_reference_t result = NIL;
+  for (tagged_reference_t lst = arguments.args[0]; !is_nil(lst);
+       lst = untag_pair(lst)->tail) {
+    result = cons(untag_pair(lst)->head, result);
+  }
+  return result;
+}
+
+static tagged_reference_t list_tail(tagged_reference_t lst, uint64_t k) {
+  for (uint64_t i = 0; i < k; i++) {
+    if (lst.tag != TAG_PAIR_T) {
+      fatal_error(ERROR_ILLEGAL_LIST_INDEX);
+    }
+    lst = untag_pair(lst)->tail;
+  }
+  return lst;
+}
+
+tagged_reference_t
+    primtive_function_list_tail(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  return list_tail(arguments.args[0], untag_uint64_t(arguments.args[1]));
+}
+
+tagged_reference_t primtive_function_list_ref(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  tagged_reference_t lst
+      = list_tail(arguments.args[0], untag_uint64_t(arguments.args[1]));
+  if (lst.tag != TAG_PAIR_T) {
+    fatal_error(ERROR_ILLEGAL_LIST_INDEX);
+  }
+  return untag_pair(lst)->head;
+}
+
+tagged_reference_t
+    primtive_function_list_copy(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  list_builder_t builder = {NIL, NULL};
+  tagged_reference_t lst = arguments.args[0];
+  while (lst.tag == TAG_PAIR_T) {
+    list_builder_add(&builder, untag_pair(lst)->head);
+    lst = untag_pair(lst)->tail;
+  }
+  if (builder.last == NULL) {
+    return lst;
+  }
+  builder.last->tail = lst;
+  return builder.head;
+}
+
+typedef boolean_t (*equivalence_t)(tagged_reference_t a, tagged_reference_t b);
+
+/**
+ * Return the first pair of lst whose head is equivalent to element
+ * or #f.
+ */
+static tagged_reference_t list_member(tagged_reference_t element,
+                                      tagged_reference_t lst,
+                                      equivalence_t equivalent) {
+  while (!is_nil(lst)) {
+    if (equivalent(element, untag_pair(lst)->head)) {
+      return lst;
+    }
+    lst = untag_pair(lst)->tail;
+  }
+  return tag_boolean(false);
+}
+
+/**
+ * Return the first pair of the association list alist whose head is
+ * equivalent to key or #f.
+ */
+static tagged_reference_t list_assoc(tagged_reference_t key,
+                                     tagged_reference_t alist,
+                                     equivalence_t equivalent) {
+  while (!is_nil(alist)) {
+    tagged_reference_t binding = untag_pair(alist)->head;
+    if (equivalent(key, car(binding))) {
+      return binding;
+    }
+    alist = untag_pair(alist)->tail;
+  }
+  return tag_boolean(false);
+}
+
+tagged_reference_t primtive_function_memq(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  return list_member(arguments.args[0], arguments.args[1], &is_eq);
+}
+
+tagged_reference_t primtive_function_memv(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  return list_member(arguments.args[0], arguments.args[1], &is_eqv);
+}
+
+tagged_reference_t primtive_function_member(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  return list_member(arguments.args[0], arguments.args[1], &is_equal);
+}
+
+tagged_reference_t primtive_function_assq(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  return list_assoc(arguments.args[0], arguments.args[1], &is_eq);
+}
+
+tagged_reference_t primtive_function_assv(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  return list_assoc(arguments.args[0], arguments.args[1], &is_eqv);
+}
+
+tagged_reference_t primtive_function_assoc(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  return list_assoc(arguments.args[0], arguments.args[1], &is_equal);
+}
+
+/**
+ * Fill in proc_arguments with the heads of the lists in arguments
+ * (starting at index 1) and advance those lists. Returns false when
+ * any of the lists is exhausted.
+ */
+boolean_t next_map_arguments(primitive_arguments_t* arguments,
+                             primitive_arguments_t* proc_arguments) {
+  proc_arguments->n_args = arguments->n_args - 1;
+  for (int i = 1; i < arguments->n_args; i++) {
+    if (is_nil(arguments->args[i])) {
+      return false;
+    }
+    pair_t* pair = untag_pair(arguments->args[i]);
+    proc_arguments->args[i - 1] = pair->head;
+    arguments->args[i] = pair->tail;
+  }
+  return true;
+}
+
+/**
+ * Example (map + '(1 2) '(10 20)) => (11 22)
+ *
+ * When the procedure is a primitive it is called directly instead of
+ * going through apply_procedure().
+ */
+tagged_reference_t primtive_function_map(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, MAX_PRIMITIVE_ARGS);
+  tagged_reference_t fn = arguments.args[0];
+  list_builder_t builder = {NIL, NULL};
+  primitive_arguments_t proc_arguments;
+  if (fn.tag == TAG_PRIMITIVE) {
+    primitive_t primitive = untag_primitive(fn);
+    while (next_map_arguments(&arguments, &proc_arguments)) {
+      list_builder_add(&builder, primitive(proc_arguments));
+    }
+  } else {
+    while (next_map_arguments(&arguments, &proc_arguments)) {
+      list_builder_add(&builder, apply_procedure(fn, proc_arguments));
+    }
+  }
+  return builder.head;
+}
+
+tagged_reference_t
+    primtive_function_for_each(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, MAX_PRIMITIVE_ARGS);
+  tagged_reference_t fn = arguments.args[0];
+  primitive_arguments_t proc_arguments;
+  if (fn.tag == TAG_PRIMITIVE) {
+    primitive_t primitive = untag_primitive(fn);
+    while (next_map_arguments(&arguments, &proc_arguments)) {
+      primitive(proc_arguments);
+    }
+  } else {
+    while (next_map_arguments(&arguments, &proc_arguments)) {
+      apply_procedure(fn, proc_arguments);
+    }
+  }
+  return NIL;
+}
+
+/**
+ * Example (apply + 1 2 '(3 4)) => 10
+ */
+/**
+ * Fill in proc_arguments with the arguments of (apply fn arg... lst),
+ * i.e., the args followed by the elements of lst.
+ */
+void apply_arguments(primitive_arguments_t* arguments,
+                     primitive_arguments_t* proc_arguments) {
+  require_n_args(*arguments, 2, MAX_PRIMITIVE_ARGS);
+  memset(proc_arguments, 0, sizeof(primitive_arguments_t));
+  for (int i = 1; i < arguments->n_args - 1; i++) {
+    proc_arguments->args[proc_arguments->n_args++] = arguments->args[i];
+  }
+  for (tagged_reference_t lst = arguments->args[arguments->n_args - 1];
+       !is_nil(lst); lst = untag_pair(lst)->tail) {
+    if (proc_arguments->n_args >= MAX_PRIMITIVE_ARGS) {
+      fatal_error(ERROR_MAX_PRIMITIVE_ARGS);
+    }
+    proc_arguments->args[proc_arguments->n_args++] = untag_pair(lst)->head;
+  }
+}
+
+tagged_reference_t primtive_function_apply(primitive_arguments_t arguments) {
+  primitive_arguments_t proc_arguments;
+  apply_arguments(&arguments, &proc_arguments);
+  return apply_procedure(arguments.args[0], proc_arguments);
+}
+
+/**
+ * Apply a sequence of car/cdr operations. The path is read from right
+ * to left just like the name, i.e., "ad" for cadr means cdr then car.
+ */
+static tagged_reference_t cxr(tagged_reference_t value, const char* path,
+                              int path_length) {
+  for (int i = path_length - 1; i >= 0; i--) {
+    value = (path[i] == 'a') ? car(value) : cdr(value);
+  }
+  return value;
+}
+
+#define DEFINE_CXR_PRIMITIVE(name, path)                                       \
+  tagged_reference_t primtive_function_##name(                                 \
+      primitive_arguments_t arguments) {                                       \
+    require_n_args(arguments, 1, 1);                                           \
+    return cxr(arguments.args[0], path, sizeof(path) - 1);                     \
+  }
+
+DEFINE_CXR_PRIMITIVE(caar, "aa")
+DEFINE_CXR_PRIMITIVE(cadr, "ad")
+DEFINE_CXR_PRIMITIVE(cdar, "da")
+DEFINE_CXR_PRIMITIVE(cddr, "dd")
+DEFINE_CXR_PRIMITIVE(caaar, "aaa")
+DEFINE_CXR_PRIMITIVE(caadr, "aad")
+DEFINE_CXR_PRIMITIVE(cadar, "ada")
+DEFINE_CXR_PRIMITIVE(caddr, "add")
+DEFINE_CXR_PRIMITIVE(cdaar, "daa")
+DEFINE_CXR_PRIMITIVE(cdadr, "dad")
+DEFINE_CXR_PRIMITIVE(cddar, "dda")
+DEFINE_CXR_PRIMITIVE(cdddr, "ddd")
+DEFINE_CXR_PRIMITIVE(caaaar, "aaaa")
+DEFINE_CXR_PRIMITIVE(caaadr, "aaad")
+DEFINE_CXR_PRIMITIVE(caadar, "aada")
+DEFINE_CXR_PRIMITIVE(caaddr, "aadd")
+DEFINE_CXR_PRIMITIVE(cadaar, "adaa")
+DEFINE_CXR_PRIMITIVE(cadadr, "adad")
+DEFINE_CXR_PRIMITIVE(caddar, "adda")
+DEFINE_CXR_PRIMITIVE(cadddr, "addd")
+DEFINE_CXR_PRIMITIVE(cdaaar, "daaa")
+DEFINE_CXR_PRIMITIVE(cdaadr, "daad")
+DEFINE_CXR_PRIMITIVE(cdadar, "dada")
+DEFINE_CXR_PRIMITIVE(cdaddr, "dadd")
+DEFINE_CXR_PRIMITIVE(cddaar, "ddaa")
+DEFINE_CXR_PRIMITIVE(cddadr, "ddad")
+DEFINE_CXR_PRIMITIVE(cdddar, "ddda")
+DEFINE_CXR_PRIMITIVE(cddddr, "dddd")
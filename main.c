@@ -8,10 +8,12 @@
 #include <string.h>
 
 #include "allocate.h"
+#include "cek-evaluator.h"
 #include "evaluator.h"
 #include "global-environment.h"
 #include "printer.h"
 #include "reader.h"
+#include "runtime-stats.h"
 
 byte_array_t* read_expression_lines(char* prompt);
 
@@ -32,15 +34,26 @@ int main(int argc, char** argv) {
     char* input = byte_array_c_substring(input_array, 0,
                                          byte_array_length(input_array));
 
-    tagged_reference_t expr = read_expression(input, 0).result;
+    // Spawning an interpreter thread freezes the top-level environment
+    // (see interpreter-thread.c) so go on in its successor.
+    while (env->is_frozen) {
+      env = env->successor;
+    }
+
+    read_expression_result_t read_result = read_expression(input, 0);
+    runtime_stats_add(bytes_read, read_result.end);
+    tagged_reference_t expr = read_result.result;
     byte_array_t* output = make_byte_array(128);
     output = print_tagged_reference_to_byte_arary(output, expr);
+    runtime_stats_add(bytes_printed, byte_array_length(output));
     output = byte_array_append_byte(output, '\0');
 
-    tagged_reference_t result = eval(env, expr, true);
+    tagged_reference_t result
+        = cek_is_enabled() ? cek_eval(env, expr) : eval(env, expr, true);
 
     byte_array_t* output2 = make_byte_array(128);
     output2 = print_tagged_reference_to_byte_arary(output2, result);
+    runtime_stats_add(bytes_printed, byte_array_length(output2));
     output2 = byte_array_append_byte(output2, '\0');
 
     fprintf(stdout, "\n;Value: %s\n\n", &output2->elements[0]);
@@ -57,7 +70,9 @@ byte_array_t* read_expression_lines(char* prompt) {
   fputs(prompt, stderr);
 
   char line[1024];
-  fgets(line, sizeof(line), stdin);
+  if (fgets(line, sizeof(line), stdin) == NULL) {
+    exit(0);
+  }
 
   // TODO(jawilson): read more lines if necessary to finish an
   // expression.
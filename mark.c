@@ -0,0 +1,654 @@
+/**
+ * @file mark.c
+ *
+ * A parallel mark phase: find every object reachable from some roots
+ * (normally the global environments) using several threads at once.
+ *
+ * There is no garbage collector yet (objects are simply malloced) so
+ * nothing is swept: heap-mark reports how many objects (and bytes)
+ * are reachable and how long it took, and marking is the first half
+ * of a tracing collector when one is added.
+ *
+ * Objects have no header to keep a mark bit in, so the marked objects
+ * are kept in a set of addresses. The set is split into shards, each
+ * with its own lock, so threads marking different objects rarely wait
+ * for each other.
+ *
+ * Every marking thread has a private mark stack of objects whose
+ * children still have to be marked. When a thread's stack gets deep
+ * it moves a packet of entries to a list other threads can steal
+ * from, and a thread whose stack is empty steals a packet from a
+ * random thread. Marking is done when every thread is idle and there
+ * are no packets left.
+ *
+ * The thread calling heap-mark waits until marking is done but any
+ * other interpreter threads keep running. Since frozen environments
+ * never change (see environment_freeze) this is only a problem for
+ * pairs, etc. they change at the same time.
+ */
+
+// ======================================================================
+// This is block is extraced to mark.h
+// ======================================================================
+
+#ifndef _MARK_H_
+#define _MARK_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "array.h"
+#include "boolean.h"
+#include "environment.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+// Every tag_t is less than this.
+#define MARK_MAX_TAGS 64
+
+typedef struct {
+  // Indexed by tag (environments are counted as TAG_ENVIRONMENT_T).
+  uint64_t n_objects[MARK_MAX_TAGS];
+  uint64_t n_bytes[MARK_MAX_TAGS];
+  uint64_t n_threads;
+  // How many packets of work were stolen by idle threads.
+  uint64_t n_steals;
+  uint64_t nanoseconds;
+} mark_result_t;
+
+// Called by mark_each_child for every child of an object.
+typedef void (*mark_visit_t)(void* context, tagged_reference_t child);
+
+// The global environments (see make_global_environment).
+extern array_t* mark_root_environments;
+
+extern void mark_add_root_environment(environment_t* env);
+extern boolean_t mark_is_heap_object(tagged_reference_t object);
+extern uint64_t mark_object_size(tagged_reference_t object);
+extern void mark_each_child(tagged_reference_t object, mark_visit_t visit,
+                            void* context);
+extern void mark_reachable(tagged_reference_t* roots, uint64_t n_roots,
+                           mark_result_t* result);
+
+extern tagged_reference_t
+    primtive_function_heap_mark(primitive_arguments_t args);
+
+#endif /* _MARK_H_ */
+
+// ======================================================================
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "allocate.h"
+#include "array.h"
+#include "call-site.h"
+#include "closure.h"
+#include "continuation.h"
+#include "fatal-error.h"
+#include "future.h"
+#include "green-thread.h"
+#include "hash-table.h"
+#include "inline-cache.h"
+#include "interpreter-thread.h"
+#include "mark.h"
+#include "pair.h"
+#include "shared-channel.h"
+#include "string-util.h"
+#include "syntax-rules.h"
+
+#define MARK_SET_SHARDS 64
+#define MARK_SET_INITIAL_CAPACITY 1024
+#define MARK_PACKET_SIZE 256
+#define MARK_MAX_THREADS 64
+
+// A packet of mark stack entries that can be stolen by another thread.
+typedef struct mark_packet_S {
+  struct mark_packet_S* next;
+  uint64_t n_entries;
+  tagged_reference_t entries[MARK_PACKET_SIZE];
+} mark_packet_t;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  uint64_t n_entries;
+  // Always a power of two. 0 is an empty slot.
+  uint64_t capacity;
+  uint64_t* addresses;
+  uint8_t padding[24];
+} mark_set_shard_t;
+
+typedef struct mark_state_S mark_state_t;
+
+typedef struct {
+  mark_state_t* state;
+  pthread_t handle;
+  tagged_reference_t* stack;
+  uint64_t n_entries;
+  uint64_t capacity;
+  // The packets other threads can steal (protected by mutex).
+  pthread_mutex_t mutex;
+  mark_packet_t* packets;
+  uint64_t random;
+  mark_result_t result;
+} marker_t;
+
+struct mark_state_S {
+  mark_set_shard_t shards[MARK_SET_SHARDS];
+  marker_t* markers;
+  uint64_t n_markers;
+  // Only accessed atomically.
+  uint64_t n_idle;
+  uint64_t n_packets;
+};
+
+array_t* mark_root_environments = NULL;
+
+void mark_add_root_environment(environment_t* env) {
+  if (mark_root_environments == NULL) {
+    mark_root_environments = make_array(4);
+  }
+  mark_root_environments
+      = array_add(mark_root_environments, (uint64_t) env);
+}
+
+static inline uint64_t mark_address_hash(uint64_t address) {
+  address *= 0x9e3779b97f4a7c15ULL;
+  return address ^ (address >> 29);
+}
+
+static void mark_set_grow(mark_set_shard_t* shard) {
+  uint64_t* old_addresses = shard->addresses;
+  uint64_t old_capacity = shard->capacity;
+  shard->capacity = old_capacity == 0 ? MARK_SET_INITIAL_CAPACITY
+                                      : old_capacity * 2;
+  shard->addresses
+      = (uint64_t*) malloc_bytes(shard->capacity * sizeof(uint64_t));
+  for (uint64_t i = 0; i < old_capacity; i++) {
+    uint64_t address = old_addresses[i];
+    if (address != 0) {
+      uint64_t slot = mark_address_hash(address) & (shard->capacity - 1);
+      while (shard->addresses[slot] != 0) {
+        slot = (slot + 1) & (shard->capacity - 1);
+      }
+      shard->addresses[slot] = address;
+    }
+  }
+  if (old_addresses != NULL) {
+    free_bytes(old_addresses);
+  }
+}
+
+/**
+ * Add an address to the set and return true if it wasn't already
+ * there.
+ */
+static boolean_t mark_set_add(mark_state_t* state, uint64_t address) {
+  uint64_t hash = mark_address_hash(address);
+  mark_set_shard_t* shard = &state->shards[hash >> 58];
+  pthread_mutex_lock(&shard->mutex);
+  if (2 * (shard->n_entries + 1) > shard->capacity) {
+    mark_set_grow(shard);
+  }
+  uint64_t slot = hash & (shard->capacity - 1);
+  boolean_t is_new = true;
+  while (shard->addresses[slot] != 0) {
+    if (shard->addresses[slot] == address) {
+      is_new = false;
+      break;
+    }
+    slot = (slot + 1) & (shard->capacity - 1);
+  }
+  if (is_new) {
+    shard->addresses[slot] = address;
+    shard->n_entries++;
+  }
+  pthread_mutex_unlock(&shard->mutex);
+  return is_new;
+}
+
+/**
+ * Return true if object refers to something on the heap (and so has
+ * to be marked).
+ */
+boolean_t mark_is_heap_object(tagged_reference_t object) {
+  switch (object.tag) {
+  case TAG_NULL:
+  case TAG_BOOLEAN_T:
+  case TAG_UINT64_T:
+  case TAG_UNICODE_CODE_POINT:
+  case TAG_SINGLETON_T:
+  case TAG_ERROR_T:
+  case TAG_PRIMITIVE:
+    return false;
+  default:
+    return object.data != 0 && object.tag < MARK_MAX_TAGS;
+  }
+}
+
+/**
+ * Return roughly how many bytes object takes up on the heap (not
+ * counting anything it refers to).
+ */
+uint64_t mark_object_size(tagged_reference_t object) {
+  switch (object.tag) {
+  case TAG_STRING:
+    if (1) {
+      char* str = (char*) object.data;
+      uint64_t size
+          = sizeof(immutable_string_t) + immutable_string_length(str) + 1;
+      if (!immutable_string_is_ascii(str)) {
+        uint64_t n_checkpoints
+            = immutable_string_n_code_points(str) / UTF8_CHECKPOINT_INTERVAL
+              + 1;
+        size += n_checkpoints * sizeof(uint64_t);
+      }
+      return size;
+    }
+  case TAG_SCHEME_SYMBOL:
+    return strlen((char*) object.data) + 1;
+  case TAG_PAIR_T:
+    return sizeof(pair_t);
+  case TAG_CLOSURE_T: {
+    closure_t* closure = untag_closure_t(object);
+    uint64_t size = sizeof(closure_t) + closure->n_arg_names * sizeof(char*);
+    if (closure->free_bindings != NULL) {
+      size += array_length(closure->analysis->free_names) * sizeof(pair_t*);
+    }
+    return size;
+  }
+  case TAG_ENVIRONMENT_T: {
+    environment_t* env = (environment_t*) object.data;
+    if (env->is_stack_allocated) {
+      return 0;
+    }
+    return sizeof(environment_t) + env->n_buckets * sizeof(tagged_reference_t);
+  }
+  case TAG_HASH_TABLE_T: {
+    hash_table_t* table = untag_hash_table(object);
+    // An entry and a control byte per slot.
+    return sizeof(hash_table_t)
+           + table->capacity * (sizeof(hash_table_entry_t) + 1);
+  }
+  case TAG_GLOBAL_REFERENCE_T:
+    return sizeof(global_reference_t);
+  case TAG_CLOSURE_SLOT_T:
+    return sizeof(closure_slot_t);
+  case TAG_CALL_SITE_T:
+    return sizeof(call_site_t);
+  case TAG_SYNTAX_RULES_T:
+    return sizeof(syntax_rules_t);
+  case TAG_CONTINUATION_T:
+    return sizeof(continuation_t);
+  case TAG_GREEN_THREAD_T:
+    return sizeof(green_thread_t);
+  case TAG_CHANNEL_T:
+    return sizeof(channel_t)
+           + ((channel_t*) object.data)->size * sizeof(tagged_reference_t);
+  case TAG_INTERPRETER_THREAD_T:
+    return sizeof(interpreter_thread_t);
+  case TAG_FUTURE_T:
+    return sizeof(future_task_t);
+  case TAG_SHARED_CHANNEL_T:
+    return sizeof(shared_channel_t)
+           + (((shared_channel_t*) object.data)->mask + 1)
+                 * sizeof(shared_channel_cell_t);
+  default:
+    return 0;
+  }
+}
+
+static void mark_push(marker_t* marker, tagged_reference_t object) {
+  if (marker->n_entries == marker->capacity) {
+    uint64_t capacity = marker->capacity * 2;
+    tagged_reference_t* stack = (tagged_reference_t*) malloc_bytes(
+        capacity * sizeof(tagged_reference_t));
+    memcpy(stack, marker->stack,
+           marker->n_entries * sizeof(tagged_reference_t));
+    free_bytes(marker->stack);
+    marker->stack = stack;
+    marker->capacity = capacity;
+  }
+  marker->stack[marker->n_entries++] = object;
+}
+
+/**
+ * Mark object unless it is already marked, in which case it is
+ * ignored, and remember to mark its children later.
+ */
+static void mark_object(marker_t* marker, tagged_reference_t object) {
+  if (!mark_is_heap_object(object)
+      || !mark_set_add(marker->state, object.data)) {
+    return;
+  }
+  marker->result.n_objects[object.tag]++;
+  marker->result.n_bytes[object.tag] += mark_object_size(object);
+  mark_push(marker, object);
+}
+
+static inline void mark_each_environment(environment_t* env,
+                                         mark_visit_t visit, void* context) {
+  if (env != NULL) {
+    visit(context, tagged_reference(TAG_ENVIRONMENT_T, env));
+  }
+}
+
+/**
+ * Call visit with everything object refers to (which may include
+ * values that aren't heap objects). This is also how the heap census
+ * walks the heap (see heap-census.c).
+ */
+void mark_each_child(tagged_reference_t object, mark_visit_t visit,
+                     void* context) {
+  switch (object.tag) {
+  case TAG_PAIR_T:
+    visit(context, untag_pair(object)->head);
+    visit(context, untag_pair(object)->tail);
+    break;
+  case TAG_CLOSURE_T:
+    visit(context, untag_closure_t(object)->code);
+    mark_each_environment(untag_closure_t(object)->env, visit, context);
+    break;
+  case TAG_ENVIRONMENT_T: {
+    environment_t* env = (environment_t*) object.data;
+    for (int i = 0; i < env->n_buckets; i++) {
+      visit(context, env->buckets[i]);
+    }
+    mark_each_environment(env->parent, visit, context);
+    mark_each_environment(env->successor, visit, context);
+    break;
+  }
+  case TAG_HASH_TABLE_T: {
+    hash_table_t* table = untag_hash_table(object);
+    for (uint64_t i = 0; i < table->capacity; i++) {
+      if (hash_table_slot_is_full(table, i)) {
+        visit(context, table->entries[i].key);
+        visit(context, table->entries[i].value);
+      }
+    }
+    break;
+  }
+  case TAG_GLOBAL_REFERENCE_T: {
+    global_reference_t* reference = (global_reference_t*) object.data;
+    // Another thread may be refilling the cache (see inline-cache.c).
+    pair_t* binding = __atomic_load_n(&reference->binding, __ATOMIC_RELAXED);
+    if (binding != NULL) {
+      visit(context, tagged_reference(TAG_PAIR_T, binding));
+    }
+    mark_each_environment(
+        __atomic_load_n(&reference->toplevel, __ATOMIC_RELAXED), visit,
+        context);
+    break;
+  }
+  case TAG_CALL_SITE_T: {
+    call_site_t* site = untag_call_site(object);
+    visit(context, site->target);
+    visit(context, site->operator.head);
+    break;
+  }
+  case TAG_SYNTAX_RULES_T:
+    visit(context, ((syntax_rules_t*) object.data)->rules);
+    break;
+  case TAG_GREEN_THREAD_T:
+    visit(context, ((green_thread_t*) object.data)->thunk);
+    visit(context, ((green_thread_t*) object.data)->value);
+    break;
+  case TAG_CHANNEL_T: {
+    channel_t* channel = (channel_t*) object.data;
+    for (uint64_t i = 0; i < channel->count; i++) {
+      visit(context,
+            channel->buffer[(channel->start + i) & (channel->size - 1)]);
+    }
+    break;
+  }
+  case TAG_INTERPRETER_THREAD_T:
+    visit(context, ((interpreter_thread_t*) object.data)->thunk);
+    visit(context, ((interpreter_thread_t*) object.data)->value);
+    break;
+  case TAG_FUTURE_T:
+    visit(context, ((future_task_t*) object.data)->procedure);
+    visit(context, ((future_task_t*) object.data)->value);
+    break;
+  case TAG_SHARED_CHANNEL_T: {
+    shared_channel_t* channel = (shared_channel_t*) object.data;
+    for (uint64_t i = 0; i <= channel->mask; i++) {
+      visit(context, channel->cells[i].value);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+static void mark_visit_child(void* context, tagged_reference_t child) {
+  mark_object((marker_t*) context, child);
+}
+
+/**
+ * Move a packet of entries from the top of the mark stack to where
+ * other threads can steal it.
+ */
+static void mark_share_packet(marker_t* marker) {
+  mark_packet_t* packet = malloc_struct(mark_packet_t);
+  marker->n_entries -= MARK_PACKET_SIZE;
+  memcpy(packet->entries, &marker->stack[marker->n_entries],
+         MARK_PACKET_SIZE * sizeof(tagged_reference_t));
+  packet->n_entries = MARK_PACKET_SIZE;
+  pthread_mutex_lock(&marker->mutex);
+  packet->next = marker->packets;
+  marker->packets = packet;
+  pthread_mutex_unlock(&marker->mutex);
+  __atomic_fetch_add(&marker->state->n_packets, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Take a packet from victim (which may be the marker itself) and push
+ * its entries on marker's stack. Return false if victim had none.
+ */
+static boolean_t mark_take_packet(marker_t* marker, marker_t* victim) {
+  pthread_mutex_lock(&victim->mutex);
+  mark_packet_t* packet = victim->packets;
+  if (packet != NULL) {
+    victim->packets = packet->next;
+  }
+  pthread_mutex_unlock(&victim->mutex);
+  if (packet == NULL) {
+    return false;
+  }
+  __atomic_fetch_sub(&marker->state->n_packets, 1, __ATOMIC_RELAXED);
+  for (uint64_t i = 0; i < packet->n_entries; i++) {
+    mark_push(marker, packet->entries[i]);
+  }
+  free_bytes(packet);
+  if (victim != marker) {
+    marker->result.n_steals++;
+  }
+  return true;
+}
+
+/**
+ * Look for a packet in every marker, starting with marker itself and
+ * then from a random one.
+ */
+static boolean_t mark_find_work(marker_t* marker) {
+  mark_state_t* state = marker->state;
+  if (mark_take_packet(marker, marker)) {
+    return true;
+  }
+  marker->random ^= marker->random << 13;
+  marker->random ^= marker->random >> 7;
+  marker->random ^= marker->random << 17;
+  uint64_t start = marker->random % state->n_markers;
+  for (uint64_t i = 0; i < state->n_markers; i++) {
+    marker_t* victim = &state->markers[(start + i) % state->n_markers];
+    if (victim != marker && mark_take_packet(marker, victim)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void* mark_thread_main(void* argument) {
+  marker_t* marker = (marker_t*) argument;
+  mark_state_t* state = marker->state;
+  while (true) {
+    while (marker->n_entries > 0) {
+      mark_each_child(marker->stack[--marker->n_entries], mark_visit_child,
+                      marker);
+      if (marker->n_entries >= 2 * MARK_PACKET_SIZE
+          && __atomic_load_n(&state->n_packets, __ATOMIC_RELAXED)
+                 < state->n_markers) {
+        mark_share_packet(marker);
+      }
+    }
+    if (mark_find_work(marker)) {
+      continue;
+    }
+    // Only threads that aren't idle make packets so once every thread
+    // is idle no more work can show up.
+    __atomic_fetch_add(&state->n_idle, 1, __ATOMIC_ACQ_REL);
+    while (true) {
+      if (__atomic_load_n(&state->n_packets, __ATOMIC_ACQUIRE) > 0) {
+        __atomic_fetch_sub(&state->n_idle, 1, __ATOMIC_ACQ_REL);
+        if (mark_find_work(marker)) {
+          break;
+        }
+        __atomic_fetch_add(&state->n_idle, 1, __ATOMIC_ACQ_REL);
+      } else if (__atomic_load_n(&state->n_idle, __ATOMIC_ACQUIRE)
+                 == state->n_markers) {
+        return NULL;
+      }
+      sched_yield();
+    }
+  }
+}
+
+static uint64_t mark_thread_count(void) {
+  char* var = getenv("ARMYKNIFE_MARK_THREADS");
+  long count = var != NULL ? atol(var) : sysconf(_SC_NPROCESSORS_ONLN);
+  if (count < 1) {
+    return 1;
+  }
+  return count > MARK_MAX_THREADS ? MARK_MAX_THREADS : count;
+}
+
+static uint64_t mark_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Mark everything reachable from roots with ARMYKNIFE_MARK_THREADS
+ * threads (by default one per processor) and add up what was found in
+ * result.
+ */
+void mark_reachable(tagged_reference_t* roots, uint64_t n_roots,
+                    mark_result_t* result) {
+  uint64_t start_time = mark_now();
+  mark_state_t* state = malloc_struct(mark_state_t);
+  state->n_markers = mark_thread_count();
+  state->markers
+      = (marker_t*) malloc_bytes(state->n_markers * sizeof(marker_t));
+  for (uint64_t i = 0; i < MARK_SET_SHARDS; i++) {
+    pthread_mutex_init(&state->shards[i].mutex, NULL);
+  }
+  for (uint64_t i = 0; i < state->n_markers; i++) {
+    marker_t* marker = &state->markers[i];
+    marker->state = state;
+    marker->capacity = 2 * MARK_PACKET_SIZE;
+    marker->stack = (tagged_reference_t*) malloc_bytes(
+        marker->capacity * sizeof(tagged_reference_t));
+    marker->random = 0x2545f4914f6cdd1dULL * (i + 1);
+    pthread_mutex_init(&marker->mutex, NULL);
+  }
+  // Deal the roots out so every thread starts with something to do.
+  for (uint64_t i = 0; i < n_roots; i++) {
+    mark_object(&state->markers[i % state->n_markers], roots[i]);
+  }
+
+  for (uint64_t i = 1; i < state->n_markers; i++) {
+    if (pthread_create(&state->markers[i].handle, NULL, mark_thread_main,
+                       &state->markers[i])
+        != 0) {
+      fatal_error(ERROR_INTERPRETER_THREAD_NOT_STARTED);
+    }
+  }
+  mark_thread_main(&state->markers[0]);
+  for (uint64_t i = 1; i < state->n_markers; i++) {
+    pthread_join(state->markers[i].handle, NULL);
+  }
+
+  for (uint64_t i = 0; i < state->n_markers; i++) {
+    marker_t* marker = &state->markers[i];
+    for (uint64_t tag = 0; tag < MARK_MAX_TAGS; tag++) {
+      result->n_objects[tag] += marker->result.n_objects[tag];
+      result->n_bytes[tag] += marker->result.n_bytes[tag];
+    }
+    result->n_steals += marker->result.n_steals;
+    free_bytes(marker->stack);
+    pthread_mutex_destroy(&marker->mutex);
+  }
+  for (uint64_t i = 0; i < MARK_SET_SHARDS; i++) {
+    if (state->shards[i].addresses != NULL) {
+      free_bytes(state->shards[i].addresses);
+    }
+    pthread_mutex_destroy(&state->shards[i].mutex);
+  }
+  result->n_threads = state->n_markers;
+  free_bytes(state->markers);
+  free_bytes(state);
+  result->nanoseconds = mark_now() - start_time;
+}
+
+/**
+ * Example (heap-mark)
+ *
+ * Mark everything reachable from the global environments and return
+ * an association list describing it: the number of objects and bytes
+ * reached, the number of threads used, how many packets of work were
+ * stolen and how long it took.
+ */
+tagged_reference_t
+    primtive_function_heap_mark(primitive_arguments_t arguments) {
+  require_n_args(arguments, 0, 0);
+  uint64_t n_roots = mark_root_environments == NULL
+                         ? 0
+                         : array_length(mark_root_environments);
+  tagged_reference_t* roots = (tagged_reference_t*) malloc_bytes(
+      (n_roots + 1) * sizeof(tagged_reference_t));
+  for (uint64_t i = 0; i < n_roots; i++) {
+    roots[i] = tagged_reference(TAG_ENVIRONMENT_T,
+                                array_get(mark_root_environments, i));
+  }
+  mark_result_t result = {0};
+  mark_reachable(roots, n_roots, &result);
+  free_bytes(roots);
+
+  uint64_t n_objects = 0;
+  uint64_t n_bytes = 0;
+  for (uint64_t tag = 0; tag < MARK_MAX_TAGS; tag++) {
+    n_objects += result.n_objects[tag];
+    n_bytes += result.n_bytes[tag];
+  }
+  tagged_reference_t objects
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "objects"),
+             tagged_reference(TAG_UINT64_T, n_objects));
+  tagged_reference_t bytes = cons(tagged_reference(TAG_SCHEME_SYMBOL, "bytes"),
+                                  tagged_reference(TAG_UINT64_T, n_bytes));
+  tagged_reference_t threads
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "threads"),
+             tagged_reference(TAG_UINT64_T, result.n_threads));
+  tagged_reference_t steals
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "steals"),
+             tagged_reference(TAG_UINT64_T, result.n_steals));
+  tagged_reference_t microseconds
+      = cons(tagged_reference(TAG_SCHEME_SYMBOL, "microseconds"),
+             tagged_reference(TAG_UINT64_T, result.nanoseconds / 1000));
+  return cons(
+      objects,
+      cons(bytes, cons(threads, cons(steals, cons(microseconds, NIL)))));
+}
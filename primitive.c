@@ -32,6 +32,9 @@ static inline primitive_t untag_primitive(tagged_reference_t reference) {
   return (primitive_t) reference.data;
 }
 
+extern void require_n_args(primitive_arguments_t arguments, uint64_t min,
+                           uint64_t max);
+
 // A list of the basic scheme library primitives (other primitives
 // specific to the debugger, etc., will not be listed here).
 
@@ -39,6 +42,20 @@ extern tagged_reference_t primtive_function_plus(primitive_arguments_t args);
 extern tagged_reference_t primtive_function_sub(primitive_arguments_t args);
 extern tagged_reference_t primtive_function_mul(primitive_arguments_t args);
 extern tagged_reference_t primtive_function_div(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_less(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_less_or_equal(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_numerically_equal(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_greater(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_greater_or_equal(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_eq_p(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_eqv_p(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_equal_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_equal_p(primitive_arguments_t args);
 
 #endif /* _PRIMITIVE_H_ */
 
@@ -49,7 +66,22 @@ extern tagged_reference_t primtive_function_div(primitive_arguments_t args);
  * good home elsewhere.
  */
 
+#include "boolean.h"
+#include "equivalence.h"
+#include "fatal-error.h"
 #include "primitive.h"
+#include "string-util.h"
+
+/**
+ * Fatal error unless a primitive was called with at least min and at
+ * most max arguments.
+ */
+void require_n_args(primitive_arguments_t arguments, uint64_t min,
+                    uint64_t max) {
+  if (arguments.n_args < min || arguments.n_args > max) {
+    fatal_error(ERROR_WRONG_NUMBER_OF_ARGS);
+  }
+}
 
 /**
  * Example (+ 1 2) => 3 or (+ 1 2 3) => 6
@@ -96,10 +128,116 @@ tagged_reference_t primtive_function_div(primitive_arguments_t arguments) {
   }
 
   int64_t result
-      = untag_int64_t(arguments.args[0]) / untag_int64_t(arguments.args[0]);
+      = untag_int64_t(arguments.args[0]) / untag_int64_t(arguments.args[1]);
   return tagged_reference(TAG_UINT64_T, result);
 }
 
+/**
+ * Return true if every adjacent pair of (integer) arguments is in
+ * the given order, i.e., the common part of <, <=, =, > and >=.
+ */
+static boolean_t numbers_are_ordered(primitive_arguments_t arguments,
+                                     int (*in_order)(int64_t a, int64_t b)) {
+  if (arguments.n_args < 2) {
+    fatal_error(ERROR_WRONG_NUMBER_OF_ARGS);
+  }
+  boolean_t result = true;
+  for (int i = 1; i < arguments.n_args; i++) {
+    // All of the arguments are checked even once the result is known.
+    if (!in_order(untag_int64_t(arguments.args[i - 1]),
+                  untag_int64_t(arguments.args[i]))) {
+      result = false;
+    }
+  }
+  return result;
+}
+
+static int is_less(int64_t a, int64_t b) { return a < b; }
+static int is_less_or_equal(int64_t a, int64_t b) { return a <= b; }
+static int is_numerically_equal(int64_t a, int64_t b) { return a == b; }
+static int is_greater(int64_t a, int64_t b) { return a > b; }
+static int is_greater_or_equal(int64_t a, int64_t b) { return a >= b; }
+
+/**
+ * Example (< 1 2 3) => #t
+ */
+tagged_reference_t primtive_function_less(primitive_arguments_t arguments) {
+  return tag_boolean(numbers_are_ordered(arguments, is_less));
+}
+
+/**
+ * Example (<= 1 1 2) => #t
+ */
+tagged_reference_t
+    primtive_function_less_or_equal(primitive_arguments_t arguments) {
+  return tag_boolean(numbers_are_ordered(arguments, is_less_or_equal));
+}
+
+/**
+ * Example (= 2 2) => #t
+ */
+tagged_reference_t
+    primtive_function_numerically_equal(primitive_arguments_t arguments) {
+  return tag_boolean(numbers_are_ordered(arguments, is_numerically_equal));
+}
+
+/**
+ * Example (> 3 2 1) => #t
+ */
+tagged_reference_t primtive_function_greater(primitive_arguments_t arguments) {
+  return tag_boolean(numbers_are_ordered(arguments, is_greater));
+}
+
+/**
+ * Example (>= 2 2 1) => #t
+ */
+tagged_reference_t
+    primtive_function_greater_or_equal(primitive_arguments_t arguments) {
+  return tag_boolean(numbers_are_ordered(arguments, is_greater_or_equal));
+}
+
+/**
+ * Example (eq? 'a 'a) => #t
+ */
+tagged_reference_t primtive_function_eq_p(primitive_arguments_t arguments) {
+  if (arguments.n_args != 2) {
+    fatal_error(ERROR_WRONG_NUMBER_OF_ARGS);
+  }
+  return tag_boolean(is_eq(arguments.args[0], arguments.args[1]));
+}
+
+/**
+ * Example (eqv? 10 10) => #t
+ */
+tagged_reference_t primtive_function_eqv_p(primitive_arguments_t arguments) {
+  if (arguments.n_args != 2) {
+    fatal_error(ERROR_WRONG_NUMBER_OF_ARGS);
+  }
+  return tag_boolean(is_eqv(arguments.args[0], arguments.args[1]));
+}
+
+/**
+ * Example (equal? '(1 2) '(1 2)) => #t
+ */
+tagged_reference_t primtive_function_equal_p(primitive_arguments_t arguments) {
+  if (arguments.n_args != 2) {
+    fatal_error(ERROR_WRONG_NUMBER_OF_ARGS);
+  }
+  return tag_boolean(is_equal(arguments.args[0], arguments.args[1]));
+}
+
+/**
+ * Example (string=? "abc" "abc") => #t
+ */
+tagged_reference_t
+    primtive_function_string_equal_p(primitive_arguments_t arguments) {
+  if (arguments.n_args != 2) {
+    fatal_error(ERROR_WRONG_NUMBER_OF_ARGS);
+  }
+  return tag_boolean(immutable_string_equal(untag_string(arguments.args[0]),
+                                            untag_string(arguments.args[1])));
+}
+
 /**
  * comet-vm:get-tag returns the tag number of a scheme object. This is
  * used to implement primitives like pair? in pure scheme.
@@ -32,12 +32,43 @@ __attribute__((warn_unused_result)) byte_array_t*
 #include <string.h>
 
 #include "byte-array.h"
+#include "call-site.h"
+#include "closure.h"
 #include "environment.h"
+#include "inline-cache.h"
 #include "pair.h"
 #include "printer.h"
 #include "string-util.h"
 #include "tagged-reference.h"
 
+/**
+ * Print an immutable string the way the reader reads it: in double
+ * quotes with '"', '\\', newlines and tabs escaped. The string's
+ * length is already known so runs of characters that don't need
+ * escaping are appended all at once.
+ */
+static byte_array_t* print_string_literal(byte_array_t* destination,
+                                          char* str) {
+  uint64_t length = immutable_string_length(str);
+  destination = byte_array_append_byte(destination, '"');
+  uint64_t run_start = 0;
+  for (uint64_t i = 0; i < length; i++) {
+    char ch = str[i];
+    if (ch != '"' && ch != '\\' && ch != '\n' && ch != '\t') {
+      continue;
+    }
+    destination = byte_array_append_bytes(
+        destination, (uint8_t*) &str[run_start], i - run_start);
+    destination = byte_array_append_byte(destination, '\\');
+    destination = byte_array_append_byte(
+        destination, ch == '\n' ? 'n' : (ch == '\t' ? 't' : ch));
+    run_start = i + 1;
+  }
+  destination = byte_array_append_bytes(
+      destination, (uint8_t*) &str[run_start], length - run_start);
+  return byte_array_append_byte(destination, '"');
+}
+
 byte_array_t*
     print_tagged_reference_to_byte_arary(byte_array_t* destination,
                                          tagged_reference_t reference) {
@@ -65,20 +96,47 @@ byte_array_t*
     break;
 
   case TAG_STRING:
-    prefix = "\"";
-    str = untag_string(reference);
-    suffix = "\"";
-    break;
+    return print_string_literal(destination, untag_string(reference));
 
   case TAG_SCHEME_SYMBOL:
     str = untag_reader_symbol(reference);
     break;
 
+  case TAG_GLOBAL_REFERENCE_T:
+    // The evaluator replaces symbols in code with these (see
+    // inline-cache.c).
+    str = untag_global_reference(reference)->name;
+    break;
+
+  case TAG_CLOSURE_SLOT_T:
+    // Likewise for free variables of closures (see closure.c).
+    str = untag_closure_slot(reference)->name;
+    break;
+
+  case TAG_CALL_SITE_T:
+    // Likewise for the operator of an application (see call-site.c).
+    return print_tagged_reference_to_byte_arary(
+        destination, untag_call_site(reference)->operator.head);
+
   case TAG_UINT64_T:
     snprintf(buffer, sizeof(buffer), "%lu", untag_uint64_t(reference));
     str = &buffer[0];
     break;
 
+  case TAG_UNICODE_CODE_POINT:
+    // #\a, #\λ or #\space (like the reader reads them) or #\x1 for
+    // unnamed control characters.
+    prefix = "#\\";
+    str = (char*) code_point_to_char_name(reference.data);
+    if (str == NULL && reference.data < 0x20) {
+      snprintf(buffer, sizeof(buffer), "x%lx", reference.data);
+      str = &buffer[0];
+    } else if (str == NULL) {
+      buffer[utf8_encode(reference.data, buffer)] = '\0';
+      str = &buffer[0];
+    }
+    break;
+
   case TAG_ERROR_T:
     prefix = "#<error-code-";
     snprintf(buffer, sizeof(buffer), "%lu", reference.data);
@@ -89,8 +147,7 @@ byte_array_t*
   case TAG_BOOLEAN_T:
     if (is_false(reference)) {
       str = "#f";
-    }
-    if (is_true(reference)) {
+    } else if (is_true(reference)) {
       str = "#t";
     } else {
       str = "#<illegal-boolean-value>";
@@ -108,6 +165,38 @@ byte_array_t*
   case TAG_CPU_THREAD_STATE_T:
     str = "#<thread-state>";
     break;
+
+  case TAG_HASH_TABLE_T:
+    str = "#<hash-table>";
+    break;
+
+  case TAG_SYNTAX_RULES_T:
+    str = "#<syntax-rules>";
+    break;
+
+  case TAG_CONTINUATION_T:
+    str = "#<continuation>";
+    break;
+
+  case TAG_GREEN_THREAD_T:
+    str = "#<green-thread>";
+    break;
+
+  case TAG_CHANNEL_T:
+    str = "#<channel>";
+    break;
+  case TAG_INTERPRETER_THREAD_T:
+    str = "#<interpreter-thread>";
+    break;
+  case TAG_FUTURE_T:
+    str = "#<future>";
+    break;
+  case TAG_SHARED_CHANNEL_T:
+    str = "#<shared-channel>";
+    break;
+  case TAG_ENVIRONMENT_T:
+    str = "#<environment>";
+    break;
   }
 
   if (prefix) {
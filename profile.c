@@ -0,0 +1,574 @@
+/**
+ * @file profile.c
+ *
+ * A sampling profiler for scheme procedures: (profile-start) starts a
+ * SIGPROF timer and (profile-stop) stops it and prints where the
+ * samples were taken.
+ *
+ * The C stack doesn't say which scheme procedures are running (and
+ * with the explicit stack evaluator they aren't on the C stack at
+ * all) so while the profiler runs, every thread keeps a shadow stack
+ * of the closures and primitives it is applying. Every entry has a
+ * key that grows with the depth of the application: the tree walking
+ * evaluator uses the address of the C frame applying it and the
+ * explicit stack evaluator uses the depth of its stack. Applying
+ * something drops the entries whose key is at least as big as its
+ * own before pushing it and a closure called in tail position
+ * replaces its caller. The evaluators drop the entries above a
+ * call (or frame) when it returns.
+ *
+ * The SIGPROF handler runs on whichever thread is using the processor
+ * and copies the innermost entries of that thread's shadow stack into
+ * a preallocated buffer (it doesn't allocate or take locks). The
+ * samples are only turned into names and counted by profile-stop.
+ *
+ * When the profiler isn't running, the only cost is that the
+ * evaluators check a flag when they apply something. Arithmetic that
+ * a call site does inline (see call-site.c) is charged to the
+ * procedure doing it. Green threads share the shadow stack of their
+ * OS thread so a sample taken just after a switch may show procedures
+ * of the previous green thread.
+ */
+
+// ======================================================================
+// This is block is extraced to profile.h
+// ======================================================================
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+
+#include "boolean.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+/**
+ * The shadow stack key of a procedure applied by the calling C
+ * function (deeper C frames have bigger keys).
+ */
+#define PROFILE_C_FRAME_KEY()                                                  \
+  (UINTPTR_MAX - (uintptr_t) __builtin_frame_address(0))
+
+extern boolean_t profile_running;
+
+extern void profile_enter(uintptr_t key, tagged_reference_t procedure,
+                          boolean_t is_tail_call);
+extern void profile_leave(uintptr_t key);
+extern tagged_reference_t
+    profile_apply_primitive(uintptr_t key, tagged_reference_t primitive,
+                            primitive_arguments_t arguments);
+
+extern tagged_reference_t
+    primtive_function_profile_start(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_profile_stop(primitive_arguments_t args);
+
+static inline boolean_t profile_is_running(void) {
+  return __atomic_load_n(&profile_running, __ATOMIC_RELAXED);
+}
+
+#endif /* _PROFILE_H_ */
+
+// ======================================================================
+
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "allocate.h"
+#include "array.h"
+#include "builtin.h"
+#include "byte-array.h"
+#include "closure.h"
+#include "fatal-error.h"
+#include "hash-table.h"
+#include "pair.h"
+#include "profile.h"
+#include "string-util.h"
+
+// Applications nested deeper than this aren't recorded.
+#define PROFILE_STACK_CAPACITY 65536
+// Only the innermost frames of a sample are kept.
+#define PROFILE_MAX_FRAMES 64
+// About half a minute of processor time at the default rate.
+#define PROFILE_MAX_SAMPLES 32768
+#define PROFILE_DEFAULT_RATE 1000
+
+typedef struct {
+  uintptr_t key;
+  tagged_reference_t procedure;
+} profile_entry_t;
+
+typedef struct {
+  boolean_t is_recorded;
+  // More entries were on the shadow stack than were kept.
+  boolean_t is_truncated;
+  uint64_t n_frames;
+  // Bit i is set when frames[i] is a primitive (otherwise it is a
+  // closure). The outermost frame comes first.
+  uint64_t primitive_bits;
+  uint64_t frames[PROFILE_MAX_FRAMES];
+} profile_sample_t;
+
+// A procedure (or caller -> callee edge) in the report.
+typedef struct {
+  char* name;
+  uint64_t caller;
+  uint64_t callee;
+  uint64_t self;
+  uint64_t total;
+  // The last sample that counted towards total (so a procedure that
+  // is on the stack several times is only counted once).
+  uint64_t last_sample;
+} profile_row_t;
+
+boolean_t profile_running = false;
+
+_Thread_local profile_entry_t* profile_stack = NULL;
+// Only changed after the entries below it are written so the signal
+// handler always sees complete entries.
+_Thread_local volatile uint64_t profile_depth = 0;
+
+profile_sample_t* profile_samples = NULL;
+uint64_t profile_rate = PROFILE_DEFAULT_RATE;
+// Only accessed atomically. Every signal reserves a sample and
+// finishes it (whether or not it records anything).
+uint64_t profile_n_reserved = 0;
+uint64_t profile_n_finished = 0;
+uint64_t profile_n_dropped = 0;
+boolean_t profile_handler_is_installed = false;
+
+/**
+ * Drop the entries whose key is at least key.
+ */
+void profile_leave(uintptr_t key) {
+  uint64_t depth = profile_depth;
+  while (depth > 0 && profile_stack[depth - 1].key >= key) {
+    depth--;
+  }
+  profile_depth = depth;
+}
+
+/**
+ * Push procedure (which is about to be applied) on the shadow stack
+ * after dropping the entries it replaces. A closure called in tail
+ * position replaces its caller (even when the C compiler didn't turn
+ * the call into a jump).
+ */
+void profile_enter(uintptr_t key, tagged_reference_t procedure,
+                   boolean_t is_tail_call) {
+  if (profile_stack == NULL) {
+    profile_stack = (profile_entry_t*) malloc_bytes(
+        PROFILE_STACK_CAPACITY * sizeof(profile_entry_t));
+  }
+  profile_leave(key);
+  uint64_t depth = profile_depth;
+  if (is_tail_call && depth > 0
+      && profile_stack[depth - 1].procedure.tag == TAG_CLOSURE_T) {
+    profile_stack[depth - 1].procedure = procedure;
+    return;
+  }
+  if (depth == PROFILE_STACK_CAPACITY) {
+    return;
+  }
+  profile_stack[depth].key = key;
+  profile_stack[depth].procedure = procedure;
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  profile_depth = depth + 1;
+}
+
+/**
+ * Call a primitive with an entry for it on the shadow stack.
+ */
+tagged_reference_t profile_apply_primitive(uintptr_t key,
+                                           tagged_reference_t primitive,
+                                           primitive_arguments_t arguments) {
+  profile_enter(key, primitive, false);
+  tagged_reference_t result = untag_primitive(primitive)(arguments);
+  profile_leave(key);
+  return result;
+}
+
+static void profile_handle_signal(int signal) {
+  int saved_errno = errno;
+  uint64_t index
+      = __atomic_fetch_add(&profile_n_reserved, 1, __ATOMIC_SEQ_CST);
+  if (index >= PROFILE_MAX_SAMPLES) {
+    __atomic_fetch_add(&profile_n_dropped, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile_n_finished, 1, __ATOMIC_RELEASE);
+    errno = saved_errno;
+    return;
+  }
+  profile_sample_t* sample = &profile_samples[index];
+  sample->is_recorded = __atomic_load_n(&profile_running, __ATOMIC_SEQ_CST);
+  if (sample->is_recorded) {
+    uint64_t depth = profile_depth;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    // Find the innermost procedures (skipping the markers of let
+    // bodies, see eval_scope_body).
+    uint64_t start = depth;
+    uint64_t n_frames = 0;
+    while (start > 0 && n_frames < PROFILE_MAX_FRAMES) {
+      start--;
+      if (profile_stack[start].procedure.tag != TAG_NULL) {
+        n_frames++;
+      }
+    }
+    sample->is_truncated = start > 0;
+    sample->n_frames = n_frames;
+    sample->primitive_bits = 0;
+    uint64_t i = 0;
+    for (uint64_t j = start; j < depth; j++) {
+      tagged_reference_t procedure = profile_stack[j].procedure;
+      if (procedure.tag == TAG_NULL) {
+        continue;
+      }
+      sample->frames[i] = procedure.data;
+      if (procedure.tag == TAG_PRIMITIVE) {
+        sample->primitive_bits |= UINT64_C(1) << i;
+      }
+      i++;
+    }
+  }
+  __atomic_fetch_add(&profile_n_finished, 1, __ATOMIC_RELEASE);
+  errno = saved_errno;
+}
+
+static void profile_set_timer(uint64_t rate) {
+  struct itimerval timer = {0};
+  if (rate > 0) {
+    uint64_t microseconds = 1000000 / rate;
+    if (microseconds == 0) {
+      microseconds = 1;
+    }
+    timer.it_interval.tv_sec = microseconds / 1000000;
+    timer.it_interval.tv_usec = microseconds % 1000000;
+    timer.it_value = timer.it_interval;
+  }
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/**
+ * Return the name of a primitive: the name it is built in as, or
+ * else the name of its C function (for example a procedure of the
+ * prelude compiled by scheme-to-c).
+ */
+static char* profile_primitive_name(primitive_t primitive) {
+  for (uint64_t i = 0; i < (UINT64_C(1) << builtin_table_bits); i++) {
+    if (builtin_table[i].name != NULL
+        && builtin_table[i].primitive == primitive) {
+      return builtin_table[i].name;
+    }
+  }
+  // The executable is linked with -rdynamic so this finds C names.
+  // The result looks like "./armyknife-scheme(name+0x0) [0x1234]".
+  void* address = (void*) primitive;
+  char** symbols = backtrace_symbols(&address, 1);
+  char* result = "<primitive>";
+  if (symbols != NULL) {
+    char* start = strchr(symbols[0], '(');
+    char* end = start == NULL ? NULL : strchr(start, '+');
+    if (end != NULL && end > start + 1) {
+      result = string_substring(symbols[0], start + 1 - symbols[0],
+                                end - symbols[0]);
+    }
+    free(symbols);
+  }
+  return result;
+}
+
+static uint64_t profile_add_row(array_t** rows, char* name) {
+  profile_row_t* row = malloc_struct(profile_row_t);
+  row->name = name;
+  *rows = array_add(*rows, (uint64_t) row);
+  return array_length(*rows) - 1;
+}
+
+static inline profile_row_t* profile_get_row(array_t* rows, uint64_t index) {
+  return (profile_row_t*) array_get(rows, index);
+}
+
+/**
+ * Return the index of the row of the procedure in frame i of sample.
+ */
+static uint64_t profile_procedure_row(hash_table_t* procedures,
+                                      hash_table_t* names, array_t** rows,
+                                      profile_sample_t* sample, uint64_t i) {
+  boolean_t is_primitive = (sample->primitive_bits >> i) & 1;
+  tagged_reference_t procedure = tagged_reference(
+      is_primitive ? TAG_PRIMITIVE : TAG_CLOSURE_T, sample->frames[i]);
+  optional_t index = hash_table_get(procedures, procedure);
+  if (optional_is_present(index)) {
+    return optional_value(index).data;
+  }
+  char* name;
+  if (is_primitive) {
+    name = profile_primitive_name(untag_primitive(procedure));
+  } else {
+    name = untag_closure_t(procedure)->debug_name;
+    if (name == NULL) {
+      name = "<lambda>";
+    }
+  }
+  // Procedures with the same name share a row. The names are plain C
+  // strings (not immutable strings) so they are keyed as symbols.
+  tagged_reference_t key = tagged_reference(TAG_SCHEME_SYMBOL, name);
+  index = hash_table_get(names, key);
+  if (!optional_is_present(index)) {
+    index = optional_of(
+        tagged_reference(TAG_UINT64_T, profile_add_row(rows, name)));
+    hash_table_set(names, key, optional_value(index));
+  }
+  hash_table_set(procedures, procedure, optional_value(index));
+  return optional_value(index).data;
+}
+
+static int profile_compare_procedures(const void* a, const void* b) {
+  profile_row_t* row_a = *(profile_row_t**) a;
+  profile_row_t* row_b = *(profile_row_t**) b;
+  if (row_a->self != row_b->self) {
+    return row_a->self < row_b->self ? 1 : -1;
+  }
+  if (row_a->total != row_b->total) {
+    return row_a->total < row_b->total ? 1 : -1;
+  }
+  return strcmp(row_a->name, row_b->name);
+}
+
+static int profile_compare_edges(const void* a, const void* b) {
+  profile_row_t* row_a = *(profile_row_t**) a;
+  profile_row_t* row_b = *(profile_row_t**) b;
+  if (row_a->total != row_b->total) {
+    return row_a->total < row_b->total ? 1 : -1;
+  }
+  return row_a->caller < row_b->caller ? -1
+                                       : (row_a->caller > row_b->caller);
+}
+
+/**
+ * Return the rows as a sorted C array (which the caller frees).
+ */
+static profile_row_t** profile_sort_rows(array_t* rows,
+                                         int (*compare)(const void*,
+                                                        const void*)) {
+  uint64_t n_rows = array_length(rows);
+  profile_row_t** sorted
+      = (profile_row_t**) malloc_bytes((n_rows + 1) * sizeof(profile_row_t*));
+  for (uint64_t i = 0; i < n_rows; i++) {
+    sorted[i] = profile_get_row(rows, i);
+  }
+  qsort(sorted, n_rows, sizeof(profile_row_t*), compare);
+  return sorted;
+}
+
+static double profile_percent(uint64_t count, uint64_t n_samples) {
+  return n_samples == 0 ? 0.0 : 100.0 * count / n_samples;
+}
+
+/**
+ * Print the flat profile and call graph of the samples and write
+ * their folded stacks to folded (when it isn't NULL). Return the
+ * number of samples.
+ */
+static uint64_t profile_report(uint64_t n_taken, FILE* folded) {
+  hash_table_t* procedures = make_hash_table(HASH_TABLE_EQ, 64);
+  hash_table_t* names = make_hash_table(HASH_TABLE_STRING, 64);
+  hash_table_t* edge_indexes = make_hash_table(HASH_TABLE_EQ, 64);
+  hash_table_t* stacks = make_hash_table(HASH_TABLE_STRING, 64);
+  array_t* rows = make_array(64);
+  array_t* edges = make_array(64);
+  uint64_t toplevel = profile_add_row(&rows, "<toplevel>");
+  uint64_t indexes[PROFILE_MAX_FRAMES];
+  byte_array_t* stack = make_byte_array(256);
+
+  uint64_t n_samples = 0;
+  for (uint64_t s = 0; s < n_taken; s++) {
+    profile_sample_t* sample = &profile_samples[s];
+    if (!sample->is_recorded) {
+      continue;
+    }
+    n_samples++;
+    uint64_t n_frames = sample->n_frames;
+    for (uint64_t i = 0; i < n_frames; i++) {
+      indexes[i] = profile_procedure_row(procedures, names, &rows, sample, i);
+    }
+    if (n_frames == 0) {
+      indexes[n_frames++] = toplevel;
+    }
+
+    profile_get_row(rows, indexes[n_frames - 1])->self++;
+    stack->length = 0;
+    if (sample->is_truncated) {
+      stack = byte_array_append_string(stack, "...;");
+    }
+    for (uint64_t i = 0; i < n_frames; i++) {
+      profile_row_t* row = profile_get_row(rows, indexes[i]);
+      if (row->last_sample != s + 1) {
+        row->last_sample = s + 1;
+        row->total++;
+      }
+      if (i > 0) {
+        stack = byte_array_append_byte(stack, ';');
+        tagged_reference_t key = tagged_reference(
+            TAG_UINT64_T, (indexes[i - 1] << 32) | indexes[i]);
+        optional_t edge_index = hash_table_get(edge_indexes, key);
+        if (!optional_is_present(edge_index)) {
+          edge_index = optional_of(
+              tagged_reference(TAG_UINT64_T, profile_add_row(&edges, NULL)));
+          profile_row_t* edge
+              = profile_get_row(edges, optional_value(edge_index).data);
+          edge->caller = indexes[i - 1];
+          edge->callee = indexes[i];
+          hash_table_set(edge_indexes, key, optional_value(edge_index));
+        }
+        profile_row_t* edge
+            = profile_get_row(edges, optional_value(edge_index).data);
+        if (edge->last_sample != s + 1) {
+          edge->last_sample = s + 1;
+          edge->total++;
+        }
+      }
+      stack = byte_array_append_string(stack, row->name);
+    }
+    stack = byte_array_append_byte(stack, 0);
+    tagged_reference_t key
+        = tagged_reference(TAG_SCHEME_SYMBOL, (char*) &stack->elements[0]);
+    hash_table_entry_t* entry = hash_table_find_entry(stacks, key);
+    if (entry == NULL) {
+      char* name = string_duplicate((char*) key.data);
+      entry = hash_table_insert_entry(
+          stacks, tagged_reference(TAG_SCHEME_SYMBOL, name));
+      entry->value = tagged_reference(TAG_UINT64_T, 0);
+    }
+    entry->value.data++;
+  }
+
+  uint64_t n_dropped = __atomic_load_n(&profile_n_dropped, __ATOMIC_RELAXED);
+  printf("Flat profile: %lu samples at %lu per second", n_samples,
+         profile_rate);
+  if (n_dropped > 0) {
+    printf(" (%lu more dropped)", n_dropped);
+  }
+  printf("\n  self%%     self  total%%    total  procedure\n");
+  profile_row_t** sorted = profile_sort_rows(rows, profile_compare_procedures);
+  for (uint64_t i = 0; i < array_length(rows); i++) {
+    if (sorted[i]->total > 0) {
+      printf("%6.2f %8lu %6.2f %8lu  %s\n",
+             profile_percent(sorted[i]->self, n_samples), sorted[i]->self,
+             profile_percent(sorted[i]->total, n_samples), sorted[i]->total,
+             sorted[i]->name);
+    }
+  }
+  free_bytes(sorted);
+
+  printf("\nCall graph: samples with caller -> callee on the stack\n");
+  sorted = profile_sort_rows(edges, profile_compare_edges);
+  for (uint64_t i = 0; i < array_length(edges); i++) {
+    printf("%8lu  %s -> %s\n", sorted[i]->total,
+           profile_get_row(rows, sorted[i]->caller)->name,
+           profile_get_row(rows, sorted[i]->callee)->name);
+  }
+  free_bytes(sorted);
+  fflush(stdout);
+
+  if (folded != NULL) {
+    for (uint64_t slot = 0; slot < stacks->capacity; slot++) {
+      if (hash_table_slot_is_full(stacks, slot)) {
+        fprintf(folded, "%s %lu\n", (char*) stacks->entries[slot].key.data,
+                stacks->entries[slot].value.data);
+      }
+    }
+  }
+  return n_samples;
+}
+
+/**
+ * Example (profile-start) or (profile-start 100)
+ *
+ * Start sampling the procedures being applied by every interpreter
+ * thread (by default a thousand times per second of processor time).
+ * Samples taken before are thrown away.
+ */
+tagged_reference_t
+    primtive_function_profile_start(primitive_arguments_t arguments) {
+  require_n_args(arguments, 0, 1);
+  uint64_t rate = PROFILE_DEFAULT_RATE;
+  if (arguments.n_args == 1) {
+    require_tag(arguments.args[0], TAG_UINT64_T);
+    rate = arguments.args[0].data;
+    if (rate == 0) {
+      fatal_error(ERROR_REFERENCE_NOT_EXPECTED_TYPE);
+    }
+  }
+  if (profile_samples == NULL) {
+    profile_samples = (profile_sample_t*) malloc_bytes(
+        PROFILE_MAX_SAMPLES * sizeof(profile_sample_t));
+  }
+  if (!profile_handler_is_installed) {
+    struct sigaction action = {0};
+    action.sa_handler = profile_handle_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    profile_handler_is_installed = true;
+  }
+  profile_set_timer(0);
+  __atomic_store_n(&profile_running, false, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&profile_n_finished, __ATOMIC_ACQUIRE)
+         != __atomic_load_n(&profile_n_reserved, __ATOMIC_SEQ_CST)) {
+    // Wait for signal handlers running on other threads.
+  }
+  __atomic_store_n(&profile_n_reserved, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&profile_n_finished, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&profile_n_dropped, 0, __ATOMIC_SEQ_CST);
+  profile_rate = rate;
+  __atomic_store_n(&profile_running, true, __ATOMIC_SEQ_CST);
+  profile_set_timer(rate);
+  return tagged_reference(TAG_BOOLEAN_T, true);
+}
+
+/**
+ * Example (profile-stop) or (profile-stop "fib.folded")
+ *
+ * Stop sampling and print a flat profile (the samples taken in each
+ * procedure itself and with it anywhere on the stack) and a call
+ * graph. Given a file name, also write the samples as folded stacks
+ * (the input of flamegraph.pl). Return the number of samples.
+ */
+tagged_reference_t
+    primtive_function_profile_stop(primitive_arguments_t arguments) {
+  require_n_args(arguments, 0, 1);
+  if (!profile_is_running()) {
+    return tagged_reference(TAG_UINT64_T, 0);
+  }
+  profile_set_timer(0);
+  __atomic_store_n(&profile_running, false, __ATOMIC_SEQ_CST);
+  uint64_t n_taken;
+  while (true) {
+    n_taken = __atomic_load_n(&profile_n_reserved, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&profile_n_finished, __ATOMIC_ACQUIRE) == n_taken) {
+      break;
+    }
+  }
+  if (n_taken > PROFILE_MAX_SAMPLES) {
+    n_taken = PROFILE_MAX_SAMPLES;
+  }
+
+  FILE* folded = NULL;
+  if (arguments.n_args == 1) {
+    folded = fopen(untag_string_or_reader_symbol(arguments.args[0]), "w");
+    if (folded == NULL) {
+      fatal_error(ERROR_FILE_NOT_OPENED);
+    }
+  }
+  uint64_t n_samples = profile_report(n_taken, folded);
+  if (folded != NULL) {
+    fclose(folded);
+  }
+  return tagged_reference(TAG_UINT64_T, n_samples);
+}
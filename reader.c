@@ -21,6 +21,7 @@ typedef struct {
 
 extern read_expression_result_t read_expression(const char* str,
                                                 uint64_t start);
+extern uint64_t skip_whitespace_and_comments(const char* str, uint64_t start);
 
 #endif /* _READER_H_ */
 
@@ -30,30 +31,50 @@ extern read_expression_result_t read_expression(const char* str,
 #include <string.h>
 
 #include "allocate.h"
+#include "boolean.h"
 #include "pair.h"
 #include "reader.h"
 #include "string-util.h"
 #include "tagged-reference.h"
 
-int is_whitespace(char ch) { return ch == ' ' || ch == '\n'; }
+int is_whitespace(char ch) {
+  return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r';
+}
 
 int is_delimiter(char ch) { return ch == '(' || ch == ')'; }
 
-int is_token_end(char ch) { return is_delimiter(ch) || is_whitespace(ch); }
+int is_token_end(char ch) {
+  return is_delimiter(ch) || is_whitespace(ch) || ch == ';' || ch == '\0';
+}
 
 int is_digit(char ch) { return ch >= '0' && ch <= '9'; }
 
 /**
- * Return true if all characters from start to the end of the string
- * are whitespace or if we are already at the end of the string.
+ * Return the position of the first character at or after start that
+ * isn't whitespace or part of a comment (which start with a ';' and
+ * continue to the end of the line).
  */
-int all_whitespace_or_end(const char* str, uint64_t start) {
-  while (str[start++]) {
-    if (!is_whitespace(str[start])) {
-      return 0;
+uint64_t skip_whitespace_and_comments(const char* str, uint64_t start) {
+  while (1) {
+    if (is_whitespace(str[start])) {
+      start++;
+    } else if (str[start] == ';') {
+      while (str[start] && str[start] != '\n') {
+        start++;
+      }
+    } else {
+      return start;
     }
   }
-  return 1;
+}
+
+/**
+ * Return true if all characters from start to the end of the string
+ * are whitespace (or comments) or if we are already at the end of the
+ * string.
+ */
+int all_whitespace_or_end(const char* str, uint64_t start) {
+  return str[skip_whitespace_and_comments(str, start)] == '\0';
 }
 
 read_expression_result_t read_expression_result(tagged_reference_t reference,
@@ -61,36 +82,134 @@ read_expression_result_t read_expression_result(tagged_reference_t reference,
   return (read_expression_result_t){reference, end};
 }
 
+/**
+ * Read a string literal starting at the opening '"'. \", \\, \n, \t
+ * and \x<hex>; (the UTF-8 encoding of that code point) are unescaped
+ * (any other escaped character stands for itself). The literal must
+ * be valid UTF-8.
+ */
+read_expression_result_t read_string_literal(const char* str, uint64_t start) {
+  tagged_reference_t bad_syntax
+      = tagged_reference(TAG_ERROR_T, ERROR_BAD_SYNTAX);
+  uint64_t end = start + 1;
+  while (str[end] != '"') {
+    if (str[end] == '\0') {
+      return read_expression_result(bad_syntax, start);
+    }
+    if (str[end] == '\\' && str[end + 1] != '\0') {
+      end++;
+    }
+    end++;
+  }
+  // Unescaping never makes a string longer.
+  immutable_string_t* result = allocate_immutable_string(end - start - 1);
+  char* bytes = result->bytes;
+  uint64_t n = 0;
+  for (uint64_t i = start + 1; i < end; i++) {
+    char ch = str[i];
+    if (ch == '\\' && i + 1 < end) {
+      ch = str[++i];
+      if (ch == 'x') {
+        uint64_t semicolon = i + 1;
+        while (semicolon < end && str[semicolon] != ';') {
+          semicolon++;
+        }
+        int64_t code_point = char_name_to_code_point(&str[i], semicolon - i);
+        uint64_t n_bytes
+            = code_point < 0 ? 0 : utf8_encode(code_point, &bytes[n]);
+        if (semicolon == end || n_bytes == 0) {
+          free_bytes(result);
+          return read_expression_result(bad_syntax, start);
+        }
+        n += n_bytes;
+        i = semicolon;
+        continue;
+      }
+      ch = ch == 'n' ? '\n' : (ch == 't' ? '\t' : ch);
+    }
+    bytes[n++] = ch;
+  }
+  bytes[n] = '\0';
+  result->length = n;
+  uint64_t n_code_points;
+  if (!utf8_validate(bytes, n, &n_code_points)) {
+    free_bytes(result);
+    return read_expression_result(bad_syntax, start);
+  }
+  return read_expression_result(
+      tagged_reference(TAG_STRING, finish_immutable_string(result)), end + 1);
+}
+
+/**
+ * Read a character starting at "#\": either a single (UTF-8 encoded)
+ * character like #\a or #\λ, a name like #\space or a code point in
+ * hex like #\x3bb.
+ */
+read_expression_result_t read_character(const char* str, uint64_t start) {
+  tagged_reference_t bad_syntax
+      = tagged_reference(TAG_ERROR_T, ERROR_BAD_SYNTAX);
+  uint32_t code_point;
+  uint64_t n = utf8_validate_code_point(&str[start + 2], UTF8_MAX_BYTES,
+                                        &code_point);
+  if (str[start + 2] == '\0' || n == 0) {
+    return read_expression_result(bad_syntax, start);
+  }
+  uint64_t end = start + 2 + n;
+  if (!is_token_end(str[end])) {
+    while (!is_token_end(str[end])) {
+      end++;
+    }
+    int64_t named
+        = char_name_to_code_point(&str[start + 2], end - (start + 2));
+    char encoding[UTF8_MAX_BYTES];
+    if (named < 0 || utf8_encode(named, encoding) == 0) {
+      return read_expression_result(bad_syntax, start);
+    }
+    code_point = named;
+  }
+  return read_expression_result(
+      tagged_reference(TAG_UNICODE_CODE_POINT, code_point), end);
+}
+
 /**
  * This is a light-weight "s-expression" reader.
  *
- * read() return NIL, symbol, string, uint64_t, or a linkd list.
+ * read() return NIL, symbol, string, character, uint64_t, or a linkd
+ * list.
  */
 read_expression_result_t read_expression(const char* str, uint64_t start) {
   uint64_t original_start = start;
-  uint64_t limit = strlen(str);
-  while (is_whitespace(str[start])) {
-    start++;
-  }
+  start = skip_whitespace_and_comments(str, start);
   if (str[start] == '(') {
     start++;
     pair_t* result = NULL;
     while (!all_whitespace_or_end(str, start)) {
+      start = skip_whitespace_and_comments(str, start);
+      if (str[start] == ')') {
+        // The empty list is NIL rather than a NULL pair.
+        if (result == NULL) {
+          return read_expression_result(NIL, start + 1);
+        }
+        return read_expression_result(tagged_reference(TAG_PAIR_T, result),
+                                      start + 1);
+      }
+
       read_expression_result_t child_result = read_expression(str, start);
       tagged_reference_t child = child_result.result;
       start = child_result.end;
 
       if (child.tag == TAG_ERROR_T) {
         return read_expression_result(child, original_start);
-      } else if (child.tag == TAG_NULL) {
-        return read_expression_result(tagged_reference(TAG_PAIR_T, result),
-                                      start);
       } else {
         result = pair_list_append(result, make_pair(child, NIL));
       }
     }
   } else if (str[start] == ')') {
     return read_expression_result(NIL, start + 1);
+  } else if (str[start] == '"') {
+    return read_string_literal(str, start);
+  } else if (str[start] == '#' && str[start + 1] == '\\') {
+    return read_character(str, start);
   } else if (is_digit(str[start])) {
     uint64_t end = start + 1;
     while (!is_token_end(str[end])) {
@@ -107,8 +226,17 @@ read_expression_result_t read_expression(const char* str, uint64_t start) {
     while (!is_token_end(str[end])) {
       end++;
     }
-    char* token = string_substring(str, start, end);
-    return read_expression_result(tagged_reference(TAG_SCHEME_SYMBOL, token),
+    if (end - start == 2 && str[start] == '#'
+        && (str[start + 1] == 't' || str[start + 1] == 'f')) {
+      return read_expression_result(tag_boolean(str[start + 1] == 't'), end);
+    }
+    uint64_t n_code_points;
+    if (!utf8_validate(&str[start], end - start, &n_code_points)) {
+      return read_expression_result(
+          tagged_reference(TAG_ERROR_T, ERROR_BAD_SYNTAX), start);
+    }
+    char* name = intern_symbol_name(&str[start], end - start);
+    return read_expression_result(tagged_reference(TAG_SCHEME_SYMBOL, name),
                                   end);
   }
   fatal_error(ERROR_NOT_REACHED);
@@ -0,0 +1,191 @@
+#!/bin/bash
+#
+# Run scheme benchmarks and write their results as JSON.
+#
+#   ./run-benchmarks.sh [-o results.json] [-b baseline.json]
+#                       [-n runs] [-t percent] benchmark...
+#   ./run-benchmarks.sh -c baseline.json results.json [-t percent]
+#
+# Every benchmark is a file of scheme given to armyknife-scheme on
+# stdin or a script (*.sh) writing such a file. It is run n times
+# (default 3) and the fastest wall time is recorded together with the
+# allocations and peak RSS printed by ARMYKNIFE_RUNTIME_STATS (see
+# runtime-stats.c). Given a baseline (or with -c), results that got
+# more than percent (default 10) worse are reported as regressions
+# and the exit status is 1.
+#
+# What a benchmark prints on stdout has to match bench/foo.expected
+# (for foo.scm or foo.sh) so that a benchmark that got faster because
+# it computes the wrong thing fails. The printer and reader benchmarks
+# print megabytes so bench/foo.cksum, the output of cksum, is checked
+# in for them instead.
+
+interpreter=${ARMYKNIFE_SCHEME:-./armyknife-scheme}
+output=bench-results.json
+baseline=""
+compare_only=0
+runs=3
+threshold=10
+
+while getopts "o:b:cn:t:" option; do
+    case $option in
+        o) output=$OPTARG ;;
+        b) baseline=$OPTARG ;;
+        c) compare_only=1 ;;
+        n) runs=$OPTARG ;;
+        t) threshold=$OPTARG ;;
+        *) exit 2 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+# Print "name wall_ms allocations allocated_bytes peak_rss_kb" for
+# every benchmark of a results file (which has one per line).
+read_results() {
+    sed -n 's/.*"name": "\([^"]*\)", "wall_ms": \([0-9]*\), "allocations": \([0-9]*\), "allocated_bytes": \([0-9]*\), "peak_rss_kb": \([0-9]*\).*/\1 \2 \3 \4 \5/p' "$1"
+}
+
+# Compare two results files, printing every metric of every benchmark
+# and flagging the ones that got more than threshold percent worse.
+compare() {
+    if [[ ! -r $1 || ! -r $2 ]] ; then
+        echo "Can't read $1 or $2"
+        return 2
+    fi
+    awk -v threshold="$threshold" '
+        FNR == NR { old[$1] = $0; next }
+        {
+            if (!($1 in old)) {
+                printf "%-20s (not in the baseline)\n", $1
+                next
+            }
+            split(old[$1], before, " ")
+            split("wall_ms allocations allocated_bytes peak_rss_kb", names, " ")
+            for (i = 2; i <= 5; i++) {
+                change = before[i] == 0 ? 0 : 100 * ($i - before[i]) / before[i]
+                flag = ""
+                if (change > threshold) {
+                    flag = "  REGRESSION"
+                    regressions++
+                }
+                printf "%-20s %-16s %12d -> %12d %+7.1f%%%s\n",
+                       $1, names[i - 1], before[i], $i, change, flag
+            }
+        }
+        END {
+            if (regressions > 0) {
+                printf "%d regressions (more than %s%% worse)\n",
+                       regressions, threshold
+                exit 1
+            }
+            print "No regressions"
+        }' <(read_results "$1") <(read_results "$2")
+}
+
+if [[ $compare_only -eq 1 ]] ; then
+    compare "$1" "$2"
+    exit $?
+fi
+
+if [[ ! -x $interpreter ]] ; then
+    echo "No $interpreter (run make first)"
+    exit 2
+fi
+
+# The recursive evaluator uses the C stack for non tail calls.
+ulimit -s unlimited 2>/dev/null
+
+input=$(mktemp)
+actual=$(mktemp)
+stats=$(mktemp)
+trap 'rm -f "$input" "$actual" "$stats"' EXIT
+
+# Print the value of a counter printed by ARMYKNIFE_RUNTIME_STATS.
+stat() {
+    sed -n "s/^;;;   $1 \([0-9]*\)$/\1/p" "$stats"
+}
+
+# Succeed if the output of benchmark $1 is the expected one.
+output_is_expected() {
+    local expected=${1%.*}
+    if [[ -r $expected.expected ]] ; then
+        cmp -s "$expected.expected" "$actual"
+    elif [[ -r $expected.cksum ]] ; then
+        [[ $(cksum < "$actual") == $(cat "$expected.cksum") ]]
+    else
+        echo "No $expected.expected or $expected.cksum"
+        return 1
+    fi
+}
+
+failures=0
+results=""
+for benchmark in "$@"
+do
+    name=$(basename "$benchmark")
+    name=${name%.*}
+    if [[ $benchmark == *.sh ]] ; then
+        "$benchmark" > "$input"
+    else
+        cp "$benchmark" "$input"
+    fi
+
+    best=""
+    for ((run = 0; run < runs; run++)); do
+        start=$(date +%s%N)
+        ARMYKNIFE_RUNTIME_STATS=1 "$interpreter" < "$input" \
+            > "$actual" 2> "$stats"
+        status=$?
+        end=$(date +%s%N)
+        if [[ $status -ne 0 ]] ; then
+            break
+        fi
+        wall_ms=$(((end - start) / 1000000))
+        if [[ -z $best || $wall_ms -lt $best ]] ; then
+            best=$wall_ms
+        fi
+    done
+
+    if [[ $status -ne 0 ]] ; then
+        echo "FAIL: non zero exit status for $benchmark"
+        ((failures++))
+        continue
+    fi
+
+    if ! output_is_expected "$benchmark" ; then
+        echo "FAIL: unexpected output for $benchmark"
+        ((failures++))
+        continue
+    fi
+
+    result="{\"name\": \"$name\", \"wall_ms\": $best"
+    result="$result, \"allocations\": $(stat allocations)"
+    result="$result, \"allocated_bytes\": $(stat allocated-bytes)"
+    result="$result, \"peak_rss_kb\": $(stat peak-rss-kb)}"
+    echo "$result"
+    if [[ -n $results ]] ; then
+        results="$results,\n"
+    fi
+    results="$results    $result"
+done
+
+{
+    echo "{"
+    echo "  \"evaluator\": \"${ARMYKNIFE_EVALUATOR:-recursive}\","
+    echo "  \"runs\": $runs,"
+    echo "  \"benchmarks\": ["
+    echo -e "$results"
+    echo "  ]"
+    echo "}"
+} > "$output"
+echo "Wrote $output"
+
+if [[ $failures -ne 0 ]] ; then
+    exit 1
+fi
+
+if [[ -n $baseline ]] ; then
+    echo
+    compare "$baseline" "$output"
+    exit $?
+fi
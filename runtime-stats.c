@@ -0,0 +1,258 @@
+/**
+ * @file runtime-stats.c
+ *
+ * Counters describing what the evaluators spend their time on: how
+ * often each special form is evaluated, how many primitives and
+ * closures are applied, how many environments are allocated, freed
+ * and captured, how far environment_find_binding has to look and how
+ * many bytes are read and printed.
+ *
+ * The counters are always compiled in but only counted once enabled,
+ * either with (runtime-stats #t) or by setting ARMYKNIFE_RUNTIME_STATS
+ * (which also prints them to stderr when the interpreter exits).
+ * Like the other statistics, every interpreter thread has counters of
+ * its own so no atomic operations are needed.
+ */
+
+// ======================================================================
+// This is block is extraced to runtime-stats.h
+// ======================================================================
+
+#ifndef _RUNTIME_STATS_H_
+#define _RUNTIME_STATS_H_
+
+#include <stdint.h>
+
+#include "boolean.h"
+#include "builtin.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+#define RUNTIME_STATS_N_SPECIAL_FORMS (SPECIAL_FORM_WHEN + 1)
+// Lookups that go through at least this many environments share the
+// last bucket of the histogram.
+#define RUNTIME_STATS_LOOKUP_DEPTHS 8
+
+typedef struct {
+  // Indexed by special_form_t.
+  uint64_t special_forms[RUNTIME_STATS_N_SPECIAL_FORMS];
+  uint64_t primitive_applications;
+  uint64_t closure_applications;
+  // Closure applications that ran compiled code (see jit.c).
+  uint64_t compiled_applications;
+  // Integer arithmetic done by a call site without calling the
+  // primitive (see call-site.c).
+  uint64_t inline_arithmetic;
+  uint64_t heap_environments;
+  uint64_t stack_environments;
+  uint64_t freed_environments;
+  uint64_t popped_environments;
+  uint64_t captured_environments;
+  // lookup_depths[i] counts the bindings environment_find_binding
+  // found i environments up from where it started.
+  uint64_t lookup_depths[RUNTIME_STATS_LOOKUP_DEPTHS];
+  uint64_t failed_lookups;
+  uint64_t bytes_read;
+  uint64_t bytes_printed;
+} runtime_stats_t;
+
+extern boolean_t runtime_stats_enabled;
+extern _Thread_local runtime_stats_t runtime_stats;
+
+extern void runtime_stats_initialize(void);
+extern tagged_reference_t
+    primtive_function_runtime_stats(primitive_arguments_t args);
+
+/**
+ * Return true when counting is turned on (by any thread).
+ */
+static inline boolean_t runtime_stats_is_enabled(void) {
+  return __atomic_load_n(&runtime_stats_enabled, __ATOMIC_RELAXED);
+}
+
+/**
+ * Add n to a field of this thread's runtime_stats (when enabled).
+ */
+#define runtime_stats_add(field, n)                                            \
+  do {                                                                         \
+    if (runtime_stats_is_enabled()) {                                          \
+      runtime_stats.field += (n);                                              \
+    }                                                                          \
+  } while (0)
+
+#define runtime_stats_count(field) runtime_stats_add(field, 1)
+
+static inline void runtime_stats_count_lookup(uint64_t depth) {
+  if (runtime_stats_is_enabled()) {
+    runtime_stats.lookup_depths[depth < RUNTIME_STATS_LOOKUP_DEPTHS
+                                    ? depth
+                                    : RUNTIME_STATS_LOOKUP_DEPTHS - 1]++;
+  }
+}
+
+#endif /* _RUNTIME_STATS_H_ */
+
+// ======================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "allocate.h"
+#include "fatal-error.h"
+#include "pair.h"
+#include "runtime-stats.h"
+
+boolean_t runtime_stats_enabled = false;
+_Thread_local runtime_stats_t runtime_stats = {0};
+
+static const char* runtime_stats_special_form_names[] = {
+    [SPECIAL_FORM_AND] = "and",
+    [SPECIAL_FORM_BEGIN] = "begin",
+    [SPECIAL_FORM_COND] = "cond",
+    [SPECIAL_FORM_DEFINE] = "define",
+    [SPECIAL_FORM_DEFINE_SYNTAX] = "define-syntax",
+    [SPECIAL_FORM_DO] = "do",
+    [SPECIAL_FORM_IF] = "if",
+    [SPECIAL_FORM_LAMBDA] = "lambda",
+    [SPECIAL_FORM_LET] = "let",
+    [SPECIAL_FORM_LET_STAR] = "let*",
+    [SPECIAL_FORM_LETREC] = "letrec",
+    [SPECIAL_FORM_OR] = "or",
+    [SPECIAL_FORM_QUOTE] = "quote",
+    [SPECIAL_FORM_SET_BANG] = "set!",
+    [SPECIAL_FORM_UNLESS] = "unless",
+    [SPECIAL_FORM_WHEN] = "when",
+};
+
+typedef struct {
+  char* name;
+  uint64_t value;
+} runtime_stat_t;
+
+/**
+ * Return the most memory the process has had resident (in kilobytes).
+ */
+static uint64_t runtime_stats_peak_rss(void) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return usage.ru_maxrss;
+}
+
+/**
+ * Fill in the counters that aren't part of a histogram and return
+ * how many there are. Allocations are counted by allocate.c whether
+ * or not counting is on and the peak RSS is the whole process's.
+ */
+static uint64_t runtime_stats_scalars(runtime_stat_t* stats) {
+  runtime_stat_t scalars[] = {
+      {"primitive-applications", runtime_stats.primitive_applications},
+      {"closure-applications", runtime_stats.closure_applications},
+      {"compiled-applications", runtime_stats.compiled_applications},
+      {"inline-arithmetic", runtime_stats.inline_arithmetic},
+      {"heap-environments", runtime_stats.heap_environments},
+      {"stack-environments", runtime_stats.stack_environments},
+      {"freed-environments", runtime_stats.freed_environments},
+      {"popped-environments", runtime_stats.popped_environments},
+      {"captured-environments", runtime_stats.captured_environments},
+      {"failed-lookups", runtime_stats.failed_lookups},
+      {"bytes-read", runtime_stats.bytes_read},
+      {"bytes-printed", runtime_stats.bytes_printed},
+      {"allocations", allocate_n_allocations},
+      {"allocated-bytes", allocate_n_bytes},
+      {"peak-rss-kb", runtime_stats_peak_rss()},
+  };
+  uint64_t n = sizeof(scalars) / sizeof(scalars[0]);
+  for (uint64_t i = 0; i < n; i++) {
+    stats[i] = scalars[i];
+  }
+  return n;
+}
+
+static void runtime_stats_print(void) {
+  runtime_stat_t stats[32];
+  uint64_t n = runtime_stats_scalars(stats);
+  fprintf(stderr, ";;; runtime-stats\n");
+  for (uint64_t i = 0; i < n; i++) {
+    fprintf(stderr, ";;;   %s %lu\n", stats[i].name, stats[i].value);
+  }
+  for (uint64_t form = 0; form < RUNTIME_STATS_N_SPECIAL_FORMS; form++) {
+    if (runtime_stats_special_form_names[form] != NULL) {
+      fprintf(stderr, ";;;   special-form %s %lu\n",
+              runtime_stats_special_form_names[form],
+              runtime_stats.special_forms[form]);
+    }
+  }
+  for (uint64_t depth = 0; depth < RUNTIME_STATS_LOOKUP_DEPTHS; depth++) {
+    fprintf(stderr, ";;;   lookup-depth %lu%s %lu\n", depth,
+            depth == RUNTIME_STATS_LOOKUP_DEPTHS - 1 ? "+" : "",
+            runtime_stats.lookup_depths[depth]);
+  }
+}
+
+/**
+ * Enable the counters (and print them at exit) when
+ * ARMYKNIFE_RUNTIME_STATS is set. Called before anything is
+ * evaluated.
+ */
+void runtime_stats_initialize(void) {
+  static boolean_t is_initialized = false;
+  if (is_initialized) {
+    return;
+  }
+  is_initialized = true;
+  char* var = getenv("ARMYKNIFE_RUNTIME_STATS");
+  if (var != NULL && var[0] != '\0') {
+    runtime_stats_enabled = true;
+    atexit(runtime_stats_print);
+  }
+}
+
+/**
+ * Example (runtime-stats) or (runtime-stats #t)
+ *
+ * Return an association list of this thread's counters (including a
+ * list of the evaluations of each special form and the histogram of
+ * lookup depths). Given a boolean, counting is turned on or off
+ * first.
+ */
+tagged_reference_t
+    primtive_function_runtime_stats(primitive_arguments_t arguments) {
+  require_n_args(arguments, 0, 1);
+  if (arguments.n_args == 1) {
+    __atomic_store_n(&runtime_stats_enabled, !is_false(arguments.args[0]),
+                     __ATOMIC_RELAXED);
+  }
+
+  tagged_reference_t depths = NIL;
+  for (uint64_t depth = RUNTIME_STATS_LOOKUP_DEPTHS; depth > 0; depth--) {
+    depths = cons(tagged_reference(TAG_UINT64_T,
+                                   runtime_stats.lookup_depths[depth - 1]),
+                  depths);
+  }
+  tagged_reference_t forms = NIL;
+  for (uint64_t form = RUNTIME_STATS_N_SPECIAL_FORMS; form > 0; form--) {
+    const char* name = runtime_stats_special_form_names[form - 1];
+    uint64_t count = runtime_stats.special_forms[form - 1];
+    if (name != NULL) {
+      forms = cons(cons(tagged_reference(TAG_SCHEME_SYMBOL, name),
+                        tagged_reference(TAG_UINT64_T, count)),
+                   forms);
+    }
+  }
+  tagged_reference_t result
+      = cons(cons(tagged_reference(TAG_SCHEME_SYMBOL, "special-forms"), forms),
+             cons(cons(tagged_reference(TAG_SCHEME_SYMBOL, "lookup-depths"),
+                       depths),
+                  NIL));
+
+  runtime_stat_t stats[32];
+  for (uint64_t i = runtime_stats_scalars(stats); i > 0; i--) {
+    result = cons(cons(tagged_reference(TAG_SCHEME_SYMBOL, stats[i - 1].name),
+                       tagged_reference(TAG_UINT64_T, stats[i - 1].value)),
+                  result);
+  }
+  return result;
+}
@@ -0,0 +1,955 @@
+/**
+ * This is a stand-alone program that compiles a file of scheme
+ * top-level forms into C which is linked into armyknife-scheme (see
+ * aot-runtime.c) so that libraries we always load (like
+ * scheme/prelude.scm) don't need to be read and interpreted at
+ * startup.
+ *
+ * Usage: scheme-to-c <file.scm> <module-name> > <module-name>.c
+ *
+ * The generated file defines load_<module-name>(environment_t* env)
+ * which performs the top-level forms of the file in order.
+ *
+ * Each (define name (lambda (args...) body...)) that only uses
+ * constants, variable references, quote, if and calls becomes a C
+ * function (bound to name as a primitive). A named let in tail
+ * position whose name is only used in tail calls (a loop) is compiled
+ * too, as C locals and a label to jump back to. Procedures defined
+ * this way in the same file are "known": they are called directly (and
+ * self tail calls become loops) without looking them up, just like
+ * procedures imported from a library. Calls to +, -, *, <, <=, =, >
+ * and >= with two arguments get an inline integer fast path and the
+ * other builtins in direct_primitives (car, cdr, null?, ...) are
+ * called as C functions. Only globals the module or the user can
+ * rebind are looked up at runtime. Any other top-level form is simply
+ * evaluated by the interpreter when the module is loaded.
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocate.h"
+#include "array.h"
+#include "boolean.h"
+#include "byte-array.h"
+#include "io.h"
+#include "pair.h"
+#include "reader.h"
+#include "string-util.h"
+
+typedef struct {
+  char* name;
+  char* c_name;
+  tagged_reference_t parameters;
+  tagged_reference_t body;
+  uint64_t n_parameters;
+  boolean_t is_known;
+} procedure_t;
+
+// A variable of a named let (or, when index is -1, its name) in scope
+// while compiling its body.
+typedef struct local_S {
+  char* name;
+  uint64_t loop;
+  int64_t index;
+  // Only for the name of the loop.
+  int64_t n_variables;
+  boolean_t* loop_is_used;
+  struct local_S* next;
+} local_t;
+
+typedef struct {
+  tagged_reference_t form;
+  char* source;
+  // NULL unless the form defines a procedure we try to compile.
+  procedure_t* procedure;
+} top_level_form_t;
+
+typedef struct {
+  char* name;
+  char* operation;
+  char* primitive;
+} fixnum_operator_t;
+
+fixnum_operator_t fixnum_operators[] = {
+    {"+", "FIXNUM_OPERATION_ADD", "primtive_function_plus"},
+    {"-", "FIXNUM_OPERATION_SUB", "primtive_function_sub"},
+    {"*", "FIXNUM_OPERATION_MUL", "primtive_function_mul"},
+    {"<", "FIXNUM_OPERATION_LESS", "primtive_function_less"},
+    {"<=", "FIXNUM_OPERATION_LESS_OR_EQUAL",
+     "primtive_function_less_or_equal"},
+    {"=", "FIXNUM_OPERATION_EQUAL", "primtive_function_numerically_equal"},
+    {">", "FIXNUM_OPERATION_GREATER", "primtive_function_greater"},
+    {">=", "FIXNUM_OPERATION_GREATER_OR_EQUAL",
+     "primtive_function_greater_or_equal"},
+};
+
+typedef struct {
+  char* name;
+  char* primitive;
+} direct_primitive_t;
+
+// Builtin primitives (declared in primitive.h or list-primitive.h)
+// that compiled code calls directly unless the module defines or
+// set!s the name.
+direct_primitive_t direct_primitives[] = {
+    {"/", "primtive_function_div"},
+    {"append", "primtive_function_append"},
+    {"car", "primtive_function_car"},
+    {"cdr", "primtive_function_cdr"},
+    {"cons", "primtive_function_cons"},
+    {"eq?", "primtive_function_eq_p"},
+    {"equal?", "primtive_function_equal_p"},
+    {"eqv?", "primtive_function_eqv_p"},
+    {"length", "primtive_function_length"},
+    {"list", "primtive_function_list"},
+    {"null?", "primtive_function_null_p"},
+    {"pair?", "primtive_function_pair_p"},
+    {"reverse", "primtive_function_reverse"},
+};
+
+// Special forms we don't compile (the interpreter evaluates any
+// top-level form that uses them).
+char* uncompiled_special_forms[] = {
+    "and", "begin",  "cond",    "define", "define-syntax", "do",   "lambda",
+    "let", "let*",   "letrec",  "letrec*", "or",           "set!", "unless",
+    "when",
+};
+
+char* module_name;
+array_t* forms;           // top_level_form_t*
+array_t* defined_names;   // char*, every name defined at the top-level
+array_t* assigned_names;  // char*, every name used with set!
+array_t* macro_names;     // char*, every name defined with define-syntax
+
+// Per generation pass state.
+array_t* global_names;    // char*, one global_cache_N per name
+byte_array_t* constants;  // statements initializing constant_N
+uint64_t n_constants;
+procedure_t* current_procedure;
+boolean_t current_procedure_loops;
+local_t* locals;  // innermost first
+uint64_t n_loops;
+
+// ======================================================================
+// Small utilities
+// ======================================================================
+
+__attribute__((format(printf, 2, 3))) byte_array_t*
+    appendf(byte_array_t* output, const char* format, ...) {
+  char buffer[1024];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  return byte_array_append_string(output, buffer);
+}
+
+boolean_t is_symbol(tagged_reference_t expr, char* name) {
+  return expr.tag == TAG_SCHEME_SYMBOL
+         && string_equal(untag_reader_symbol(expr), name);
+}
+
+boolean_t names_contain(array_t* names, char* name) {
+  for (uint64_t i = 0; i < array_length(names); i++) {
+    if (string_equal((char*) array_get(names, i), name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t name_index(array_t* names, char* name) {
+  for (uint64_t i = 0; i < array_length(names); i++) {
+    if (string_equal((char*) array_get(names, i), name)) {
+      return i;
+    }
+  }
+  return array_length(names);
+}
+
+int64_t list_length(tagged_reference_t lst) {
+  int64_t result = 0;
+  while (lst.tag == TAG_PAIR_T) {
+    result++;
+    lst = untag_pair(lst)->tail;
+  }
+  return is_nil(lst) ? result : -1;
+}
+
+/**
+ * Turn a scheme name into a (readable) C identifier.
+ */
+char* mangle(char* name) {
+  byte_array_t* result = make_byte_array(32);
+  for (int i = 0; name[i]; i++) {
+    if (isalnum(name[i])) {
+      result = byte_array_append_byte(result, name[i]);
+    } else if (name[i] == '-') {
+      result = byte_array_append_byte(result, '_');
+    } else if (name[i] == '?') {
+      result = byte_array_append_string(result, "_p");
+    } else if (name[i] == '!') {
+      result = byte_array_append_string(result, "_x");
+    } else {
+      result = appendf(result, "_%02x", (unsigned char) name[i]);
+    }
+  }
+  return byte_array_c_substring(result, 0, byte_array_length(result));
+}
+
+byte_array_t* append_c_string_literal(byte_array_t* output, char* str) {
+  output = byte_array_append_byte(output, '"');
+  for (int i = 0; str[i]; i++) {
+    if (str[i] == '"' || str[i] == '\\') {
+      output = byte_array_append_byte(output, '\\');
+      output = byte_array_append_byte(output, str[i]);
+    } else if (str[i] == '\n') {
+      output = byte_array_append_string(output, "\\n\"\n    \"");
+    } else {
+      output = byte_array_append_byte(output, str[i]);
+    }
+  }
+  return byte_array_append_byte(output, '"');
+}
+
+int64_t parameter_index(char* name) {
+  int64_t index = 0;
+  for (tagged_reference_t lst = current_procedure->parameters;
+       lst.tag == TAG_PAIR_T; lst = cdr(lst)) {
+    if (string_equal(untag_reader_symbol(car(lst)), name)) {
+      return index;
+    }
+    index++;
+  }
+  return -1;
+}
+
+local_t* find_local(char* name) {
+  for (local_t* local = locals; local != NULL; local = local->next) {
+    if (string_equal(local->name, name)) {
+      return local;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Return true if name refers to a parameter or a local of the code
+ * being compiled rather than a global.
+ */
+boolean_t is_lexical(char* name) {
+  return find_local(name) != NULL || parameter_index(name) >= 0;
+}
+
+procedure_t* find_known_procedure(char* name) {
+  for (uint64_t i = 0; i < array_length(forms); i++) {
+    procedure_t* procedure
+        = ((top_level_form_t*) array_get(forms, i))->procedure;
+    if (procedure != NULL && procedure->is_known
+        && string_equal(procedure->name, name)) {
+      return procedure;
+    }
+  }
+  return NULL;
+}
+
+fixnum_operator_t* find_fixnum_operator(char* name) {
+  if (names_contain(defined_names, name)) {
+    return NULL;
+  }
+  for (int i = 0; i < sizeof(fixnum_operators) / sizeof(fixnum_operators[0]);
+       i++) {
+    if (string_equal(fixnum_operators[i].name, name)) {
+      return &fixnum_operators[i];
+    }
+  }
+  return NULL;
+}
+
+direct_primitive_t* find_direct_primitive(char* name) {
+  if (names_contain(defined_names, name)
+      || names_contain(assigned_names, name)) {
+    return NULL;
+  }
+  for (int i = 0;
+       i < sizeof(direct_primitives) / sizeof(direct_primitives[0]); i++) {
+    if (string_equal(direct_primitives[i].name, name)) {
+      return &direct_primitives[i];
+    }
+  }
+  return NULL;
+}
+
+void collect_assigned_names(tagged_reference_t expr) {
+  if (expr.tag != TAG_PAIR_T) {
+    return;
+  }
+  if (is_symbol(car(expr), "set!") && cdr(expr).tag == TAG_PAIR_T
+      && car(cdr(expr)).tag == TAG_SCHEME_SYMBOL) {
+    char* name = untag_reader_symbol(car(cdr(expr)));
+    assigned_names = array_add(assigned_names, (uint64_t) name);
+  }
+  while (expr.tag == TAG_PAIR_T) {
+    collect_assigned_names(car(expr));
+    expr = cdr(expr);
+  }
+}
+
+// ======================================================================
+// Compiling expressions
+// ======================================================================
+
+boolean_t compile_expression(byte_array_t** output, tagged_reference_t expr);
+
+/**
+ * Append C code which builds the quoted datum.
+ */
+boolean_t compile_datum(byte_array_t** output, tagged_reference_t datum) {
+  switch (datum.tag) {
+  case TAG_NULL:
+    *output = byte_array_append_string(*output, "NIL");
+    return true;
+  case TAG_UINT64_T:
+    *output = appendf(*output, "tagged_reference(TAG_UINT64_T, UINT64_C(%lu))",
+                      datum.data);
+    return true;
+  case TAG_BOOLEAN_T:
+    *output = appendf(*output, "tag_boolean(%d)", datum.data != 0);
+    return true;
+  case TAG_UNICODE_CODE_POINT:
+    *output = appendf(
+        *output, "tagged_reference(TAG_UNICODE_CODE_POINT, UINT64_C(%lu))",
+        datum.data);
+    return true;
+  case TAG_SCHEME_SYMBOL:
+    *output = byte_array_append_string(
+        *output, "tagged_reference(TAG_SCHEME_SYMBOL, ");
+    *output = append_c_string_literal(*output, untag_reader_symbol(datum));
+    *output = byte_array_append_string(*output, ")");
+    return true;
+  case TAG_PAIR_T:
+    *output = byte_array_append_string(*output, "cons(");
+    if (!compile_datum(output, car(datum))) {
+      return false;
+    }
+    *output = byte_array_append_string(*output, ", ");
+    if (!compile_datum(output, cdr(datum))) {
+      return false;
+    }
+    *output = byte_array_append_string(*output, ")");
+    return true;
+  }
+  return false;
+}
+
+boolean_t compile_quote(byte_array_t** output, tagged_reference_t expr) {
+  if (list_length(expr) != 2) {
+    return false;
+  }
+  tagged_reference_t datum = car(cdr(expr));
+  if (datum.tag != TAG_PAIR_T) {
+    return compile_datum(output, datum);
+  }
+  // Lists are built once when the module is loaded.
+  constants = appendf(constants, "  constant_%lu = ", n_constants);
+  if (!compile_datum(&constants, datum)) {
+    return false;
+  }
+  constants = byte_array_append_string(constants, ";\n");
+  *output = appendf(*output, "constant_%lu", n_constants++);
+  return true;
+}
+
+boolean_t compile_arguments(byte_array_t** output, tagged_reference_t lst) {
+  for (boolean_t first = true; lst.tag == TAG_PAIR_T;
+       lst = cdr(lst), first = false) {
+    if (!first) {
+      *output = byte_array_append_string(*output, ", ");
+    }
+    if (!compile_expression(output, car(lst))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+boolean_t compile_application(byte_array_t** output,
+                              tagged_reference_t expr) {
+  tagged_reference_t operator = car(expr);
+  tagged_reference_t operands = cdr(expr);
+  int64_t n_operands = list_length(operands);
+  if (n_operands < 0 || n_operands >= 16) {
+    return false;
+  }
+
+  if (operator.tag == TAG_SCHEME_SYMBOL
+      && !is_lexical(untag_reader_symbol(operator))) {
+    char* name = untag_reader_symbol(operator);
+
+    fixnum_operator_t* fixnum_operator = find_fixnum_operator(name);
+    if (fixnum_operator != NULL && n_operands == 2) {
+      *output = appendf(*output, "aot_fixnum_operation(%s, &%s, ",
+                        fixnum_operator->operation, fixnum_operator->primitive);
+      if (!compile_arguments(output, operands)) {
+        return false;
+      }
+      *output = byte_array_append_string(*output, ")");
+      return true;
+    }
+
+    procedure_t* procedure = find_known_procedure(name);
+    if (procedure != NULL && procedure->n_parameters == n_operands) {
+      *output = appendf(*output, "%s_direct(", procedure->c_name);
+      if (!compile_arguments(output, operands)) {
+        return false;
+      }
+      *output = byte_array_append_string(*output, ")");
+      return true;
+    }
+
+    direct_primitive_t* direct_primitive = find_direct_primitive(name);
+    if (direct_primitive != NULL) {
+      *output = appendf(*output, "%s((primitive_arguments_t){%ld, {",
+                        direct_primitive->primitive, n_operands);
+      if (!compile_arguments(output, operands)) {
+        return false;
+      }
+      *output = byte_array_append_string(*output, "}})");
+      return true;
+    }
+  }
+
+  *output = byte_array_append_string(*output, "aot_call(");
+  if (!compile_expression(output, operator)) {
+    return false;
+  }
+  if (n_operands == 0) {
+    *output = byte_array_append_string(*output, ", 0, NULL)");
+    return true;
+  }
+  *output = appendf(*output, ", %ld, (tagged_reference_t[]){", n_operands);
+  if (!compile_arguments(output, operands)) {
+    return false;
+  }
+  *output = byte_array_append_string(*output, "})");
+  return true;
+}
+
+/**
+ * Append a C expression that evaluates expr or return false if expr
+ * can't be compiled.
+ */
+boolean_t compile_expression(byte_array_t** output, tagged_reference_t expr) {
+  switch (expr.tag) {
+  case TAG_NULL:
+  case TAG_UINT64_T:
+  case TAG_BOOLEAN_T:
+  case TAG_UNICODE_CODE_POINT:
+    return compile_datum(output, expr);
+
+  case TAG_SCHEME_SYMBOL:
+    if (1) {
+      char* name = untag_reader_symbol(expr);
+      local_t* local = find_local(name);
+      if (local != NULL) {
+        if (local->index < 0) {
+          // The loop itself is only compiled as a tail call.
+          return false;
+        }
+        *output = appendf(*output, "l%lu_%ld", local->loop, local->index);
+        return true;
+      }
+      int64_t index = parameter_index(name);
+      if (index >= 0) {
+        *output = appendf(*output, "a%ld", index);
+        return true;
+      }
+      procedure_t* procedure = find_known_procedure(name);
+      if (procedure != NULL) {
+        *output = appendf(*output, "tagged_reference(TAG_PRIMITIVE, &%s)",
+                          procedure->c_name);
+        return true;
+      }
+      direct_primitive_t* direct_primitive = find_direct_primitive(name);
+      if (direct_primitive != NULL) {
+        *output = appendf(*output, "tagged_reference(TAG_PRIMITIVE, &%s)",
+                          direct_primitive->primitive);
+        return true;
+      }
+      uint64_t cache = name_index(global_names, name);
+      if (cache == array_length(global_names)) {
+        global_names = array_add(global_names, (uint64_t) name);
+      }
+      *output = appendf(*output,
+                        "aot_global_ref(module_environment, "
+                        "&global_cache_%lu, ",
+                        cache);
+      *output = append_c_string_literal(*output, name);
+      *output = byte_array_append_string(*output, ")");
+      return true;
+    }
+
+  case TAG_PAIR_T:
+    break;
+
+  default:
+    return false;
+  }
+
+  tagged_reference_t first = car(expr);
+  if (is_symbol(first, "quote")) {
+    return compile_quote(output, expr);
+  }
+  if (is_symbol(first, "if")) {
+    int64_t length = list_length(expr);
+    if (length != 3 && length != 4) {
+      return false;
+    }
+    *output = byte_array_append_string(*output, "(!is_false(");
+    if (!compile_expression(output, car(cdr(expr)))) {
+      return false;
+    }
+    *output = byte_array_append_string(*output, ") ? ");
+    if (!compile_expression(output, car(cdr(cdr(expr))))) {
+      return false;
+    }
+    *output = byte_array_append_string(*output, " : ");
+    if (length == 3) {
+      *output = byte_array_append_string(*output, "NIL");
+    } else if (!compile_expression(output, car(cdr(cdr(cdr(expr)))))) {
+      return false;
+    }
+    *output = byte_array_append_string(*output, ")");
+    return true;
+  }
+  if (first.tag == TAG_SCHEME_SYMBOL
+      && names_contain(macro_names, untag_reader_symbol(first))) {
+    // Macro uses are expanded by the interpreter (see syntax-rules.c).
+    return false;
+  }
+  int n_uncompiled = sizeof(uncompiled_special_forms) / sizeof(char*);
+  for (int i = 0; i < n_uncompiled; i++) {
+    if (is_symbol(first, uncompiled_special_forms[i])) {
+      return false;
+    }
+  }
+  return compile_application(output, expr);
+}
+
+boolean_t compile_tail(byte_array_t** output, tagged_reference_t expr);
+
+/**
+ * Append C statements that assign the arguments of a tail call to the
+ * variables prefix0, prefix1, ... and jump to label.
+ */
+boolean_t compile_jump(byte_array_t** output, tagged_reference_t arguments,
+                       char* prefix, char* label) {
+  // Evaluate all of the arguments before assigning any variable.
+  *output = byte_array_append_string(*output, "  {\n");
+  uint64_t i = 0;
+  for (tagged_reference_t lst = arguments; lst.tag == TAG_PAIR_T;
+       lst = cdr(lst), i++) {
+    *output = appendf(*output, "    tagged_reference_t t%lu = ", i);
+    if (!compile_expression(output, car(lst))) {
+      return false;
+    }
+    *output = byte_array_append_string(*output, ";\n");
+  }
+  for (uint64_t j = 0; j < i; j++) {
+    *output = appendf(*output, "    %s%lu = t%lu;\n", prefix, j, j);
+  }
+  *output = appendf(*output, "    goto %s;\n  }\n", label);
+  return true;
+}
+
+/**
+ * Append C statements for a named let in tail position: its variables
+ * become C locals and calls to its name (which must all be tail calls)
+ * jump back to the start of its body.
+ */
+boolean_t compile_named_let(byte_array_t** output, tagged_reference_t expr) {
+  tagged_reference_t bindings = car(cdr(cdr(expr)));
+  tagged_reference_t body = cdr(cdr(cdr(expr)));
+  if (list_length(bindings) < 0 || list_length(body) < 1) {
+    return false;
+  }
+  uint64_t loop = n_loops++;
+
+  // The initial values are evaluated outside of the let.
+  *output = byte_array_append_string(*output, "  {\n");
+  int64_t index = 0;
+  for (tagged_reference_t lst = bindings; lst.tag == TAG_PAIR_T;
+       lst = cdr(lst), index++) {
+    tagged_reference_t binding = car(lst);
+    if (list_length(binding) != 2 || car(binding).tag != TAG_SCHEME_SYMBOL) {
+      return false;
+    }
+    *output = appendf(*output, "  tagged_reference_t l%lu_%ld = ", loop, index);
+    if (!compile_expression(output, car(cdr(binding)))) {
+      return false;
+    }
+    *output = byte_array_append_string(*output, ";\n");
+  }
+
+  local_t* outer = locals;
+  boolean_t loop_is_used = false;
+  local_t* local = malloc_struct(local_t);
+  local->name = untag_reader_symbol(car(cdr(expr)));
+  local->loop = loop;
+  local->index = -1;
+  local->n_variables = list_length(bindings);
+  local->loop_is_used = &loop_is_used;
+  local->next = locals;
+  locals = local;
+  index = 0;
+  for (tagged_reference_t lst = bindings; lst.tag == TAG_PAIR_T;
+       lst = cdr(lst), index++) {
+    local = malloc_struct(local_t);
+    local->name = untag_reader_symbol(car(car(lst)));
+    local->loop = loop;
+    local->index = index;
+    local->next = locals;
+    locals = local;
+  }
+
+  byte_array_t* statements = make_byte_array(1024);
+  boolean_t compiled = true;
+  for (tagged_reference_t lst = body; compiled && lst.tag == TAG_PAIR_T;
+       lst = cdr(lst)) {
+    if (cdr(lst).tag == TAG_PAIR_T) {
+      statements = byte_array_append_string(statements, "  (void) ");
+      compiled = compile_expression(&statements, car(lst));
+      statements = byte_array_append_string(statements, ";\n");
+    } else {
+      compiled = compile_tail(&statements, car(lst));
+    }
+  }
+  locals = outer;
+  if (!compiled) {
+    return false;
+  }
+
+  if (loop_is_used) {
+    *output = appendf(*output, "loop_%lu:\n", loop);
+  }
+  *output = byte_array_append_bytes(*output, &statements->elements[0],
+                                    byte_array_length(statements));
+  *output = byte_array_append_string(*output, "  }\n");
+  return true;
+}
+
+/**
+ * Append C statements that return the value of expr, turning self
+ * tail calls into jumps back to the start of the procedure.
+ */
+boolean_t compile_tail(byte_array_t** output, tagged_reference_t expr) {
+  if (expr.tag == TAG_PAIR_T && is_symbol(car(expr), "if")
+      && list_length(expr) == 4) {
+    *output = byte_array_append_string(*output, "  if (!is_false(");
+    if (!compile_expression(output, car(cdr(expr)))) {
+      return false;
+    }
+    *output = byte_array_append_string(*output, ")) {\n");
+    if (!compile_tail(output, car(cdr(cdr(expr))))) {
+      return false;
+    }
+    *output = byte_array_append_string(*output, "  } else {\n");
+    if (!compile_tail(output, car(cdr(cdr(cdr(expr)))))) {
+      return false;
+    }
+    *output = byte_array_append_string(*output, "  }\n");
+    return true;
+  }
+
+  if (expr.tag == TAG_PAIR_T && is_symbol(car(expr), "let")
+      && list_length(expr) >= 4 && car(cdr(expr)).tag == TAG_SCHEME_SYMBOL) {
+    return compile_named_let(output, expr);
+  }
+
+  if (expr.tag == TAG_PAIR_T && car(expr).tag == TAG_SCHEME_SYMBOL) {
+    local_t* local = find_local(untag_reader_symbol(car(expr)));
+    if (local != NULL && local->index < 0) {
+      if (list_length(cdr(expr)) != local->n_variables) {
+        return false;
+      }
+      *local->loop_is_used = true;
+      byte_array_t* prefix = appendf(make_byte_array(16), "l%lu_", local->loop);
+      byte_array_t* label
+          = appendf(make_byte_array(16), "loop_%lu", local->loop);
+      return compile_jump(
+          output, cdr(expr),
+          byte_array_c_substring(prefix, 0, byte_array_length(prefix)),
+          byte_array_c_substring(label, 0, byte_array_length(label)));
+    }
+  }
+
+  if (expr.tag == TAG_PAIR_T && is_symbol(car(expr), current_procedure->name)
+      && !is_lexical(current_procedure->name)
+      && list_length(cdr(expr)) == current_procedure->n_parameters) {
+    current_procedure_loops = true;
+    return compile_jump(output, cdr(expr), "a", "start");
+  }
+
+  *output = byte_array_append_string(*output, "  return ");
+  if (!compile_expression(output, expr)) {
+    return false;
+  }
+  *output = byte_array_append_string(*output, ";\n");
+  return true;
+}
+
+byte_array_t* append_parameter_list(byte_array_t* output,
+                                    procedure_t* procedure) {
+  if (procedure->n_parameters == 0) {
+    return byte_array_append_string(output, "void");
+  }
+  for (uint64_t i = 0; i < procedure->n_parameters; i++) {
+    output = appendf(output, "%stagged_reference_t a%lu", i > 0 ? ", " : "",
+                     i);
+  }
+  return output;
+}
+
+/**
+ * Append the C functions for procedure or return false if it can't be
+ * compiled.
+ */
+boolean_t compile_procedure(byte_array_t** output, procedure_t* procedure) {
+  current_procedure = procedure;
+  current_procedure_loops = false;
+  locals = NULL;
+  n_loops = 0;
+
+  byte_array_t* body = make_byte_array(1024);
+  for (tagged_reference_t lst = procedure->body; lst.tag == TAG_PAIR_T;
+       lst = cdr(lst)) {
+    if (cdr(lst).tag == TAG_PAIR_T) {
+      body = byte_array_append_string(body, "  (void) ");
+      if (!compile_expression(&body, car(lst))) {
+        return false;
+      }
+      body = byte_array_append_string(body, ";\n");
+    } else if (!compile_tail(&body, car(lst))) {
+      return false;
+    }
+  }
+
+  *output = appendf(*output, "static tagged_reference_t %s_direct(",
+                    procedure->c_name);
+  *output = append_parameter_list(*output, procedure);
+  *output = byte_array_append_string(*output, ") {\n");
+  if (current_procedure_loops) {
+    *output = byte_array_append_string(*output, "start:\n");
+  }
+  *output = byte_array_append_bytes(*output, &body->elements[0],
+                                    byte_array_length(body));
+  *output = byte_array_append_string(*output, "}\n\n");
+
+  *output = appendf(*output,
+                    "static tagged_reference_t %s("
+                    "primitive_arguments_t arguments) {\n"
+                    "  require_n_args(arguments, %lu, %lu);\n"
+                    "  return %s_direct(",
+                    procedure->c_name, procedure->n_parameters,
+                    procedure->n_parameters, procedure->c_name);
+  for (uint64_t i = 0; i < procedure->n_parameters; i++) {
+    *output = appendf(*output, "%sarguments.args[%lu]", i > 0 ? ", " : "", i);
+  }
+  *output = byte_array_append_string(*output, ");\n}\n\n");
+  return true;
+}
+
+// ======================================================================
+// Reading and generating the module
+// ======================================================================
+
+/**
+ * If form looks like (define name (lambda (args...) body...)) return
+ * a procedure_t for it.
+ */
+procedure_t* procedure_definition(tagged_reference_t form) {
+  if (list_length(form) != 3 || !is_symbol(car(form), "define")
+      || car(cdr(form)).tag != TAG_SCHEME_SYMBOL) {
+    return NULL;
+  }
+  tagged_reference_t lambda = car(cdr(cdr(form)));
+  if (list_length(lambda) < 3 || !is_symbol(car(lambda), "lambda")) {
+    return NULL;
+  }
+  tagged_reference_t parameters = car(cdr(lambda));
+  int64_t n_parameters = list_length(parameters);
+  if (n_parameters < 0 || n_parameters >= 16) {
+    return NULL;
+  }
+  for (tagged_reference_t lst = parameters; lst.tag == TAG_PAIR_T;
+       lst = cdr(lst)) {
+    if (car(lst).tag != TAG_SCHEME_SYMBOL) {
+      return NULL;
+    }
+  }
+
+  procedure_t* result = malloc_struct(procedure_t);
+  result->name = untag_reader_symbol(car(cdr(form)));
+  byte_array_t* c_name = appendf(make_byte_array(64), "scm_%s_%s",
+                                 mangle(module_name), mangle(result->name));
+  result->c_name = byte_array_c_substring(c_name, 0, byte_array_length(c_name));
+  result->parameters = parameters;
+  result->body = cdr(cdr(lambda));
+  result->n_parameters = n_parameters;
+  return result;
+}
+
+void read_forms(char* file_name) {
+  byte_array_t* contents
+      = byte_array_append_file_contents(make_byte_array(4096), file_name);
+  char* source = byte_array_c_substring(contents, 0, byte_array_length(contents));
+
+  forms = make_array(64);
+  defined_names = make_array(64);
+  assigned_names = make_array(8);
+  macro_names = make_array(8);
+
+  uint64_t position = 0;
+  while (1) {
+    position = skip_whitespace_and_comments(source, position);
+    if (source[position] == '\0') {
+      break;
+    }
+    read_expression_result_t read_result = read_expression(source, position);
+    if (read_result.result.tag == TAG_ERROR_T) {
+      fprintf(stderr, "%s: can't read form at offset %lu\n", file_name,
+              position);
+      exit(1);
+    }
+    top_level_form_t* form = malloc_struct(top_level_form_t);
+    form->form = read_result.result;
+    form->source = string_substring(source, position, read_result.end);
+    form->procedure = procedure_definition(form->form);
+    forms = array_add(forms, (uint64_t) form);
+
+    if (list_length(form->form) >= 2 && is_symbol(car(form->form), "define")
+        && car(cdr(form->form)).tag == TAG_SCHEME_SYMBOL) {
+      char* name = untag_reader_symbol(car(cdr(form->form)));
+      if (names_contain(defined_names, name) && form->procedure != NULL) {
+        // Defined more than once so not a known procedure.
+        form->procedure = NULL;
+      }
+      defined_names = array_add(defined_names, (uint64_t) name);
+    }
+    if (list_length(form->form) >= 2
+        && is_symbol(car(form->form), "define-syntax")
+        && car(cdr(form->form)).tag == TAG_SCHEME_SYMBOL) {
+      char* name = untag_reader_symbol(car(cdr(form->form)));
+      macro_names = array_add(macro_names, (uint64_t) name);
+    }
+    collect_assigned_names(form->form);
+    position = read_result.end;
+  }
+
+  for (uint64_t i = 0; i < array_length(forms); i++) {
+    top_level_form_t* form = (top_level_form_t*) array_get(forms, i);
+    if (form->procedure != NULL) {
+      form->procedure->is_known
+          = !names_contain(assigned_names, form->procedure->name);
+      if (!form->procedure->is_known) {
+        form->procedure = NULL;
+      }
+    }
+  }
+}
+
+/**
+ * Generate the module. If a procedure can't be compiled, it is marked
+ * as not known (which can change how other procedures are compiled)
+ * and NULL is returned so that the caller can try again.
+ */
+byte_array_t* generate_module(char* file_name) {
+  global_names = make_array(16);
+  constants = make_byte_array(1024);
+  n_constants = 0;
+
+  byte_array_t* functions = make_byte_array(16 * 1024);
+  for (uint64_t i = 0; i < array_length(forms); i++) {
+    top_level_form_t* form = (top_level_form_t*) array_get(forms, i);
+    if (form->procedure != NULL
+        && !compile_procedure(&functions, form->procedure)) {
+      fprintf(stderr, "%s: %s will be interpreted\n", file_name,
+              form->procedure->name);
+      form->procedure->is_known = false;
+      form->procedure = NULL;
+      return NULL;
+    }
+  }
+
+  byte_array_t* output = make_byte_array(32 * 1024);
+  output = appendf(output,
+                   "// Generated by scheme-to-c from %s. Do not edit.\n\n"
+                   "#include \"aot-runtime.h\"\n\n"
+                   "static environment_t* module_environment;\n",
+                   file_name);
+  for (uint64_t i = 0; i < array_length(global_names); i++) {
+    output = appendf(output, "static pair_t* global_cache_%lu;\n", i);
+  }
+  for (uint64_t i = 0; i < n_constants; i++) {
+    output = appendf(output, "static tagged_reference_t constant_%lu;\n", i);
+  }
+  output = byte_array_append_string(output, "\n");
+
+  for (uint64_t i = 0; i < array_length(forms); i++) {
+    procedure_t* procedure
+        = ((top_level_form_t*) array_get(forms, i))->procedure;
+    if (procedure != NULL) {
+      output = appendf(output, "static tagged_reference_t %s_direct(",
+                       procedure->c_name);
+      output = append_parameter_list(output, procedure);
+      output = appendf(output,
+                       ");\nstatic tagged_reference_t %s("
+                       "primitive_arguments_t arguments);\n",
+                       procedure->c_name);
+    }
+  }
+  output = byte_array_append_string(output, "\n");
+  output = byte_array_append_bytes(output, &functions->elements[0],
+                                   byte_array_length(functions));
+
+  output = appendf(output,
+                   "void load_%s(environment_t* env) {\n"
+                   "  module_environment = env;\n",
+                   mangle(module_name));
+  output = byte_array_append_bytes(output, &constants->elements[0],
+                                   byte_array_length(constants));
+  for (uint64_t i = 0; i < array_length(forms); i++) {
+    top_level_form_t* form = (top_level_form_t*) array_get(forms, i);
+    if (form->procedure != NULL) {
+      output = byte_array_append_string(output, "  environment_define(env, ");
+      output = append_c_string_literal(output, form->procedure->name);
+      output = appendf(output, ", tagged_reference(TAG_PRIMITIVE, &%s));\n",
+                       form->procedure->c_name);
+    } else {
+      output = byte_array_append_string(output, "  aot_eval_source(env, ");
+      output = append_c_string_literal(output, form->source);
+      output = byte_array_append_string(output, ");\n");
+    }
+  }
+  return byte_array_append_string(output, "}\n");
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <file.scm> <module-name>\n", argv[0]);
+    exit(1);
+  }
+  module_name = argv[2];
+  read_forms(argv[1]);
+
+  byte_array_t* output = NULL;
+  while (output == NULL) {
+    output = generate_module(argv[1]);
+  }
+  fwrite(&output->elements[0], 1, byte_array_length(output), stdout);
+  exit(0);
+}
@@ -0,0 +1,46 @@
+;; The prelude is a small library of standard procedures written in
+;; scheme itself. It is compiled to C by scheme-to-c (see
+;; scheme-to-c-main.c) and loaded into every global environment.
+
+(define not (lambda (x) (if x #f #t)))
+
+;; Integers
+
+(define zero? (lambda (n) (= n 0)))
+(define positive? (lambda (n) (> n 0)))
+(define negative? (lambda (n) (< n 0)))
+(define abs (lambda (n) (if (< n 0) (- 0 n) n)))
+(define square (lambda (n) (* n n)))
+(define remainder (lambda (a b) (- a (* b (/ a b)))))
+(define even? (lambda (n) (= (remainder n 2) 0)))
+(define odd? (lambda (n) (not (even? n))))
+(define gcd (lambda (a b) (if (= b 0) (abs a) (gcd b (remainder a b)))))
+(define lcm
+  (lambda (a b)
+    (if (= a 0) 0 (abs (* (/ a (gcd a b)) b)))))
+
+;; Lists
+
+(define iota
+  (lambda (n)
+    (let loop ((n n) (result (quote ())))
+      (if (= n 0) result (loop (- n 1) (cons (- n 1) result))))))
+
+(define last-pair
+  (lambda (lst) (if (pair? (cdr lst)) (last-pair (cdr lst)) lst)))
+
+(define fold-left
+  (lambda (f acc lst)
+    (if (null? lst) acc (fold-left f (f acc (car lst)) (cdr lst)))))
+
+(define fold-right
+  (lambda (f acc lst)
+    (if (null? lst) acc (f (car lst) (fold-right f acc (cdr lst))))))
+
+(define filter
+  (lambda (keep? lst)
+    (let loop ((lst lst) (result (quote ())))
+      (if (null? lst)
+          (reverse result)
+          (loop (cdr lst)
+                (if (keep? (car lst)) (cons (car lst) result) result))))))
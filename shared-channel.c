@@ -0,0 +1,372 @@
+/**
+ * @file shared-channel.c
+ *
+ * Shared channels: bounded channels that interpreter threads (see
+ * interpreter-thread.c) use to pass values to each other, like a
+ * producer thread reading a file and several consumer threads
+ * analyzing what it read. make-shared-channel makes one and the usual
+ * channel-send and channel-receive (see green-thread.c) work with it.
+ *
+ * A shared channel is a ring buffer that any number of threads send
+ * to and receive from without locks (Dmitry Vyukov's bounded
+ * multi-producer multi-consumer queue). Every cell has a sequence
+ * number which says whether it is free for the sender whose position
+ * it is or full for the receiver whose position it is. A thread claims
+ * a position by bumping send_position (or receive_position) with a
+ * compare and swap and then owns the cell until it publishes it by
+ * bumping the cell's sequence number. The two positions are kept on
+ * different cache lines so senders and receivers don't slow each
+ * other down.
+ *
+ * channel-send-list and channel-receive-list move several values with
+ * a single compare and swap which amortizes the cost of synchronizing
+ * (and of the cache misses on the positions) over the batch.
+ *
+ * Values are passed by reference: a string, pair or hash table sent
+ * over a channel isn't copied, so it shouldn't be changed once sent.
+ *
+ * A thread waiting for room or for a value blocks its whole OS thread
+ * (including any green threads on it): it spins for a little while,
+ * then yields the processor, then sleeps for gradually longer periods.
+ */
+
+// ======================================================================
+// This is block is extraced to shared-channel.h
+// ======================================================================
+
+#ifndef _SHARED_CHANNEL_H_
+#define _SHARED_CHANNEL_H_
+
+#include <stdint.h>
+
+#include "boolean.h"
+#include "primitive.h"
+#include "tagged-reference.h"
+
+typedef struct {
+  // Only accessed atomically.
+  uint64_t sequence;
+  tagged_reference_t value;
+} shared_channel_cell_t;
+
+typedef struct {
+  // The number of cells (a power of two) minus one.
+  uint64_t mask;
+  shared_channel_cell_t* cells;
+  uint8_t padding0[48];
+  // The next position to send to (only accessed atomically).
+  uint64_t send_position;
+  uint8_t padding1[56];
+  // The next position to receive from (only accessed atomically).
+  uint64_t receive_position;
+  uint8_t padding2[56];
+} shared_channel_t;
+
+extern shared_channel_t* make_shared_channel(uint64_t capacity);
+extern uint64_t shared_channel_try_send(shared_channel_t* channel,
+                                        tagged_reference_t* values,
+                                        uint64_t n_values);
+extern uint64_t shared_channel_try_receive(shared_channel_t* channel,
+                                           tagged_reference_t* values,
+                                           uint64_t n_values);
+extern void shared_channel_send(shared_channel_t* channel,
+                                tagged_reference_t value);
+extern tagged_reference_t shared_channel_receive(shared_channel_t* channel);
+
+extern tagged_reference_t
+    primtive_function_make_shared_channel(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_channel_send_list(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_channel_receive_list(primitive_arguments_t args);
+
+static inline shared_channel_t*
+    untag_shared_channel(tagged_reference_t reference) {
+  require_tag(reference, TAG_SHARED_CHANNEL_T);
+  return (shared_channel_t*) reference.data;
+}
+
+#endif /* _SHARED_CHANNEL_H_ */
+
+// ======================================================================
+
+#include <sched.h>
+#include <time.h>
+
+#include "allocate.h"
+#include "fatal-error.h"
+#include "pair.h"
+#include "shared-channel.h"
+
+// How many times a waiting thread tries again right away, and then
+// after yielding the processor, before it starts sleeping.
+#define SHARED_CHANNEL_SPINS 64
+#define SHARED_CHANNEL_YIELDS 64
+// The longest a waiting thread sleeps before trying again.
+#define SHARED_CHANNEL_MAX_SLEEP_NANOSECONDS 1000000
+// The most values channel-send-list and channel-receive-list move with
+// one compare and swap.
+#define SHARED_CHANNEL_MAX_BATCH 64
+
+/**
+ * Make a channel that holds at least capacity values (rounded up to a
+ * power of two).
+ */
+shared_channel_t* make_shared_channel(uint64_t capacity) {
+  uint64_t size = 2;
+  while (size < capacity) {
+    size *= 2;
+  }
+  shared_channel_t* result = malloc_struct(shared_channel_t);
+  result->mask = size - 1;
+  result->cells = (shared_channel_cell_t*) malloc_bytes(
+      size * sizeof(shared_channel_cell_t));
+  for (uint64_t i = 0; i < size; i++) {
+    result->cells[i].sequence = i;
+  }
+  return result;
+}
+
+/**
+ * Send as many of values as there is room for right now (at most
+ * n_values, and all of them with one compare and swap) and return how
+ * many were sent.
+ */
+uint64_t shared_channel_try_send(shared_channel_t* channel,
+                                 tagged_reference_t* values,
+                                 uint64_t n_values) {
+  uint64_t position
+      = __atomic_load_n(&channel->send_position, __ATOMIC_RELAXED);
+  while (true) {
+    // Count the free cells starting at position. A cell is free when
+    // its sequence number is the position that will be sent to it.
+    uint64_t n = 0;
+    while (n < n_values) {
+      shared_channel_cell_t* cell
+          = &channel->cells[(position + n) & channel->mask];
+      uint64_t sequence
+          = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+      if (sequence != position + n) {
+        break;
+      }
+      n++;
+    }
+    if (n == 0) {
+      uint64_t sequence = __atomic_load_n(
+          &channel->cells[position & channel->mask].sequence,
+          __ATOMIC_ACQUIRE);
+      if ((int64_t) (sequence - position) < 0) {
+        // The cell still holds a value from the previous lap so the
+        // channel is full.
+        return 0;
+      }
+      // Another sender got here first.
+      position = __atomic_load_n(&channel->send_position, __ATOMIC_RELAXED);
+      continue;
+    }
+    if (__atomic_compare_exchange_n(&channel->send_position, &position,
+                                    position + n, true, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+      // The cells are ours until their sequence numbers are bumped.
+      for (uint64_t i = 0; i < n; i++) {
+        shared_channel_cell_t* cell
+            = &channel->cells[(position + i) & channel->mask];
+        cell->value = values[i];
+        __atomic_store_n(&cell->sequence, position + i + 1,
+                         __ATOMIC_RELEASE);
+      }
+      return n;
+    }
+    // The failed compare and swap reloaded position.
+  }
+}
+
+/**
+ * Receive as many values as are available right now (at most
+ * n_values, and all of them with one compare and swap) into values
+ * and return how many were received.
+ */
+uint64_t shared_channel_try_receive(shared_channel_t* channel,
+                                    tagged_reference_t* values,
+                                    uint64_t n_values) {
+  uint64_t position
+      = __atomic_load_n(&channel->receive_position, __ATOMIC_RELAXED);
+  while (true) {
+    // A cell is full when its sequence number is one more than the
+    // position it will be received from.
+    uint64_t n = 0;
+    while (n < n_values) {
+      shared_channel_cell_t* cell
+          = &channel->cells[(position + n) & channel->mask];
+      uint64_t sequence
+          = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+      if (sequence != position + n + 1) {
+        break;
+      }
+      n++;
+    }
+    if (n == 0) {
+      uint64_t sequence = __atomic_load_n(
+          &channel->cells[position & channel->mask].sequence,
+          __ATOMIC_ACQUIRE);
+      if ((int64_t) (sequence - (position + 1)) < 0) {
+        // Nothing has been sent to this position yet so the channel is
+        // empty.
+        return 0;
+      }
+      // Another receiver got here first.
+      position
+          = __atomic_load_n(&channel->receive_position, __ATOMIC_RELAXED);
+      continue;
+    }
+    if (__atomic_compare_exchange_n(&channel->receive_position, &position,
+                                    position + n, true, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+      for (uint64_t i = 0; i < n; i++) {
+        shared_channel_cell_t* cell
+            = &channel->cells[(position + i) & channel->mask];
+        values[i] = cell->value;
+        cell->value = NIL;
+        // Free the cell for the sender one lap ahead.
+        __atomic_store_n(&cell->sequence, position + i + channel->mask + 1,
+                         __ATOMIC_RELEASE);
+      }
+      return n;
+    }
+  }
+}
+
+/**
+ * Called each time a thread finds it has to wait with the number of
+ * times it has already waited.
+ */
+static void shared_channel_back_off(uint64_t attempt) {
+  if (attempt < SHARED_CHANNEL_SPINS) {
+    return;
+  }
+  if (attempt < SHARED_CHANNEL_SPINS + SHARED_CHANNEL_YIELDS) {
+    sched_yield();
+    return;
+  }
+  uint64_t shift = attempt - SHARED_CHANNEL_SPINS - SHARED_CHANNEL_YIELDS;
+  uint64_t nanoseconds = shift < 20 ? 1000ULL << shift
+                                    : SHARED_CHANNEL_MAX_SLEEP_NANOSECONDS;
+  if (nanoseconds > SHARED_CHANNEL_MAX_SLEEP_NANOSECONDS) {
+    nanoseconds = SHARED_CHANNEL_MAX_SLEEP_NANOSECONDS;
+  }
+  struct timespec duration = {.tv_sec = 0, .tv_nsec = nanoseconds};
+  nanosleep(&duration, NULL);
+}
+
+/**
+ * Send a value, waiting for room when the channel is full.
+ */
+void shared_channel_send(shared_channel_t* channel, tagged_reference_t value) {
+  for (uint64_t attempt = 0;
+       shared_channel_try_send(channel, &value, 1) == 0; attempt++) {
+    shared_channel_back_off(attempt);
+  }
+}
+
+/**
+ * Receive a value, waiting until one is sent when the channel is
+ * empty.
+ */
+tagged_reference_t shared_channel_receive(shared_channel_t* channel) {
+  tagged_reference_t result;
+  for (uint64_t attempt = 0;
+       shared_channel_try_receive(channel, &result, 1) == 0; attempt++) {
+    shared_channel_back_off(attempt);
+  }
+  return result;
+}
+
+/**
+ * Example (make-shared-channel 1024)
+ *
+ * Make a channel interpreter threads can share which holds at least
+ * capacity values before channel-send waits.
+ */
+tagged_reference_t
+    primtive_function_make_shared_channel(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  uint64_t capacity = untag_uint64_t(arguments.args[0]);
+  return tagged_reference(TAG_SHARED_CHANNEL_T, make_shared_channel(capacity));
+}
+
+/**
+ * Example (channel-send-list channel (list 1 2 3))
+ *
+ * Send every element of a list in order (waiting for room whenever
+ * the channel is full). The elements are sent in batches so this is
+ * much cheaper than sending them one at a time, although other
+ * senders' values may end up between two batches.
+ */
+tagged_reference_t
+    primtive_function_channel_send_list(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  shared_channel_t* channel = untag_shared_channel(arguments.args[0]);
+  tagged_reference_t lst = arguments.args[1];
+  tagged_reference_t batch[SHARED_CHANNEL_MAX_BATCH];
+  while (lst.tag == TAG_PAIR_T) {
+    uint64_t n = 0;
+    for (; n < SHARED_CHANNEL_MAX_BATCH && lst.tag == TAG_PAIR_T; n++) {
+      batch[n] = untag_pair(lst)->head;
+      lst = untag_pair(lst)->tail;
+    }
+    uint64_t sent = 0;
+    for (uint64_t attempt = 0; sent < n; attempt++) {
+      uint64_t count
+          = shared_channel_try_send(channel, &batch[sent], n - sent);
+      if (count == 0) {
+        shared_channel_back_off(attempt);
+      } else {
+        sent += count;
+        attempt = 0;
+      }
+    }
+  }
+  return NIL;
+}
+
+/**
+ * Example (channel-receive-list channel 100)
+ *
+ * Wait until a value is available and then return a list of the
+ * values that are available (but no more than max of them) in the
+ * order they were sent.
+ */
+tagged_reference_t
+    primtive_function_channel_receive_list(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  shared_channel_t* channel = untag_shared_channel(arguments.args[0]);
+  uint64_t max = untag_uint64_t(arguments.args[1]);
+  tagged_reference_t batch[SHARED_CHANNEL_MAX_BATCH];
+  tagged_reference_t result = NIL;
+  pair_t* last = NULL;
+  uint64_t received = 0;
+  for (uint64_t attempt = 0; received < max; attempt++) {
+    uint64_t wanted = max - received;
+    uint64_t n = shared_channel_try_receive(
+        channel, batch,
+        wanted < SHARED_CHANNEL_MAX_BATCH ? wanted : SHARED_CHANNEL_MAX_BATCH);
+    if (n == 0) {
+      if (received > 0) {
+        break;
+      }
+      shared_channel_back_off(attempt);
+      continue;
+    }
+    for (uint64_t i = 0; i < n; i++) {
+      tagged_reference_t cell = cons(batch[i], NIL);
+      if (last == NULL) {
+        result = cell;
+      } else {
+        last->tail = cell;
+      }
+      last = untag_pair(cell);
+    }
+    received += n;
+  }
+  return result;
+}
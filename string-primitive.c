@@ -0,0 +1,407 @@
+/**
+ * @file string-primitive.c
+ *
+ * Native implementations of the basic R7RS string procedures. Scheme
+ * strings are immutable and know their length (see
+ * immutable_string_t) so string-length is O(1) and substring and
+ * string-append copy each byte exactly once without ever scanning for
+ * a NUL.
+ *
+ * Strings are UTF-8 and lengths and indexes count code points. In
+ * ASCII strings an index is a byte offset and other strings find the
+ * byte offset from a checkpoint (see immutable_string_byte_offset) so
+ * string-ref and substring are never O(n).
+ *
+ * Searching and case-insensitive comparison are done by the SIMD
+ * kernels in string-util.c (string_search, string_find_byte and
+ * string_compare_ignore_case).
+ */
+
+// ======================================================================
+// This is block is extraced to string-primitive.h
+// ======================================================================
+
+#ifndef _STRING_PRIMITIVE_H_
+#define _STRING_PRIMITIVE_H_
+
+#include "primitive.h"
+#include "tagged-reference.h"
+
+extern tagged_reference_t
+    primtive_function_string_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_length(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_ref(primitive_arguments_t args);
+extern tagged_reference_t primtive_function_string(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_to_list(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_list_to_string(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_substring(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_append(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_to_symbol(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_search_forward(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_contains(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_prefix_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_suffix_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_index(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_ci_equal_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_ci_less_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_ci_less_or_equal_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_ci_greater_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_string_ci_greater_or_equal_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_symbol_p(primitive_arguments_t args);
+extern tagged_reference_t
+    primtive_function_symbol_to_string(primitive_arguments_t args);
+
+#endif /* _STRING_PRIMITIVE_H_ */
+
+// ======================================================================
+
+#include <string.h>
+
+#include "boolean.h"
+#include "fatal-error.h"
+#include "pair.h"
+#include "string-primitive.h"
+#include "string-util.h"
+
+tagged_reference_t primtive_function_string_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return tag_boolean(arguments.args[0].tag == TAG_STRING);
+}
+
+/**
+ * Example (string-length "abc") => 3
+ */
+tagged_reference_t
+    primtive_function_string_length(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return tagged_reference(
+      TAG_UINT64_T,
+      immutable_string_n_code_points(untag_string(arguments.args[0])));
+}
+
+/**
+ * Example (string-ref "λx" 1) => #\x
+ */
+tagged_reference_t
+    primtive_function_string_ref(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  char* str = untag_string(arguments.args[0]);
+  uint64_t index = untag_uint64_t(arguments.args[1]);
+  if (index >= immutable_string_n_code_points(str)) {
+    fatal_error(ERROR_ARRAY_ACCESS_OUT_OF_BOUNDS);
+  }
+  uint32_t code_point;
+  utf8_decode(str, immutable_string_byte_offset(str, index), &code_point);
+  return tagged_reference(TAG_UNICODE_CODE_POINT, code_point);
+}
+
+/**
+ * Return the UTF-8 encoding of a character (or fail if it isn't one
+ * or can't be encoded) and store its length in n_bytes.
+ */
+static inline void encode_character(tagged_reference_t character,
+                                    char* encoding, uint64_t* n_bytes) {
+  require_tag(character, TAG_UNICODE_CODE_POINT);
+  *n_bytes = utf8_encode(character.data, encoding);
+  if (*n_bytes == 0) {
+    fatal_error(ERROR_INVALID_UTF8);
+  }
+}
+
+/**
+ * Make a string of the characters in a list (the characters are
+ * encoded twice, once to find the length of the string).
+ */
+static tagged_reference_t list_to_string(tagged_reference_t lst) {
+  char encoding[UTF8_MAX_BYTES];
+  uint64_t n_bytes;
+  uint64_t length = 0;
+  for (tagged_reference_t tail = lst; !is_nil(tail); tail = cdr(tail)) {
+    encode_character(car(tail), encoding, &n_bytes);
+    length += n_bytes;
+  }
+  immutable_string_t* result = allocate_immutable_string(length);
+  uint64_t n = 0;
+  for (tagged_reference_t tail = lst; !is_nil(tail); tail = cdr(tail)) {
+    encode_character(car(tail), &result->bytes[n], &n_bytes);
+    n += n_bytes;
+  }
+  return tagged_reference(TAG_STRING, finish_immutable_string(result));
+}
+
+/**
+ * Example (string #\a #\λ) => "aλ"
+ */
+tagged_reference_t primtive_function_string(primitive_arguments_t arguments) {
+  tagged_reference_t characters = NIL;
+  for (uint64_t i = arguments.n_args; i > 0; i--) {
+    characters = cons(arguments.args[i - 1], characters);
+  }
+  return list_to_string(characters);
+}
+
+/**
+ * Example (list->string (list #\a #\b)) => "ab"
+ */
+tagged_reference_t
+    primtive_function_list_to_string(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return list_to_string(arguments.args[0]);
+}
+
+/**
+ * Example (string->list "aλ") => (#\a #\λ)
+ */
+tagged_reference_t
+    primtive_function_string_to_list(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  char* str = untag_string(arguments.args[0]);
+  // Decode from the end so the list can be built without reversing it.
+  tagged_reference_t result = NIL;
+  uint64_t offset = immutable_string_length(str);
+  while (offset > 0) {
+    do {
+      offset--;
+    } while ((str[offset] & 0xc0) == 0x80);
+    uint32_t code_point;
+    utf8_decode(str, offset, &code_point);
+    result = cons(tagged_reference(TAG_UNICODE_CODE_POINT, code_point), result);
+  }
+  return result;
+}
+
+/**
+ * Example (substring "hello" 1 3) => "el" or (substring "hello" 1) =>
+ * "ello"
+ */
+tagged_reference_t
+    primtive_function_substring(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 3);
+  char* str = untag_string(arguments.args[0]);
+  uint64_t length = immutable_string_n_code_points(str);
+  uint64_t start = untag_uint64_t(arguments.args[1]);
+  uint64_t end = length;
+  if (arguments.n_args == 3) {
+    end = untag_uint64_t(arguments.args[2]);
+  }
+  if (start > end || end > length) {
+    fatal_error(ERROR_ARRAY_ACCESS_OUT_OF_BOUNDS);
+  }
+  uint64_t start_offset = immutable_string_byte_offset(str, start);
+  uint64_t end_offset = immutable_string_byte_offset(str, end);
+  return tagged_reference(
+      TAG_STRING,
+      make_immutable_string(&str[start_offset], end_offset - start_offset));
+}
+
+/**
+ * Example (string-append "ab" "c" "de") => "abcde"
+ *
+ * The length of the result is known up front so it is allocated once.
+ */
+tagged_reference_t
+    primtive_function_string_append(primitive_arguments_t arguments) {
+  uint64_t length = 0;
+  for (uint64_t i = 0; i < arguments.n_args; i++) {
+    length += immutable_string_length(untag_string(arguments.args[i]));
+  }
+  immutable_string_t* result = allocate_immutable_string(length);
+  uint64_t n = 0;
+  for (uint64_t i = 0; i < arguments.n_args; i++) {
+    char* str = (char*) arguments.args[i].data;
+    uint64_t str_length = immutable_string_length(str);
+    memcpy(&result->bytes[n], str, str_length);
+    n += str_length;
+  }
+  return tagged_reference(TAG_STRING, finish_immutable_string(result));
+}
+
+/**
+ * Example (string->symbol "abc") => abc
+ *
+ * The name is interned so the symbol is eq? to the one the reader
+ * makes for abc.
+ */
+tagged_reference_t
+    primtive_function_string_to_symbol(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  char* str = untag_string(arguments.args[0]);
+  return tagged_reference(
+      TAG_SCHEME_SYMBOL,
+      intern_symbol_name(str, immutable_string_length(str)));
+}
+
+tagged_reference_t primtive_function_symbol_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  return tag_boolean(arguments.args[0].tag == TAG_SCHEME_SYMBOL);
+}
+
+/**
+ * Example (symbol->string 'abc) => "abc"
+ *
+ * Symbols made from C strings don't know their length so this is the
+ * one place a name is scanned.
+ */
+tagged_reference_t
+    primtive_function_symbol_to_string(primitive_arguments_t arguments) {
+  require_n_args(arguments, 1, 1);
+  char* name = untag_reader_symbol(arguments.args[0]);
+  return tagged_reference(TAG_STRING,
+                          make_immutable_string(name, strlen(name)));
+}
+
+/**
+ * Return the index of the code point at byte offset in str (or #f
+ * when offset is negative, i.e., nothing was found).
+ */
+static inline tagged_reference_t index_or_false(char* str, int64_t offset) {
+  if (offset < 0) {
+    return tag_boolean(false);
+  }
+  return tagged_reference(TAG_UINT64_T,
+                          immutable_string_code_point_index(str, offset));
+}
+
+/**
+ * Example (string-search-forward "lo" "hello hello" 4) => 9
+ *
+ * Return the index of the first occurrence of pattern in string at or
+ * after start (or #f).
+ */
+tagged_reference_t
+    primtive_function_string_search_forward(primitive_arguments_t arguments) {
+  require_n_args(arguments, 3, 3);
+  char* pattern = untag_string(arguments.args[0]);
+  char* str = untag_string(arguments.args[1]);
+  uint64_t start = untag_uint64_t(arguments.args[2]);
+  if (start > immutable_string_n_code_points(str)) {
+    fatal_error(ERROR_ARRAY_ACCESS_OUT_OF_BOUNDS);
+  }
+  uint64_t offset = immutable_string_byte_offset(str, start);
+  int64_t index
+      = string_search(&str[offset], immutable_string_length(str) - offset,
+                      pattern, immutable_string_length(pattern));
+  return index_or_false(str, index < 0 ? index : index + offset);
+}
+
+/**
+ * Example (string-contains "hello" "ll") => 2
+ */
+tagged_reference_t
+    primtive_function_string_contains(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  char* str = untag_string(arguments.args[0]);
+  char* pattern = untag_string(arguments.args[1]);
+  return index_or_false(str, string_search(str, immutable_string_length(str),
+                                           pattern,
+                                           immutable_string_length(pattern)));
+}
+
+/**
+ * Example (string-prefix? "he" "hello") => #t
+ */
+tagged_reference_t
+    primtive_function_string_prefix_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  char* prefix = untag_string(arguments.args[0]);
+  char* str = untag_string(arguments.args[1]);
+  uint64_t length = immutable_string_length(prefix);
+  return tag_boolean(length <= immutable_string_length(str)
+                     && memcmp(prefix, str, length) == 0);
+}
+
+/**
+ * Example (string-suffix? "lo" "hello") => #t
+ */
+tagged_reference_t
+    primtive_function_string_suffix_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  char* suffix = untag_string(arguments.args[0]);
+  char* str = untag_string(arguments.args[1]);
+  uint64_t length = immutable_string_length(suffix);
+  uint64_t str_length = immutable_string_length(str);
+  return tag_boolean(length <= str_length
+                     && memcmp(suffix, &str[str_length - length], length)
+                            == 0);
+}
+
+/**
+ * Example (string-index "hello" #\l) => 2
+ *
+ * Return the index of the first occurrence of a character in string
+ * (or #f). Other characters than ASCII are searched for as their
+ * UTF-8 encoding.
+ */
+tagged_reference_t
+    primtive_function_string_index(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  char* str = untag_string(arguments.args[0]);
+  char encoding[UTF8_MAX_BYTES];
+  uint64_t n_bytes;
+  encode_character(arguments.args[1], encoding, &n_bytes);
+  return index_or_false(
+      str, string_search(str, immutable_string_length(str), encoding, n_bytes));
+}
+
+static inline int compare_ignore_case(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  char* str1 = untag_string(arguments.args[0]);
+  char* str2 = untag_string(arguments.args[1]);
+  return string_compare_ignore_case(str1, immutable_string_length(str1),
+                                    str2, immutable_string_length(str2));
+}
+
+/**
+ * Example (string-ci=? "Hello" "hELLO") => #t
+ *
+ * Only ASCII letters are case folded (which can't change a string's
+ * length so strings of different lengths are never compared).
+ */
+tagged_reference_t
+    primtive_function_string_ci_equal_p(primitive_arguments_t arguments) {
+  require_n_args(arguments, 2, 2);
+  char* str1 = untag_string(arguments.args[0]);
+  char* str2 = untag_string(arguments.args[1]);
+  uint64_t length = immutable_string_length(str1);
+  return tag_boolean(length == immutable_string_length(str2)
+                     && string_compare_ignore_case(str1, length, str2, length)
+                            == 0);
+}
+
+tagged_reference_t
+    primtive_function_string_ci_less_p(primitive_arguments_t arguments) {
+  return tag_boolean(compare_ignore_case(arguments) < 0);
+}
+
+tagged_reference_t primtive_function_string_ci_less_or_equal_p(
+    primitive_arguments_t arguments) {
+  return tag_boolean(compare_ignore_case(arguments) <= 0);
+}
+
+tagged_reference_t
+    primtive_function_string_ci_greater_p(primitive_arguments_t arguments) {
+  return tag_boolean(compare_ignore_case(arguments) > 0);
+}
+
+tagged_reference_t primtive_function_string_ci_greater_or_equal_p(
+    primitive_arguments_t arguments) {
+  return tag_boolean(compare_ignore_case(arguments) >= 0);
+}
@@ -12,6 +12,7 @@
 #ifndef _STRING_UTIL_H_
 #define _STRING_UTIL_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "fatal-error.h"
@@ -27,6 +28,79 @@ extern uint64_t string_hash(const char* str);
 extern char* string_substring(const char* str, int start, int end);
 extern uint64_t string_parse_uint64(const char* string);
 extern char* string_duplicate(const char* src);
+extern uint64_t fasthash64(const void* buf, size_t len, uint64_t seed);
+extern int64_t string_find_byte(const char* bytes, uint64_t length, char ch);
+extern int64_t string_search(const char* haystack, uint64_t haystack_length,
+                             const char* needle, uint64_t needle_length);
+extern int string_compare_ignore_case(const char* str1, uint64_t length1,
+                                      const char* str2, uint64_t length2);
+
+// Non ASCII strings remember the byte offset of every this many code
+// points (see immutable_string_byte_offset).
+#define UTF8_CHECKPOINT_INTERVAL 64
+#define UTF8_MAX_BYTES 4
+
+/**
+ * A scheme string (TAG_STRING) is immutable valid UTF-8 and knows its
+ * length (in bytes and in code points) and hash code so none of them
+ * ever needs to be computed again. Its tagged reference points at the
+ * bytes (which are NUL terminated too) so it can still be used as a C
+ * string.
+ *
+ * Symbols read by the reader are interned strings of the same kind
+ * (see intern_symbol_name) but symbols made from C strings aren't, so
+ * only strings may be assumed to have a header.
+ */
+typedef struct {
+  uint64_t length;
+  uint64_t hash;
+  uint64_t n_code_points;
+  // The byte offsets of code points 0, UTF8_CHECKPOINT_INTERVAL, 2 *
+  // UTF8_CHECKPOINT_INTERVAL, etc. (NULL for ASCII strings where the
+  // byte offset is the index).
+  uint64_t* checkpoints;
+  char bytes[];
+} immutable_string_t;
+
+extern immutable_string_t* allocate_immutable_string(uint64_t length);
+extern char* finish_immutable_string(immutable_string_t* str);
+extern char* make_immutable_string(const char* bytes, uint64_t length);
+extern char* intern_symbol_name(const char* bytes, uint64_t length);
+extern int immutable_string_equal(const char* str1, const char* str2);
+extern uint64_t immutable_string_byte_offset(const char* str, uint64_t index);
+extern uint64_t immutable_string_code_point_index(const char* str,
+                                                  uint64_t offset);
+
+extern int utf8_validate(const char* bytes, uint64_t length,
+                         uint64_t* n_code_points);
+extern uint64_t utf8_validate_code_point(const char* bytes, uint64_t length,
+                                         uint32_t* code_point);
+extern uint64_t utf8_count_code_points(const char* bytes, uint64_t length);
+extern uint64_t utf8_decode(const char* bytes, uint64_t offset,
+                            uint32_t* code_point);
+extern uint64_t utf8_encode(uint32_t code_point, char* destination);
+extern int64_t char_name_to_code_point(const char* name, uint64_t length);
+extern const char* code_point_to_char_name(uint32_t code_point);
+
+static inline immutable_string_t* immutable_string_header(const char* str) {
+  return (immutable_string_t*) (str - offsetof(immutable_string_t, bytes));
+}
+
+static inline uint64_t immutable_string_length(const char* str) {
+  return immutable_string_header(str)->length;
+}
+
+static inline uint64_t immutable_string_hash(const char* str) {
+  return immutable_string_header(str)->hash;
+}
+
+static inline uint64_t immutable_string_n_code_points(const char* str) {
+  return immutable_string_header(str)->n_code_points;
+}
+
+static inline int immutable_string_is_ascii(const char* str) {
+  return immutable_string_header(str)->checkpoints == NULL;
+}
 
 static inline char* untag_string(tagged_reference_t reference) {
   require_tag(reference, TAG_STRING);
@@ -46,6 +120,18 @@ static inline char*
   fatal_error(ERROR_REFERENCE_NOT_EXPECTED_TYPE);
 }
 
+/**
+ * Return string_hash of a string or symbol (which strings have
+ * already computed).
+ */
+static inline uint64_t
+    string_or_reader_symbol_hash(tagged_reference_t reference) {
+  if (reference.tag == TAG_STRING) {
+    return immutable_string_hash((char*) reference.data);
+  }
+  return string_hash(untag_string_or_reader_symbol(reference));
+}
+
 #endif /* _STRING_UTIL_H_ */
 
 // ======================================================================
@@ -53,24 +139,46 @@ static inline char*
 #include <stdlib.h>
 #include <string.h>
 
+// The search and compare kernels look at 16 bytes at a time with SSE2
+// (which every x86-64 processor has). Compile with -DNO_STRING_SIMD to
+// use the portable byte loops instead (for example to benchmark them).
+#if defined(__SSE2__) && !defined(NO_STRING_SIMD)
+#define STRING_SIMD
+#include <emmintrin.h>
+#endif
+
 #include "allocate.h"
 #include "string-util.h"
 
-uint64_t fasthash64(const void* buf, size_t len, uint64_t seed);
-
 int string_is_null_or_empty(const char* str) {
-  return (str == NULL) || (strlen(str) == 0);
+  return (str == NULL) || (str[0] == '\0');
 }
 
+/**
+ * Return true if str1 and str2 have the same contents (NULL is the
+ * same as ""). The same (for example interned) string is recognized
+ * without looking at its contents.
+ */
 int string_equal(const char* str1, const char* str2) {
+  if (str1 == str2) {
+    return 1;
+  }
   if (string_is_null_or_empty(str1)) {
     return string_is_null_or_empty(str2);
   }
+  if (str2 == NULL) {
+    return 0;
+  }
   return strcmp(str1, str2) == 0;
 }
 
 int string_starts_with(const char* str1, const char* str2) {
-  return strncmp(str1, str2, strlen(str2)) == 0;
+  while (*str2 != '\0') {
+    if (*str1++ != *str2++) {
+      return 0;
+    }
+  }
+  return 1;
 }
 
 int string_ends_with(const char* str1, const char* str2) {
@@ -88,7 +196,7 @@ int string_contains(const char* str, char ch) {
   if (string_is_null_or_empty(str)) {
     return 0;
   }
-  for (int i = 0; i < strlen(str); i++) {
+  for (int i = 0; str[i] != '\0'; i++) {
     if (str[i] == ch) {
       return 1;
     }
@@ -107,7 +215,7 @@ char* string_substring(const char* str, int start, int end) {
   for (int i = start; (i < end); i++) {
     result[i - start] = str[i];
   }
-  result[result_size] = '\0';
+  result[result_size - 1] = '\0';
   return result;
 }
 
@@ -188,6 +296,520 @@ char* string_duplicate(const char* src) {
   return result;
 }
 
+/**
+ * Return the index of the first ch in length bytes (or -1 when there
+ * isn't one).
+ */
+int64_t string_find_byte(const char* bytes, uint64_t length, char ch) {
+  uint64_t i = 0;
+#ifdef STRING_SIMD
+  __m128i pattern = _mm_set1_epi8(ch);
+  for (; i + 16 <= length; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*) &bytes[i]);
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; i < length; i++) {
+    if (bytes[i] == ch) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Return the index of the first occurrence of needle in haystack (or
+ * -1 when there isn't one). An empty needle is found at 0.
+ *
+ * The SIMD version compares the first and last byte of needle against
+ * 16 candidate positions at once and only calls memcmp for positions
+ * where both match, which for text is rarely a false positive.
+ */
+int64_t string_search(const char* haystack, uint64_t haystack_length,
+                      const char* needle, uint64_t needle_length) {
+  if (needle_length == 0) {
+    return 0;
+  }
+  if (needle_length > haystack_length) {
+    return -1;
+  }
+  if (needle_length == 1) {
+    return string_find_byte(haystack, haystack_length, needle[0]);
+  }
+  uint64_t last = needle_length - 1;
+  uint64_t i = 0;
+#ifdef STRING_SIMD
+  __m128i first_byte = _mm_set1_epi8(needle[0]);
+  __m128i last_byte = _mm_set1_epi8(needle[last]);
+  for (; i + last + 16 <= haystack_length; i += 16) {
+    __m128i first_block = _mm_loadu_si128((const __m128i*) &haystack[i]);
+    __m128i last_block
+        = _mm_loadu_si128((const __m128i*) &haystack[i + last]);
+    int mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(first_block, first_byte),
+                      _mm_cmpeq_epi8(last_block, last_byte)));
+    while (mask != 0) {
+      uint64_t candidate = i + __builtin_ctz(mask);
+      if (memcmp(&haystack[candidate + 1], &needle[1], last - 1) == 0) {
+        return candidate;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; i + last < haystack_length; i++) {
+    if (haystack[i] == needle[0] && haystack[i + last] == needle[last]
+        && memcmp(&haystack[i + 1], &needle[1], last - 1) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static inline uint8_t ascii_fold_case(uint8_t ch) {
+  return (ch >= 'A' && ch <= 'Z') ? ch + ('a' - 'A') : ch;
+}
+
+/**
+ * Compare two strings ignoring the case of ASCII letters and return a
+ * negative number, zero or a positive number (like strcmp, bytes are
+ * compared as unsigned).
+ */
+int string_compare_ignore_case(const char* str1, uint64_t length1,
+                               const char* str2, uint64_t length2) {
+  uint64_t length = length1 < length2 ? length1 : length2;
+  uint64_t i = 0;
+#ifdef STRING_SIMD
+  // Bytes >= 0x80 are negative (so never between 'A' and 'Z').
+  __m128i before_a = _mm_set1_epi8('A' - 1);
+  __m128i after_z = _mm_set1_epi8('Z' + 1);
+  __m128i case_bit = _mm_set1_epi8('a' - 'A');
+  for (; i + 16 <= length; i += 16) {
+    __m128i block1 = _mm_loadu_si128((const __m128i*) &str1[i]);
+    __m128i block2 = _mm_loadu_si128((const __m128i*) &str2[i]);
+    __m128i upper1 = _mm_and_si128(_mm_cmpgt_epi8(block1, before_a),
+                                   _mm_cmpgt_epi8(after_z, block1));
+    __m128i upper2 = _mm_and_si128(_mm_cmpgt_epi8(block2, before_a),
+                                   _mm_cmpgt_epi8(after_z, block2));
+    block1 = _mm_add_epi8(block1, _mm_and_si128(upper1, case_bit));
+    block2 = _mm_add_epi8(block2, _mm_and_si128(upper2, case_bit));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block1, block2));
+    if (mask != 0xffff) {
+      // The scalar loop below finds the first difference.
+      i += __builtin_ctz(~mask);
+      break;
+    }
+  }
+#endif
+  for (; i < length; i++) {
+    uint8_t ch1 = ascii_fold_case(str1[i]);
+    uint8_t ch2 = ascii_fold_case(str2[i]);
+    if (ch1 != ch2) {
+      return ch1 < ch2 ? -1 : 1;
+    }
+  }
+  if (length1 == length2) {
+    return 0;
+  }
+  return length1 < length2 ? -1 : 1;
+}
+
+/**
+ * Allocate an immutable string of length (zero) bytes. The caller
+ * fills in the bytes and then calls finish_immutable_string (after
+ * which they must not change).
+ */
+immutable_string_t* allocate_immutable_string(uint64_t length) {
+  immutable_string_t* result = (immutable_string_t*) malloc_bytes(
+      sizeof(immutable_string_t) + length + 1);
+  result->length = length;
+  return result;
+}
+
+/**
+ * Compute the hash code, number of code points and (for non ASCII
+ * strings) the checkpoints of a string made by
+ * allocate_immutable_string and return a pointer to its (NUL
+ * terminated) bytes. The bytes must be valid UTF-8.
+ */
+char* finish_immutable_string(immutable_string_t* str) {
+  str->hash = fasthash64(str->bytes, str->length, 0);
+  if (!utf8_validate(str->bytes, str->length, &str->n_code_points)) {
+    fatal_error(ERROR_INVALID_UTF8);
+  }
+  if (str->n_code_points != str->length) {
+    uint64_t n_checkpoints
+        = str->n_code_points / UTF8_CHECKPOINT_INTERVAL + 1;
+    str->checkpoints
+        = (uint64_t*) malloc_bytes(n_checkpoints * sizeof(uint64_t));
+    uint64_t offset = 0;
+    for (uint64_t i = 0; i < n_checkpoints; i++) {
+      str->checkpoints[i] = offset;
+      for (uint64_t j = 0;
+           j < UTF8_CHECKPOINT_INTERVAL && offset < str->length; j++) {
+        uint32_t code_point;
+        offset = utf8_decode(str->bytes, offset, &code_point);
+      }
+    }
+  }
+  return str->bytes;
+}
+
+/**
+ * Return the byte offset of the code point at index (or the length in
+ * bytes when index is the number of code points). For non ASCII
+ * strings this starts at the closest checkpoint so at most
+ * UTF8_CHECKPOINT_INTERVAL - 1 code points are skipped.
+ */
+uint64_t immutable_string_byte_offset(const char* str, uint64_t index) {
+  immutable_string_t* header = immutable_string_header(str);
+  if (header->checkpoints == NULL) {
+    return index;
+  }
+  if (index >= header->n_code_points) {
+    return header->length;
+  }
+  uint64_t offset = header->checkpoints[index / UTF8_CHECKPOINT_INTERVAL];
+  for (uint64_t i = index % UTF8_CHECKPOINT_INTERVAL; i > 0; i--) {
+    uint32_t code_point;
+    offset = utf8_decode(str, offset, &code_point);
+  }
+  return offset;
+}
+
+/**
+ * Return the index of the code point starting at byte offset (the
+ * inverse of immutable_string_byte_offset).
+ */
+uint64_t immutable_string_code_point_index(const char* str,
+                                           uint64_t offset) {
+  immutable_string_t* header = immutable_string_header(str);
+  if (header->checkpoints == NULL) {
+    return offset;
+  }
+  // Find the last checkpoint at or before offset.
+  uint64_t low = 0;
+  uint64_t high = header->n_code_points / UTF8_CHECKPOINT_INTERVAL;
+  while (low < high) {
+    uint64_t middle = (low + high + 1) / 2;
+    if (header->checkpoints[middle] <= offset) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  uint64_t checkpoint = header->checkpoints[low];
+  return low * UTF8_CHECKPOINT_INTERVAL
+         + utf8_count_code_points(&str[checkpoint], offset - checkpoint);
+}
+
+/**
+ * Make an immutable string (see immutable_string_t) with a copy of
+ * length bytes and return a pointer to its (NUL terminated) bytes.
+ */
+char* make_immutable_string(const char* bytes, uint64_t length) {
+  immutable_string_t* result = allocate_immutable_string(length);
+  memcpy(result->bytes, bytes, length);
+  return finish_immutable_string(result);
+}
+
+/**
+ * Return true if the immutable strings str1 and str2 have the same
+ * contents. Only strings of the same length and hash are compared.
+ */
+int immutable_string_equal(const char* str1, const char* str2) {
+  if (str1 == str2) {
+    return 1;
+  }
+  immutable_string_t* a = immutable_string_header(str1);
+  immutable_string_t* b = immutable_string_header(str2);
+  return a->length == b->length && a->hash == b->hash
+         && memcmp(a->bytes, b->bytes, a->length) == 0;
+}
+
+// The symbol table: the interned symbol names in an open addressing
+// hash table (NULL is an empty slot) that is at most half full. Any
+// interpreter thread may intern a name so it's protected by a spin
+// lock (without needing pthreads in every program using this file).
+#define SYMBOL_TABLE_INITIAL_CAPACITY 1024
+
+static char** symbol_table = NULL;
+static uint64_t symbol_table_capacity = 0;
+static uint64_t symbol_table_count = 0;
+static char symbol_table_lock = 0;
+
+static void symbol_table_grow(void) {
+  uint64_t old_capacity = symbol_table_capacity;
+  char** old_table = symbol_table;
+  symbol_table_capacity = old_capacity == 0 ? SYMBOL_TABLE_INITIAL_CAPACITY
+                                            : old_capacity * 2;
+  symbol_table
+      = (char**) malloc_bytes(symbol_table_capacity * sizeof(char*));
+  uint64_t mask = symbol_table_capacity - 1;
+  for (uint64_t i = 0; i < old_capacity; i++) {
+    if (old_table[i] != NULL) {
+      uint64_t j = immutable_string_hash(old_table[i]) & mask;
+      while (symbol_table[j] != NULL) {
+        j = (j + 1) & mask;
+      }
+      symbol_table[j] = old_table[i];
+    }
+  }
+  if (old_table != NULL) {
+    free_bytes(old_table);
+  }
+}
+
+/**
+ * Return the one immutable string for a symbol's name (so the reader
+ * doesn't allocate a name every time a symbol is read and symbols
+ * read with the same name are the same pointer).
+ */
+char* intern_symbol_name(const char* bytes, uint64_t length) {
+  uint64_t hash = fasthash64(bytes, length, 0);
+  while (__atomic_test_and_set(&symbol_table_lock, __ATOMIC_ACQUIRE)) {
+  }
+  if (2 * (symbol_table_count + 1) > symbol_table_capacity) {
+    symbol_table_grow();
+  }
+  uint64_t mask = symbol_table_capacity - 1;
+  uint64_t i = hash & mask;
+  while (symbol_table[i] != NULL) {
+    immutable_string_t* name = immutable_string_header(symbol_table[i]);
+    if (name->hash == hash && name->length == length
+        && memcmp(name->bytes, bytes, length) == 0) {
+      __atomic_clear(&symbol_table_lock, __ATOMIC_RELEASE);
+      return name->bytes;
+    }
+    i = (i + 1) & mask;
+  }
+  char* result = make_immutable_string(bytes, length);
+  symbol_table[i] = result;
+  symbol_table_count++;
+  __atomic_clear(&symbol_table_lock, __ATOMIC_RELEASE);
+  return result;
+}
+
+/**
+ * Check that length bytes start with one valid UTF-8 encoded code
+ * point (not overlong, not a surrogate and at most 0x10ffff) and
+ * return how many bytes it takes up (or 0 if it isn't valid).
+ */
+uint64_t utf8_validate_code_point(const char* bytes, uint64_t length,
+                                  uint32_t* code_point) {
+  const uint8_t* str = (const uint8_t*) bytes;
+  if (length == 0) {
+    return 0;
+  }
+  uint8_t lead = str[0];
+  uint64_t n;
+  uint32_t result;
+  uint32_t minimum;
+  if (lead < 0x80) {
+    *code_point = lead;
+    return 1;
+  } else if ((lead & 0xe0) == 0xc0) {
+    n = 2;
+    result = lead & 0x1f;
+    minimum = 0x80;
+  } else if ((lead & 0xf0) == 0xe0) {
+    n = 3;
+    result = lead & 0x0f;
+    minimum = 0x800;
+  } else if ((lead & 0xf8) == 0xf0) {
+    n = 4;
+    result = lead & 0x07;
+    minimum = 0x10000;
+  } else {
+    return 0;
+  }
+  if (n > length) {
+    return 0;
+  }
+  for (uint64_t i = 1; i < n; i++) {
+    // A NUL terminator is never a continuation byte so this doesn't
+    // read past the end of a C string.
+    if ((str[i] & 0xc0) != 0x80) {
+      return 0;
+    }
+    result = (result << 6) | (str[i] & 0x3f);
+  }
+  if (result < minimum || result > 0x10ffff
+      || (result >= 0xd800 && result <= 0xdfff)) {
+    return 0;
+  }
+  *code_point = result;
+  return n;
+}
+
+/**
+ * Return true if length bytes are valid UTF-8 and store how many code
+ * points they encode in n_code_points. Runs of ASCII are skipped 16
+ * bytes at a time.
+ */
+int utf8_validate(const char* bytes, uint64_t length,
+                  uint64_t* n_code_points) {
+  uint64_t count = 0;
+  uint64_t i = 0;
+  while (i < length) {
+#ifdef STRING_SIMD
+    while (i + 16 <= length
+           && _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) &bytes[i]))
+                  == 0) {
+      i += 16;
+      count += 16;
+    }
+    if (i == length) {
+      break;
+    }
+#endif
+    uint32_t code_point;
+    uint64_t n = utf8_validate_code_point(&bytes[i], length - i, &code_point);
+    if (n == 0) {
+      return 0;
+    }
+    i += n;
+    count++;
+  }
+  *n_code_points = count;
+  return 1;
+}
+
+/**
+ * Return how many code points length bytes of valid UTF-8 encode
+ * (i.e., how many bytes aren't continuation bytes).
+ */
+uint64_t utf8_count_code_points(const char* bytes, uint64_t length) {
+  uint64_t count = 0;
+  uint64_t i = 0;
+#ifdef STRING_SIMD
+  // Continuation bytes (0x80 to 0xbf) are -128 to -65 as signed bytes.
+  __m128i last_continuation = _mm_set1_epi8(-65);
+  for (; i + 16 <= length; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*) &bytes[i]);
+    count += __builtin_popcount(
+        _mm_movemask_epi8(_mm_cmpgt_epi8(block, last_continuation)));
+  }
+#endif
+  for (; i < length; i++) {
+    if ((bytes[i] & 0xc0) != 0x80) {
+      count++;
+    }
+  }
+  return count;
+}
+
+/**
+ * Decode the code point starting at offset in valid UTF-8 and return
+ * the offset of the next one.
+ */
+uint64_t utf8_decode(const char* bytes, uint64_t offset,
+                     uint32_t* code_point) {
+  const uint8_t* str = (const uint8_t*) &bytes[offset];
+  if (str[0] < 0x80) {
+    *code_point = str[0];
+    return offset + 1;
+  } else if (str[0] < 0xe0) {
+    *code_point = ((str[0] & 0x1f) << 6) | (str[1] & 0x3f);
+    return offset + 2;
+  } else if (str[0] < 0xf0) {
+    *code_point = ((str[0] & 0x0f) << 12) | ((str[1] & 0x3f) << 6)
+                  | (str[2] & 0x3f);
+    return offset + 3;
+  }
+  *code_point = ((str[0] & 0x07) << 18) | ((str[1] & 0x3f) << 12)
+                | ((str[2] & 0x3f) << 6) | (str[3] & 0x3f);
+  return offset + 4;
+}
+
+/**
+ * Write the UTF-8 encoding of code_point (at most UTF8_MAX_BYTES) to
+ * destination and return how many bytes were written (0 for
+ * surrogates and anything above 0x10ffff, which can't be encoded).
+ */
+uint64_t utf8_encode(uint32_t code_point, char* destination) {
+  uint8_t* result = (uint8_t*) destination;
+  if (code_point < 0x80) {
+    result[0] = code_point;
+    return 1;
+  } else if (code_point < 0x800) {
+    result[0] = 0xc0 | (code_point >> 6);
+    result[1] = 0x80 | (code_point & 0x3f);
+    return 2;
+  } else if (code_point >= 0xd800 && code_point <= 0xdfff) {
+    return 0;
+  } else if (code_point < 0x10000) {
+    result[0] = 0xe0 | (code_point >> 12);
+    result[1] = 0x80 | ((code_point >> 6) & 0x3f);
+    result[2] = 0x80 | (code_point & 0x3f);
+    return 3;
+  } else if (code_point <= 0x10ffff) {
+    result[0] = 0xf0 | (code_point >> 18);
+    result[1] = 0x80 | ((code_point >> 12) & 0x3f);
+    result[2] = 0x80 | ((code_point >> 6) & 0x3f);
+    result[3] = 0x80 | (code_point & 0x3f);
+    return 4;
+  }
+  return 0;
+}
+
+// The R7RS character names (as in #\space).
+static const struct {
+  const char* name;
+  uint32_t code_point;
+} char_names[] = {
+    {"alarm", 0x07},  {"backspace", 0x08}, {"delete", 0x7f},
+    {"escape", 0x1b}, {"newline", 0x0a},   {"null", 0x00},
+    {"return", 0x0d}, {"space", 0x20},     {"tab", 0x09},
+};
+
+#define N_CHAR_NAMES (sizeof(char_names) / sizeof(char_names[0]))
+
+/**
+ * Return the code point of a character name (like "space" or "x3bb")
+ * or -1 if it isn't one.
+ */
+int64_t char_name_to_code_point(const char* name, uint64_t length) {
+  for (uint64_t i = 0; i < N_CHAR_NAMES; i++) {
+    if (strlen(char_names[i].name) == length
+        && memcmp(char_names[i].name, name, length) == 0) {
+      return char_names[i].code_point;
+    }
+  }
+  if (length < 2 || length > 7 || name[0] != 'x') {
+    return -1;
+  }
+  int64_t result = 0;
+  for (uint64_t i = 1; i < length; i++) {
+    char ch = name[i];
+    if (ch >= '0' && ch <= '9') {
+      result = result * 16 + (ch - '0');
+    } else if (ch >= 'a' && ch <= 'f') {
+      result = result * 16 + (ch - 'a' + 10);
+    } else if (ch >= 'A' && ch <= 'F') {
+      result = result * 16 + (ch - 'A' + 10);
+    } else {
+      return -1;
+    }
+  }
+  return result;
+}
+
+/**
+ * Return the name of a character (or NULL if it doesn't have one).
+ */
+const char* code_point_to_char_name(uint32_t code_point) {
+  for (uint64_t i = 0; i < N_CHAR_NAMES; i++) {
+    if (char_names[i].code_point == code_point) {
+      return char_names[i].name;
+    }
+  }
+  return NULL;
+}
+
 /* The MIT License
 
    Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)
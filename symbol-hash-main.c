@@ -2,6 +2,18 @@
  * This is a stand-alone program to hash scheme symbols so that we can
  * used the hashed values in C code as constants (for example for
  * switch statements).
+ *
+ * With --builtins it instead reads the define_primitive() and
+ * special_form() entries in a C file (global-environment.c) and
+ * writes a C file with a static perfect hash table of all of them
+ * (see builtin.c):
+ *
+ * symbol-hash --builtins global-environment.c > builtin-table.c
+ *
+ * Before writing the table it checks that looking up every name in
+ * it (with builtin_probe(), just like builtin_lookup() does) finds
+ * that name and that looking up names which aren't builtins finds
+ * nothing.
  */
 
 #include <stdio.h>
@@ -9,8 +21,21 @@
 #include <ctype.h>
 #include <string.h>
 
+#include "allocate.h"
+#include "array.h"
+#include "builtin.h"
+#include "byte-array.h"
+#include "io.h"
 #include "string-util.h"
 
+typedef struct {
+  char* name;
+  // Either a special_form_t enumerator or the C name of a primitive.
+  char* definition;
+  boolean_t is_special_form;
+  uint64_t hash_code;
+} builtin_entry_t;
+
 char* upper_case(char *str) {
   str = strdup(str);
   for (int i = 0; str[i]; i++) {
@@ -19,7 +44,302 @@ char* upper_case(char *str) {
   return str;
 }
 
+// ======================================================================
+// Reading the catalog
+// ======================================================================
+
+char* skip_space(char* p) {
+  while (isspace(*p)) {
+    p++;
+  }
+  return p;
+}
+
+/**
+ * Parse a C identifier at *p (after any whitespace) or return NULL.
+ */
+char* parse_identifier(char** p) {
+  char* start = skip_space(*p);
+  char* end = start;
+  while (isalnum(*end) || *end == '_') {
+    end++;
+  }
+  if (end == start) {
+    return NULL;
+  }
+  *p = end;
+  return string_substring(start, 0, end - start);
+}
+
+/**
+ * Parse a C string literal (without escapes) at *p (after any
+ * whitespace) or return NULL.
+ */
+char* parse_string_literal(char** p) {
+  char* start = skip_space(*p);
+  if (*start != '"') {
+    return NULL;
+  }
+  char* end = strchr(start + 1, '"');
+  if (end == NULL) {
+    return NULL;
+  }
+  *p = end + 1;
+  return string_substring(start, 1, end - start);
+}
+
+boolean_t parse_char(char** p, char ch) {
+  char* start = skip_space(*p);
+  if (*start != ch) {
+    return false;
+  }
+  *p = start + 1;
+  return true;
+}
+
+/**
+ * Parse the arguments of define_primitive(env, "name", function) or
+ * special_form("name", SPECIAL_FORM_XXX) starting right after the
+ * open paren. Anything else (like the macro definitions themselves)
+ * is ignored by returning NULL.
+ */
+builtin_entry_t* parse_entry(char* p, boolean_t is_special_form) {
+  if (!is_special_form) {
+    char* env = parse_identifier(&p);
+    if (env == NULL || !parse_char(&p, ',')) {
+      return NULL;
+    }
+  }
+  char* name = parse_string_literal(&p);
+  if (name == NULL || !parse_char(&p, ',')) {
+    return NULL;
+  }
+  char* definition = parse_identifier(&p);
+  if (definition == NULL || !parse_char(&p, ')')) {
+    return NULL;
+  }
+  builtin_entry_t* result = malloc_struct(builtin_entry_t);
+  result->name = name;
+  result->definition = definition;
+  result->is_special_form = is_special_form;
+  result->hash_code = string_hash(name);
+  return result;
+}
+
+array_t* read_catalog(char* file_name) {
+  byte_array_t* contents = make_byte_array(16384);
+  contents = byte_array_append_file_contents(contents, file_name);
+  contents = byte_array_append_byte(contents, '\0');
+  char* text = (char*) &contents->elements[0];
+
+  array_t* result = make_array(256);
+  char* markers[] = {"define_primitive(", "special_form("};
+  for (int m = 0; m < 2; m++) {
+    char* p = text;
+    while ((p = strstr(p, markers[m])) != NULL) {
+      // Don't match the tail of some other identifier.
+      boolean_t at_start = p == text || !(isalnum(p[-1]) || p[-1] == '_');
+      p += strlen(markers[m]);
+      builtin_entry_t* entry = at_start ? parse_entry(p, m == 1) : NULL;
+      if (entry == NULL) {
+        continue;
+      }
+      for (uint64_t i = 0; i < array_length(result); i++) {
+        builtin_entry_t* other = (builtin_entry_t*) array_get(result, i);
+        if (string_equal(other->name, entry->name)) {
+          fprintf(stderr, "%s: %s is defined more than once\n", file_name,
+                  entry->name);
+          exit(1);
+        }
+      }
+      result = array_add(result, (uint64_t) entry);
+    }
+  }
+  return result;
+}
+
+// ======================================================================
+// Building the perfect hash table
+// ======================================================================
+
+/**
+ * Try to find a seed for each group of entries (entries whose hash
+ * codes have the same low bits) so that every entry gets its own
+ * slot. Groups are placed from largest to smallest since the large
+ * groups are the hard ones. Returns false if some group couldn't be
+ * placed.
+ */
+boolean_t build_table(array_t* entries, uint64_t bits, uint64_t n_seeds,
+                      uint64_t* seeds, builtin_entry_t** slots) {
+  uint64_t n_slots = UINT64_C(1) << bits;
+  memset(slots, 0, n_slots * sizeof(builtin_entry_t*));
+  // Groups without any entries keep seed 0.
+  memset(seeds, 0, n_seeds * sizeof(uint64_t));
+
+  uint64_t group_sizes[n_seeds];
+  memset(group_sizes, 0, sizeof(group_sizes));
+  for (uint64_t i = 0; i < array_length(entries); i++) {
+    builtin_entry_t* entry = (builtin_entry_t*) array_get(entries, i);
+    group_sizes[entry->hash_code & (n_seeds - 1)]++;
+  }
+
+  for (uint64_t size = array_length(entries); size > 0; size--) {
+    for (uint64_t group = 0; group < n_seeds; group++) {
+      if (group_sizes[group] != size) {
+        continue;
+      }
+      uint64_t seed = 0;
+      for (; seed < 100000; seed++) {
+        uint64_t used[size];
+        uint64_t n_used = 0;
+        for (uint64_t i = 0; i < array_length(entries); i++) {
+          builtin_entry_t* entry = (builtin_entry_t*) array_get(entries, i);
+          if ((entry->hash_code & (n_seeds - 1)) != group) {
+            continue;
+          }
+          uint64_t slot = builtin_slot(entry->hash_code, seed, bits);
+          boolean_t is_free = slots[slot] == NULL;
+          for (uint64_t j = 0; is_free && j < n_used; j++) {
+            is_free = used[j] != slot;
+          }
+          if (!is_free) {
+            break;
+          }
+          used[n_used++] = slot;
+        }
+        if (n_used == size) {
+          break;
+        }
+      }
+      if (seed == 100000) {
+        return false;
+      }
+      seeds[group] = seed;
+      for (uint64_t i = 0; i < array_length(entries); i++) {
+        builtin_entry_t* entry = (builtin_entry_t*) array_get(entries, i);
+        if ((entry->hash_code & (n_seeds - 1)) == group) {
+          slots[builtin_slot(entry->hash_code, seed, bits)] = entry;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Check the table the way builtin_lookup() will use it, exiting with
+ * an error if some builtin isn't found or a name that isn't a builtin
+ * is.
+ */
+void check_table(char* file_name, array_t* entries, uint64_t bits,
+                 uint64_t n_seeds, uint64_t* seeds, builtin_entry_t** slots) {
+  uint64_t n_slots = UINT64_C(1) << bits;
+  builtin_t* table = (builtin_t*) malloc_bytes(n_slots * sizeof(builtin_t));
+  for (uint64_t slot = 0; slot < n_slots; slot++) {
+    table[slot].name = slots[slot] == NULL ? NULL : slots[slot]->name;
+  }
+
+  for (uint64_t i = 0; i < array_length(entries); i++) {
+    char* name = ((builtin_entry_t*) array_get(entries, i))->name;
+    const builtin_t* builtin = builtin_probe(table, seeds, n_seeds, bits, name);
+    if (builtin == NULL || !string_equal(builtin->name, name)) {
+      fprintf(stderr, "%s: builtin %s isn't found\n", file_name, name);
+      exit(1);
+    }
+    // No builtin name has a space in it.
+    char other[strlen(name) + 2];
+    snprintf(other, sizeof(other), "%s ", name);
+    if (builtin_probe(table, seeds, n_seeds, bits, other) != NULL) {
+      fprintf(stderr, "%s: \"%s\" is found as a builtin\n", file_name, other);
+      exit(1);
+    }
+  }
+  char* others[] = {"", "x", "not-a-builtin", "CAR", "lambda!"};
+  for (int i = 0; i < sizeof(others) / sizeof(others[0]); i++) {
+    if (builtin_probe(table, seeds, n_seeds, bits, others[i]) != NULL) {
+      fprintf(stderr, "%s: \"%s\" is found as a builtin\n", file_name,
+              others[i]);
+      exit(1);
+    }
+  }
+  free_bytes(table);
+}
+
+void print_c_string_literal(char* str) {
+  fputc('"', stdout);
+  for (int i = 0; str[i]; i++) {
+    if (str[i] == '"' || str[i] == '\\') {
+      fputc('\\', stdout);
+    }
+    fputc(str[i], stdout);
+  }
+  fputc('"', stdout);
+}
+
+void generate_builtins(char* file_name) {
+  array_t* entries = read_catalog(file_name);
+
+  // Keep the table at most half full so that seeds are easy to find.
+  uint64_t bits = 1;
+  while ((UINT64_C(1) << bits) < 2 * array_length(entries)) {
+    bits++;
+  }
+  uint64_t n_seeds = (UINT64_C(1) << bits) / 4;
+  uint64_t seeds[n_seeds];
+  builtin_entry_t** slots = NULL;
+  while (1) {
+    slots = (builtin_entry_t**) malloc_bytes((UINT64_C(1) << bits)
+                                             * sizeof(builtin_entry_t*));
+    if (build_table(entries, bits, n_seeds, seeds, slots)) {
+      break;
+    }
+    free_bytes(slots);
+    bits++;
+  }
+  check_table(file_name, entries, bits, n_seeds, seeds, slots);
+
+  fprintf(stdout, "// Generated by symbol-hash from %s. Do not edit.\n\n",
+          file_name);
+  fprintf(stdout, "#include \"builtin.h\"\n\n");
+  for (uint64_t i = 0; i < array_length(entries); i++) {
+    builtin_entry_t* entry = (builtin_entry_t*) array_get(entries, i);
+    if (!entry->is_special_form) {
+      fprintf(stdout, "extern tagged_reference_t %s(primitive_arguments_t);\n",
+              entry->definition);
+    }
+  }
+
+  fprintf(stdout, "\nconst uint64_t builtin_table_bits = %lu;\n", bits);
+  fprintf(stdout, "const uint64_t builtin_n_seeds = %lu;\n\n", n_seeds);
+  fprintf(stdout, "const uint64_t builtin_seeds[%lu] = {\n", n_seeds);
+  for (uint64_t i = 0; i < n_seeds; i++) {
+    fprintf(stdout, "    %lu,\n", seeds[i]);
+  }
+  fprintf(stdout, "};\n\n");
+
+  fprintf(stdout, "const builtin_t builtin_table[%lu] = {\n",
+          UINT64_C(1) << bits);
+  for (uint64_t slot = 0; slot < (UINT64_C(1) << bits); slot++) {
+    builtin_entry_t* entry = slots[slot];
+    if (entry == NULL) {
+      continue;
+    }
+    fprintf(stdout, "    [%lu] = {", slot);
+    print_c_string_literal(entry->name);
+    if (entry->is_special_form) {
+      fprintf(stdout, ", %s, NULL},\n", entry->definition);
+    } else {
+      fprintf(stdout, ", SPECIAL_FORM_NONE, &%s},\n", entry->definition);
+    }
+  }
+  fprintf(stdout, "};\n");
+}
+
 int main(int argc, char** argv) {
+  if (argc == 3 && strcmp(argv[1], "--builtins") == 0) {
+    generate_builtins(argv[2]);
+    exit(0);
+  }
   for (int i = 1; i < argc; i++) {
     fprintf(stdout, "#define HASHCODE_%s UINT64_C(%lu)\n", upper_case(argv[i]), string_hash(argv[i]));
   }
@@ -0,0 +1,662 @@
+/**
+ * @file syntax-rules.c
+ *
+ * Macros defined with define-syntax and syntax-rules.
+ *
+ * A macro use is only ever expanded once. The first time a lambda (or
+ * let, do, etc.) is analyzed (see lambda-analysis.c), expand_macros()
+ * replaces every macro use in it *in place* with its expansion, the
+ * same way the evaluator memoizes global variable references and call
+ * sites, so the analysis sees the expanded code and evaluating the
+ * same code again never expands anything. A macro use that isn't
+ * inside of an analyzed form (for example at the top-level) is
+ * expanded (again in place) the first time it is evaluated.
+ *
+ * Patterns support literals, _, ellipses (including patterns after
+ * an ellipsis and a custom ellipsis symbol), dotted tails and
+ * constants. Templates support ellipses and (... ...) to escape an
+ * ellipsis.
+ *
+ * Hygiene is "good enough": names that a template introduces in a
+ * binding position (lambda parameters, let and do variables) are
+ * renamed to fresh names for each expansion so they can't capture the
+ * variables of the macro use. Other names introduced by a template
+ * are not renamed so a local variable at the use site can still
+ * shadow a global the template refers to.
+ */
+
+// ======================================================================
+// This is block is extraced to syntax-rules.h
+// ======================================================================
+
+#ifndef _SYNTAX_RULES_H_
+#define _SYNTAX_RULES_H_
+
+#include "array.h"
+#include "boolean.h"
+#include "environment.h"
+#include "tagged-reference.h"
+
+typedef struct {
+  // The symbol that follows a repeated part of a pattern (usually ...)
+  char* ellipsis;
+  // The names (char*) that only match themselves.
+  array_t* literals;
+  // A list of (pattern template) which are tried in order.
+  tagged_reference_t rules;
+} syntax_rules_t;
+
+extern syntax_rules_t* make_syntax_rules(tagged_reference_t spec);
+extern tagged_reference_t syntax_rules_expand(syntax_rules_t* macro,
+                                              tagged_reference_t form);
+extern boolean_t expand_macro_use(environment_t* env,
+                                  tagged_reference_t expr);
+extern void expand_macros(environment_t* env, tagged_reference_t expr);
+
+static inline syntax_rules_t*
+    untag_syntax_rules(tagged_reference_t reference) {
+  require_tag(reference, TAG_SYNTAX_RULES_T);
+  return (syntax_rules_t*) reference.data;
+}
+
+#endif /* _SYNTAX_RULES_H_ */
+
+// ======================================================================
+
+#include <stdio.h>
+#include <string.h>
+
+#include "allocate.h"
+#include "builtin.h"
+#include "equivalence.h"
+#include "interpreter-thread.h"
+#include "lambda-analysis.h"
+#include "optional.h"
+#include "pair.h"
+#include "string-util.h"
+#include "syntax-rules.h"
+
+typedef struct {
+  char* name;
+  // The number of ellipses the pattern variable is nested in.
+  uint64_t depth;
+  // For depth > 0, a list with the value of each repetition.
+  tagged_reference_t value;
+} pattern_binding_t;
+
+// Used to make the fresh names of renamed binders (shared by all
+// interpreter threads so it is incremented atomically).
+uint64_t syntax_rules_n_renames = 0;
+
+static boolean_t is_symbol(tagged_reference_t reference) {
+  return reference.tag == TAG_SCHEME_SYMBOL;
+}
+
+static boolean_t is_ellipsis(syntax_rules_t* macro,
+                             tagged_reference_t reference) {
+  return is_symbol(reference)
+         && string_equal(untag_reader_symbol(reference), macro->ellipsis);
+}
+
+static uint64_t list_length(tagged_reference_t lst) {
+  uint64_t result = 0;
+  for (; lst.tag == TAG_PAIR_T; lst = cdr(lst)) {
+    result++;
+  }
+  return result;
+}
+
+static array_t* add_pattern_binding(array_t* bindings, char* name,
+                                    uint64_t depth, tagged_reference_t value) {
+  pattern_binding_t* binding = malloc_struct(pattern_binding_t);
+  binding->name = name;
+  binding->depth = depth;
+  binding->value = value;
+  return array_add(bindings, (uint64_t) binding);
+}
+
+/**
+ * Return the binding of name in bindings or NULL. Later bindings
+ * shadow earlier ones.
+ */
+static pattern_binding_t* find_pattern_binding(array_t* bindings,
+                                               char* name) {
+  for (uint64_t i = array_length(bindings); i > 0; i--) {
+    pattern_binding_t* binding
+        = (pattern_binding_t*) array_get(bindings, i - 1);
+    if (string_equal(binding->name, name)) {
+      return binding;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Make a macro from (syntax-rules (literal...) (pattern template)...)
+ * or (syntax-rules ellipsis (literal...) (pattern template)...).
+ */
+syntax_rules_t* make_syntax_rules(tagged_reference_t spec) {
+  if (spec.tag != TAG_PAIR_T || !is_symbol(car(spec))
+      || !string_equal(untag_reader_symbol(car(spec)), "syntax-rules")) {
+    fatal_error(ERROR_BAD_SYNTAX);
+  }
+  syntax_rules_t* result = malloc_struct(syntax_rules_t);
+  result->ellipsis = "...";
+  spec = cdr(spec);
+  if (spec.tag == TAG_PAIR_T && is_symbol(car(spec))) {
+    result->ellipsis = untag_reader_symbol(car(spec));
+    spec = cdr(spec);
+  }
+  if (spec.tag != TAG_PAIR_T) {
+    fatal_error(ERROR_BAD_SYNTAX);
+  }
+  result->literals = make_array(4);
+  for (tagged_reference_t lst = car(spec); lst.tag == TAG_PAIR_T;
+       lst = cdr(lst)) {
+    result->literals = array_add(result->literals,
+                                 (uint64_t) untag_reader_symbol(car(lst)));
+  }
+  result->rules = cdr(spec);
+  return result;
+}
+
+// ======================================================================
+// Matching
+// ======================================================================
+
+/**
+ * Add the variables of pattern (with NIL values) to variables.
+ */
+static array_t* pattern_variables(syntax_rules_t* macro,
+                                  tagged_reference_t pattern, uint64_t depth,
+                                  array_t* variables) {
+  if (is_symbol(pattern)) {
+    char* name = untag_reader_symbol(pattern);
+    if (!name_array_contains(macro->literals, name)
+        && !string_equal(name, "_") && !is_ellipsis(macro, pattern)) {
+      variables = add_pattern_binding(variables, name, depth, NIL);
+    }
+    return variables;
+  }
+  while (pattern.tag == TAG_PAIR_T) {
+    tagged_reference_t rest = cdr(pattern);
+    if (rest.tag == TAG_PAIR_T && is_ellipsis(macro, car(rest))) {
+      variables
+          = pattern_variables(macro, car(pattern), depth + 1, variables);
+      pattern = cdr(rest);
+    } else {
+      variables = pattern_variables(macro, car(pattern), depth, variables);
+      pattern = rest;
+    }
+  }
+  if (is_symbol(pattern)) {
+    // A dotted tail.
+    variables = pattern_variables(macro, pattern, depth, variables);
+  }
+  return variables;
+}
+
+/**
+ * Match form against pattern adding the pattern variables to
+ * *bindings. Returns false if form doesn't match.
+ */
+static boolean_t match(syntax_rules_t* macro, tagged_reference_t pattern,
+                       tagged_reference_t form, array_t** bindings) {
+  if (is_symbol(pattern)) {
+    char* name = untag_reader_symbol(pattern);
+    if (name_array_contains(macro->literals, name)) {
+      return is_symbol(form)
+             && string_equal(untag_reader_symbol(form), name);
+    }
+    if (!string_equal(name, "_")) {
+      *bindings = add_pattern_binding(*bindings, name, 0, form);
+    }
+    return true;
+  }
+
+  if (pattern.tag == TAG_PAIR_T) {
+    tagged_reference_t rest = cdr(pattern);
+    if (rest.tag != TAG_PAIR_T || !is_ellipsis(macro, car(rest))) {
+      return form.tag == TAG_PAIR_T
+             && match(macro, car(pattern), car(form), bindings)
+             && match(macro, rest, cdr(form), bindings);
+    }
+
+    // (element ... rest...) matches as many elements as possible while
+    // leaving enough for the patterns after the ellipsis.
+    rest = cdr(rest);
+    uint64_t n_form = list_length(form);
+    uint64_t n_rest = list_length(rest);
+    if (n_form < n_rest) {
+      return false;
+    }
+    uint64_t n_repetitions = n_form - n_rest;
+    array_t* repetitions = make_array(n_repetitions + 1);
+    for (uint64_t i = 0; i < n_repetitions; i++) {
+      array_t* repetition = make_array(4);
+      if (!match(macro, car(pattern), car(form), &repetition)) {
+        return false;
+      }
+      repetitions = array_add(repetitions, (uint64_t) repetition);
+      form = cdr(form);
+    }
+
+    array_t* variables
+        = pattern_variables(macro, car(pattern), 0, make_array(4));
+    for (uint64_t i = 0; i < array_length(variables); i++) {
+      pattern_binding_t* variable
+          = (pattern_binding_t*) array_get(variables, i);
+      tagged_reference_t values = NIL;
+      for (uint64_t j = n_repetitions; j > 0; j--) {
+        array_t* repetition = (array_t*) array_get(repetitions, j - 1);
+        values = cons(find_pattern_binding(repetition, variable->name)->value,
+                      values);
+      }
+      *bindings = add_pattern_binding(*bindings, variable->name,
+                                      variable->depth + 1, values);
+    }
+    free_bytes(variables);
+    free_bytes(repetitions);
+    return match(macro, rest, form, bindings);
+  }
+
+  if (pattern.tag == TAG_NULL) {
+    return form.tag == TAG_NULL;
+  }
+  return is_equal(pattern, form);
+}
+
+// ======================================================================
+// Expansion
+// ======================================================================
+
+static array_t* add_binder(syntax_rules_t* macro, array_t* binders,
+                           array_t* bindings, tagged_reference_t name) {
+  if (!is_symbol(name) || is_ellipsis(macro, name)) {
+    return binders;
+  }
+  char* str = untag_reader_symbol(name);
+  if (find_pattern_binding(bindings, str) != NULL
+      || name_array_contains(binders, str)) {
+    return binders;
+  }
+  return array_add(binders, (uint64_t) str);
+}
+
+/**
+ * Add the names template itself introduces in binding positions to
+ * binders (but not pattern variables since those come from the macro
+ * use).
+ */
+static array_t* template_binders(syntax_rules_t* macro,
+                                 tagged_reference_t template,
+                                 array_t* bindings, array_t* binders) {
+  if (template.tag != TAG_PAIR_T) {
+    return binders;
+  }
+  tagged_reference_t first = car(template);
+  tagged_reference_t rest = cdr(template);
+  special_form_t form = is_symbol(first)
+                            ? special_form_of(untag_reader_symbol(first))
+                            : SPECIAL_FORM_NONE;
+  if (form == SPECIAL_FORM_LAMBDA && rest.tag == TAG_PAIR_T) {
+    tagged_reference_t parameters = car(rest);
+    for (; parameters.tag == TAG_PAIR_T; parameters = cdr(parameters)) {
+      binders = add_binder(macro, binders, bindings, car(parameters));
+    }
+    binders = add_binder(macro, binders, bindings, parameters);
+  } else if ((form == SPECIAL_FORM_LET || form == SPECIAL_FORM_LET_STAR
+              || form == SPECIAL_FORM_LETREC || form == SPECIAL_FORM_DO)
+             && rest.tag == TAG_PAIR_T) {
+    if (is_symbol(car(rest))) {
+      // A named let.
+      binders = add_binder(macro, binders, bindings, car(rest));
+      rest = cdr(rest);
+    }
+    if (rest.tag == TAG_PAIR_T) {
+      for (tagged_reference_t lst = car(rest); lst.tag == TAG_PAIR_T;
+           lst = cdr(lst)) {
+        if (car(lst).tag == TAG_PAIR_T) {
+          binders = add_binder(macro, binders, bindings, car(car(lst)));
+        }
+      }
+    }
+  }
+  for (; template.tag == TAG_PAIR_T; template = cdr(template)) {
+    binders = template_binders(macro, car(template), bindings, binders);
+  }
+  return binders;
+}
+
+/**
+ * Add the variables with depth > 0 referenced by template to
+ * variables.
+ */
+static array_t* repeated_variables(tagged_reference_t template,
+                                   array_t* bindings, array_t* variables) {
+  if (is_symbol(template)) {
+    pattern_binding_t* binding
+        = find_pattern_binding(bindings, untag_reader_symbol(template));
+    if (binding != NULL && binding->depth > 0) {
+      variables = array_add(variables, (uint64_t) binding);
+    }
+    return variables;
+  }
+  for (; template.tag == TAG_PAIR_T; template = cdr(template)) {
+    variables = repeated_variables(car(template), bindings, variables);
+  }
+  return variables;
+}
+
+/**
+ * Instantiate template. The result is always freshly consed (except
+ * for the parts of the macro use that pattern variables are bound to)
+ * since the evaluator rewrites code in place.
+ */
+static tagged_reference_t expand_template(syntax_rules_t* macro,
+                                          tagged_reference_t template,
+                                          array_t* bindings,
+                                          array_t* renames) {
+  if (is_symbol(template)) {
+    char* name = untag_reader_symbol(template);
+    pattern_binding_t* binding = find_pattern_binding(bindings, name);
+    if (binding == NULL) {
+      binding = find_pattern_binding(renames, name);
+    }
+    if (binding == NULL) {
+      return template;
+    }
+    if (binding->depth > 0) {
+      // Used without (enough) ellipses.
+      fatal_error(ERROR_BAD_SYNTAX);
+    }
+    return binding->value;
+  }
+  if (template.tag != TAG_PAIR_T) {
+    return template;
+  }
+
+  tagged_reference_t rest = cdr(template);
+  if (is_ellipsis(macro, car(template)) && rest.tag == TAG_PAIR_T) {
+    // (... template) is template with ellipses taken literally.
+    return car(rest);
+  }
+  if (rest.tag != TAG_PAIR_T || !is_ellipsis(macro, car(rest))) {
+    return cons(expand_template(macro, car(template), bindings, renames),
+                expand_template(macro, rest, bindings, renames));
+  }
+
+  // (element ... rest...) repeats element once for each value of the
+  // repeated pattern variables it references.
+  tagged_reference_t element = car(template);
+  array_t* variables = repeated_variables(element, bindings, make_array(4));
+  uint64_t n_variables = array_length(variables);
+  if (n_variables == 0) {
+    fatal_error(ERROR_BAD_SYNTAX);
+  }
+  tagged_reference_t values[n_variables];
+  uint64_t n_repetitions = 0;
+  for (uint64_t i = 0; i < n_variables; i++) {
+    values[i] = ((pattern_binding_t*) array_get(variables, i))->value;
+    uint64_t length = list_length(values[i]);
+    if (i > 0 && length != n_repetitions) {
+      fatal_error(ERROR_BAD_SYNTAX);
+    }
+    n_repetitions = length;
+  }
+
+  tagged_reference_t expansions[n_repetitions + 1];
+  for (uint64_t j = 0; j < n_repetitions; j++) {
+    array_t* repetition = make_array(array_length(bindings) + n_variables);
+    for (uint64_t i = 0; i < array_length(bindings); i++) {
+      repetition = array_add(repetition, array_get(bindings, i));
+    }
+    for (uint64_t i = 0; i < n_variables; i++) {
+      pattern_binding_t* variable
+          = (pattern_binding_t*) array_get(variables, i);
+      repetition = add_pattern_binding(repetition, variable->name,
+                                       variable->depth - 1, car(values[i]));
+      values[i] = cdr(values[i]);
+    }
+    expansions[j] = expand_template(macro, element, repetition, renames);
+    free_bytes(repetition);
+  }
+  free_bytes(variables);
+
+  tagged_reference_t result
+      = expand_template(macro, cdr(rest), bindings, renames);
+  for (uint64_t j = n_repetitions; j > 0; j--) {
+    result = cons(expansions[j - 1], result);
+  }
+  return result;
+}
+
+/**
+ * Return the expansion of form, a use of macro.
+ */
+tagged_reference_t syntax_rules_expand(syntax_rules_t* macro,
+                                       tagged_reference_t form) {
+  for (tagged_reference_t rules = macro->rules; rules.tag == TAG_PAIR_T;
+       rules = cdr(rules)) {
+    tagged_reference_t pattern = car(car(rules));
+    tagged_reference_t template = car(cdr(car(rules)));
+    // The keyword position of the pattern is ignored.
+    array_t* bindings = make_array(8);
+    if (!match(macro, cdr(pattern), cdr(form), &bindings)) {
+      free_bytes(bindings);
+      continue;
+    }
+
+    array_t* binders = template_binders(macro, template, bindings,
+                                        make_array(4));
+    array_t* renames = make_array(array_length(binders) + 1);
+    for (uint64_t i = 0; i < array_length(binders); i++) {
+      char* name = (char*) array_get(binders, i);
+      char buffer[32];
+      uint64_t n = __atomic_add_fetch(&syntax_rules_n_renames, 1,
+                                      __ATOMIC_RELAXED);
+      snprintf(buffer, sizeof(buffer), ".%lu", n);
+      char* fresh_name
+          = (char*) malloc_bytes(strlen(name) + strlen(buffer) + 1);
+      strcpy(fresh_name, name);
+      strcat(fresh_name, buffer);
+      renames = add_pattern_binding(
+          renames, name, 0, tagged_reference(TAG_SCHEME_SYMBOL, fresh_name));
+    }
+    free_bytes(binders);
+
+    return expand_template(macro, template, bindings, renames);
+  }
+  fatal_error(ERROR_NO_MATCHING_SYNTAX_RULE);
+}
+
+// ======================================================================
+// Expanding code in place
+// ======================================================================
+
+static boolean_t is_bound(tagged_reference_t bound_names, char* name) {
+  for (; bound_names.tag == TAG_PAIR_T; bound_names = cdr(bound_names)) {
+    if (string_equal(untag_reader_symbol(car(bound_names)), name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Return the macro that reference names in env (unless one of
+ * bound_names shadows it) or NULL.
+ */
+static syntax_rules_t* find_macro(environment_t* env,
+                                  tagged_reference_t bound_names,
+                                  tagged_reference_t reference) {
+  if (!is_symbol(reference)) {
+    return NULL;
+  }
+  char* name = untag_reader_symbol(reference);
+  if (special_form_of(name) != SPECIAL_FORM_NONE
+      || is_bound(bound_names, name)) {
+    return NULL;
+  }
+  optional_t value = environment_get(env, name);
+  if (!optional_is_present(value)
+      || optional_value(value).tag != TAG_SYNTAX_RULES_T) {
+    return NULL;
+  }
+  return untag_syntax_rules(optional_value(value));
+}
+
+/**
+ * Make expr (a pair) be expansion instead.
+ */
+static void replace_expression(tagged_reference_t expr,
+                               tagged_reference_t expansion) {
+  pair_t* pair = untag_pair(expr);
+  if (expansion.tag != TAG_PAIR_T) {
+    expansion = cons(tagged_reference(TAG_SCHEME_SYMBOL, "begin"),
+                     cons(expansion, NIL));
+  }
+  interpreter_code_lock();
+  pair->head = car(expansion);
+  pair->tail = cdr(expansion);
+  interpreter_code_unlock();
+}
+
+static void expand_all(environment_t* env, tagged_reference_t expr,
+                       tagged_reference_t bound_names);
+
+static void expand_each(environment_t* env, tagged_reference_t exprs,
+                        tagged_reference_t bound_names) {
+  for (; exprs.tag == TAG_PAIR_T; exprs = cdr(exprs)) {
+    expand_all(env, car(exprs), bound_names);
+  }
+}
+
+/**
+ * Return bound_names plus the names bound by bindings (a list of
+ * binding forms or lambda parameters).
+ */
+static tagged_reference_t bind_names(tagged_reference_t bound_names,
+                                     tagged_reference_t bindings) {
+  for (; bindings.tag == TAG_PAIR_T; bindings = cdr(bindings)) {
+    bound_names = cons(tagged_reference(TAG_SCHEME_SYMBOL,
+                                        binding_name(car(bindings))),
+                       bound_names);
+  }
+  if (is_symbol(bindings)) {
+    bound_names = cons(bindings, bound_names);
+  }
+  return bound_names;
+}
+
+/**
+ * Expand every macro use in expr (in place). bound_names are the
+ * local variables in scope (within expr) that shadow any macro with
+ * the same name.
+ */
+static void expand_all(environment_t* env, tagged_reference_t expr,
+                       tagged_reference_t bound_names) {
+  if (expr.tag != TAG_PAIR_T) {
+    return;
+  }
+  syntax_rules_t* macro;
+  while ((macro = find_macro(env, bound_names, car(expr))) != NULL) {
+    replace_expression(expr, syntax_rules_expand(macro, expr));
+  }
+
+  tagged_reference_t first = car(expr);
+  tagged_reference_t rest = cdr(expr);
+  special_form_t form = is_symbol(first)
+                            ? special_form_of(untag_reader_symbol(first))
+                            : SPECIAL_FORM_NONE;
+  switch (form) {
+  case SPECIAL_FORM_QUOTE:
+  case SPECIAL_FORM_DEFINE_SYNTAX:
+    return;
+
+  case SPECIAL_FORM_LAMBDA:
+    if (rest.tag == TAG_PAIR_T) {
+      expand_each(env, cdr(rest), bind_names(bound_names, car(rest)));
+    }
+    return;
+
+  case SPECIAL_FORM_LET:
+  case SPECIAL_FORM_LET_STAR:
+  case SPECIAL_FORM_LETREC:
+  case SPECIAL_FORM_DO:
+    if (rest.tag != TAG_PAIR_T) {
+      return;
+    }
+    tagged_reference_t inner_names = bound_names;
+    if (is_symbol(car(rest))) {
+      // A named let.
+      inner_names = cons(car(rest), inner_names);
+      rest = cdr(rest);
+    }
+    tagged_reference_t bindings = car(rest);
+    inner_names = bind_names(inner_names, bindings);
+    for (; bindings.tag == TAG_PAIR_T; bindings = cdr(bindings)) {
+      tagged_reference_t binding = car(bindings);
+      if (binding.tag != TAG_PAIR_T) {
+        continue;
+      }
+      tagged_reference_t init = cdr(binding);
+      if (init.tag == TAG_PAIR_T) {
+        // Being conservative, let* initial values are expanded as if
+        // all of its variables were already bound.
+        expand_all(env, car(init),
+                   form == SPECIAL_FORM_LET || form == SPECIAL_FORM_DO
+                       ? bound_names
+                       : inner_names);
+        // The step of a do variable.
+        expand_each(env, cdr(init), inner_names);
+      }
+    }
+    if (form == SPECIAL_FORM_DO && cdr(rest).tag == TAG_PAIR_T) {
+      expand_each(env, car(cdr(rest)), inner_names);
+      rest = cdr(rest);
+    }
+    expand_each(env, cdr(rest), inner_names);
+    return;
+
+  case SPECIAL_FORM_COND:
+    for (; rest.tag == TAG_PAIR_T; rest = cdr(rest)) {
+      expand_each(env, car(rest), bound_names);
+    }
+    return;
+
+  case SPECIAL_FORM_DEFINE:
+  case SPECIAL_FORM_SET_BANG:
+    if (rest.tag == TAG_PAIR_T) {
+      expand_each(env, cdr(rest), bound_names);
+    }
+    return;
+
+  default:
+    expand_each(env, expr, bound_names);
+    return;
+  }
+}
+
+/**
+ * Expand every macro use in expr in place. Nothing happens when env
+ * is NULL.
+ */
+void expand_macros(environment_t* env, tagged_reference_t expr) {
+  if (env != NULL) {
+    expand_all(env, expr, NIL);
+  }
+}
+
+/**
+ * If expr is a use of a macro defined in env, replace it (in place)
+ * with its expansion and return true.
+ */
+boolean_t expand_macro_use(environment_t* env, tagged_reference_t expr) {
+  syntax_rules_t* macro = find_macro(env, NIL, car(expr));
+  if (macro == NULL) {
+    return false;
+  }
+  replace_expression(expr, syntax_rules_expand(macro, expr));
+  return true;
+}
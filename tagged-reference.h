@@ -13,7 +13,7 @@ typedef enum {
   TAG_BOOLEAN_T,
   TAG_UINT64_T,
   TAG_UNICODE_CODE_POINT,
-  TAG_STRING,        // aka const char* C string
+  TAG_STRING,        // the bytes of an immutable_string_t (string-util.h)
   TAG_SCHEME_SYMBOL, // also a const char* C string
   TAG_SINGLETON_T,   // also a const char* C string
   TAG_ERROR_T,
@@ -23,7 +23,21 @@ typedef enum {
   TAG_BYTE_VECTOR_T,
   TAG_PRIMITIVE,
   TAG_CLOSURE_T,
-  TAG_CPU_THREAD_STATE_T
+  TAG_CPU_THREAD_STATE_T,
+  TAG_HASH_TABLE_T,
+  TAG_LAMBDA_ANALYSIS_T,  // only used internally by the evaluator
+  TAG_GLOBAL_REFERENCE_T, // only used internally by the evaluator
+  TAG_CALL_SITE_T,        // only used internally by the evaluator
+  TAG_NAMED_LET_LOOP_T,   // only used internally by the evaluator
+  TAG_SYNTAX_RULES_T,
+  TAG_CONTINUATION_T,
+  TAG_GREEN_THREAD_T,
+  TAG_CHANNEL_T,
+  TAG_INTERPRETER_THREAD_T,
+  TAG_FUTURE_T,
+  TAG_SHARED_CHANNEL_T,
+  TAG_ENVIRONMENT_T, // only used internally by the heap marker
+  TAG_CLOSURE_SLOT_T, // only used internally by the evaluator
 } tag_t;
 
 /**
@@ -0,0 +1,50 @@
+(define inline-count (lambda () (cdr (assq (quote inline-arithmetic) (runtime-stats)))))
+(begin (runtime-stats #t) #t)
+(define add (lambda (a b) (+ a b)))
+(add 1 2)
+(define before (inline-count))
+(add 3 4)
+(add 5 6)
+(- (inline-count) before)
+(add 9223372036854775807 1)
+(add 18446744073709551615 2)
+(define mul (lambda (a b) (* a b)))
+(mul 3 4)
+(mul 4294967296 4294967296)
+(mul 4294967297 4294967297)
+(define less (lambda (a b) (< a b)))
+(less 1 2)
+(less 9223372036854775807 9223372036854775808)
+(define saved-plus +)
+(define + (lambda (a b) (* a b)))
+(define before (inline-count))
+(add 3 4)
+(add 5 6)
+(- (inline-count) before)
+(define + saved-plus)
+(add 3 4)
+(define op2 (lambda (f a b) (f a b)))
+(op2 - 10 3)
+(op2 - 10 3)
+(op2 cons 1 2)
+(op2 eq? (quote a) (quote a))
+(op2 - 10 3)
+(define helper (lambda (x) (* x 2)))
+(define use (lambda (x) (helper x)))
+(use 1)
+(use 2)
+(define helper (lambda (x) (+ x 100)))
+(use 1)
+(define helper car)
+(use (list 5 6))
+(define helper (lambda (x y) (list x y)))
+(define call-with-two (lambda (f) (f 1 2)))
+(call-with-two helper)
+(call-with-two list)
+(call-with-two (lambda (a b) (- b a)))
+(call-with-two helper)
+(define sub (lambda (a b) (- a b)))
+(sub 5 3)
+(sub 5 3)
+(begin (runtime-stats #f) #f)
+(sub (quote a) 1)
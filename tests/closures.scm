@@ -0,0 +1,17 @@
+(define make-counter (lambda (n) (lambda () (set! n (+ n 1)) n)))
+(define c (make-counter 10))
+(c)
+(c)
+(define adder (lambda (a b) (lambda (x) (+ x a b))))
+((adder 1 2) 3)
+(define f (adder 10 20))
+(f 1)
+(f 2)
+(define nest (lambda (a) (lambda (b) (lambda (c) (list a b c)))))
+(((nest 1) 2) 3)
+(((nest 4) 5) 6)
+(define g (lambda (x) (let loop ((i 0) (acc (quote ()))) (if (= i 3) acc (loop (+ i 1) (cons (+ i x) acc))))))
+(g 10)
+(define h (lambda (x) (map (lambda (y) (* x y)) (list 1 2 3))))
+(h 2)
+(h 3)
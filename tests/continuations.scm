@@ -0,0 +1,17 @@
+(define saved #f)
+(define count 0)
+(+ 100 (call/cc (lambda (k) (set! saved k) 1)))
+(set! count (+ count 1))
+(if (< count 3) (saved count) count)
+(define make-generator (lambda (lst) (let ((return #f) (resume #f)) (lambda () (call/cc (lambda (r) (set! return r) (if resume (resume #f) (begin (for-each (lambda (x) (call/cc (lambda (k) (set! resume k) (return x)))) lst) (return (quote done))))))))))
+(define g (make-generator (list 1 2 3)))
+(g)
+(g)
+(g)
+(g)
+(define trace (quote ()))
+(define note (lambda (x) (set! trace (cons x trace))))
+(define reenter #f)
+(dynamic-wind (lambda () (note (quote in))) (lambda () (call/cc (lambda (k) (set! reenter k))) (note (quote body))) (lambda () (note (quote out))))
+(if (< (length trace) 6) (reenter #f) (reverse trace))
+(reverse trace)
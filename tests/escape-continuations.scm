@@ -0,0 +1,10 @@
+(define inner #f)
+(call/ec (lambda (outer) (call/ec (lambda (k) (set! inner k) (outer 1)))))
+(call/ec (lambda (k) (+ 1 (k 42))))
+(call/cc (lambda (k) (+ 1 (k 43))))
+(define find-first (lambda (p lst) (call/ec (lambda (return) (for-each (lambda (x) (if (p x) (return x) #f)) lst) #f))))
+(find-first (lambda (x) (> x 2)) (list 1 2 3 4))
+(define trace (quote ()))
+(call/ec (lambda (k) (dynamic-wind (lambda () (set! trace (cons (quote in) trace))) (lambda () (k 1)) (lambda () (set! trace (cons (quote out) trace))))))
+trace
+(inner 2)
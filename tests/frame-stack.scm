@@ -0,0 +1,37 @@
+(define stat (lambda (name) (cdr (assq name (runtime-stats)))))
+(define add (lambda (a b) (+ a b)))
+(define count-down (lambda (n) (if (= n 0) 0 (count-down (- n 1)))))
+(define sum-to (lambda (n) (if (= n 0) 0 (+ n (sum-to (- n 1))))))
+(define make-adder (lambda (n) (lambda (x) (+ x n))))
+(define deep-adder (lambda (depth n) (if (= depth 0) (make-adder n) (deep-adder (- depth 1) n))))
+(define allocations-of (lambda (thunk) (thunk) (let ((before (stat (quote allocations)))) (thunk) (- (stat (quote allocations)) before))))
+(define extra-allocations-of (lambda (thunk) (- (allocations-of thunk) (allocations-of (lambda () 0)))))
+(define environments-of (lambda (thunk) (let ((heap (stat (quote heap-environments))) (stack (stat (quote stack-environments))) (popped (stat (quote popped-environments)))) (thunk) (list (- (stat (quote heap-environments)) heap) (- (stat (quote stack-environments)) stack) (- (stat (quote popped-environments)) popped)))))
+(define nested (lambda (a) (let ((b (+ a 1))) (let ((c (+ b 1))) (+ a b c)))))
+(begin (runtime-stats #t) #t)
+(extra-allocations-of (lambda () 0))
+(extra-allocations-of (lambda () (add 1 2)))
+(extra-allocations-of (lambda () (count-down 1000)))
+(extra-allocations-of (lambda () (sum-to 1000)))
+(extra-allocations-of (lambda () (nested 1)))
+(> (extra-allocations-of (lambda () (make-adder 1))) 0)
+(environments-of (lambda () (count-down 10)))
+(environments-of (lambda () (sum-to 10)))
+(environments-of (lambda () (make-adder 1)))
+(define add5 (deep-adder 100 5))
+(sum-to 1000)
+(count-down 1000)
+(add5 10)
+(define adders (map make-adder (list 1 2 3)))
+(sum-to 100)
+(map (lambda (f) (f 10)) adders)
+(nested 1)
+(define capture-in-let (lambda (a) (let ((b (+ a 1))) (lambda () (list a b)))))
+(define captured (capture-in-let 1))
+(sum-to 100)
+(captured)
+(define named-let-closure (lambda (n) (let loop ((i 0)) (if (< i n) (+ 1 (loop (+ i 1))) (lambda () (list n i))))))
+(define inner (named-let-closure 0))
+(sum-to 100)
+(inner)
+(begin (runtime-stats #f) #f)
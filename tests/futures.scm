@@ -0,0 +1,16 @@
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(define f (future (lambda () (fib 20))))
+(touch f)
+(touch f)
+(touch 42)
+(parallel-map fib (iota 15))
+(parallel-map (lambda (x) (* x x)) (quote ()))
+(parallel-reduce + 0 (parallel-map (lambda (x) (* x x)) (iota 1000)))
+(parallel-reduce + 0 (quote ()))
+(define results (make-shared-channel 16))
+(parallel-for-each (lambda (x) (channel-send results x)) (iota 5))
+(fold-left + 0 (map (lambda (i) (channel-receive results)) (iota 5)))
+(define nested (future (lambda () (touch (future (lambda () (fib 15)))))))
+(touch nested)
+(map touch (map (lambda (n) (future (lambda () (fib n)))) (iota 10)))
+(>= (worker-count) 0)
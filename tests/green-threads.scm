@@ -0,0 +1,23 @@
+(define c (make-channel))
+(spawn (lambda () (channel-send c (* 6 7))))
+(channel-receive c)
+(define order (quote ()))
+(define note (lambda (x) (set! order (cons x order))))
+(define a (spawn (lambda () (note (quote a1)) (yield) (note (quote a2)) (quote a-done))))
+(define b (spawn (lambda () (note (quote b1)) (yield) (note (quote b2)) (quote b-done))))
+(list (join a) (join b))
+(reverse order)
+(define bounded (make-channel 2))
+(define producer (spawn (lambda () (do ((i 0 (+ i 1))) ((= i 10) (quote sent)) (channel-send bounded i)))))
+(define consume (lambda (n total) (if (= n 0) total (consume (- n 1) (+ total (channel-receive bounded))))))
+(consume 10 0)
+(join producer)
+(define sleeper (spawn (lambda () (sleep 10) (quote awake))))
+(join sleeper)
+(define ping (make-channel))
+(define pong (make-channel))
+(define ponger (spawn (lambda () (let loop ((n 0)) (let ((v (channel-receive ping))) (if (eq? v (quote stop)) n (begin (channel-send pong (* v 2)) (loop (+ n 1)))))))))
+(define exchange (lambda (i) (channel-send ping i) (channel-receive pong)))
+(list (exchange 1) (exchange 2) (exchange 3))
+(channel-send ping (quote stop))
+(join ponger)
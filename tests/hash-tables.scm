@@ -0,0 +1,59 @@
+(define table (make-hash-table))
+(hash-table? table)
+(hash-table? (list 1 2))
+(hash-table-set! table 1 (quote one))
+(hash-table-set! table 2 (quote two))
+(hash-table-set! table (quote three) 3)
+(hash-table-ref table 2)
+(hash-table-ref/default table 4 (quote none))
+(hash-table-ref table 4 (lambda () (quote missing)))
+(hash-table-exists? table (quote three))
+(hash-table-contains? table 5)
+(hash-table-size table)
+(hash-table-delete! table 1)
+(hash-table-count table)
+(hash-table-update! table (quote three) (lambda (x) (* x 10)))
+(hash-table-ref table (quote three))
+(hash-table-update!/default table (quote counter) (lambda (x) (+ x 1)) 0)
+(hash-table-update!/default table (quote counter) (lambda (x) (+ x 1)) 0)
+(hash-table-ref table (quote counter))
+(define numbers (make-hash-table))
+(do ((i 0 (+ i 1))) ((= i 1000)) (hash-table-set! numbers i (* i i)))
+(hash-table-size numbers)
+(hash-table-ref numbers 999)
+(hash-table-fold numbers (lambda (key value acc) (+ acc key)) 0)
+(define total 0)
+(hash-table-walk numbers (lambda (key value) (set! total (+ total value))))
+total
+(length (hash-table-keys numbers))
+(length (hash-table->alist numbers))
+(define copy (hash-table-copy numbers))
+(hash-table-clear! numbers)
+(hash-table-size numbers)
+(hash-table-size copy)
+(define strings (make-hash-table string=?))
+(hash-table-set! strings (string-append "ab" "c") 1)
+(hash-table-ref/default strings "abc" 0)
+(define lists (make-hash-table equal?))
+(hash-table-set! lists (list 1 2) (quote found))
+(hash-table-ref/default lists (list 1 2) (quote not-found))
+(= (hash (list 1 "x")) (hash (list 1 "x")))
+(define grow (lambda (table from to) (if (< from to) (begin (hash-table-set! table from from) (grow table (+ from 1) to)) #t)))
+(define growing (make-hash-table))
+(hash-table-set! growing (quote key) 1)
+(hash-table-update! growing (quote key) (lambda (v) (grow growing 0 100) (+ v 1)))
+(hash-table-ref growing (quote key))
+(hash-table-count growing)
+(hash-table-update!/default growing (quote key) (lambda (v) (hash-table-delete! growing (quote key)) (+ v 1)) 0)
+(hash-table-ref growing (quote key))
+(hash-table-update!/default growing (quote key) (lambda (v) (hash-table-clear! growing) (+ v 1)) 0)
+(hash-table->alist growing)
+(define walked (make-hash-table))
+(grow walked 0 10)
+(define visits 0)
+(hash-table-walk walked (lambda (k v) (set! visits (+ visits 1)) (hash-table-delete! walked (- 9 k)) (hash-table-set! walked (+ k 100) v)))
+visits
+(hash-table-count walked)
+(hash-table-fold walked (lambda (k v acc) (hash-table-set! walked (+ k 1000) v) (+ acc 1)) 0)
+(hash-table-count walked)
+(hash-table-ref table 42)
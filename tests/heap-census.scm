@@ -0,0 +1,17 @@
+(define census-field (lambda (census name) (cdr (assq name census))))
+(define retained-by (lambda (name) (let ((entry (assq name (census-field (heap-census) (quote retained))))) (if entry (cdr entry) 0))))
+(define type-count (lambda (census type) (car (cdr (assq type (census-field census (quote types)))))))
+(define numbers (list 1 2 3 4 5 6 7 8 9 10))
+(retained-by (quote numbers))
+(define nested (list (list 1 2) (list 3 4)))
+(retained-by (quote nested))
+(define alias numbers)
+(retained-by (quote numbers))
+(retained-by (quote alias))
+(set! alias 0)
+(retained-by (quote numbers))
+(define sum-bytes (lambda (types) (if (null? types) 0 (+ (cdr (cdr (car types))) (sum-bytes (cdr types))))))
+(define census (heap-census))
+(= (sum-bytes (census-field census (quote types))) (census-field census (quote bytes)))
+(> (type-count census (quote pair)) (type-count census (quote closure)))
+(pair? (heap-census "/tmp/armyknife-heap-census-test.dump"))
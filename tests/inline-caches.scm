@@ -0,0 +1,32 @@
+(define stat (lambda (name) (cdr (assq name (inline-cache-statistics)))))
+(define measure (lambda (thunk) (let ((hits (stat (quote hits))) (misses (stat (quote misses)))) (thunk) (list (- (stat (quote hits)) hits) (- (stat (quote misses)) misses)))))
+(define x 1)
+(define read-x (lambda () (+ x 0)))
+(define read-x-twice (lambda () (+ x x)))
+(measure read-x)
+(measure read-x)
+(measure read-x-twice)
+(measure read-x-twice)
+(measure read-x-twice)
+(read-x)
+(set! x 2)
+(measure read-x)
+(read-x)
+(define y 3)
+(measure read-x)
+(measure read-x)
+(define x 4)
+(read-x)
+(read-x-twice)
+(define x 5)
+(measure read-x-twice)
+(read-x-twice)
+(join-interpreter-thread (spawn-interpreter-thread (lambda () (read-x-twice))))
+(define read-x-later (lambda () (+ x 0)))
+(measure read-x-later)
+(measure read-x-later)
+(define x 6)
+(measure read-x-later)
+(read-x-later)
+(read-x)
+(inline-cache-statistics 1)
@@ -0,0 +1,16 @@
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(define counter 10)
+(define threads (map (lambda (i) (spawn-interpreter-thread (lambda () (+ (fib (+ 15 i)) counter)))) (iota 4)))
+(map join-interpreter-thread threads)
+(define counter 20)
+counter
+(define t (spawn-interpreter-thread (lambda () counter)))
+(join-interpreter-thread t)
+(define make-adder (lambda (n) (lambda (x) (+ x n))))
+(define add5 (make-adder 5))
+(join-interpreter-thread (spawn-interpreter-thread (lambda () (map add5 (list 1 2 3)))))
+(map add5 (list 10 20))
+(> (processor-count) 0)
+(define frozen-value 1)
+(join-interpreter-thread (spawn-interpreter-thread (lambda () frozen-value)))
+(set! fib 0)
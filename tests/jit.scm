@@ -0,0 +1,55 @@
+(define compiled (lambda () (cdr (assq (quote compiled-applications) (runtime-stats)))))
+(begin (runtime-stats #t) #t)
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(fib 20)
+(fib 25)
+(> (compiled) 0)
+(define tak (lambda (x y z) (if (< y x) (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y)) z)))
+(tak 18 12 6)
+(tak 18 12 6)
+(define halve (lambda (n) (/ n 2)))
+(halve 10)
+(halve 21)
+(define sum3 (lambda (a b c) (+ a b c)))
+(sum3 1 2 3)
+(sum3 4 5 6)
+(define same? (lambda (a b) (equal? a b)))
+(same? 3 3)
+(same? 3 4)
+(same? (quote a) (quote a))
+(same? "abc" "abc")
+(define answer 42)
+(define get-answer (lambda (n) (if (= n 0) answer (get-answer (- n 1)))))
+(get-answer 10)
+(get-answer 10)
+(set! answer 43)
+(get-answer 10)
+(define answer (quote forty-two))
+(get-answer 10)
+(define answer 44)
+(get-answer 10)
+(define add (lambda (a b) (+ a b)))
+(add 1 2)
+(add 3 4)
+(define saved-plus +)
+(define + (lambda (a b) (* a b)))
+(add 3 4)
+(define + saved-plus)
+(add 3 4)
+(define fib2 fib)
+(define fib (lambda (n) 0))
+(fib2 10)
+(define before (compiled))
+(sum3 9223372036854775807 1 0)
+(sum3 (- 0 1) (- 0 2) 3)
+(> (compiled) before)
+(join-interpreter-thread (spawn-interpreter-thread (lambda () (tak 18 12 6))))
+(define twice (lambda (n) (* n 2)))
+(twice 5)
+(twice 5)
+(define * saved-plus)
+(define before (compiled))
+(twice 5)
+(twice 6)
+(> (compiled) before)
+(begin (runtime-stats #f) #f)
@@ -0,0 +1,45 @@
+(define lst (list 1 2 3 4 5))
+(car lst)
+(cdr lst)
+(cadr lst)
+(caddr lst)
+(cdddr lst)
+(length lst)
+(length (quote ()))
+(list? lst)
+(list? (cons 1 2))
+(pair? (quote ()))
+(null? (quote ()))
+(append (list 1 2) (list 3) (quote ()) (list 4 5))
+(append)
+(append (list 1) 2)
+(reverse lst)
+(list-tail lst 2)
+(list-ref lst 3)
+(define copy (list-copy lst))
+(set-car! copy 100)
+(car lst)
+(car copy)
+(define pair (cons 1 2))
+(set-cdr! pair 3)
+pair
+(memq (quote c) (list (quote a) (quote b) (quote c) (quote d)))
+(memq (quote e) (list (quote a) (quote b)))
+(memv 3 lst)
+(member (list 2) (list (list 1) (list 2) (list 3)))
+(assq (quote b) (list (cons (quote a) 1) (cons (quote b) 2)))
+(assv 2 (list (cons 1 (quote one)) (cons 2 (quote two))))
+(assoc "b" (list (cons "a" 1) (cons "b" 2)))
+(map (lambda (x) (* x x)) lst)
+(map + (list 1 2 3) (list 10 20 30))
+(define sum 0)
+(for-each (lambda (x) (set! sum (+ sum x))) lst)
+sum
+(apply + 1 2 (list 3 4))
+(iota 5)
+(filter odd? lst)
+(fold-left (lambda (acc x) (cons x acc)) (quote ()) lst)
+(fold-right cons (quote ()) lst)
+(last-pair lst)
+(length (iota 100000))
+(car (quote ()))
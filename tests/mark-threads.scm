@@ -0,0 +1,17 @@
+(define field (lambda (alist name) (cdr (assq name alist))))
+(define totals (lambda () (let ((mark (heap-mark)) (census (heap-census))) (list (field mark (quote objects)) (field census (quote objects)) (field mark (quote bytes)) (field census (quote bytes))))))
+(define same-totals? (lambda () (totals) (let ((counts (totals))) (if (= (car counts) (car (cdr counts))) (= (car (cdr (cdr counts))) (car (cdr (cdr (cdr counts))))) #f))))
+(field (heap-mark) (quote threads))
+(same-totals?)
+(define numbers (iota 20000))
+(define shared (list numbers numbers (cdr numbers)))
+(define cycle (list 1 2 3))
+(set-cdr! (cdr (cdr cycle)) cycle)
+(define words (map (lambda (n) (string-append "word-" (list->string (list (integer->char (+ 97 (remainder n 26))))))) (iota 500)))
+(define table (make-hash-table))
+(for-each (lambda (n) (hash-table-set! table n (list n (* n n)))) (iota 2000))
+(define adders (map (lambda (n) (lambda (x) (+ x n))) (iota 300)))
+(same-totals?)
+(totals)
+(field (heap-census) (quote types))
+(heap-mark 1)
@@ -0,0 +1,39 @@
+(define interpreted-not (lambda (x) (if x #f #t)))
+(define interpreted-abs (lambda (n) (if (< n 0) (- 0 n) n)))
+(define interpreted-remainder (lambda (a b) (- a (* b (/ a b)))))
+(define interpreted-even? (lambda (n) (= (interpreted-remainder n 2) 0)))
+(define interpreted-gcd (lambda (a b) (if (= b 0) (interpreted-abs a) (interpreted-gcd b (interpreted-remainder a b)))))
+(define interpreted-lcm (lambda (a b) (if (= a 0) 0 (interpreted-abs (* (/ a (interpreted-gcd a b)) b)))))
+(define interpreted-iota (lambda (n) (let loop ((n n) (result (quote ()))) (if (= n 0) result (loop (- n 1) (cons (- n 1) result))))))
+(define interpreted-last-pair (lambda (lst) (if (pair? (cdr lst)) (interpreted-last-pair (cdr lst)) lst)))
+(define interpreted-fold-left (lambda (f acc lst) (if (null? lst) acc (interpreted-fold-left f (f acc (car lst)) (cdr lst)))))
+(define interpreted-fold-right (lambda (f acc lst) (if (null? lst) acc (f (car lst) (interpreted-fold-right f acc (cdr lst))))))
+(define interpreted-filter (lambda (keep? lst) (let loop ((lst lst) (result (quote ()))) (if (null? lst) (reverse result) (loop (cdr lst) (if (keep? (car lst)) (cons (car lst) result) result))))))
+(define same-for-each? (lambda (f g lst) (if (null? lst) #t (if (equal? (f (car lst)) (g (car lst))) (same-for-each? f g (cdr lst)) (car lst)))))
+(define numbers (list 0 1 2 3 7 10 12 35 100 1000))
+(same-for-each? not interpreted-not (list #t #f 0 (quote ())))
+(same-for-each? abs interpreted-abs (cons (- 0 5) numbers))
+(same-for-each? even? interpreted-even? numbers)
+(same-for-each? (lambda (n) (remainder n 7)) (lambda (n) (interpreted-remainder n 7)) numbers)
+(same-for-each? (lambda (n) (gcd n 12)) (lambda (n) (interpreted-gcd n 12)) numbers)
+(same-for-each? (lambda (n) (lcm n 12)) (lambda (n) (interpreted-lcm n 12)) numbers)
+(same-for-each? iota interpreted-iota numbers)
+(iota 5)
+(iota 0)
+(equal? (last-pair (iota 10)) (interpreted-last-pair (iota 10)))
+(equal? (fold-left cons 0 (iota 5)) (interpreted-fold-left cons 0 (iota 5)))
+(equal? (fold-right cons 0 (iota 5)) (interpreted-fold-right cons 0 (iota 5)))
+(fold-left - 100 (iota 5))
+(fold-right - 0 (iota 5))
+(same-for-each? (lambda (n) (filter even? (iota n))) (lambda (n) (interpreted-filter even? (iota n))) numbers)
+(filter even? (iota 10))
+(filter pair? (quote ()))
+(define seen (quote ()))
+(define remember (lambda (x) (set! seen (cons x seen)) (> x 2)))
+(filter remember (iota 5))
+seen
+(define loop (lambda (x) #f))
+(filter loop (iota 3))
+(length (iota 100000))
+(length (filter even? (iota 100000)))
+(filter car (iota 3))
@@ -0,0 +1,8 @@
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(profile-start)
+(fib 27)
+(> (profile-stop) 0)
+(profile-start 250)
+(fib 27)
+(> (profile-stop) 0)
+(profile-stop)
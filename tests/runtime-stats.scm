@@ -0,0 +1,23 @@
+(define count-down (lambda (n) (if (= n 0) (quote done) (count-down (- n 1)))))
+(define stat (lambda (name) (cdr (assq name (runtime-stats)))))
+(define form-count (lambda (form) (cdr (assq form (stat (quote special-forms))))))
+(begin (runtime-stats #f) #f)
+(stat (quote closure-applications))
+(begin (runtime-stats #t) #t)
+(define before-calls (stat (quote closure-applications)))
+(define before-ifs (form-count (quote if)))
+(count-down 100)
+(- (stat (quote closure-applications)) before-calls)
+(- (form-count (quote if)) before-ifs)
+(define make-reader (lambda (x) (lambda () (let ((y 1)) (+ x y)))))
+(define reader (make-reader 41))
+(define depths-before (stat (quote lookup-depths)))
+(reader)
+(map - (stat (quote lookup-depths)) depths-before)
+(length (stat (quote lookup-depths)))
+(> (stat (quote allocations)) 0)
+(> (stat (quote peak-rss-kb)) 0)
+(begin (runtime-stats #f) #f)
+(define frozen (stat (quote closure-applications)))
+(count-down 10)
+(- (stat (quote closure-applications)) frozen)
@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+# Run scheme regression tests.
+#
+#   ./tests/scheme-test.sh tests/foo.scm...
+#
+# Every test is a file of scheme given to armyknife-scheme on stdin
+# (one form per line) with both evaluators. What it prints on stdout
+# (without the backtrace of a fatal error), followed by a line with
+# its exit status, has to match foo.expected
+# (or foo.recursive.expected and foo.cek.expected when the evaluators
+# are supposed to differ, for example for green threads which the
+# tree walking evaluator runs to completion right away). When there
+# is a foo.sed, the output is edited with it first (to hide things
+# like the sample counts of the profiler that change from run to
+# run). When there is a foo.env, the environment variables it sets
+# (one NAME=value per line, for example ARMYKNIFE_JIT=true) are set
+# for the test.
+#
+# ARMYKNIFE_SCHEME is the interpreter to test (./armyknife-scheme by
+# default).
+
+interpreter=${ARMYKNIFE_SCHEME:-./armyknife-scheme}
+
+if [[ ! -x $interpreter ]] ; then
+    echo "No $interpreter (run make first)"
+    exit 2
+fi
+
+# The recursive evaluator uses the C stack for non tail calls.
+ulimit -s unlimited 2>/dev/null
+
+actual=$(mktemp)
+trap 'rm -f "$actual"' EXIT
+
+failures=0
+for test in "$@"
+do
+    for evaluator in recursive cek; do
+        expected=${test%.scm}.$evaluator.expected
+        if [[ ! -r $expected ]] ; then
+            expected=${test%.scm}.expected
+        fi
+        filter=${test%.scm}.sed
+        if [[ ! -r $filter ]] ; then
+            filter=/dev/null
+        fi
+        settings=()
+        if [[ -r ${test%.scm}.env ]] ; then
+            mapfile -t settings < "${test%.scm}.env"
+        fi
+        env "${settings[@]}" ARMYKNIFE_EVALUATOR=$evaluator \
+            "$interpreter" < "$test" 2> /dev/null \
+            | grep -v '^#[0-9]' | sed -E -f "$filter" > "$actual"
+        echo ";;; exit status ${PIPESTATUS[0]}" >> "$actual"
+        if diff -u "$expected" "$actual" ; then
+            ./tests/pass-fail.sh "$test ($evaluator)" 0
+        else
+            ./tests/pass-fail.sh "$test ($evaluator)" 1
+            ((failures++))
+        fi
+    done
+done
+
+if [[ $failures -ne 0 ]] ; then
+    echo "$failures failures"
+    exit 1
+fi
@@ -0,0 +1,20 @@
+(define c (make-shared-channel 4))
+(channel-send c 1)
+(channel-send c (quote two))
+(channel-receive c)
+(channel-receive c)
+(channel-send-list c (iota 3))
+(channel-receive-list c 10)
+(define big (make-shared-channel 1024))
+(channel-send-list big (iota 100))
+(length (channel-receive-list big 10))
+(define drain (lambda (n total) (if (= n 0) total (let ((values (channel-receive-list big n))) (drain (- n (length values)) (fold-left + total values))))))
+(drain 90 0)
+(define work (make-shared-channel 64))
+(define done (make-shared-channel 64))
+(define worker (lambda () (let loop ((total 0)) (let ((v (channel-receive work))) (if (eq? v (quote stop)) (channel-send done total) (loop (+ total v)))))))
+(define workers (map (lambda (i) (spawn-interpreter-thread worker)) (iota 3)))
+(do ((i 0 (+ i 1))) ((= i 3000)) (channel-send work i))
+(for-each (lambda (t) (channel-send work (quote stop))) workers)
+(+ (channel-receive done) (channel-receive done) (channel-receive done))
+(length (map join-interpreter-thread workers))
@@ -0,0 +1,35 @@
+(define long "the quick brown fox jumps over the lazy dog and then the fox sleeps")
+(string-search-forward "lo" "hello hello" 0)
+(string-search-forward "lo" "hello hello" 4)
+(string-search-forward "fox" long 0)
+(string-search-forward "fox" long 17)
+(string-search-forward "cat" long 0)
+(string-search-forward "" "abc" 1)
+(string-search-forward "sleeps" long 0)
+(string-contains "hello" "ll")
+(string-contains long "lazy dog")
+(string-contains long "lazy cat")
+(string-contains "ab" "abc")
+(string-prefix? "he" "hello")
+(string-prefix? "hello world" "hello")
+(string-prefix? "" "hello")
+(string-suffix? "lo" "hello")
+(string-suffix? "sleeps" long)
+(string-suffix? "he" "hello")
+(string-index "hello" #\l)
+(string-index long #\z)
+(string-index long #\Q)
+(string-index "λx.λy.x" #\y)
+(string-contains "αβγδ αβγδ" "δ α")
+(string-ci=? "Hello" "hELLO")
+(string-ci=? "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG" "the quick brown fox jumps over the lazy dog")
+(string-ci=? "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG" "the quick brown fox jumps over the lazy cat")
+(string-ci=? "[@`{" "[@`{")
+(string-ci=? "@" "`")
+(string-ci<? "apple" "BANANA")
+(string-ci<? "BANANA" "apple")
+(string-ci<? "abc" "ABCD")
+(string-ci<=? "ABC" "abc")
+(string-ci>? "Zebra" "apple")
+(string-ci>=? "abc" "ABC")
+(string-search-forward "lo" "hello" 9)
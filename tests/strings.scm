@@ -0,0 +1,19 @@
+(string? "hello")
+(string? (quote hello))
+(string-length "hello")
+(string-length "")
+(substring "hello world" 6 11)
+(substring "hello" 0 0)
+(string-append "foo" "bar" "baz")
+(string-append)
+(string=? "abc" (string-append "a" "bc"))
+(equal? "abc" (string-append "ab" "c"))
+(string->symbol "hello")
+(eq? (string->symbol "hello") (quote hello))
+(symbol? (quote hello))
+(symbol? "hello")
+(symbol->string (quote hello))
+(string-length (symbol->string (quote hello)))
+"tab\tquote\"backslash\\"
+(string-length "a\nb")
+(substring "hello" 3 10)
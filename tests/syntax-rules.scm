@@ -0,0 +1,31 @@
+(define-syntax swap! (syntax-rules () ((_ a b) (let ((tmp a)) (set! a b) (set! b tmp)))))
+(define x 1)
+(define tmp 2)
+(swap! x tmp)
+(list x tmp)
+(define-syntax my-or (syntax-rules () ((_) #f) ((_ e) e) ((_ e r ...) (let ((t e)) (if t t (my-or r ...))))))
+(my-or)
+(my-or #f 3)
+(define t 5)
+(my-or #f t)
+(define-syntax my-let* (syntax-rules () ((_ () body ...) (let () body ...)) ((_ ((n v) rest ...) body ...) (let ((n v)) (my-let* (rest ...) body ...)))))
+(my-let* ((a 1) (b (+ a 1)) (c (* b 10))) (list a b c))
+(define-syntax while (syntax-rules () ((_ test body ...) (let loop () (when test body ... (loop))))))
+(define i 0)
+(while (< i 5) (set! i (+ i 1)))
+i
+(define-syntax for (syntax-rules (in) ((_ v in lst body ...) (for-each (lambda (v) body ...) lst))))
+(define total 0)
+(for n in (list 1 2 3) (set! total (+ total n)))
+total
+(define-syntax pairs (syntax-rules () ((_ (a b) ...) (list (cons a b) ...))))
+(pairs (1 2) (3 4) (5 6))
+(define-syntax tail (syntax-rules () ((_ a ... z) (quote z))))
+(tail 1 2 3)
+(define-syntax be-like-begin (syntax-rules () ((be-like-begin name) (define-syntax name (syntax-rules () ((name expr (... ...)) (begin expr (... ...))))))))
+(be-like-begin sequence)
+(sequence 1 2 3 4)
+(define use-macro (lambda (n) (my-or #f n)))
+(use-macro 7)
+(use-macro 8)
+(swap! 1)
@@ -0,0 +1,46 @@
+(string-length "λx.x")
+(string-ref "λx.x" 0)
+(string-ref "λx.x" 1)
+(substring "αβγδε" 1 3)
+"\x3bb;\x41;"
+(string-length "\x1f600;")
+#\a
+#\λ
+#\space
+#\newline
+#\x3bb
+(char->integer #\λ)
+(integer->char 955)
+(char? #\a)
+(char? "a")
+(string #\λ #\x #\. #\x)
+(string->list "aλb")
+(list->string (list #\α #\β))
+(char=? #\a #\a #\a)
+(char<? #\a #\b #\c)
+(char<? #\a #\c #\b)
+(char>=? #\λ #\a)
+(char-upcase #\a)
+(char-downcase #\A)
+(char-upcase #\λ)
+(char-alphabetic? #\a)
+(char-alphabetic? #\1)
+(char-numeric? #\7)
+(char-whitespace? #\space)
+(char-upper-case? #\A)
+(char-lower-case? #\A)
+(define greek (lambda (n) (if (= n 0) "" (string-append "αβγδεζηθικ" (greek (- n 1))))))
+(define long (string-append (greek 20) "end"))
+(string-length long)
+(string-ref long 0)
+(string-ref long 63)
+(string-ref long 64)
+(string-ref long 65)
+(string-ref long 199)
+(string-ref long 200)
+(substring long 198 203)
+(string-index long #\e)
+(string-search-forward "κα" long 100)
+(string-contains long "end")
+(equal? (string->list (substring long 60 70)) (string->list "αβγδεζηθικ"))
+(string-ref long 203)